@@ -0,0 +1,600 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Microbenchmarks of the building blocks of the kernels.
+ *
+ * Every case is timed in isolation over a matrix of block sizes, lattice sizes and variants
+ * (real or imaginary time, one or two components, rotation, kernel type), and reported as JSON:
+ *  - ns_per_point: time of one call divided by the lattice points it processes;
+ *  - gb_per_s: bytes read and written by the call per second; for functions working on a block
+ *    resident in cache this is cache traffic, and can exceed the memory bandwidth;
+ *  - gflop_per_s: floating point operations per second, counting each cos, sin, exp and sqrt as
+ *    one operation (null where no operation count is modelled).
+ * Each case is warmed up, then timed over enough calls to last --min-time seconds split in
+ * --repeats runs, of which the fastest is reported.
+ * With --counters, the calls of a timed run are repeated under the hardware performance counters, adding
+ * the instructions per cycle, the memory traffic per point (a cache line per last level cache miss), the
+ * measured floating point operations per point, the arithmetic intensity and whether the case is compute
+ * or memory bound on the roofline of the host; the quantities the host cannot count are null.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+#include "kernel.h"
+#include "common.h"
+
+#define LENGTH 20.
+#define HALO 4
+
+static double wall_time(void) {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+static void fill(double *data, size_t size, double seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 0.5 + 0.5 * sin(seed + 0.37 * i);
+    }
+}
+
+/**
+ * A timed operation. reset restores the input data between timed runs, outside of the timing.
+ */
+class BenchCase {
+public:
+    string name;    ///< Function being timed.
+    string variant;    ///< Variant of the function (time direction, components, kernel type).
+    int lattice;    ///< Linear size of the lattice (0 if the case only works on a block).
+    int block;    ///< Linear size of the block (0 if the case works on the whole lattice).
+    double points;    ///< Lattice points processed by one call.
+    double bytes_per_point;    ///< Bytes read and written per point.
+    double flops_per_point;    ///< Floating point operations per point; negative if not modelled.
+
+    BenchCase(string _name, string _variant, int _lattice, int _block, double _points, double _bytes_per_point, double _flops_per_point):
+        name(_name), variant(_variant), lattice(_lattice), block(_block), points(_points),
+        bytes_per_point(_bytes_per_point), flops_per_point(_flops_per_point) {}
+    virtual ~BenchCase() {}
+    virtual void reset() {}
+    virtual void run() = 0;
+};
+
+/**
+ * Cases working on a block, or a band, of two wave functions with their potential.
+ */
+class BlockCase: public BenchCase {
+public:
+    BlockCase(string _name, string _variant, int _lattice, int _block, size_t _width, size_t _height,
+              double _points, double _bytes_per_point, double _flops_per_point):
+        BenchCase(_name, _variant, _lattice, _block, _points, _bytes_per_point, _flops_per_point),
+        width(_width), height(_height), imag_time(_variant.find("imaginary") != string::npos) {
+        size_t size = width * height;
+        for (int i = 0; i < 2; i++) {
+            real[i] = new double[size];
+            imag[i] = new double[size];
+            next_real[i] = new double[size];
+            next_imag[i] = new double[size];
+        }
+        pot_real = new double[size];
+        pot_imag = new double[size];
+        // Small coefficients keep the imaginary time operators from growing the data over many calls
+        double angle = 1.e-6;
+        a = imag_time ? cosh(angle) : cos(angle);
+        b = imag_time ? sinh(angle) : sin(angle);
+        reset();
+    }
+    ~BlockCase() {
+        for (int i = 0; i < 2; i++) {
+            delete [] real[i];
+            delete [] imag[i];
+            delete [] next_real[i];
+            delete [] next_imag[i];
+        }
+        delete [] pot_real;
+        delete [] pot_imag;
+    }
+    void reset() {
+        size_t size = width * height;
+        for (int i = 0; i < 2; i++) {
+            fill(real[i], size, 1. + i);
+            fill(imag[i], size, 2. + i);
+            fill(next_real[i], size, 3. + i);
+            fill(next_imag[i], size, 4. + i);
+        }
+        for (size_t i = 0; i < size; i++) {
+            pot_real[i] = cos(1.e-3 * i);
+            pot_imag[i] = imag_time ? 0. : -sin(1.e-3 * i);
+        }
+    }
+
+protected:
+    size_t width, height;
+    bool imag_time;
+    double a, b;
+    double *real[2], *imag[2], *next_real[2], *next_imag[2];
+    double *pot_real, *pot_imag;
+};
+
+class KineticCase: public BlockCase {
+public:
+    KineticCase(string _name, string _variant, int _block):
+        BlockCase(_name, _variant, 0, _block, _block, _block, double(_block) * _block, 32., 6.) {}
+    void run() {
+        if (name == "block_kernel_vertical") {
+            if (imag_time) {
+                block_kernel_vertical_imaginary(0u, width, width, height, a, b, real[0], imag[0]);
+            }
+            else {
+                block_kernel_vertical(0u, width, width, height, a, b, real[0], imag[0]);
+            }
+        }
+        else if (name == "block_kernel_horizontal") {
+            if (imag_time) {
+                block_kernel_horizontal_imaginary(0u, width, width, height, a, b, real[0], imag[0]);
+            }
+            else {
+                block_kernel_horizontal(0u, width, width, height, a, b, real[0], imag[0]);
+            }
+        }
+        else if (name == "block_kernel_vertical_nnn") {
+            if (imag_time) {
+                block_kernel_vertical_nnn_imaginary(0u, 0u, 0u, width, width, height, a, b, real[0], imag[0]);
+            }
+            else {
+                block_kernel_vertical_nnn(0u, 0u, 0u, width, width, height, a, b, real[0], imag[0]);
+            }
+        }
+        else if (name == "block_kernel_horizontal_nnn") {
+            if (imag_time) {
+                block_kernel_horizontal_nnn_imaginary(0u, 0u, 0u, width, width, height, a, b, real[0], imag[0]);
+            }
+            else {
+                block_kernel_horizontal_nnn(0u, 0u, 0u, width, width, height, a, b, real[0], imag[0]);
+            }
+        }
+        else {
+            // Away from the origin of the radial coordinate
+            if (imag_time) {
+                block_kernel_radial_kinetic_imaginary(0u, width, width, height, 10., 1.e-6, real[0], imag[0]);
+            }
+            else {
+                block_kernel_radial_kinetic(0u, width, width, height, 10., 1.e-6, real[0], imag[0]);
+            }
+        }
+    }
+};
+
+class PotentialCase: public BlockCase {
+public:
+    PotentialCase(string _variant, int _block, bool _two_wavefunctions, double _bytes_per_point, double _flops_per_point):
+        BlockCase("block_kernel_potential", _variant, 0, _block, _block, _block, double(_block) * _block, _bytes_per_point, _flops_per_point),
+        two_wavefunctions(_two_wavefunctions) {}
+    void run() {
+        if (imag_time) {
+            block_kernel_potential_imaginary(two_wavefunctions, width, width, height, 1.e-6, 1.e-6, 1.e-6, width,
+                                             pot_real, pot_imag, real[1], imag[1], real[0], imag[0]);
+        }
+        else {
+            block_kernel_potential(two_wavefunctions, width, width, height, 1.e-6, 1.e-6, 1.e-6, width,
+                                   pot_real, pot_imag, real[1], imag[1], real[0], imag[0]);
+        }
+    }
+
+private:
+    bool two_wavefunctions;
+};
+
+class RotationCase: public BlockCase {
+public:
+    RotationCase(string _variant, int _block):
+        BlockCase("block_kernel_rotation", _variant, 0, _block, _block, _block, double(_block) * _block, 128., 24.) {}
+    void run() {
+        if (imag_time) {
+            block_kernel_rotation_imaginary(width, width, height, -int(width) / 2, -int(height) / 2, 1.e-6, 1.e-6, real[0], imag[0]);
+        }
+        else {
+            block_kernel_rotation(width, width, height, -int(width) / 2, -int(height) / 2, 1.e-6, 1.e-6, real[0], imag[0]);
+        }
+    }
+};
+
+class RabiCase: public BlockCase {
+public:
+    RabiCase(string _variant, int _block):
+        BlockCase("rabi_coupling", _variant, 0, _block, _block, _block, double(_block) * _block, 64., 20.) {}
+    void run() {
+        if (imag_time) {
+            rabi_coupling_imaginary(width, width, height, a, b, b, real[0], imag[0], real[1], imag[1]);
+        }
+        else {
+            rabi_coupling_real(width, width, height, a, b, b, real[0], imag[0], real[1], imag[1]);
+        }
+    }
+};
+
+class FullStepCase: public BlockCase {
+public:
+    FullStepCase(string _variant, int _block, double _bytes_per_point, double _flops_per_point):
+        BlockCase("full_step", _variant, 0, _block, _block, _block, double(_block) * _block, _bytes_per_point, _flops_per_point),
+        alpha(_variant.find("rotation") != string::npos ? 1.e-6 : 0.) {}
+    void run() {
+        if (imag_time) {
+            full_step_imaginary(false, width, width, height, -double(width) / 2, -double(height) / 2, alpha, alpha, 0, 0, 0u, 0u, a, b, a, b, 1., 0., 1., 0., 0., 1.e-6, 0., 0., width,
+                                pot_real, pot_imag, real[1], imag[1], real[0], imag[0], "cartesian");
+        }
+        else {
+            full_step(false, width, width, height, -double(width) / 2, -double(height) / 2, alpha, alpha, 0, 0, 0u, 0u, a, b, a, b, 1., 0., 1., 0., 0., 1.e-6, 0., 0., width,
+                      pot_real, pot_imag, real[1], imag[1], real[0], imag[0], "cartesian");
+        }
+    }
+
+private:
+    double alpha;
+};
+
+/**
+ * One band of blocks of the CPU kernel across a tile of the lattice width, sides included.
+ */
+class BandCase: public BlockCase {
+public:
+    BandCase(string _variant, int _lattice, int _block, double _bytes_per_point, double _flops_per_point):
+        BlockCase("process_band", _variant, _lattice, _block, _lattice, _block, double(_lattice) * _block, _bytes_per_point, _flops_per_point) {}
+    void run() {
+        process_band(false, -double(width) / 2, -double(height) / 2, 0, 0, 0u, 0u, 0., 0., width, block, height, HALO, 0, height, HALO, height - 2 * HALO,
+                     a, b, a, b, 1., 0., 1., 0., 0., 1.e-6, 0., 0., pot_real, pot_imag, real[0], imag[0], real[1], imag[1],
+                     next_real[0], next_imag[0], 1, 1, imag_time, "cartesian");
+    }
+};
+
+/**
+ * Copy of a block out of a tile of the lattice width, as done when loading a block.
+ */
+class CopyCase: public BlockCase {
+public:
+    CopyCase(int _lattice, int _block):
+        BlockCase("memcpy2D", "block_from_tile", _lattice, _block, _lattice, _block, double(_block) * _block, 16., -1.) {}
+    void run() {
+        memcpy2D(next_real[0], block * sizeof(double), real[0], width * sizeof(double), block * sizeof(double), height);
+    }
+};
+
+/**
+ * State whose expected values can be recomputed on demand.
+ */
+class SweepState: public GaussianState {
+public:
+    SweepState(Lattice2D *grid): GaussianState(grid, 1.) {}
+    void sweep() {
+        calculate_expected_values();
+    }
+};
+
+/**
+ * Cases timed through the public objects on a periodic harmonic trap.
+ */
+class SystemCase: public BenchCase {
+public:
+    SystemCase(string _name, string _variant, int _lattice, double _bytes_per_point):
+        BenchCase(_name, _variant, _lattice, 0, double(_lattice) * _lattice, _bytes_per_point, -1.) {
+        grid = new Lattice2D(_lattice, LENGTH, true, true);
+        state = new SweepState(grid);
+        potential = new HarmonicPotential(grid, 1., 1.);
+        hamiltonian = new Hamiltonian(grid, potential);
+        solver = new Solver(grid, state, hamiltonian, 1.e-3, name == "kernel_step" ? variant : "cpu");
+        points = double(grid->inner_end_x - grid->inner_start_x) * (grid->inner_end_y - grid->inner_start_y);
+    }
+    ~SystemCase() {
+        delete solver;
+        delete hamiltonian;
+        delete potential;
+        delete state;
+        delete grid;
+    }
+    void run() {
+        if (name == "kernel_step") {
+            // A negative number of iterations leaves the evolved state in the kernel
+            solver->evolve(-1);
+        }
+        else if (name == "state_expected_values") {
+            state->sweep();
+        }
+        else {
+            // evolve(0) only invalidates the cached energies, copying the state from the kernel
+            solver->evolve(0);
+            solver->get_total_energy();
+        }
+    }
+
+private:
+    Lattice2D *grid;
+    SweepState *state;
+    Potential *potential;
+    Hamiltonian *hamiltonian;
+    Solver *solver;
+};
+
+struct BenchOptions {
+    vector<int> lattices;
+    vector<int> blocks;
+    double min_time;
+    int repeats;
+    string filter;
+    string output;
+    bool counters;
+};
+
+static vector<int> parse_sizes(const char *list) {
+    vector<int> sizes;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        int size = atoi(item.c_str());
+        if (size <= 2 * HALO) {
+            my_abort("Sizes must be larger than " + item);
+        }
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
+static void usage(void) {
+    cout << "Usage: kernelbench [options]\n"
+         << "  --sizes N,N,...    lattice sizes (default 256,1024)\n"
+         << "  --blocks N,N,...   block sizes (default 64,128,256)\n"
+         << "  --min-time S       seconds spent timing each case (default 0.2)\n"
+         << "  --repeats N        timed runs per case, the fastest is reported (default 5)\n"
+         << "  --filter TEXT      only run the cases whose name contains TEXT\n"
+         << "  --output FILE      write the JSON report to FILE instead of the standard output\n"
+         << "  --counters         read the hardware performance counters of each case and place it on the roofline of the host\n"
+         << "  --quick            small sizes and short timings, to check that everything runs\n";
+}
+
+static double time_case(BenchCase *bench, const BenchOptions &options, long *calls) {
+    bench->reset();
+    bench->run();
+    // Number of calls lasting at least min_time / repeats
+    long n = 1;
+    double elapsed;
+    while (true) {
+        bench->reset();
+        double start = wall_time();
+        for (long i = 0; i < n; i++) {
+            bench->run();
+        }
+        elapsed = wall_time() - start;
+        if (elapsed >= options.min_time / options.repeats || n >= (1L << 30)) {
+            break;
+        }
+        n *= 2;
+    }
+    double best = elapsed / n;
+    for (int r = 1; r < options.repeats; r++) {
+        bench->reset();
+        double start = wall_time();
+        for (long i = 0; i < n; i++) {
+            bench->run();
+        }
+        best = min(best, (wall_time() - start) / n);
+    }
+    *calls = n;
+    return best;
+}
+
+/**
+ * Count the hardware events of calls runs of the case, after the timing.
+ */
+static KernelCounters count_case(BenchCase *bench, PerfCounters *counters, long calls) {
+    bench->reset();
+    counters->reset();
+    counters->start();
+    for (long i = 0; i < calls; i++) {
+        bench->run();
+    }
+    counters->stop();
+    return counters->get_summary(bench->points * calls);
+}
+
+static vector<BenchCase *> build_cases(const BenchOptions &options) {
+    vector<BenchCase *> cases;
+    const char *directions[2] = {"real", "imaginary"};
+    for (size_t k = 0; k < options.blocks.size(); k++) {
+        int block = options.blocks[k];
+        for (int d = 0; d < 2; d++) {
+            string direction = directions[d];
+            cases.push_back(new KineticCase("block_kernel_vertical", direction, block));
+            cases.push_back(new KineticCase("block_kernel_horizontal", direction, block));
+            cases.push_back(new KineticCase("block_kernel_vertical_nnn", direction, block));
+            cases.push_back(new KineticCase("block_kernel_horizontal_nnn", direction, block));
+            cases.push_back(new KineticCase("block_kernel_radial_kinetic", direction, block));
+            // Single component: |psi|^2, |psi|^3, phase, cos and sin (or exp), external potential and phase products
+            cases.push_back(new PotentialCase(direction + "/one_component", block, false, d == 0 ? 48. : 40., d == 0 ? 22. : 13.));
+            cases.push_back(new PotentialCase(direction + "/two_components", block, true, d == 0 ? 64. : 56., d == 0 ? 23. : 14.));
+            cases.push_back(new RotationCase(direction, block));
+            cases.push_back(new RabiCase(direction, block));
+            // Eight kinetic sweeps and the potential, plus the rotation sweeps
+            double potential_bytes = d == 0 ? 48. : 40., potential_flops = d == 0 ? 22. : 13.;
+            cases.push_back(new FullStepCase(direction, block, 8 * 32. + potential_bytes, 8 * 6. + potential_flops));
+            cases.push_back(new FullStepCase(direction + "/rotation", block, 8 * 32. + potential_bytes + 128., 8 * 6. + potential_flops + 24.));
+        }
+    }
+    for (size_t l = 0; l < options.lattices.size(); l++) {
+        int lattice = options.lattices[l];
+        for (size_t k = 0; k < options.blocks.size(); k++) {
+            int block = options.blocks[k];
+            if (block > lattice) {
+                continue;
+            }
+            cases.push_back(new CopyCase(lattice, block));
+            for (int d = 0; d < 2; d++) {
+                // Blocks are loaded and stored around the full step
+                double potential_bytes = d == 0 ? 48. : 40., potential_flops = d == 0 ? 22. : 13.;
+                cases.push_back(new BandCase(directions[d], lattice, block, 2 * 32. + 8 * 32. + potential_bytes, 8 * 6. + potential_flops));
+            }
+        }
+        cases.push_back(new SystemCase("state_expected_values", "real", lattice, 16.));
+        cases.push_back(new SystemCase("solver_energy", "real", lattice, 16. + 16.));
+        vector<string> names = KernelRegistry::get_names();
+        for (size_t i = 0; i < names.size(); i++) {
+            if (KernelRegistry::is_available(names[i])) {
+                cases.push_back(new SystemCase("kernel_step", names[i], lattice, -1.));
+            }
+        }
+    }
+    return cases;
+}
+
+static void print_number(ostream &out, double value) {
+    if (value < 0.) {
+        out << "null";
+    }
+    else {
+        out << value;
+    }
+}
+
+int main(int argc, char** argv) {
+#ifdef HAVE_MPI
+    MPI_Init(&argc, &argv);
+#endif
+    BenchOptions options;
+    options.lattices = parse_sizes("256,1024");
+    options.blocks = parse_sizes("64,128,256");
+    options.min_time = 0.2;
+    options.repeats = 5;
+    options.counters = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            options.lattices = parse_sizes(argv[++i]);
+        }
+        else if (arg == "--blocks" && has_value) {
+            options.blocks = parse_sizes(argv[++i]);
+        }
+        else if (arg == "--min-time" && has_value) {
+            options.min_time = atof(argv[++i]);
+        }
+        else if (arg == "--repeats" && has_value) {
+            options.repeats = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        }
+        else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        }
+        else if (arg == "--counters") {
+            options.counters = true;
+        }
+        else if (arg == "--quick") {
+            options.lattices = parse_sizes("128");
+            options.blocks = parse_sizes("64");
+            options.min_time = 0.01;
+            options.repeats = 2;
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    int rank = 0;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+
+    vector<BenchCase *> cases = build_cases(options);
+    stringstream report;
+    report.precision(6);
+    report << "{\n  \"isa\": \"" << get_cpu_isa() << "\",\n";
+#ifdef _OPENMP
+    report << "  \"threads\": " << omp_get_max_threads() << ",\n";
+#else
+    report << "  \"threads\": 1,\n";
+#endif
+    PerfCounters *counters = NULL;
+    if (options.counters) {
+        counters = new PerfCounters();
+        double peak_gflop_per_s, peak_gb_per_s;
+        measure_roofline(&peak_gflop_per_s, &peak_gb_per_s);
+        report << "  \"counters\": " << (counters->is_available() ? "true" : "false")
+               << ",\n  \"peak_gflop_per_s\": " << peak_gflop_per_s << ",\n  \"peak_gb_per_s\": " << peak_gb_per_s << ",\n";
+    }
+    report << "  \"min_time\": " << options.min_time << ",\n  \"repeats\": " << options.repeats << ",\n  \"results\": [";
+    bool first = true;
+    for (size_t i = 0; i < cases.size(); i++) {
+        BenchCase *bench = cases[i];
+        if (options.filter.empty() || bench->name.find(options.filter) != string::npos) {
+            long calls;
+            double seconds = time_case(bench, options, &calls);
+            double ns_per_point = 1.e9 * seconds / bench->points;
+            report << (first ? "\n" : ",\n") << "    {\"name\": \"" << bench->name << "\", \"variant\": \"" << bench->variant
+                   << "\", \"lattice\": " << bench->lattice << ", \"block\": " << bench->block
+                   << ", \"points\": " << bench->points << ", \"calls\": " << calls
+                   << ", \"ns_per_point\": " << ns_per_point << ", \"gb_per_s\": ";
+            print_number(report, bench->bytes_per_point < 0. ? -1. : bench->bytes_per_point / ns_per_point);
+            report << ", \"gflop_per_s\": ";
+            print_number(report, bench->flops_per_point < 0. ? -1. : bench->flops_per_point / ns_per_point);
+            if (counters != NULL) {
+                KernelCounters events = count_case(bench, counters, calls);
+                report << ", \"ipc\": ";
+                print_number(report, events.ipc);
+                report << ", \"dram_bytes_per_point\": ";
+                print_number(report, events.bytes_per_point);
+                report << ", \"measured_flops_per_point\": ";
+                print_number(report, events.flops_per_point);
+                report << ", \"arithmetic_intensity\": ";
+                print_number(report, events.arithmetic_intensity);
+                report << ", \"bound\": \"" << events.bound << "\"";
+            }
+            report << "}";
+            first = false;
+            if (rank == 0 && !options.output.empty()) {
+                cerr << bench->name << " " << bench->variant << " " << bench->lattice << " " << bench->block << ": "
+                     << ns_per_point << " ns/point" << endl;
+            }
+        }
+        delete bench;
+    }
+    delete counters;
+    report << "\n  ]\n}\n";
+    if (rank == 0) {
+        if (options.output.empty()) {
+            cout << report.str();
+        }
+        else {
+            ofstream file(options.output.c_str());
+            file << report.str();
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -0,0 +1,469 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Performance regression check of the solver against a stored baseline.
+ *
+ * The scenarios are the systems of the unit tests (test/kerneltest.cpp), evolved for a fixed
+ * number of iterations from their initial state: the total energy and the squared norm at the end
+ * of this evolution are the results. The evolution then goes on by the same number of iterations at
+ * a time, each one a sample of the time per step, until the samples add up to --min-time seconds
+ * and number at least --min-samples; their median gives the throughput in points*steps/s, and their
+ * median absolute deviation, relative to the median, its spread.
+ *
+ * With --update, or when the baseline does not exist yet, the measurements are written as the new
+ * baseline. Otherwise each scenario is compared with the baseline, which must contain it, and the
+ * check fails if the energy or the norm moved by more than --result-tolerance (relative), or if the
+ * median throughput dropped by more than --tolerance (a fraction of the baseline) widened by
+ * the spreads of the baseline and of the measurement. A scenario that looks slower is measured again,
+ * up to --retries times, and only fails if none of the measurements keeps up: the noise of a loaded
+ * machine seldom repeats, a regression does. The throughput is only compared with a baseline of the
+ * same number of processes and threads; the results are compared whatever the parallelism.
+ *
+ *     bench/perfcheck --baseline perfcheck-baseline.json --update
+ *     bench/perfcheck --baseline perfcheck-baseline.json
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+#include "common.h"
+
+#define DIM 250
+#define LENGTH 100
+
+static double wall_time(void) {
+#ifdef HAVE_MPI
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+/**
+ * Slowest of the processes, so that every process agrees on a timing.
+ */
+static double slowest(double seconds) {
+#ifdef HAVE_MPI
+    double result;
+    MPI_Allreduce(&seconds, &result, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return result;
+#else
+    return seconds;
+#endif
+}
+
+/**
+ * A system of the unit tests, evolved through the Solver API.
+ */
+class Scenario {
+public:
+    Scenario(string name, string kernel_type):
+        state_b(NULL), potential(NULL), imag_time(false) {
+        string system = name;
+        if (name.compare(0, 10, "imaginary_") == 0) {
+            system = name.substr(10);
+            imag_time = true;
+        }
+        double delta_t = 1.e-3;
+        if (system == "free_particle") {
+            grid = new Lattice2D(DIM, LENGTH, true, true);
+            state = new ExponentialState(grid);
+            hamiltonian = new Hamiltonian(grid, NULL);
+            delta_t = 5.e-3;
+            iterations = 100;
+        }
+        else if (system == "harmonic_oscillator") {
+            grid = new Lattice2D(DIM, LENGTH);
+            state = new GaussianState(grid, 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential);
+            delta_t = 5.e-3;
+            iterations = 100;
+        }
+        else if (system == "intra_particle_interaction") {
+            grid = new Lattice2D(DIM, LENGTH);
+            state = new GaussianState(grid, 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+            iterations = 100;
+        }
+        else if (system == "rotating_frame_of_reference") {
+            double angular_velocity = 0.7;
+            grid = new Lattice2D(300, 20, false, false, angular_velocity);
+            state = new GaussianState(grid, 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
+            delta_t = 1.e-4;
+            iterations = 100;
+        }
+        else if (system == "mixed_BEC") {
+            grid = new Lattice2D(DIM, LENGTH);
+            state = new GaussianState(grid, 1.);
+            state_b = new State(grid);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 0., 0., 0., 2. * M_PI / 10.);
+            iterations = 100;
+        }
+        else {
+            my_abort("Unknown scenario " + name);
+        }
+        if (state_b == NULL) {
+            solver = new Solver(grid, state, hamiltonian, delta_t, kernel_type);
+        }
+        else {
+            solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component *>(hamiltonian), delta_t, kernel_type);
+        }
+    }
+    ~Scenario() {
+        delete solver;
+        delete hamiltonian;
+        delete potential;
+        delete state_b;
+        delete state;
+        delete grid;
+    }
+    double points() const {
+        return double(grid->global_no_halo_dim_x) * grid->global_no_halo_dim_y;
+    }
+
+    Lattice2D *grid;
+    State *state;
+    State *state_b;
+    Potential *potential;
+    Hamiltonian *hamiltonian;
+    Solver *solver;
+    bool imag_time;
+    int iterations;    ///< Iterations of the check; part of the definition of the scenario.
+};
+
+/**
+ * Measurement of a scenario, or its baseline.
+ */
+struct CheckResult {
+    string scenario;
+    string kernel;
+    int ranks;
+    int threads;
+    int iterations;
+    int samples;    ///< Timed evolutions of the iterations.
+    double seconds;    ///< Median time of the samples.
+    double spread;    ///< Median absolute deviation of the samples, relative to their median.
+    double point_steps_per_s;
+    double energy;    ///< Total energy at the end of the evolution.
+    double norm;    ///< Squared norm at the end of the evolution.
+};
+
+static vector<string> parse_names(const char *list) {
+    vector<string> names;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+/**
+ * Value of a field in a line of the JSON baseline, or the empty string.
+ */
+static string get_field(const string &line, const string &key) {
+    string pattern = "\"" + key + "\": ";
+    size_t begin = line.find(pattern);
+    if (begin == string::npos) {
+        return "";
+    }
+    begin += pattern.size();
+    if (line[begin] == '"') {
+        begin++;
+        return line.substr(begin, line.find('"', begin) - begin);
+    }
+    return line.substr(begin, line.find_first_of(",}", begin) - begin);
+}
+
+static vector<CheckResult> read_baseline(const string &file_name) {
+    vector<CheckResult> results;
+    ifstream file(file_name.c_str());
+    string line;
+    while (getline(file, line)) {
+        if (get_field(line, "scenario").empty()) {
+            continue;
+        }
+        CheckResult result;
+        result.scenario = get_field(line, "scenario");
+        result.kernel = get_field(line, "kernel");
+        result.ranks = atoi(get_field(line, "ranks").c_str());
+        result.threads = atoi(get_field(line, "threads").c_str());
+        result.iterations = atoi(get_field(line, "iterations").c_str());
+        result.samples = atoi(get_field(line, "samples").c_str());
+        result.seconds = atof(get_field(line, "seconds").c_str());
+        result.spread = atof(get_field(line, "spread").c_str());
+        result.point_steps_per_s = atof(get_field(line, "point_steps_per_s").c_str());
+        result.energy = atof(get_field(line, "energy").c_str());
+        result.norm = atof(get_field(line, "norm").c_str());
+        results.push_back(result);
+    }
+    return results;
+}
+
+static void write_baseline(const string &file_name, const vector<CheckResult> &results) {
+    ofstream file(file_name.c_str());
+    if (!file) {
+        my_abort("Cannot write the baseline " + file_name);
+    }
+    file << "{\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const CheckResult &result = results[i];
+        file.precision(6);
+        file << (i == 0 ? "\n" : ",\n") << "    {\"scenario\": \"" << result.scenario << "\", \"kernel\": \"" << result.kernel
+             << "\", \"ranks\": " << result.ranks << ", \"threads\": " << result.threads
+             << ", \"iterations\": " << result.iterations << ", \"samples\": " << result.samples << ", \"seconds\": " << result.seconds
+             << ", \"spread\": " << result.spread
+             << ", \"point_steps_per_s\": " << result.point_steps_per_s;
+        // The results are compared to many digits
+        file.precision(17);
+        file << ", \"energy\": " << result.energy << ", \"norm\": " << result.norm << "}";
+    }
+    file << "\n  ]\n}\n";
+}
+
+static double median(vector<double> values) {
+    sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : 0.5 * (values[middle - 1] + values[middle]);
+}
+
+static CheckResult run_scenario(const string &name, const string &kernel_type, int ranks, double min_time, int min_samples) {
+    CheckResult result;
+    result.scenario = name;
+    result.kernel = kernel_type;
+    result.ranks = ranks;
+    result.threads = 1;
+#ifdef _OPENMP
+    result.threads = omp_get_max_threads();
+#endif
+    Scenario scenario(name, kernel_type);
+    // The first evolution gives the results, and sets up the kernel out of the samples
+    scenario.solver->evolve(scenario.iterations, scenario.imag_time);
+    result.iterations = scenario.iterations;
+    result.energy = scenario.solver->get_total_energy();
+    result.norm = scenario.solver->get_squared_norm();
+    // Every process times the same samples, as the slowest of them sees them
+    vector<double> samples;
+    double total = 0.;
+    while (total < min_time || int(samples.size()) < min_samples) {
+        double start = wall_time();
+        scenario.solver->evolve(scenario.iterations, scenario.imag_time);
+        samples.push_back(slowest(wall_time() - start));
+        total += samples.back();
+    }
+    result.samples = samples.size();
+    result.seconds = median(samples);
+    vector<double> deviations;
+    for (size_t i = 0; i < samples.size(); i++) {
+        deviations.push_back(std::abs(samples[i] - result.seconds));
+    }
+    result.spread = median(deviations) / result.seconds;
+    result.point_steps_per_s = scenario.points() * scenario.iterations / result.seconds;
+    return result;
+}
+
+static bool close_to(double value, double reference, double tolerance) {
+    return std::abs(value - reference) <= tolerance * std::max(1., std::abs(reference));
+}
+
+/**
+ * Whether the median throughput dropped by more than the tolerance, widened by the spreads of the samples.
+ */
+static bool slower(const CheckResult &result, const CheckResult &base, double tolerance) {
+    return result.point_steps_per_s < (1. - tolerance - base.spread - result.spread) * base.point_steps_per_s;
+}
+
+static void usage(void) {
+    cout << "Usage: perfcheck [options]\n"
+         << "  --baseline FILE          baseline to compare with (default perfcheck-baseline.json)\n"
+         << "  --update                 write the measurements as the new baseline instead of comparing with it\n"
+         << "  --tolerance F            largest accepted drop of the median throughput, as a fraction of the baseline, before\n"
+         << "                           widening by the spreads of the samples (default 0.1)\n"
+         << "  --retries N              measurements again of a scenario that looks slower before it fails (default 2)\n"
+         << "  --result-tolerance F     largest accepted relative change of the energy and of the norm (default 1e-8)\n"
+         << "  --scenarios A,B,...      free_particle, harmonic_oscillator, imaginary_harmonic_oscillator, intra_particle_interaction,\n"
+         << "                           imaginary_intra_particle_interaction, rotating_frame_of_reference, mixed_BEC, imaginary_mixed_BEC\n"
+         << "                           (default all)\n"
+         << "  --kernel TYPE            kernel type of the solver (default cpu)\n"
+         << "  --min-time S             least time of the timed samples of each scenario, in seconds (default 1)\n"
+         << "  --min-samples N          least number of timed samples of each scenario, whose median is compared (default 5)\n";
+}
+
+int main(int argc, char** argv) {
+#ifdef HAVE_MPI
+    MPI_Init(&argc, &argv);
+#endif
+    string baseline_file = "perfcheck-baseline.json";
+    bool update = false;
+    double tolerance = 0.1;
+    double result_tolerance = 1.e-8;
+    vector<string> scenarios = parse_names("free_particle,harmonic_oscillator,imaginary_harmonic_oscillator,intra_particle_interaction,"
+                                           "imaginary_intra_particle_interaction,rotating_frame_of_reference,mixed_BEC,imaginary_mixed_BEC");
+    string kernel_type = "cpu";
+    double min_time = 1.;
+    int min_samples = 5;
+    int retries = 2;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--baseline" && has_value) {
+            baseline_file = argv[++i];
+        }
+        else if (arg == "--update") {
+            update = true;
+        }
+        else if (arg == "--tolerance" && has_value) {
+            tolerance = atof(argv[++i]);
+        }
+        else if (arg == "--result-tolerance" && has_value) {
+            result_tolerance = atof(argv[++i]);
+        }
+        else if (arg == "--scenarios" && has_value) {
+            scenarios = parse_names(argv[++i]);
+        }
+        else if (arg == "--kernel" && has_value) {
+            kernel_type = argv[++i];
+        }
+        else if (arg == "--min-time" && has_value) {
+            min_time = atof(argv[++i]);
+        }
+        else if (arg == "--min-samples" && has_value) {
+            min_samples = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--retries" && has_value) {
+            retries = max(0, atoi(argv[++i]));
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    int rank = 0, ranks = 1;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+#endif
+    vector<CheckResult> baseline;
+    if (!update) {
+        baseline = read_baseline(baseline_file);
+        // The first run records the baseline of the following ones
+        if (baseline.empty()) {
+            if (rank == 0) {
+                cout << "No baseline in " << baseline_file << ": recording one" << endl;
+            }
+            update = true;
+        }
+    }
+
+    vector<CheckResult> results;
+    int failures = 0;
+    for (size_t s = 0; s < scenarios.size(); s++) {
+        CheckResult result = run_scenario(scenarios[s], kernel_type, ranks, min_time, min_samples);
+        const CheckResult *base = NULL;
+        for (size_t i = 0; i < baseline.size(); i++) {
+            if (baseline[i].scenario == result.scenario && baseline[i].kernel == result.kernel) {
+                base = &baseline[i];
+            }
+        }
+        // A scenario that looks slower is measured again, and keeps the best of its measurements
+        int measurements = 1;
+        bool comparable = !update && base != NULL && base->ranks == result.ranks && base->threads == result.threads;
+        for (; comparable && measurements <= retries && slower(result, *base, tolerance); measurements++) {
+            CheckResult again = run_scenario(scenarios[s], kernel_type, ranks, min_time, min_samples);
+            if (again.point_steps_per_s > result.point_steps_per_s) {
+                result = again;
+            }
+        }
+        stringstream line;
+        line.precision(4);
+        line << result.scenario << ": " << result.point_steps_per_s / 1.e6 << " Mpoint*steps/s";
+        if (update) {
+            line << " (median of " << result.samples << " samples)";
+        }
+        else if (base == NULL) {
+            line << " -> NOT IN THE BASELINE";
+            failures++;
+        }
+        else {
+            bool same_results = base->iterations == result.iterations && close_to(result.energy, base->energy, result_tolerance) &&
+                                close_to(result.norm, base->norm, result_tolerance);
+            if (!same_results) {
+                line.precision(12);
+                line << ", energy " << result.energy << " (baseline " << base->energy << "), norm " << result.norm
+                     << " (baseline " << base->norm << ") -> RESULTS CHANGED";
+                failures++;
+            }
+            else if (!comparable) {
+                line << ", baseline with " << base->ranks << "x" << base->threads << " units: throughput not compared";
+            }
+            else {
+                double change = result.point_steps_per_s / base->point_steps_per_s - 1.;
+                line << " (" << (change >= 0. ? "+" : "") << 100. * change << "% of the baseline, spread " << 100. * result.spread << "%";
+                if (measurements > 1) {
+                    line << ", best of " << measurements << " measurements";
+                }
+                line << ")";
+                if (slower(result, *base, tolerance)) {
+                    line << " -> SLOWER";
+                    failures++;
+                }
+            }
+        }
+        results.push_back(result);
+        if (rank == 0) {
+            cout << line.str() << endl;
+        }
+    }
+
+    if (rank == 0) {
+        if (update) {
+            write_baseline(baseline_file, results);
+            cout << "Baseline written to " << baseline_file << endl;
+        }
+        else if (failures > 0) {
+            cout << failures << " of " << results.size() << " scenarios regressed against " << baseline_file << " or are missing from it" << endl;
+        }
+        else {
+            cout << "No regression against " << baseline_file << endl;
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return failures > 0 ? 1 : 0;
+}
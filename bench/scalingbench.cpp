@@ -0,0 +1,458 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Strong and weak scaling of the solver, driven through the public Solver API.
+ *
+ * Each scenario (free particle, harmonic trap, rotating BEC, two-component system with Rabi
+ * coupling, cylindrical coordinates) is evolved for every thread count in --threads, on every
+ * lattice size in --sizes, by all the MPI processes the program was launched with. The parallel
+ * units of a run are processes times threads:
+ *  - strong scaling evolves the same lattice whatever the number of units;
+ *  - weak scaling evolves a lattice of side size * sqrt(units), so that the points per unit stay
+ *    the same.
+ * Every run is warmed up with --warmup iterations, then timed over enough iterations to last
+ * --min-time seconds split in --repeats runs, of which the fastest is reported as steps/s and
+ * points*steps/s. The parallel efficiency is the throughput per unit relative to the run with the
+ * fewest units of the same scenario, mode and size; runs read with --reference (the JSON report of
+ * a previous launch, e.g. with a single process) take part in the choice, so that efficiencies
+ * across process counts can be obtained by launching the program once per count:
+ *
+ *     bench/scalingbench --threads 1 --output scaling-1.json
+ *     mpirun -np 4 bench/scalingbench --threads 1 --reference scaling-1.json
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+#include "common.h"
+
+#define LENGTH 20.
+#define DELTA_T 1.e-3
+#define COUPLING 10.
+#define ANGULAR_VELOCITY 0.7
+#define RABI_FREQUENCY 1.
+
+static double wall_time(void) {
+#ifdef HAVE_MPI
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+/**
+ * Slowest of the processes, so that every process agrees on a timing.
+ */
+static double slowest(double seconds) {
+#ifdef HAVE_MPI
+    double result;
+    MPI_Allreduce(&seconds, &result, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return result;
+#else
+    return seconds;
+#endif
+}
+
+/**
+ * A system evolved through the Solver API.
+ */
+class Scenario {
+public:
+    Scenario(string name, int dim, string kernel_type):
+        state_b(NULL), potential(NULL) {
+        if (name == "free") {
+            grid = new Lattice2D(dim, LENGTH);
+            state = new GaussianState(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid);
+        }
+        else if (name == "harmonic") {
+            grid = new Lattice2D(dim, LENGTH);
+            state = new GaussianState(grid, 1., 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential, 1., COUPLING);
+        }
+        else if (name == "rotating") {
+            grid = new Lattice2D(dim, LENGTH, false, false, ANGULAR_VELOCITY);
+            state = new GaussianState(grid, 1., 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential, 1., COUPLING, 0., ANGULAR_VELOCITY);
+        }
+        else if (name == "two_component") {
+            grid = new Lattice2D(dim, LENGTH);
+            state = new GaussianState(grid, 1., 1., 0., 0., 0.5);
+            state_b = new GaussianState(grid, 1., 1., 0., 0., 0.5, M_PI / 2.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1.,
+                                                    COUPLING, 0.5 * COUPLING, COUPLING, RABI_FREQUENCY);
+        }
+        else if (name == "cylindrical") {
+            grid = new Lattice2D(dim, LENGTH, dim, LENGTH, false, true, 0., "cylindrical");
+            state = new GaussianState(grid, 1., 1.);
+            potential = new HarmonicPotential(grid, 1., 1.);
+            hamiltonian = new Hamiltonian(grid, potential);
+        }
+        else {
+            my_abort("Unknown scenario " + name);
+        }
+        if (state_b != NULL) {
+            solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component *>(hamiltonian), DELTA_T, kernel_type);
+        }
+        else {
+            solver = new Solver(grid, state, hamiltonian, DELTA_T, kernel_type);
+        }
+    }
+    ~Scenario() {
+        delete solver;
+        delete hamiltonian;
+        delete potential;
+        delete state_b;
+        delete state;
+        delete grid;
+    }
+    double points(void) {
+        return double(grid->global_no_halo_dim_x) * grid->global_no_halo_dim_y;
+    }
+
+    Solver *solver;
+
+private:
+    Lattice2D *grid;
+    State *state;
+    State *state_b;
+    Potential *potential;
+    Hamiltonian *hamiltonian;
+};
+
+struct ScalingOptions {
+    vector<string> scenarios;
+    vector<int> sizes;
+    vector<int> threads;
+    vector<string> modes;
+    string kernel_type;
+    bool imag_time;
+    int warmup;
+    double min_time;
+    int repeats;
+    string reference;
+    string output;
+};
+
+/**
+ * Outcome of one run.
+ */
+struct ScalingResult {
+    string scenario;
+    string mode;
+    int size;    ///< Lattice side (strong) or lattice side per unit (weak) asked for.
+    int lattice;    ///< Side of the lattice evolved.
+    int ranks;
+    int threads;
+    long steps;    ///< Iterations of each timed run.
+    double seconds;    ///< Time of the fastest timed run.
+    double steps_per_s;
+    double point_steps_per_s;
+    double efficiency;
+};
+
+static vector<string> parse_names(const char *list) {
+    vector<string> names;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+static vector<int> parse_counts(const char *list) {
+    vector<int> counts;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        int count = atoi(item.c_str());
+        if (count < 1) {
+            my_abort("Counts must be positive: " + item);
+        }
+        counts.push_back(count);
+    }
+    return counts;
+}
+
+/**
+ * Value of a field in a line of the JSON report, or the empty string.
+ */
+static string get_field(const string &line, const string &key) {
+    string pattern = "\"" + key + "\": ";
+    size_t begin = line.find(pattern);
+    if (begin == string::npos) {
+        return "";
+    }
+    begin += pattern.size();
+    if (line[begin] == '"') {
+        begin++;
+        return line.substr(begin, line.find('"', begin) - begin);
+    }
+    return line.substr(begin, line.find_first_of(",}", begin) - begin);
+}
+
+/**
+ * Read the results of a previous report; only the fields taking part in the efficiency are kept.
+ */
+static vector<ScalingResult> read_reference(string file_name) {
+    vector<ScalingResult> results;
+    ifstream file(file_name.c_str());
+    if (!file) {
+        my_abort("Cannot read the reference " + file_name);
+    }
+    string line;
+    while (getline(file, line)) {
+        if (get_field(line, "scenario").empty()) {
+            continue;
+        }
+        ScalingResult result;
+        result.scenario = get_field(line, "scenario");
+        result.mode = get_field(line, "mode");
+        result.size = atoi(get_field(line, "size").c_str());
+        result.lattice = atoi(get_field(line, "lattice").c_str());
+        result.ranks = atoi(get_field(line, "ranks").c_str());
+        result.threads = atoi(get_field(line, "threads").c_str());
+        result.point_steps_per_s = atof(get_field(line, "point_steps_per_s").c_str());
+        results.push_back(result);
+    }
+    return results;
+}
+
+static ScalingResult run_scenario(string scenario, string mode, int size, int ranks, int threads,
+                                  const ScalingOptions &options) {
+    ScalingResult result;
+    result.scenario = scenario;
+    result.mode = mode;
+    result.size = size;
+    result.ranks = ranks;
+    result.threads = threads;
+    result.lattice = size;
+    if (mode == "weak") {
+        result.lattice = int(size * sqrt(double(ranks * threads)) + 0.5);
+    }
+    Scenario system(scenario, result.lattice, options.kernel_type);
+    system.solver->set_num_threads(threads);
+    // The warm-up also builds the kernel, and estimates the cost of an iteration
+    double start = wall_time();
+    system.solver->evolve(options.warmup, options.imag_time);
+    double per_step = slowest(wall_time() - start) / options.warmup;
+    long steps = max(1L, long(options.min_time / options.repeats / per_step));
+    double best = -1.;
+    for (int r = 0; r < options.repeats; r++) {
+#ifdef HAVE_MPI
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        start = wall_time();
+        system.solver->evolve(steps, options.imag_time);
+        double elapsed = slowest(wall_time() - start);
+        if (best < 0. || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    result.steps = steps;
+    result.seconds = best;
+    result.steps_per_s = steps / best;
+    result.point_steps_per_s = result.steps_per_s * system.points();
+    result.efficiency = -1.;
+    return result;
+}
+
+/**
+ * Throughput per unit of every result relative to the result with the fewest units of the same
+ * scenario, mode and size, among the results and the reference.
+ */
+static void compute_efficiencies(vector<ScalingResult> &results, const vector<ScalingResult> &reference) {
+    vector<ScalingResult> all = reference;
+    all.insert(all.end(), results.begin(), results.end());
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScalingResult *base = NULL;
+        for (size_t j = 0; j < all.size(); j++) {
+            if (all[j].scenario == results[i].scenario && all[j].mode == results[i].mode &&
+                    all[j].size == results[i].size &&
+                    (base == NULL || all[j].ranks * all[j].threads < base->ranks * base->threads)) {
+                base = &all[j];
+            }
+        }
+        int units = results[i].ranks * results[i].threads;
+        int base_units = base->ranks * base->threads;
+        results[i].efficiency = (results[i].point_steps_per_s / units) / (base->point_steps_per_s / base_units);
+    }
+}
+
+static void usage(void) {
+    cout << "Usage: scalingbench [options]\n"
+         << "  --scenarios A,B,...  free, harmonic, rotating, two_component, cylindrical (default all)\n"
+         << "  --sizes N,N,...      lattice side, or lattice side per unit for weak scaling (default 256,512)\n"
+         << "  --threads N,N,...    OpenMP threads per process (default 1,2,4,... up to the OpenMP default)\n"
+         << "  --mode MODE          strong, weak or both (default both)\n"
+         << "  --kernel TYPE        kernel type of the solver (default cpu)\n"
+         << "  --imag               evolve in imaginary time\n"
+         << "  --warmup N           iterations before the timing (default 20)\n"
+         << "  --min-time S         seconds spent timing each run (default 1)\n"
+         << "  --repeats N          timed runs, the fastest is reported (default 3)\n"
+         << "  --reference FILE     report of a previous launch taking part in the efficiencies\n"
+         << "  --output FILE        write the JSON report to FILE instead of the standard output\n"
+         << "  --quick              small lattices and short timings, to check the harness\n";
+}
+
+int main(int argc, char** argv) {
+#ifdef HAVE_MPI
+    MPI_Init(&argc, &argv);
+#endif
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    ScalingOptions options;
+    options.scenarios = parse_names("free,harmonic,rotating,two_component,cylindrical");
+    options.sizes = parse_counts("256,512");
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        options.threads.push_back(threads);
+    }
+    options.threads.push_back(max_threads);
+    options.modes = parse_names("strong,weak");
+    options.kernel_type = "cpu";
+    options.imag_time = false;
+    options.warmup = 20;
+    options.min_time = 1.;
+    options.repeats = 3;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scenarios" && has_value) {
+            options.scenarios = parse_names(argv[++i]);
+        }
+        else if (arg == "--sizes" && has_value) {
+            options.sizes = parse_counts(argv[++i]);
+        }
+        else if (arg == "--threads" && has_value) {
+            options.threads = parse_counts(argv[++i]);
+        }
+        else if (arg == "--mode" && has_value) {
+            string mode = argv[++i];
+            options.modes = mode == "both" ? parse_names("strong,weak") : parse_names(mode.c_str());
+        }
+        else if (arg == "--kernel" && has_value) {
+            options.kernel_type = argv[++i];
+        }
+        else if (arg == "--imag") {
+            options.imag_time = true;
+        }
+        else if (arg == "--warmup" && has_value) {
+            options.warmup = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--min-time" && has_value) {
+            options.min_time = atof(argv[++i]);
+        }
+        else if (arg == "--repeats" && has_value) {
+            options.repeats = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--reference" && has_value) {
+            options.reference = argv[++i];
+        }
+        else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        }
+        else if (arg == "--quick") {
+            options.sizes = parse_counts("64");
+            options.warmup = 2;
+            options.min_time = 0.02;
+            options.repeats = 2;
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    int rank = 0, ranks = 1;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+#endif
+    vector<ScalingResult> reference;
+    if (!options.reference.empty()) {
+        reference = read_reference(options.reference);
+    }
+
+    vector<ScalingResult> results;
+    for (size_t s = 0; s < options.scenarios.size(); s++) {
+        for (size_t m = 0; m < options.modes.size(); m++) {
+            if (options.modes[m] != "strong" && options.modes[m] != "weak") {
+                my_abort("Unknown scaling mode " + options.modes[m]);
+            }
+            for (size_t n = 0; n < options.sizes.size(); n++) {
+                for (size_t t = 0; t < options.threads.size(); t++) {
+                    ScalingResult result = run_scenario(options.scenarios[s], options.modes[m], options.sizes[n],
+                                                        ranks, options.threads[t], options);
+                    results.push_back(result);
+                    if (rank == 0 && !options.output.empty()) {
+                        cerr << result.scenario << " " << result.mode << " " << result.lattice << " "
+                             << result.ranks << "x" << result.threads << ": " << result.steps_per_s << " steps/s" << endl;
+                    }
+                }
+            }
+        }
+    }
+    compute_efficiencies(results, reference);
+
+    stringstream report;
+    report.precision(6);
+    report << "{\n  \"kernel\": \"" << options.kernel_type << "\",\n  \"imag_time\": " << (options.imag_time ? "true" : "false")
+           << ",\n  \"warmup\": " << options.warmup << ",\n  \"repeats\": " << options.repeats << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScalingResult &result = results[i];
+        report << (i == 0 ? "\n" : ",\n") << "    {\"scenario\": \"" << result.scenario << "\", \"mode\": \"" << result.mode
+               << "\", \"size\": " << result.size << ", \"lattice\": " << result.lattice
+               << ", \"ranks\": " << result.ranks << ", \"threads\": " << result.threads
+               << ", \"steps\": " << result.steps << ", \"seconds\": " << result.seconds
+               << ", \"steps_per_s\": " << result.steps_per_s << ", \"point_steps_per_s\": " << result.point_steps_per_s
+               << ", \"efficiency\": " << result.efficiency << "}";
+    }
+    report << "\n  ]\n}\n";
+    if (rank == 0) {
+        if (options.output.empty()) {
+            cout << report.str();
+        }
+        else {
+            ofstream file(options.output.c_str());
+            file << report.str();
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -122,17 +122,34 @@ else:
                      'trottersuzuki/src/cpucylindrical.cpp',
                      'trottersuzuki/src/model.cpp',
                      'trottersuzuki/src/solver.cpp',
+                     'trottersuzuki/src/ensemble.cpp',
+                     'trottersuzuki/src/kernelregistry.cpp',
+                     'trottersuzuki/src/cpuchebyshev.cpp',
+                     'trottersuzuki/src/cpuspectral.cpp',
+                     'trottersuzuki/src/perfcounters.cpp',
+                     'trottersuzuki/src/trace.cpp',
+                     'trottersuzuki/src/memory.cpp',
+                     'trottersuzuki/src/multilevel.cpp',
                      'trottersuzuki/trottersuzuki_wrap.cxx']
 
+    # Compile the CPU kernels for several instruction sets, dispatched at load time
+    define_macros = []
+    if sys.platform.startswith('linux') and \
+            platform.machine() in ('x86_64', 'AMD64'):
+        define_macros.append(('HAVE_TARGET_CLONES', '1'))
+    # Hardware performance counters through perf_event_open
+    if sys.platform.startswith('linux'):
+        define_macros.append(('HAVE_LINUX_PERF_EVENT_H', '1'))
     ts_module = Extension('_trottersuzuki', sources=sources_files,
                           include_dirs=[numpy_include, 'src'],
                           extra_compile_args=extra_compile_args,
+                          define_macros=define_macros,
                           libraries=libraries,
                           )
     if CUDA is not None:
         ts_module.sources += ['trottersuzuki/src/gpukernel.cu',
                               'trottersuzuki/src/gpucartesian.cu']
-        ts_module.define_macros = [('CUDA', None)]
+        ts_module.define_macros += [('CUDA', None)]
         ts_module.include_dirs.append(CUDA['include'])
         ts_module.library_dirs = [CUDA['lib']]
         ts_module.libraries += ['cudart', 'cublas']
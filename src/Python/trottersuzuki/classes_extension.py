@@ -8,7 +8,7 @@ from .trottersuzuki import ExponentialState as _ExponentialState
 from .trottersuzuki import BesselState as _BesselState
 from .trottersuzuki import Potential as _Potential
 from .trottersuzuki import Solver as _Solver
-from .tools import map_lattice_to_coordinate_space, imprint
+from .tools import imprint, evaluate_on_lattice
 
 
 class Lattice1D(_Lattice1D):
@@ -23,8 +23,9 @@ class Lattice1D(_Lattice1D):
             X-axis of the lattice
         """
         if self.coordinate_system == "cartesian":
-            x_axis = np.arange(self.global_no_halo_dim_x) - \
-                self.global_no_halo_dim_x * 0.5 + 0.5
+            # An axis with a parity is unfolded to the full system
+            n_x = self.global_no_halo_dim_x * (2 if self.parity_x != 0 else 1)
+            x_axis = np.arange(n_x) - n_x * 0.5 + 0.5
             x_axis *= self.delta_x
 
         if self.coordinate_system == "cylindrical":
@@ -38,14 +39,16 @@ class Lattice2D(_Lattice2D):
 
     def __init__(self, dim_x, length_x, dim_y=None, length_y=None,
                  periodic_x_axis=False, periodic_y_axis=False,
-                 angular_velocity=0., coordinate_system="cartesian"):
+                 angular_velocity=0., coordinate_system="cartesian",
+                 kinetic_order=2, parity_x=0, parity_y=0):
         if dim_y is None:
             dim_y = dim_x
         if length_y is None:
             length_y = length_x
         super(Lattice2D, self).__init__(dim_x, length_x, dim_y, length_y,
                                         periodic_x_axis, periodic_y_axis,
-                                        angular_velocity, coordinate_system)
+                                        angular_velocity, coordinate_system,
+                                        kinetic_order, parity_x, parity_y)
 
     def get_x_axis(self):
         """
@@ -57,8 +60,9 @@ class Lattice2D(_Lattice2D):
             X-axis of the lattice
         """
         if self.coordinate_system == "cartesian":
-            x_axis = np.arange(self.global_no_halo_dim_x) - \
-                self.global_no_halo_dim_x * 0.5 + 0.5
+            # An axis with a parity is unfolded to the full system
+            n_x = self.global_no_halo_dim_x * (2 if self.parity_x != 0 else 1)
+            x_axis = np.arange(n_x) - n_x * 0.5 + 0.5
             x_axis *= self.delta_x
 
         if self.coordinate_system == "cylindrical":
@@ -76,8 +80,8 @@ class Lattice2D(_Lattice2D):
         * `y_axis` : numpy array
             Y-axis of the lattice
         """
-        y_axis = np.arange(self.global_no_halo_dim_y) - \
-            self.global_no_halo_dim_y * 0.5 + 0.5
+        n_y = self.global_no_halo_dim_y * (2 if self.parity_y != 0 else 1)
+        y_axis = np.arange(n_y) - n_y * 0.5 + 0.5
         y_axis *= self.delta_y
 
         return y_axis
@@ -96,7 +100,9 @@ class State(_State):
 
         Notes
         -----
-        The input arguments of the python function must be (x,y).
+        The input arguments of the python function must be (x,y). The
+        function is called on whole numpy coordinate meshes when it supports
+        them and point by point otherwise.
 
         Example
         -------
@@ -108,22 +114,10 @@ class State(_State):
             >>> state = ts.State(grid)  # Create the system's state
             >>> state.ini_state(wave_function)  # Initialize the wave function
         """
-        try:
-            state_function(0)
-
-            def function(x, y):
-                return state_function(x)
-        except TypeError:
-            function = state_function
-
-        state = np.zeros((self.grid.dim_y, self.grid.dim_x),
-                         dtype=np.complex128)
-
-        for y in range(self.grid.dim_y):
-            for x in range(self.grid.dim_x):
-                state[y, x] = function(*map_lattice_to_coordinate_space(self.grid, x, y))
-
-        self.init_state_matrix(state.real, state.imag)
+        state = evaluate_on_lattice(self.grid, state_function)
+        self.get_tile_real()[...] = state.real
+        self.get_tile_imag()[...] = state.imag
+        self.expected_values_updated = False
 
     def imprint(self, function):
         """
@@ -342,40 +336,36 @@ class Potential(_Potential):
                     return pot_function(x, y, 0)
                 self.updated_potential_matrix = True
                 self.pot_function = pot_function
-                self.exp_potential_matrix = np.zeros((self.grid.dim_y,
-                                                      self.grid.dim_x),
-                                                     dtype=np.complex128)
             except TypeError:
                 _pot_function = pot_function
 
-        self.potential_matrix = np.zeros((self.grid.dim_y, self.grid.dim_x))
-
-        for y in range(self.grid.dim_y):
-            for x in range(self.grid.dim_x):
-                self.potential_matrix[y, x] = \
-                    _pot_function(*map_lattice_to_coordinate_space(self.grid, x, y))
-
-        self.init_potential_matrix(self.potential_matrix)
+        self.potential_matrix = self.get_tile_matrix()
+        self.potential_matrix[...] = \
+            evaluate_on_lattice(self.grid, _pot_function).real
 
     def exponential_update(self, delta_t, t):
-        for y in range(self.grid.dim_y):
-            for x in range(self.grid.dim_x):
-                x1, y1 = map_lattice_to_coordinate_space(self.grid, x, y)
-                self.exp_potential_matrix[y, x] = \
-                    np.exp(-1j*delta_t*self.pot_function(x1, y1, t))
-        return self.exp_potential_matrix
+        def exp_potential(x, y):
+            return np.exp(-1j*delta_t*self.pot_function(x, y, t))
+        return evaluate_on_lattice(self.grid, exp_potential)
 
 
 class Solver(_Solver):
 
     def __init__(self, Lattice, State, Hamiltonian, delta_t, Potential=None,
-                 State2=None, Potential2=None, kernel_type="cpu",):
-        if State2 is None:
+                 State2=None, Potential2=None, kernel_type="cpu",
+                 num_threads=0):
+        if isinstance(State, (list, tuple)):
+            super(Solver, self).__init__(Lattice, State, Hamiltonian,
+                                         delta_t, kernel_type)
+            # The C++ solver keeps pointers to the states
+            self._states = list(State)
+        elif State2 is None:
             super(Solver, self).__init__(Lattice, State, Hamiltonian,
                                          delta_t, kernel_type)
         else:
             super(Solver, self).__init__(Lattice, State, State2,
                                          Hamiltonian, delta_t, kernel_type)
+        self.set_num_threads(num_threads)
         self.delta_t = delta_t
         self.potential = Potential
         if State2 is not None and Potential2 is None:
@@ -390,14 +380,18 @@ class Solver(_Solver):
                 imag_time:
             super(Solver, self).evolve(iterations, imag_time)
             return
+        exp_pot_real, exp_pot_imag = self.get_exp_potential_view(0)
+        self.use_external_exp_potential()
         for _ in range(iterations-1):
             exp_pot = self.potential.exponential_update(self.delta_t,
                                                         self.current_evolution_time)
-            super(Solver, self).set_exp_potential(np.ravel(exp_pot.real),
-                                                  np.ravel(exp_pot.imag), 0)
+            exp_pot_real[...] = exp_pot.real
+            exp_pot_imag[...] = exp_pot.imag
+            self.apply_absorbing_layer(0)
             super(Solver, self).evolve(-1, imag_time)
         exp_pot = self.potential.exponential_update(self.delta_t,
                                                     self.current_evolution_time)
-        super(Solver, self).set_exp_potential(np.ravel(exp_pot.real),
-                                              np.ravel(exp_pot.imag), 0)
+        exp_pot_real[...] = exp_pot.real
+        exp_pot_imag[...] = exp_pot.imag
+        self.apply_absorbing_layer(0)
         super(Solver, self).evolve(1, imag_time)
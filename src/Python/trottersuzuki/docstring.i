@@ -252,6 +252,92 @@ Example
     >>> hamiltonian = ts.Hamiltonian(grid, potential)  # Create the Hamiltonian of an harmonic oscillator
 ";
 
+%feature("docstring") Hamiltonian::set_schedule "
+
+Make a parameter follow a piecewise-linear table of values during the
+evolution. The solver updates the parameter at every time step; before the
+first and after the last point of the table the parameter is constant.
+
+Parameters
+----------
+* `parameter` : string
+    Name of the parameter: `mass`, `coupling_a` or `angular_velocity`, and
+    for two-component systems also `mass_b`, `coupling_b`, `coupling_ab`,
+    `omega_r` and `omega_i`. A scheduled `angular_velocity` needs closed
+    boundaries, and under MPI a lattice built with a nonzero angular velocity.
+* `times` : numpy array
+    Times of the points of the table, in increasing order.
+* `values` : numpy array
+    Values of the parameter at the points of the table.
+
+Example
+-------
+
+    >>> import numpy as np
+    >>> import trottersuzuki as ts  # import the module
+    >>> grid = ts.Lattice2D(200, 20.)  # Define the simulation's geometry
+    >>> potential = ts.HarmonicPotential(grid, 1., 1.)  # Create an harmonic external potential
+    >>> hamiltonian = ts.Hamiltonian(grid, potential)  # Create the Hamiltonian of an harmonic oscillator
+    >>> hamiltonian.set_schedule('coupling_a', np.array([0., 1.]), np.array([0., 100.]))  # Ramp the interaction
+";
+
+%feature("docstring") Hamiltonian::remove_schedule "
+
+Stop scheduling a parameter, which keeps its last value.
+
+Parameters
+----------
+* `parameter` : string
+    Name of the parameter.
+";
+
+%feature("docstring") Hamiltonian::has_schedule "
+
+Whether a parameter follows a schedule.
+
+Parameters
+----------
+* `parameter` : string
+    Name of the parameter.
+
+Returns
+-------
+* `has_schedule` : bool
+    True if the parameter is scheduled.
+";
+
+%feature("docstring") Hamiltonian::set_absorbing_layer "
+
+Absorb the wave function near the edges of the lattice, so that outgoing
+waves leave the domain instead of being reflected.
+
+Real time evolution adds the complex absorbing potential :math:`-iW` to the
+external potential, where :math:`W` rises from 0 to `strength` as a power of
+the depth into a layer of the given width along each edge (along the outer
+radius only, in cylindrical coordinates). Imaginary time evolution ignores
+the layer. Call `Solver.update_parameters` after changing the layer of a
+Hamiltonian in use.
+
+Parameters
+----------
+* `width` : float
+    Physical width of the layer; 0 removes it.
+* `strength` : float
+    Height of the absorbing potential at the edges.
+* `power` : integer,optional (default: 2)
+    Power of the profile of the absorbing potential (2: quadratic).
+";
+
+%feature("docstring") Hamiltonian::has_absorbing_layer "
+
+Whether an absorbing layer is set.
+
+Returns
+-------
+* `has_absorbing_layer` : bool
+    True if the Hamiltonian has an absorbing layer.
+";
+
 // File: classHamiltonian2Component.xml
 
 %feature("docstring") Hamiltonian2Component "
@@ -334,6 +420,11 @@ Example
 Return the value of the external potential at coordinate (x,y)  
 ";
 
+%feature("docstring") HarmonicPotential::get_value_at "
+
+Return the value of the external potential at the point (x,y) of the coordinate space.  
+";
+
 %feature("docstring") HarmonicPotential::HarmonicPotential "
 
 Construct the harmonic external potential.  
@@ -476,6 +567,20 @@ Parameters
     Boundary condition along the x axis (false=closed, true=periodic).  
 * `periodic_y_axis` : bool,optional (default: False) 
     Boundary condition along the y axis (false=closed, true=periodic).
+* `angular_velocity` : float,optional (default: 0.)
+    Angular velocity of the frame of reference.
+* `coordinate_system` : string,optional (default: 'cartesian')
+    Type of the coordinate system used ('cartesian' or 'cylindrical').
+* `kinetic_order` : integer,optional (default: 2)
+    Order of the spatial accuracy of the kinetic operator of the CPU kernel: 2 couples the nearest neighbours,
+    4 also couples the next-nearest ones and widens the halos, which reaches the same accuracy on coarser
+    lattices for smooth wave functions (cartesian coordinates only).
+* `parity_x` : integer,optional (default: 0)
+    Parity of the wave function along the x axis (1 even, -1 odd, 0 no symmetry). With a parity, only
+    the half x > 0 of the closed cartesian axis is stored and evolved; the snapshots and the axes of the
+    lattice are unfolded to the full system on a single process.
+* `parity_y` : integer,optional (default: 0)
+    Parity of the wave function along the y axis.
 
 Returns
 -------
@@ -634,6 +739,16 @@ Returns
     Value of the external potential.
 ";
 
+%feature("docstring") Potential::get_value_at "
+
+Get the value at the point (x,y) of the coordinate space, for a potential defined by a function.
+
+Returns
+-------
+* `value` : float
+    Value of the external potential.
+";
+
 // File: classSinusoidState.xml
 
 
@@ -722,6 +837,29 @@ Returns
     Rabi energy of the system.  
 ";
 
+%feature("docstring") Solver::get_absorbed_norm "
+
+Get the squared norm removed by the absorbing layer of the Hamiltonian
+since the last switch to real time evolution.
+
+Returns
+-------
+* `get_absorbed_norm` : float
+    Squared norm that left the lattice through the absorbing layer.
+";
+
+%feature("docstring") Solver::apply_absorbing_layer "
+
+Multiply the exponential of the potential written by the caller by the
+decay of the absorbing layer; the Python solver calls it after writing
+the exponential of a time-dependent potential.
+
+Parameters
+----------
+* `which` : integer,optional (default: 0)
+    Component whose exponential of the potential is updated (0 or 1).
+";
+
 %feature("docstring") Solver::get_squared_norm "
 
 Get the squared norm of the state (default: total wave-function).
@@ -830,9 +968,38 @@ Example
     >>> solver.evolve(1000)  # perform 1000 iteration in real time evolution
 ";
 
+%feature("docstring") Solver::set_num_threads "
+
+Limit the number of OpenMP threads used by the solver.
+
+Parameters
+----------
+* `num_threads` : integer
+    Number of threads used by the evolution and by the energy calculations;
+    0 restores the OpenMP default.
+
+Notes
+-----
+The evolution releases the GIL, so several solvers can run concurrently from
+Python threads. Giving each of them a thread budget avoids oversubscribing
+the cores.
+";
+
+%feature("docstring") Solver::get_num_threads "
+
+Get the OpenMP thread budget of the solver.
+
+Returns
+-------
+* `num_threads` : integer
+    Number of threads, 0 if the OpenMP default is used.
+";
+
 %feature("docstring") Solver::update_parameters "
 
-Notify the solver if any parameter changed in the Hamiltonian
+Notify the solver if any parameter changed in the Hamiltonian. The kernel
+recomputes its coefficients in place at the next evolution, without
+reallocating its buffers.
 
 ";
 
@@ -851,7 +1018,11 @@ Parameters
 * `delta_t` : float 
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use: cpu, gpu, chebyshev, spectral, or auto for the fastest available kernel supporting the system.  
+    The chebyshev kernel expands the evolution operator of linear single-component systems in
+    Chebyshev polynomials, which allows much larger time steps.  
+    The spectral kernel applies the kinetic operator exactly in momentum space (split-step Fourier method)
+    and requires periodic boundary conditions along every axis.  
 
 Returns
 -------
@@ -900,7 +1071,7 @@ Parameters
 * `delta_t` : float
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use: cpu, gpu, spectral (periodic lattices only), or auto for the fastest available kernel supporting the system.  
 
 Returns
 -------
@@ -920,6 +1091,245 @@ Example
 
 ";
 
+%feature("docstring") Solver::Solver "
+
+Construct the Solver object for several states of a single-component system.
+
+The states are evolved together. In imaginary time they are kept orthonormal
+in Gram-Schmidt order, so that the i-th state relaxes to the i-th lowest
+eigenstate of the Hamiltonian.
+
+Parameters
+----------
+* `grid` : Lattice object
+    Define the geometry of the simulation.
+* `states` : list of State objects
+    States of the system.
+* `hamiltonian` : Hamiltonian object
+    Hamiltonian of the system.
+* `delta_t` : float
+    A single evolution iteration, evolves the states for this time.
+* `kernel_type` : string,optional (default: 'cpu')
+    Which kernel to use (cpu or auto).
+
+Returns
+-------
+* `Solver` : Solver object
+    Solver object for the simulation of several states.
+
+Example
+-------
+
+    >>> import trottersuzuki as ts  # import the module
+    >>> grid = ts.Lattice2D(200, 20.)  # Define the simulation's geometry
+    >>> states = [ts.GaussianState(grid, 1., 1., 0.3 * i, -0.2 * i) for i in range(3)]  # Create the initial guesses
+    >>> potential = ts.HarmonicPotential(grid, 1., 1.)  # Create harmonic potential
+    >>> hamiltonian = ts.Hamiltonian(grid, potential)  # Create a harmonic oscillator Hamiltonian
+    >>> solver = ts.Solver(grid, states, hamiltonian, 1e-3)  # Create the solver
+    >>> solver.evolve(10000, True)  # Relax to the three lowest eigenstates
+    >>> energies = [solver.get_state_energy(i) for i in range(3)]
+
+";
+
+%feature("docstring") Solver::get_kernel_name "
+
+Get the name of the kernel in use, which resolves the kernel type auto.
+
+Returns
+-------
+* `get_kernel_name` : string
+    Name of the kernel (empty before the first evolution).
+";
+
+%feature("docstring") Solver::get_timings "
+
+Get the time spent in each phase of the evolution since the construction of the solver or the last `reset_timings`.
+The phases are setup (evolution operators and kernel), parameters (scheduled parameters and time-dependent potentials),
+kernel_on_halo, start_halo_exchange, kernel, finish_halo_exchange, wait_for_completion (comprising the normalization
+in imaginary time), rabi_coupling, normalization and get_sample. Under MPI, every process has to call it.
+
+Returns
+-------
+* `get_timings` : dictionary
+    For each phase, a dictionary with the number of calls and the seconds spent by this process, and the minimum,
+    maximum and average seconds over the processes (keys calls, seconds, min, max and avg).
+
+Example
+-------
+
+    >>> solver.evolve(1000)
+    >>> timings = solver.get_timings()
+    >>> timings['finish_halo_exchange']['max'] - timings['finish_halo_exchange']['min']  # Imbalance of the waits
+";
+
+%feature("docstring") Solver::reset_timings "
+
+Restart the accumulation of the time spent in the phases of the evolution.
+";
+
+%feature("docstring") Solver::enable_counters "
+
+Count the hardware events (cycles, instructions, last level cache misses and floating point operations) of the kernel
+phases of the following evolutions, through perf_event_open on Linux. Enabling the counters again clears them.
+
+Parameters
+----------
+* `enable` : bool,optional (default: True)
+    Whether to count the events.
+";
+
+%feature("docstring") Solver::get_counters "
+
+Get the hardware events of this process counted since `enable_counters`, with the derived metrics and a roofline
+estimate of the host (peak floating point throughput and memory bandwidth, measured at the first call).
+
+Returns
+-------
+* `get_counters` : dictionary
+    seconds, points (lattice point updates), cycles, instructions, llc_misses, fp_ops, ipc, bytes_per_point,
+    flops_per_point, arithmetic_intensity, gflop_per_s, gb_per_s, peak_gflop_per_s and peak_gb_per_s; the quantities
+    the host cannot measure are None. bound is compute or memory according to the roofline, unknown if the
+    arithmetic intensity cannot be measured.
+
+Example
+-------
+
+    >>> solver.enable_counters()
+    >>> solver.evolve(100)
+    >>> solver.get_counters()['bound']
+";
+
+%feature("docstring") Solver::get_comm_stats "
+
+Get the communication of this process since the construction of the solver or the last `reset_comm_stats`. The halo
+messages are counted per neighbour in the order up, down, left and right of the process grid; the left and right halos
+are exchanged first, then the up and down ones. Messages to the missing neighbours of a closed boundary are not counted.
+
+Returns
+-------
+* `get_comm_stats` : dictionary
+    bytes_sent, bytes_received, messages_sent and messages_received (one entry per neighbour), wait_seconds and
+    wait_calls (time blocked waiting for the left and right halos, and for the up and down halos), collective_seconds and
+    collective_calls (collective operations of the norms and of the observables).
+";
+
+%feature("docstring") Solver::reset_comm_stats "
+
+Restart the count of the communication.
+";
+
+%feature("docstring") Solver::get_comm_report "
+
+Get a summary of the halo volume, of the time waiting for the halos and of the time in collectives of each process,
+laid out over the process grid, with the ratio of the maximum to the average of each quantity. Under MPI, every process
+has to call it; the first process of the lattice gets the summary and the others an empty string.
+
+Returns
+-------
+* `get_comm_report` : string
+    Tables of the processes over the process grid.
+
+Example
+-------
+
+    >>> solver.evolve(1000)
+    >>> print(solver.get_comm_report())
+";
+
+%feature("docstring") Solver::get_memory_usage "
+
+Get the bytes allocated by the library on this process, now and at the peak since the start or the last
+`reset_memory_peaks`. The memory is shared by all the solvers and states of the process: the wave functions (states),
+the buffers of the kernels (kernel), the exponentials of the potentials (exp_potential), the potentials defined by a
+matrix (potential) and the scratch buffers of the steps and of the observables (temporary).
+
+Returns
+-------
+* `get_memory_usage` : dictionary
+    For each category and for the total, a dictionary with the current and the peak bytes, and the current bytes held
+    in the scratch files of `set_out_of_core` (mapped).
+";
+
+%feature("docstring") Solver::reset_memory_peaks "
+
+Restart the peaks of the memory usage from the bytes allocated now.
+";
+
+%feature("docstring") Solver::predict_memory "
+
+Predict the memory used on each process by a solver of the given configuration, before allocating it. The prediction is
+an upper bound for the largest tile of the lattice with periodic halos; potentials defined by a matrix are not counted.
+
+Parameters
+----------
+* `dim_x` : integer
+    Points of the lattice along the x axis.
+* `dim_y` : integer
+    Points of the lattice along the y axis.
+* `n_components` : integer,optional (default: 1)
+    Number of wave functions: 1, 2 for a two-component system, or the number of states evolved together.
+* `kernel_type` : string,optional (default: 'cpu')
+    Kernel of the solver: 'cpu', 'chebyshev' or 'spectral'.
+* `n_procs` : integer,optional (default: 1)
+    Number of MPI processes.
+* `rotating` : bool,optional (default: False)
+    Whether the frame of reference rotates, which widens the halos.
+* `kinetic_order` : integer,optional (default: 2)
+    Order of the kinetic operator, 2 or 4, which widens the halos.
+
+Returns
+-------
+* `predict_memory` : dictionary
+    For each category and for the total, a dictionary with the current and the peak bytes, which are equal.
+
+Example
+-------
+
+    >>> ts.Solver.predict_memory(4096, 4096, kernel_type='spectral', n_procs=16)['total']['peak']
+";
+
+%feature("docstring") Solver::get_state_energy "
+
+Get the total energy of one of the states evolved together.
+
+Parameters
+----------
+* `index` : integer
+    Index of the state in the list given to the constructor.
+
+Returns
+-------
+* `get_state_energy` : float
+    Total energy of the state.
+";
+
+%feature("docstring") Solver::set_orthogonalization_period "
+
+Orthogonalize the states evolved together every `period` imaginary time
+iterations. The norms of the states are restored at every iteration.
+
+Parameters
+----------
+* `period` : integer
+    Number of iterations between two orthogonalizations (default: 1).
+";
+
+%feature("docstring") Solver::set_halo_precision "
+
+Set the wire format of the halos exchanged between the MPI processes at every
+step; the wave functions stay in double precision. As floats, each message
+carries the change of the strip since the previous one, so that the rounding
+errors do not add up, and every `resync_period` steps the halos are exchanged
+in double precision again. Only the cpu kernel supports float halos.
+
+Parameters
+----------
+* `precision` : string
+    'double' (default) or 'float'.
+* `resync_period` : integer,optional (default: 16)
+    Number of steps between two exchanges in double precision.
+";
+
 %feature("docstring") Solver::get_potential_energy "
 
 Get the potential energy of the system.  
@@ -1189,6 +1599,38 @@ Returns
     Particle density of the state :math:`|\psi(x,y)|^2` 
 ";
 
+%feature("docstring") State::get_particle_density_into "
+
+Write the particle density into a preallocated array.
+
+Parameters
+----------
+* `density` : numpy matrix
+    C-contiguous float64 array with the shape of the inner region of the tile.
+";
+
+%feature("docstring") State::get_phase_into "
+
+Write the phase of the wave function into a preallocated array.
+
+Parameters
+----------
+* `phase` : numpy matrix
+    C-contiguous float64 array with the shape of the inner region of the tile.
+";
+
+%feature("docstring") Solver::use_external_exp_potential "
+
+Declare whether the exponential of the potential is written by the caller.
+
+Parameters
+----------
+* `external` : bool,optional (default: True)
+    If True, real time evolution uses the exponential of the potential as
+    written through `get_exp_potential_view` instead of recomputing it from
+    the Hamiltonian.
+";
+
 %feature("docstring") State::get_mean_y "
 
 Return the expected value of the :math:`Y` operator.
@@ -1513,3 +1955,59 @@ Defines the null potential function.
 
 // File: indexpage.xml
 
+%feature("docstring") set_out_of_core "
+
+Keep the large buffers in memory-mapped scratch files, for the lattices that do not fit in RAM. The states, solvers and
+potentials created afterwards are mapped from files of the scratch directory, which are deleted with them; the CPU kernel
+reads ahead the band after the one it evolves and lets the operating system evict the bands behind it.
+
+Parameters
+----------
+* `scratch_directory` : string
+    Directory of the scratch files, on a fast local disk; an empty string disables the mode.
+* `min_bytes` : integer,optional (default: 1048576)
+    Smallest buffer mapped from a file; the smaller ones stay in RAM.
+
+Example
+-------
+
+    >>> import trottersuzuki as ts
+    >>> ts.set_out_of_core('/scratch')
+    >>> grid = ts.Lattice2D(40000, 100.)
+";
+
+%feature("docstring") start_trace "
+
+Start recording a timeline of the evolutions: the phases of each step, the processing of the bands by the threads, the
+MPI waits, the norm computations and the file input and output. Available if the library was configured with
+--enable-tracing. Starting again discards the events recorded so far. Under MPI, every process has to call it.
+
+Parameters
+----------
+* `events_per_thread` : integer,optional (default: 65536)
+    Number of events kept by each thread; the oldest are overwritten when the buffer is full.
+";
+
+%feature("docstring") stop_trace "
+
+Stop recording the timeline; the events recorded so far are kept until `write_trace`.
+";
+
+%feature("docstring") write_trace "
+
+Write the timeline in the Chrome trace event format, which opens in chrome://tracing and Perfetto. Under MPI, every
+process has to call it and the first one writes the events of all of them, one process per rank.
+
+Parameters
+----------
+* `file_name` : string
+    Name of the JSON file.
+
+Example
+-------
+
+    >>> import trottersuzuki as ts
+    >>> ts.start_trace()
+    >>> solver.evolve(100)
+    >>> ts.write_trace('evolution.json')
+";
@@ -26,13 +26,18 @@ def map_lattice_to_coordinate_space(grid, x, y=None):
         x_c = grid.global_no_halo_dim_x * grid.delta_x * 0.5
         y_c = grid.global_no_halo_dim_y * grid.delta_y * 0.5
         idx = grid.start_x*grid.delta_x + 0.5*grid.delta_x + x*grid.delta_x
-        if idx - x_c < -grid.length_x*0.5:
+        # The lattice of an axis with a parity starts at the symmetry plane
+        if grid.parity_x != 0:
+            x_c = 0.
+        elif idx - x_c < -grid.length_x*0.5:
             idx += grid.length_x
-        if idx - x_c > grid.length_x*0.5:
+        elif idx - x_c > grid.length_x*0.5:
             idx -= grid.length_x
-        if idy - y_c < -grid.length_y*0.5:
+        if grid.parity_y != 0:
+            y_c = 0.
+        elif idy - y_c < -grid.length_y*0.5:
             idy += grid.length_y
-        if idy - y_c > grid.length_y*0.5:
+        elif idy - y_c > grid.length_y*0.5:
             idy -= grid.length_y
         if y is None:
             return idx - x_c
@@ -52,6 +57,98 @@ def map_lattice_to_coordinate_space(grid, x, y=None):
             return idx, idy - y_c
 
 
+def get_lattice_coordinate_mesh(grid):
+    """Get the coordinates of all the points of the local tile of the lattice,
+    halos included, as numpy meshes.
+
+    Parameters
+    ----------
+    * `grid`: Lattice object
+        Defines the topology.
+
+    Returns
+    -------
+    * `x_mesh`, `y_mesh` : numpy arrays
+        Coordinates of the points, both of shape (grid.dim_y, grid.dim_x).
+
+    Notes
+    -----
+    The mesh is the vectorized counterpart of
+    `map_lattice_to_coordinate_space`: on a single process without periodic
+    boundaries it coincides with the axes returned by `get_x_axis` and
+    `get_y_axis`, otherwise it also covers the tile offsets and the periodic
+    images in the halos.
+    """
+    x = np.arange(grid.dim_x, dtype=np.float64)
+    y = np.arange(grid.dim_y, dtype=np.float64)
+    idy = grid.start_y*grid.delta_y + 0.5*grid.delta_y + y*grid.delta_y
+    y_c = grid.global_no_halo_dim_y * grid.delta_y * 0.5
+    if grid.coordinate_system == "cartesian" and grid.parity_y != 0:
+        # The lattice of an axis with a parity starts at the symmetry plane
+        y_c = 0.
+    else:
+        idy = np.where(idy - y_c < -grid.length_y*0.5, idy + grid.length_y,
+                       idy)
+        idy = np.where(idy - y_c > grid.length_y*0.5, idy - grid.length_y,
+                       idy)
+    y_axis = idy - y_c
+    if grid.coordinate_system == "cylindrical":
+        x_axis = grid.delta_x * (grid.start_x - 0.5 + x)
+    else:
+        idx = grid.start_x*grid.delta_x + 0.5*grid.delta_x + x*grid.delta_x
+        x_c = grid.global_no_halo_dim_x * grid.delta_x * 0.5
+        if grid.parity_x != 0:
+            x_c = 0.
+        else:
+            idx = np.where(idx - x_c < -grid.length_x*0.5,
+                           idx + grid.length_x, idx)
+            idx = np.where(idx - x_c > grid.length_x*0.5,
+                           idx - grid.length_x, idx)
+        x_axis = idx - x_c
+    return np.meshgrid(x_axis, y_axis)
+
+
+def evaluate_on_lattice(grid, function):
+    """Evaluate a function of the coordinates on every point of the local
+    tile of the lattice.
+
+    Parameters
+    ----------
+    * `grid`: Lattice object
+        Defines the topology.
+    * `function` : python function
+        Function of (x) or (x, y).
+
+    Returns
+    -------
+    * `values` : numpy array
+        Complex matrix of shape (grid.dim_y, grid.dim_x).
+
+    Notes
+    -----
+    The function is first called once on the whole coordinate meshes. If it
+    does not accept numpy arrays (for instance because it relies on the math
+    module or on branching), it is evaluated point by point instead.
+    """
+    x_mesh, y_mesh = get_lattice_coordinate_mesh(grid)
+    try:
+        function(0)
+
+        def _function(x, y):
+            return function(x)
+    except TypeError:
+        _function = function
+
+    try:
+        values = np.asarray(_function(x_mesh, y_mesh), dtype=np.complex128)
+        return np.array(np.broadcast_to(values, x_mesh.shape))
+    except Exception:
+        values = np.zeros(x_mesh.shape, dtype=np.complex128)
+        for index in np.ndindex(x_mesh.shape):
+            values[index] = _function(x_mesh[index], y_mesh[index])
+        return values
+
+
 def imprint(state, function):
     """Multiply the wave function of the state by the function provided.
 
@@ -83,22 +180,13 @@ def imprint(state, function):
         >>> state = ts.GaussianState(grid, 1.)  # Create the system's state
         >>> state.imprint(vortex)  # Imprint a vortex on the state
     """
-    try:
-        function(0)
-
-        def _function(x, y):
-            return function(x)
-    except TypeError:
-        _function = function
-
-    matrix = np.zeros((state.grid.dim_y, state.grid.dim_x),
-                      dtype=np.complex128)
-
-    for y in range(state.grid.dim_y):
-        for x in range(state.grid.dim_x):
-            matrix[y, x] = _function(*map_lattice_to_coordinate_space(state.grid, x, y))
-
-    state.imprint_matrix(matrix.real, matrix.imag)
+    matrix = evaluate_on_lattice(state.grid, function)
+    p_real = state.get_tile_real()
+    p_imag = state.get_tile_imag()
+    psi = matrix * (p_real + 1j * p_imag)
+    p_real[...] = psi.real
+    p_imag[...] = psi.imag
+    state.expected_values_updated = False
 
 
 def get_vortex_position(grid, state, approx_cloud_radius=0.):
@@ -13,6 +13,49 @@
 import_array();
 %}
 
+%{
+/* Wrap memory owned by a C++ object into a writable numpy array. The array
+   holds a reference to the Python owner, so the memory outlives the view. */
+static PyObject *owned_view(PyObject *owner, double *data, int rows, int cols, int row_stride) {
+    if (data == NULL) {
+        Py_RETURN_NONE;
+    }
+    npy_intp dims[2] = {rows, cols};
+    npy_intp strides[2] = {(npy_intp)row_stride * (npy_intp)sizeof(double), (npy_intp)sizeof(double)};
+    PyObject *array = PyArray_New(&PyArray_Type, 2, dims, NPY_DOUBLE, strides, data, 0,
+                                  NPY_ARRAY_WRITEABLE | NPY_ARRAY_ALIGNED, NULL);
+    if (array == NULL) {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    if (PyArray_SetBaseObject((PyArrayObject *)array, owner) < 0) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    return array;
+}
+
+static PyObject *owned_tile_view(PyObject *owner, Lattice *grid, double *data, bool with_halos) {
+    if (with_halos || data == NULL) {
+        return owned_view(owner, data, grid->dim_y, grid->dim_x, grid->dim_x);
+    }
+    return owned_view(owner, data + (grid->inner_start_y - grid->start_y) * grid->dim_x + grid->inner_start_x - grid->start_x,
+                      grid->inner_end_y - grid->inner_start_y, grid->inner_end_x - grid->inner_start_x, grid->dim_x);
+}
+
+/* Dictionary category -> {"current": bytes, "peak": bytes, "mapped": bytes} of a memory usage. */
+static PyObject *memory_usage_dict(const std::vector<MemoryUsage> &usage) {
+    PyObject *result = PyDict_New();
+    for (size_t i = 0; i < usage.size(); i++) {
+        PyObject *bytes = Py_BuildValue("{s:d,s:d,s:d}", "current", usage[i].current_bytes, "peak", usage[i].peak_bytes,
+                                        "mapped", usage[i].mapped_bytes);
+        PyDict_SetItemString(result, usage[i].category.c_str(), bytes);
+        Py_DECREF(bytes);
+    }
+    return result;
+}
+%}
+
 %apply (double* IN_ARRAY2, int DIM1, int DIM2) {(double* state_real, int state_real_width, int state_real_height)}
 %apply (double* IN_ARRAY2, int DIM1, int DIM2) {(double* state_imag, int state_imag_width, int state_imag_height)}
 %apply (double* IN_ARRAY2, int DIM1, int DIM2) {(double* _potential, int _potential_width, int _potential_height)}
@@ -20,11 +63,137 @@ import_array();
 %apply (double* IN_ARRAY1, int DIM1) {(double* exp_pot_imag, int exp_pot_imag_length)}
 %apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double* p_real, int p_r_width, int p_r_height)}
 %apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double* p_imag, int p_i_width, int p_i_height)}
+%apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double *density_inout, int de_dim1_in, int de_dim2_in)}
+%apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double *phase_inout, int ph_dim1_in, int ph_dim2_in)}
 %apply (double** ARGOUTVIEWM_ARRAY2, int* DIM1, int* DIM2) {(double **density_out, int *de_dim1_out, int *de_dim2_out)}
 %apply (double** ARGOUTVIEWM_ARRAY2, int* DIM1, int* DIM2) {(double **phase_out, int *ph_dim1_out, int *ph_dim2_out)}
+%apply (double* IN_ARRAY1, int DIM1) {(double *times, int n_times)}
+%apply (double* IN_ARRAY1, int DIM1) {(double *values, int n_values)}
 %apply const std::string& {std::string* coordinate_system};
 %apply const std::string& {std::string* _operator};
 
+/* A Python sequence of State objects, for the solver evolving several states together. */
+%typemap(in) (State **states, int n_states) {
+   if (!PySequence_Check($input)) {
+      PyErr_SetString(PyExc_TypeError, "Expected a sequence of State objects");
+      SWIG_fail;
+   }
+   $2 = (int)PySequence_Length($input);
+   $1 = new State*[$2];
+   for (int i = 0; i < $2; i++) {
+      PyObject *item = PySequence_GetItem($input, i);
+      void *ptr = NULL;
+      int res = SWIG_ConvertPtr(item, &ptr, SWIGTYPE_p_State, 0);
+      Py_DECREF(item);
+      if (!SWIG_IsOK(res)) {
+         delete [] $1;
+         $1 = NULL;
+         PyErr_SetString(PyExc_TypeError, "Expected a sequence of State objects");
+         SWIG_fail;
+      }
+      $1[i] = reinterpret_cast<State*>(ptr);
+   }
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER) (State **states, int n_states) {
+   $1 = PySequence_Check($input) ? 1 : 0;
+}
+%typemap(freearg) (State **states, int n_states) {
+   delete [] $1;
+}
+
+/* Evolution and observables run without the GIL, so that other Python
+   threads (and other solvers) make progress in the meantime. */
+%define RELEASE_GIL(function)
+%exception function {
+   std::string error_message;
+   bool failed = false;
+   Py_BEGIN_ALLOW_THREADS
+   try {
+      $action
+   } catch (runtime_error &e) {
+      failed = true;
+      error_message = e.what();
+   }
+   Py_END_ALLOW_THREADS
+   if (failed) {
+      PyErr_SetString(PyExc_RuntimeError, error_message.c_str());
+      return NULL;
+   }
+}
+%enddef
+
+RELEASE_GIL(Solver::evolve)
+RELEASE_GIL(Solver::get_total_energy)
+RELEASE_GIL(Solver::get_squared_norm)
+RELEASE_GIL(Solver::get_kinetic_energy)
+RELEASE_GIL(Solver::get_potential_energy)
+RELEASE_GIL(Solver::get_rotational_energy)
+RELEASE_GIL(Solver::get_intra_species_energy)
+RELEASE_GIL(Solver::get_LeeHuangYang_energy)
+RELEASE_GIL(Solver::get_inter_species_energy)
+RELEASE_GIL(Solver::get_rabi_energy)
+RELEASE_GIL(Solver::get_state_energy)
+RELEASE_GIL(State::get_expected_value)
+RELEASE_GIL(State::get_squared_norm)
+RELEASE_GIL(State::get_particle_density)
+RELEASE_GIL(State::get_phase)
+RELEASE_GIL(State::get_particle_density_into)
+RELEASE_GIL(State::get_phase_into)
+
+%exception Hamiltonian::set_schedule {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
+%exception Solver::get_counters {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
+%exception Solver::set_halo_precision {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
+%exception set_out_of_core {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
+%exception start_trace {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
+%exception write_trace {
+   try {
+      $action
+   } catch (runtime_error &e) {
+      PyErr_SetString(PyExc_RuntimeError, const_cast<char*>(e.what()));
+      return NULL;
+   }
+}
+
 %exception Solver::init_kernel {
    try {
       $action
@@ -42,11 +211,15 @@ public:
     int global_no_halo_dim_x, global_no_halo_dim_y;
     int start_x, start_y;
     std::string coordinate_system;
+    int kinetic_order;
+    int parity_x, parity_y;
+    int symmetry_factor() const;
 };
 
 class Lattice1D: public Lattice {
 public:
-    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian", int kinetic_order=2,
+              int parity_x=0);
 };
 
 
@@ -54,7 +227,8 @@ class Lattice2D: public Lattice {
 public:
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis=false, bool periodic_y_axis=false,
-              double angular_velocity=0., std::string coordinate_system="cartesian");
+              double angular_velocity=0., std::string coordinate_system="cartesian", int kinetic_order=2,
+              int parity_x=0, int parity_y=0);
 };
 
 class State{
@@ -77,6 +251,27 @@ public:
             }
         }
     }
+    %extend {
+        PyObject *_buffer_view(PyObject *owner, bool imag_part, bool with_halos) {
+            return owned_tile_view(owner, self->grid, imag_part ? self->p_imag : self->p_real, with_halos);
+        }
+    }
+    %pythoncode %{
+    p_real = property(lambda self: self._buffer_view(self, False, False),
+                      doc="Writable view of the real part of the wave function (inner region of the tile).")
+    p_imag = property(lambda self: self._buffer_view(self, True, False),
+                      doc="Writable view of the imaginary part of the wave function (inner region of the tile).")
+
+    def get_tile_real(self):
+        """Writable view of the real part of the wave function on the whole
+        tile, halos included. It shares memory with the state."""
+        return self._buffer_view(self, False, True)
+
+    def get_tile_imag(self):
+        """Writable view of the imaginary part of the wave function on the
+        whole tile, halos included. It shares memory with the state."""
+        return self._buffer_view(self, True, True)
+    %}
     void loadtxt(char *file_name /**< [in] Name of the file. */);
     %extend {
         void imprint_matrix(double* state_real, int state_real_width, int state_real_height,
@@ -98,8 +293,7 @@ public:
             double *_density;
             _density = self->get_particle_density();
         end:
-           *de_dim1_out = self->grid->inner_end_y - self->grid->inner_start_y;
-           *de_dim2_out = self->grid->inner_end_x - self->grid->inner_start_x;
+           self->grid->get_snapshot_dims(de_dim2_out, de_dim1_out);
            *density_out = _density;
 	    }
     }
@@ -108,11 +302,30 @@ public:
             double *_phase;
             _phase = self->get_phase();
         end:
-           *ph_dim1_out = self->grid->global_no_halo_dim_y;
-           *ph_dim2_out = self->grid->global_no_halo_dim_x;
+           self->grid->get_snapshot_dims(ph_dim2_out, ph_dim1_out);
            *phase_out = _phase;
         }
     }
+    %extend {
+        void get_particle_density_into(double *density_inout, int de_dim1_in, int de_dim2_in) {
+            int width, height;
+            self->grid->get_snapshot_dims(&width, &height);
+            if (de_dim1_in != height || de_dim2_in != width) {
+                throw runtime_error("The output array does not match the inner region of the tile");
+            }
+            self->get_particle_density(density_inout);
+        }
+    }
+    %extend {
+        void get_phase_into(double *phase_inout, int ph_dim1_in, int ph_dim2_in) {
+            int width, height;
+            self->grid->get_snapshot_dims(&width, &height);
+            if (ph_dim1_in != height || ph_dim2_in != width) {
+                throw runtime_error("The output array does not match the inner region of the tile");
+            }
+            self->get_phase(phase_inout);
+        }
+    }
     double get_expected_value(std::string _operator);
     double get_squared_norm(void);
     double get_mean_x(void);
@@ -214,7 +427,19 @@ public:
             }
         }
     }
+    %extend {
+        PyObject *_buffer_view(PyObject *owner) {
+            return owned_tile_view(owner, self->grid, self->matrix, true);
+        }
+    }
+    %pythoncode %{
+    def get_tile_matrix(self):
+        """Writable view of the potential matrix on the whole tile, halos
+        included, or None if the potential is defined by a function."""
+        return self._buffer_view(self)
+    %}
     virtual double get_value(int x, int y);
+    virtual double get_value_at(double x, double y);
     bool update(double t);
     bool updated_potential_matrix;
 protected:
@@ -231,6 +456,7 @@ public:
     HarmonicPotential(Lattice2D *_grid, double _omegax, double _omegay, double _mass=1., double _mean_x = 0., double _mean_y = 0.);
     ~HarmonicPotential();
     double get_value(int x, int y);
+    double get_value_at(double x, double y);
 
 private:
     double omegax, omegay;
@@ -247,10 +473,25 @@ public:
     double angular_velocity;
     double rot_coord_x;
     double rot_coord_y;
+    double absorbing_width;
+    double absorbing_strength;
+    int absorbing_power;
     Hamiltonian(Lattice *_grid, Potential *_potential=0, double _mass=1., double _coupling_a=0., double LeeHuangYang_coupling_a = 0.,
                 double _angular_velocity=0.,
                 double _rot_coord_x=0, double _rot_coord_y=0);
     ~Hamiltonian();
+    %extend {
+        void set_schedule(std::string parameter, double *times, int n_times, double *values, int n_values) {
+            if (n_times != n_values) {
+                throw runtime_error("The times and the values of the schedule must have the same length");
+            }
+            self->set_schedule(parameter, times, values, n_times);
+        }
+    }
+    void remove_schedule(std::string parameter);
+    bool has_schedule(std::string parameter);
+    void set_absorbing_layer(double width, double strength, int power=2);
+    bool has_absorbing_layer(void);
 
 protected:
     bool self_init;
@@ -291,6 +532,8 @@ public:
     Solver(Lattice *grid, State *state1, State *state2,
            Hamiltonian2Component *hamiltonian,
            double delta_t, std::string kernel_type="cpu");
+    Solver(Lattice *grid, State **states, int n_states, Hamiltonian *hamiltonian,
+           double delta_t, std::string kernel_type="cpu");
     ~Solver();
     void evolve(int iterations, bool imag_time=false);
     void update_parameters();
@@ -303,8 +546,96 @@ public:
     double get_LeeHuangYang_energy(void);
     double get_inter_species_energy(void);
     double get_rabi_energy(void);
+    double get_absorbed_norm(void);
     void set_exp_potential(double *exp_pot_real, int exp_pot_real_length, double *exp_pot_imag,
                            int exp_pot_imag_length, int which);
+    void use_external_exp_potential(bool external=true);
+    void apply_absorbing_layer(int which=0);
+    %extend {
+        PyObject *_exp_potential_view(PyObject *owner, int which, bool imag_part) {
+            if (which < 0 || which > 1 || self->get_exp_potential_real(which) == NULL) {
+                PyErr_SetString(PyExc_ValueError, "No such component");
+                return NULL;
+            }
+            return owned_tile_view(owner, self->grid, imag_part ? self->get_exp_potential_imag(which) : self->get_exp_potential_real(which), true);
+        }
+    }
+    %pythoncode %{
+    def get_exp_potential_view(self, which=0):
+        """Writable views (real part, imaginary part) of the exponential of
+        the potential of a component (0 or 1) on the whole tile. Call
+        `use_external_exp_potential` before writing into them."""
+        return (self._exp_potential_view(self, which, False),
+                self._exp_potential_view(self, which, True))
+    %}
+    void set_num_threads(int num_threads);
+    int get_num_threads(void);
+    double get_state_energy(int index);
+    std::string get_kernel_name(void);
+    void set_orthogonalization_period(int period);
+    void set_halo_precision(std::string precision, int resync_period=16);
+    %extend {
+        PyObject *get_timings(void) {
+            std::vector<PhaseTiming> timings = self->get_timings();
+            PyObject *result = PyDict_New();
+            for (size_t i = 0; i < timings.size(); i++) {
+                PyObject *timing = Py_BuildValue("{s:l,s:d,s:d,s:d,s:d}", "calls", timings[i].calls,
+                                                 "seconds", timings[i].seconds, "min", timings[i].min_seconds,
+                                                 "max", timings[i].max_seconds, "avg", timings[i].avg_seconds);
+                PyDict_SetItemString(result, timings[i].phase.c_str(), timing);
+                Py_DECREF(timing);
+            }
+            return result;
+        }
+    }
+    void reset_timings(void);
+    void enable_counters(bool enable=true);
+    %extend {
+        PyObject *get_counters(void) {
+            KernelCounters counters = self->get_counters();
+            const char *names[14] = {"seconds", "points", "cycles", "instructions", "llc_misses", "fp_ops", "ipc", "bytes_per_point",
+                                     "flops_per_point", "arithmetic_intensity", "gflop_per_s", "gb_per_s", "peak_gflop_per_s", "peak_gb_per_s"};
+            double values[14] = {counters.seconds, counters.points, counters.cycles, counters.instructions, counters.llc_misses, counters.fp_ops, counters.ipc,
+                                 counters.bytes_per_point, counters.flops_per_point, counters.arithmetic_intensity, counters.gflop_per_s, counters.gb_per_s,
+                                 counters.peak_gflop_per_s, counters.peak_gb_per_s};
+            PyObject *result = PyDict_New();
+            for (int i = 0; i < 14; i++) {
+                // The quantities the host cannot measure are None
+                PyObject *value = values[i] < 0. ? Py_BuildValue("") : PyFloat_FromDouble(values[i]);
+                PyDict_SetItemString(result, names[i], value);
+                Py_DECREF(value);
+            }
+            PyObject *bound = PyUnicode_FromString(counters.bound.c_str());
+            PyDict_SetItemString(result, "bound", bound);
+            Py_DECREF(bound);
+            return result;
+        }
+    }
+    %extend {
+        PyObject *get_comm_stats(void) {
+            CommStats stats = self->get_comm_stats();
+            return Py_BuildValue("{s:(dddd),s:(dddd),s:(llll),s:(llll),s:(dd),s:(ll),s:d,s:l}",
+                                 "bytes_sent", stats.bytes_sent[0], stats.bytes_sent[1], stats.bytes_sent[2], stats.bytes_sent[3],
+                                 "bytes_received", stats.bytes_received[0], stats.bytes_received[1], stats.bytes_received[2], stats.bytes_received[3],
+                                 "messages_sent", stats.messages_sent[0], stats.messages_sent[1], stats.messages_sent[2], stats.messages_sent[3],
+                                 "messages_received", stats.messages_received[0], stats.messages_received[1], stats.messages_received[2], stats.messages_received[3],
+                                 "wait_seconds", stats.wait_seconds[0], stats.wait_seconds[1], "wait_calls", stats.wait_calls[0], stats.wait_calls[1],
+                                 "collective_seconds", stats.collective_seconds, "collective_calls", stats.collective_calls);
+        }
+    }
+    void reset_comm_stats(void);
+    std::string get_comm_report(void);
+    %extend {
+        PyObject *get_memory_usage(void) {
+            return memory_usage_dict(self->get_memory_usage());
+        }
+        static PyObject *predict_memory(int dim_x, int dim_y, int n_components=1, std::string kernel_type="cpu", int n_procs=1,
+                                        bool rotating=false, int kinetic_order=2) {
+            return memory_usage_dict(Solver::predict_memory(dim_x, dim_y, n_components, kernel_type, n_procs, rotating,
+                                                            kinetic_order));
+        }
+    }
+    void reset_memory_peaks(void);
 private:
     bool imag_time;
     double **external_pot_real;
@@ -312,7 +643,14 @@ private:
     double delta_t;
     double norm2[2];
     bool single_component;
+    State **states;
+    int n_states;
+    double *states_norm2;
+    int orthogonalization_period;
+    std::string halo_precision;
+    int halo_resync_period;
     std::string kernel_type;
+    std::string kernel_name;
     void initialize_exp_potential(double time_single_it, int which);
     void init_kernel();
     double total_energy;
@@ -331,3 +669,45 @@ private:
     bool energy_expected_values_updated;
     void calculate_energy_expected_values(void);
 };
+
+void set_out_of_core(std::string scratch_directory, size_t min_bytes=1048576);
+void start_trace(size_t events_per_thread=65536);
+void stop_trace(void);
+void write_trace(std::string file_name);
+
+%inline %{
+PyObject *_multilevel_ground_state(Lattice2D *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
+                                   int levels, double tolerance, int check_period, int max_iterations, std::string kernel_type) {
+    std::vector<int> iterations;
+    std::string error_message;
+    bool failed = false;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        iterations = multilevel_ground_state(grid, state, hamiltonian, delta_t, levels, tolerance, check_period, max_iterations, kernel_type);
+    } catch (runtime_error &e) {
+        failed = true;
+        error_message = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        PyErr_SetString(PyExc_RuntimeError, error_message.c_str());
+        return NULL;
+    }
+    PyObject *result = PyList_New(iterations.size());
+    for (size_t i = 0; i < iterations.size(); i++) {
+        PyList_SET_ITEM(result, i, PyLong_FromLong(iterations[i]));
+    }
+    return result;
+}
+%}
+
+%pythoncode %{
+def multilevel_ground_state(grid, state, hamiltonian, delta_t, levels=3, tolerance=1.e-9,
+                            check_period=100, max_iterations=100000, kernel_type="cpu"):
+    """Find the ground state by imaginary time evolution on successively
+    finer lattices, from a lattice coarser than `grid` by 2**(levels-1)
+    down to `grid`. The state is overwritten by the ground state; the
+    number of iterations run on each level, coarsest first, is returned."""
+    return _multilevel_ground_state(grid, state, hamiltonian, delta_t, levels, tolerance,
+                                    check_period, max_iterations, kernel_type)
+%}
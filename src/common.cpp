@@ -26,13 +26,17 @@ void map_lattice_to_coordinate_space(Lattice *grid, int x_in, double *x_out) {
     if (grid->coordinate_system == "cartesian") {
         double idx = grid->start_x * grid->delta_x + 0.5 * grid->delta_x + x_in * grid->delta_x;
         double x_c = grid->global_no_halo_dim_x * grid->delta_x * 0.5;
-        if (idx - x_c < -grid->length_x * 0.5) {
+        // The lattice of an axis with a parity starts at the symmetry plane
+        if (grid->parity_x != 0) {
+            x_c = 0.;
+        }
+        else if (idx - x_c < -grid->length_x * 0.5) {
             idx += grid->length_x;
         }
-        if (idx - x_c > grid->length_x * 0.5) {
+        else if (idx - x_c > grid->length_x * 0.5) {
             idx -= grid->length_x;
         }
-        *x_out = idx - x_c;
+        *x_out = idx - x_c + grid->origin_x;
     }
 
     // By convention the radial axis is the x axis.
@@ -48,20 +52,27 @@ void map_lattice_to_coordinate_space(Lattice *grid, int x_in, int y_in, double *
         double idx = grid->start_x * grid->delta_x + 0.5 * grid->delta_x + x_in * grid->delta_x;
         double x_c = grid->global_no_halo_dim_x * grid->delta_x * 0.5;
         double y_c = grid->global_no_halo_dim_y * grid->delta_y * 0.5;
-        if (idx - x_c < -grid->length_x * 0.5) {
+        // The lattice of an axis with a parity starts at the symmetry plane
+        if (grid->parity_x != 0) {
+            x_c = 0.;
+        }
+        else if (idx - x_c < -grid->length_x * 0.5) {
             idx += grid->length_x;
         }
-        if (idx - x_c > grid->length_x * 0.5) {
+        else if (idx - x_c > grid->length_x * 0.5) {
             idx -= grid->length_x;
         }
-        if (idy - y_c < -grid->length_y * 0.5) {
+        if (grid->parity_y != 0) {
+            y_c = 0.;
+        }
+        else if (idy - y_c < -grid->length_y * 0.5) {
             idy += grid->length_y;
         }
-        if (idy - y_c > grid->length_y * 0.5) {
+        else if (idy - y_c > grid->length_y * 0.5) {
             idy -= grid->length_y;
         }
-        *x_out = idx - x_c;
-        *y_out = idy - y_c;
+        *x_out = idx - x_c + grid->origin_x;
+        *y_out = idy - y_c + grid->origin_y;
     }
 
     // By convention the radial axis is the x axis.
@@ -76,8 +87,67 @@ void map_lattice_to_coordinate_space(Lattice *grid, int x_in, int y_in, double *
             idy -= grid->length_y;
         }
         *x_out = idx;
-        *y_out = idy - y_c;
+        *y_out = idy - y_c + grid->origin_y;
+    }
+}
+
+void fill_mirror_halos(double *p_real, double *p_imag, size_t tile_width, size_t tile_height, size_t halo_x, size_t halo_y, int parity_x, int parity_y) {
+    // The point at distance d from the symmetry plane, on the negative side, is the image of the one at distance d on the positive side
+    if (parity_x != 0) {
+        for (size_t y = 0; y < tile_height; y++) {
+            for (size_t x = 0; x < halo_x; x++) {
+                p_real[y * tile_width + x] = parity_x * p_real[y * tile_width + 2 * halo_x - 1 - x];
+                p_imag[y * tile_width + x] = parity_x * p_imag[y * tile_width + 2 * halo_x - 1 - x];
+            }
+        }
+    }
+    if (parity_y != 0) {
+        for (size_t y = 0; y < halo_y; y++) {
+            for (size_t x = 0; x < tile_width; x++) {
+                p_real[y * tile_width + x] = parity_y * p_real[(2 * halo_y - 1 - y) * tile_width + x];
+                p_imag[y * tile_width + x] = parity_y * p_imag[(2 * halo_y - 1 - y) * tile_width + x];
+            }
+        }
+    }
+}
+
+void fill_mirror_halos(Lattice *grid, double *p_real, double *p_imag) {
+    fill_mirror_halos(p_real, p_imag, grid->dim_x, grid->dim_y, grid->halo_x, grid->halo_y,
+                      grid->start_x < 0 ? grid->parity_x : 0, grid->start_y < 0 ? grid->parity_y : 0);
+}
+
+int map_snapshot_to_tile(Lattice *grid, int x, int y, int *sign) {
+    int width = grid->inner_end_x - grid->inner_start_x;
+    int height = grid->inner_end_y - grid->inner_start_y;
+    *sign = 1;
+    // The first half of an unfolded axis is the mirror image of the tile
+    if (grid->mpi_procs == 1 && grid->parity_x != 0) {
+        if (x < width) {
+            x = width - 1 - x;
+            *sign *= grid->parity_x;
+        }
+        else {
+            x -= width;
+        }
+    }
+    if (grid->mpi_procs == 1 && grid->parity_y != 0) {
+        if (y < height) {
+            y = height - 1 - y;
+            *sign *= grid->parity_y;
+        }
+        else {
+            y -= height;
+        }
     }
+    return (y + grid->inner_start_y - grid->start_y) * grid->dim_x + x + grid->inner_start_x - grid->start_x;
+}
+
+/**
+ * Width of the halos: the kinetic operator of order 4 couples next-nearest neighbours, so that
+ * its four extra sweeps per step reach eight more points, and a rotating frame needs four more.
+ */
+int lattice_halo(double angular_velocity, int kinetic_order) {
+    return (angular_velocity == 0. ? 4 : 8) + (kinetic_order == 4 ? 8 : 0);
 }
 
 void calculate_borders(int coord, int dim, int * start, int *end, int *inner_start, int *inner_end, int length, int halo, int periodic_bound) {
@@ -191,6 +261,7 @@ void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size
 }
 
 void stamp(Lattice *grid, State *state, string fileprefix) {
+    TRACE_SCOPE("write_file");
 #ifdef HAVE_MPI
     // Set variables for mpi output
     char *data_as_txt;
@@ -211,7 +282,7 @@ void stamp(Lattice *grid, State *state, string fileprefix) {
     MPI_Type_commit(&num_as_string);
 
     // create a type describing our piece of the array
-    int globalsizes[2] = {grid->global_dim_y - 2 * grid->periods[0] * grid->halo_y, grid->global_dim_x - 2 * grid->periods[1] * grid->halo_x};
+    int globalsizes[2] = {grid->global_no_halo_dim_y, grid->global_no_halo_dim_x};
     int localsizes [2] = {grid->inner_end_y - grid->inner_start_y, grid->inner_end_x - grid->inner_start_x};
     int starts[2]      = {grid->inner_start_y, grid->inner_start_x};
     int order          = MPI_ORDER_C;
@@ -258,6 +329,24 @@ void stamp(Lattice *grid, State *state, string fileprefix) {
     stringstream output_filename;
     output_filename.str("");
     output_filename << fileprefix;
+    if (grid->parity_x != 0 || grid->parity_y != 0) {
+        // The file holds the full domain
+        int width, height, sign;
+        grid->get_snapshot_dims(&width, &height);
+        double *snapshot_real = allocate_tracked(width * height, MEMORY_TEMPORARY);
+        double *snapshot_imag = allocate_tracked(width * height, MEMORY_TEMPORARY);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int index = map_snapshot_to_tile(grid, x, y, &sign);
+                snapshot_real[y * width + x] = sign * state->p_real[index];
+                snapshot_imag[y * width + x] = sign * state->p_imag[index];
+            }
+        }
+        print_complex_matrix(output_filename.str().c_str(), snapshot_real, snapshot_imag, width, width, height);
+        free_tracked(snapshot_real);
+        free_tracked(snapshot_imag);
+        return;
+    }
     print_complex_matrix(output_filename.str().c_str(), &(state->p_real[grid->global_dim_x * (grid->inner_start_y - grid->start_y) + grid->inner_start_x - grid->start_x]), &(state->p_imag[grid->global_dim_x * (grid->inner_start_y - grid->start_y) + grid->inner_start_x - grid->start_x]), grid->global_dim_x,
                          grid->global_dim_x - 2 * grid->periods[1]*grid->halo_x, grid->global_dim_y - 2 * grid->periods[0]*grid->halo_y);
 #endif
@@ -265,6 +354,7 @@ void stamp(Lattice *grid, State *state, string fileprefix) {
 }
 
 void stamp_matrix(Lattice *grid, double *matrix, string filename) {
+    TRACE_SCOPE("write_file");
 
 #ifdef HAVE_MPI
     // Set variables for mpi output
@@ -281,7 +371,7 @@ void stamp_matrix(Lattice *grid, double *matrix, string filename) {
     MPI_Type_commit(&num_as_string);
 
     // create a type describing our piece of the array
-    int globalsizes[2] = {grid->global_dim_y - 2 * grid->periods[0] * grid->halo_y, grid->global_dim_x - 2 * grid->periods[1] * grid->halo_x};
+    int globalsizes[2] = {grid->global_no_halo_dim_y, grid->global_no_halo_dim_x};
     int localsizes [2] = {grid->inner_end_y - grid->inner_start_y, grid->inner_end_x - grid->inner_start_x};
     int starts[2]      = {grid->inner_start_y, grid->inner_start_x};
     int order          = MPI_ORDER_C;
@@ -320,8 +410,8 @@ void stamp_matrix(Lattice *grid, double *matrix, string filename) {
     MPI_File_close(&file);
     delete [] data_as_txt;
 #else
-    print_matrix(filename.c_str(), &(matrix[grid->global_dim_x * (grid->inner_start_y - grid->start_y) + grid->inner_start_x - grid->start_x]), grid->global_dim_x,
-                 grid->global_dim_x - 2 * grid->periods[1]*grid->halo_x, grid->global_dim_y - 2 * grid->periods[0]*grid->halo_y);
+    print_matrix(filename.c_str(), &(matrix[grid->dim_x * (grid->inner_start_y - grid->start_y) + grid->inner_start_x - grid->start_x]), grid->dim_x,
+                 grid->global_no_halo_dim_x, grid->global_no_halo_dim_y);
 #endif
     return;
 }
@@ -25,9 +25,60 @@ void print_matrix(string filename, double * matrix, size_t stride, size_t width,
 void stamp(Lattice *grid, State *state, string fileprefix);
 void stamp_matrix(Lattice *grid, double *matrix, string filename);
 
+/** Mirror halos at the symmetry planes of the axes with a parity: the halo_x first columns (halo_y first rows) of the tile get the
+ *  images of the following ones, times parity_x (parity_y); an axis with a null parity is left untouched.
+ */
+void fill_mirror_halos(double *p_real, double *p_imag, size_t tile_width, size_t tile_height, size_t halo_x, size_t halo_y, int parity_x, int parity_y);
+void fill_mirror_halos(Lattice *grid, double *p_real, double *p_imag);    ///< Fill the mirror halos of a wave function defined on the tile of the lattice.
+int map_snapshot_to_tile(Lattice *grid, int x, int y, int *sign);    ///< Tile index of the point (x, y) of a snapshot (Lattice::get_snapshot_dims) and the sign of the wave function there with respect to it.
+int lattice_halo(double angular_velocity, int kinetic_order);    ///< Width of the halos of the tiles for a frame rotating at angular_velocity and a kinetic operator of the given order.
 void calculate_borders(int coord, int dim, int * start, int *end, int *inner_start, int *inner_end, int length, int halo, int periodic_bound);
 void my_abort(string err);
 void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height);
 double bessel_j_zeros(int l, int x);
 
+/** Tracked allocations: the bytes allocated now and at the peak are counted per category for the whole process.
+ *  A tracked buffer must be released with free_tracked; memory held by containers is declared with track_memory.
+ */
+double *allocate_tracked(size_t count, MemoryCategory category);    ///< Allocate count doubles, not initialized.
+void free_tracked(double *buffer);    ///< Release a tracked buffer; NULL is ignored.
+void track_memory(long bytes, MemoryCategory category);    ///< Account for bytes allocated (positive) or released (negative) elsewhere.
+vector<MemoryUsage> get_tracked_memory(void);    ///< Current and peak bytes per category, followed by the total.
+void reset_tracked_peaks(void);    ///< Restart the peaks from the current bytes.
+vector<MemoryUsage> make_memory_usage(const double *bytes);    ///< Usage table of MEMORY_CATEGORIES byte counts, followed by their total.
+void prefetch_tracked(const double *buffer, size_t offset, size_t count);    ///< Start reading count doubles from offset of a buffer mapped by the out-of-core mode; ignored for the other buffers.
+void release_tracked(const double *buffer, size_t offset, size_t count);    ///< Let the out-of-core mode write back and evict count doubles from offset of a mapped buffer; ignored for the other buffers.
+
+/** Timeline of the activity of the threads and processes, written as Chrome trace JSON by write_trace.
+ *  TRACE_SCOPE(name) records the span from its declaration to the end of the enclosing scope, and
+ *  TRACE_EVENT(name, start, end) a span measured with trace_time; name must be a string literal.
+ *  Both vanish unless the library is configured with --enable-tracing.
+ */
+double trace_time(void);
+#ifdef ENABLE_TRACING
+extern volatile bool tracing;    ///< Whether the events are recorded (between start_trace and stop_trace).
+void trace_event(const char *name, double start, double end);
+
+class TraceScope {
+public:
+    TraceScope(const char *_name): name(_name), start(tracing ? trace_time() : 0.) {}
+    ~TraceScope() {
+        if (tracing && start > 0.) {
+            trace_event(name, start, trace_time());
+        }
+    }
+private:
+    const char *name;
+    double start;
+};
+
+#define TRACE_CONCAT(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_CONCAT(trace_scope_, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+#define TRACE_EVENT(name, start, end) trace_event(name, start, end)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_EVENT(name, start, end)
+#endif
+
 #endif
@@ -1,7 +1,8 @@
 #include <string>
+#include "kernel.h"
 #include <complex>
 
-void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
     for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
         double tmp_real = p_real[idx];
         double tmp_imag = p_imag[idx];
@@ -22,7 +23,7 @@ void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, siz
     }
 }
 
-void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
     for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
         double tmp_real = p_real[idx];
         double tmp_imag = p_imag[idx];
@@ -43,7 +44,7 @@ void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t
     }
 }
 
-void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
     for (size_t y = 0; y < height; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
             double tmp_real = p_real[idx];
@@ -56,7 +57,7 @@ void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, s
     }
 }
 
-void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
     for (size_t y = 0; y < height; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
             double tmp_real = p_real[idx];
@@ -69,8 +70,201 @@ void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_
     }
 }
 
+/* Sweep of the next-nearest neighbour pair (g, g + 2) of an axis, g being the global coordinate of its first dot
+ * and period the number of dots of a periodic axis (0 for a closed one). The pairs of the dots 4k, 4k + 1 and of
+ * the dots 4k + 2, 4k + 3 take two alternate sweeps; when the period is not a multiple of 4 the two pairs across
+ * the seam would collide with both, and take a third sweep.
+ */
+static inline size_t nnn_sweep(size_t g, size_t period) {
+    if (period % 4 != 0 && g + 2 >= period) {
+        return 2;
+    }
+    return (g % 4) / 2;
+}
+
+static inline size_t nnn_next(size_t g, size_t period) {
+    return g + 1 == period ? 0 : g + 1;
+}
+
+CPU_KERNEL_CLONES void block_kernel_vertical_nnn(size_t sweep, size_t global_y, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0, g = global_y; y + 2 < height; ++y, g = nnn_next(g, period_y)) {
+        if (nnn_sweep(g, period_y) != sweep) {
+            continue;
+        }
+        for (size_t idx = y * stride, peer = idx + 2 * stride; idx < y * stride + width; ++idx, ++peer) {
+            double tmp_real = p_real[idx];
+            double tmp_imag = p_imag[idx];
+            p_real[idx] = a * tmp_real - b * p_imag[peer];
+            p_imag[idx] = a * tmp_imag + b * p_real[peer];
+            p_real[peer] = a * p_real[peer] - b * tmp_imag;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_real;
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_vertical_nnn_imaginary(size_t sweep, size_t global_y, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0, g = global_y; y + 2 < height; ++y, g = nnn_next(g, period_y)) {
+        if (nnn_sweep(g, period_y) != sweep) {
+            continue;
+        }
+        for (size_t idx = y * stride, peer = idx + 2 * stride; idx < y * stride + width; ++idx, ++peer) {
+            double tmp_real = p_real[idx];
+            double tmp_imag = p_imag[idx];
+            p_real[idx] = a * tmp_real + b * p_real[peer];
+            p_imag[idx] = a * tmp_imag + b * p_imag[peer];
+            p_real[peer] = a * p_real[peer] + b * tmp_real;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_horizontal_nnn(size_t sweep, size_t global_x, size_t period_x, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0, g = global_x; x + 2 < width; ++x, g = nnn_next(g, period_x)) {
+            if (nnn_sweep(g, period_x) != sweep) {
+                continue;
+            }
+            size_t idx = y * stride + x, peer = idx + 2;
+            double tmp_real = p_real[idx];
+            double tmp_imag = p_imag[idx];
+            p_real[idx] = a * tmp_real - b * p_imag[peer];
+            p_imag[idx] = a * tmp_imag + b * p_real[peer];
+            p_real[peer] = a * p_real[peer] - b * tmp_imag;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_real;
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_horizontal_nnn_imaginary(size_t sweep, size_t global_x, size_t period_x, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0, g = global_x; x + 2 < width; ++x, g = nnn_next(g, period_x)) {
+            if (nnn_sweep(g, period_x) != sweep) {
+                continue;
+            }
+            size_t idx = y * stride + x, peer = idx + 2;
+            double tmp_real = p_real[idx];
+            double tmp_imag = p_imag[idx];
+            p_real[idx] = a * tmp_real + b * p_real[peer];
+            p_imag[idx] = a * tmp_imag + b * p_imag[peer];
+            p_real[peer] = a * p_real[peer] + b * tmp_real;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
+        }
+    }
+}
+
+/* Sweep of the nearest neighbour pair (g, g + 1) of an axis, g being the global coordinate of its first dot, h the
+ * global coordinate of the pair along the other axis and period the number of dots of a periodic axis (0 for a
+ * closed one). The pairs follow the checkerboard of g + h; when the period is odd the pair across the seam would
+ * collide with the pair of the dot 0, and takes a third sweep.
+ */
+static inline size_t nn_sweep(size_t g, size_t h, size_t period) {
+    if (period % 2 != 0 && g + 1 == period) {
+        return 2;
+    }
+    return (g + h) % 2;
+}
+
+/* The pair kernels leave out the diagonal of the kinetic operator, a global phase as long as every dot is paired in
+ * every sweep. Along an axis of odd period the seam leaves a dot out of each sweep: that dot takes the phase its pair
+ * would have left out, so that each pair applies exactly its share of the kinetic operator and the splitting error
+ * at the seam matches the bulk.
+ */
+CPU_KERNEL_CLONES void block_kernel_vertical_seam(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    bool seam = period_y % 2 != 0;
+    for (size_t y = 0, g = global_y; y < height; ++y, g = nnn_next(g, period_y)) {
+        size_t previous = g == 0 ? period_y - 1 : g - 1;
+        for (size_t x = 0, h = global_x; x < width; ++x, h = nnn_next(h, period_x)) {
+            size_t idx = y * stride + x, peer = idx + stride;
+            bool first = nn_sweep(g, h, period_y) == sweep;
+            if (first && y + 1 < height) {
+                double tmp_real = p_real[idx];
+                double tmp_imag = p_imag[idx];
+                p_real[idx] = a * tmp_real - b * p_imag[peer];
+                p_imag[idx] = a * tmp_imag + b * p_real[peer];
+                p_real[peer] = a * p_real[peer] - b * tmp_imag;
+                p_imag[peer] = a * p_imag[peer] + b * tmp_real;
+            }
+            else if (!first && seam && nn_sweep(previous, h, period_y) != sweep) {
+                double tmp_real = p_real[idx];
+                p_real[idx] = a * tmp_real - b * p_imag[idx];
+                p_imag[idx] = a * p_imag[idx] + b * tmp_real;
+            }
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_vertical_seam_imaginary(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    bool seam = period_y % 2 != 0;
+    for (size_t y = 0, g = global_y; y < height; ++y, g = nnn_next(g, period_y)) {
+        size_t previous = g == 0 ? period_y - 1 : g - 1;
+        for (size_t x = 0, h = global_x; x < width; ++x, h = nnn_next(h, period_x)) {
+            size_t idx = y * stride + x, peer = idx + stride;
+            bool first = nn_sweep(g, h, period_y) == sweep;
+            if (first && y + 1 < height) {
+                double tmp_real = p_real[idx];
+                double tmp_imag = p_imag[idx];
+                p_real[idx] = a * tmp_real + b * p_real[peer];
+                p_imag[idx] = a * tmp_imag + b * p_imag[peer];
+                p_real[peer] = a * p_real[peer] + b * tmp_real;
+                p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
+            }
+            else if (!first && seam && nn_sweep(previous, h, period_y) != sweep) {
+                p_real[idx] *= a + b;
+                p_imag[idx] *= a + b;
+            }
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_horizontal_seam(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    bool seam = period_x % 2 != 0;
+    for (size_t y = 0, h = global_y; y < height; ++y, h = nnn_next(h, period_y)) {
+        for (size_t x = 0, g = global_x; x < width; ++x, g = nnn_next(g, period_x)) {
+            size_t previous = g == 0 ? period_x - 1 : g - 1;
+            size_t idx = y * stride + x, peer = idx + 1;
+            bool first = nn_sweep(g, h, period_x) == sweep;
+            if (first && x + 1 < width) {
+                double tmp_real = p_real[idx];
+                double tmp_imag = p_imag[idx];
+                p_real[idx] = a * tmp_real - b * p_imag[peer];
+                p_imag[idx] = a * tmp_imag + b * p_real[peer];
+                p_real[peer] = a * p_real[peer] - b * tmp_imag;
+                p_imag[peer] = a * p_imag[peer] + b * tmp_real;
+            }
+            else if (!first && seam && nn_sweep(previous, h, period_x) != sweep) {
+                double tmp_real = p_real[idx];
+                p_real[idx] = a * tmp_real - b * p_imag[idx];
+                p_imag[idx] = a * p_imag[idx] + b * tmp_real;
+            }
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void block_kernel_horizontal_seam_imaginary(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    bool seam = period_x % 2 != 0;
+    for (size_t y = 0, h = global_y; y < height; ++y, h = nnn_next(h, period_y)) {
+        for (size_t x = 0, g = global_x; x < width; ++x, g = nnn_next(g, period_x)) {
+            size_t previous = g == 0 ? period_x - 1 : g - 1;
+            size_t idx = y * stride + x, peer = idx + 1;
+            bool first = nn_sweep(g, h, period_x) == sweep;
+            if (first && x + 1 < width) {
+                double tmp_real = p_real[idx];
+                double tmp_imag = p_imag[idx];
+                p_real[idx] = a * tmp_real + b * p_real[peer];
+                p_imag[idx] = a * tmp_imag + b * p_imag[peer];
+                p_real[peer] = a * p_real[peer] + b * tmp_real;
+                p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
+            }
+            else if (!first && seam && nn_sweep(previous, h, period_x) != sweep) {
+                p_real[idx] *= a + b;
+                p_imag[idx] *= a + b;
+            }
+        }
+    }
+}
+
 //double time potential
-void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+CPU_KERNEL_CLONES void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
                             const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
     if(two_wavefunctions) {
         for (size_t y = 0; y < height; ++y) {
@@ -110,7 +304,7 @@ void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width,
 }
 
 //double time potential
-void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+CPU_KERNEL_CLONES void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
                                       const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
     if(two_wavefunctions) {
         for (size_t y = 0; y < height; ++y) {
@@ -138,7 +332,7 @@ void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, siz
 }
 
 //rotation
-void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
 
     double tmp_r, tmp_i;
 
@@ -200,7 +394,7 @@ void block_kernel_rotation(size_t stride, size_t width, size_t height, int offse
     }
 }
 
-void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
+CPU_KERNEL_CLONES void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
 
     double tmp_r, tmp_i;
     for (int j = 0, y = offset_y; j < height; ++j, ++y) {
@@ -261,7 +455,7 @@ void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height,
     }
 }
 
-void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
+CPU_KERNEL_CLONES void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
     double real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
@@ -275,7 +469,7 @@ void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, d
     }
 }
 
-void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
+CPU_KERNEL_CLONES void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
     double real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
@@ -0,0 +1,380 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#include "kernel.h"
+#include <algorithm>
+#include <cstring>
+
+// Coefficients of the fourth-order second derivative, as in the energy routines
+#define STENCIL_0 2.5
+#define STENCIL_1 (4. / 3.)
+#define STENCIL_2 (1. / 12.)
+
+static inline double tile_value(const double *in, long width, long height, long x, long y) {
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return 0.;
+    }
+    return in[y * width + x];
+}
+
+static inline double scaled_hamiltonian_point(long width, long height, long x, long y, double kin_x, double kin_y,
+        double shift, const double *potential, const double *in) {
+    long idx = y * width + x;
+    double value = (kin_x * STENCIL_0 + potential[idx] - shift) * in[idx]
+                   - kin_x * (STENCIL_1 * (tile_value(in, width, height, x - 1, y) + tile_value(in, width, height, x + 1, y))
+                              - STENCIL_2 * (tile_value(in, width, height, x - 2, y) + tile_value(in, width, height, x + 2, y)));
+    if (height > 1) {
+        value += kin_y * STENCIL_0 * in[idx]
+                 - kin_y * (STENCIL_1 * (tile_value(in, width, height, x, y - 1) + tile_value(in, width, height, x, y + 1))
+                            - STENCIL_2 * (tile_value(in, width, height, x, y - 2) + tile_value(in, width, height, x, y + 2)));
+    }
+    return value;
+}
+
+CPU_KERNEL_CLONES void chebyshev_apply_hamiltonian(size_t tile_width, size_t tile_height, size_t x_start, size_t x_end, size_t y_start, size_t y_end,
+        double kin_x, double kin_y, double shift, double scale, double factor, const double *potential,
+        const double *in, const double *sub, double *out) {
+    long width = tile_width, height = tile_height;
+    double coeff = factor / scale;
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (long y = y_start; y < long(y_end); y++) {
+        // Away from the edges of the tile the stencil needs no bound checks
+        long fast_start = max(long(x_start), 2L);
+        long fast_end = max(fast_start, min(long(x_end), width - 2));
+        if (height > 1 && (y < 2 || y >= height - 2)) {
+            fast_end = fast_start;
+        }
+        for (long x = x_start; x < fast_start; x++) {
+            out[y * width + x] = coeff * scaled_hamiltonian_point(width, height, x, y, kin_x, kin_y, shift, potential, in) - (sub != NULL ? sub[y * width + x] : 0.);
+        }
+        const double *row = &in[y * width];
+        const double *up = row, *up_up = row, *down = row, *down_down = row;
+        if (height > 1 && fast_end > fast_start) {
+            up = &in[(y - 1) * width];
+            up_up = &in[(y - 2) * width];
+            down = &in[(y + 1) * width];
+            down_down = &in[(y + 2) * width];
+        }
+        const double *row_potential = &potential[y * width];
+        double kin_v = height > 1 ? kin_y : 0.;
+        double diagonal = (kin_x + kin_v) * STENCIL_0 - shift;
+        for (long x = fast_start; x < fast_end; x++) {
+            double value = (diagonal + row_potential[x]) * row[x]
+                           - kin_x * (STENCIL_1 * (row[x - 1] + row[x + 1]) - STENCIL_2 * (row[x - 2] + row[x + 2]))
+                           - kin_v * (STENCIL_1 * (up[x] + down[x]) - STENCIL_2 * (up_up[x] + down_down[x]));
+            out[y * width + x] = coeff * value - (sub != NULL ? sub[y * width + x] : 0.);
+        }
+        for (long x = fast_end; x < long(x_end); x++) {
+            out[y * width + x] = coeff * scaled_hamiltonian_point(width, height, x, y, kin_x, kin_y, shift, potential, in) - (sub != NULL ? sub[y * width + x] : 0.);
+        }
+    }
+}
+
+/* Bessel functions J_k(z), or the scaled modified Bessel functions e^-z I_k(z), for k = 0..n-1,
+ * by Miller's backward recurrence normalized with J_0 + 2 sum J_2k = 1 (I_0 + 2 sum I_k = e^z).
+ */
+static void bessel_sequence(double z, bool modified, int n, vector<double> &values) {
+    values.assign(n, 0.);
+    if (z == 0.) {
+        values[0] = 1.;
+        return;
+    }
+    int start = n + 20 + int(sqrt(40. * n));
+    double next = 0., current = 1.e-30, sum = 0.;
+    for (int k = start; k > 0; k--) {
+        double previous = 2. * k / z * current + (modified ? next : -next);
+        next = current;
+        current = previous;
+        if (k - 1 < n) {
+            values[k - 1] = current;
+        }
+        if (modified || (k - 1) % 2 == 0) {
+            sum += (k - 1 == 0 ? 1. : 2.) * current;
+        }
+        if (abs(current) > 1.e200) {
+            next *= 1.e-200;
+            current *= 1.e-200;
+            sum *= 1.e-200;
+            for (int i = k - 1; i < n; i++) {
+                values[i] *= 1.e-200;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        values[i] /= sum;
+    }
+}
+
+CPUChebyshev::CPUChebyshev(Lattice *grid, State *state, Hamiltonian *_hamiltonian,
+                           double _delta_t, double _norm, bool _imag_time):
+    hamiltonian(_hamiltonian),
+    delta_t(_delta_t),
+    norm(_norm),
+    imag_time(_imag_time) {
+    delta_x = grid->delta_x;
+    delta_y = grid->delta_y;
+    halo_x = grid->halo_x;
+    halo_y = grid->halo_y;
+    periods = grid->periods;
+    start_x = grid->start_x;
+    start_y = grid->start_y;
+    inner_start_x = grid->inner_start_x;
+    inner_end_x = grid->inner_end_x;
+    inner_start_y = grid->inner_start_y;
+    inner_end_y = grid->inner_end_y;
+    tile_width = grid->end_x - grid->start_x;
+    tile_height = grid->end_y - grid->start_y;
+#ifdef HAVE_MPI
+    cartcomm = grid->cartcomm;
+    MPI_Cart_shift(cartcomm, 0, 1, &neighbors[UP], &neighbors[DOWN]);
+    MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+#endif
+    p_real = state->p_real;
+    p_imag = state->p_imag;
+    for (int i = 0; i < 3; i++) {
+        work_real[i] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+        work_imag[i] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+        // The points outside the inner region are only written by the halo exchange
+        fill(work_real[i], work_real[i] + tile_width * tile_height, 0.);
+        fill(work_imag[i], work_imag[i] + tile_width * tile_height, 0.);
+    }
+    sum_real = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+    sum_imag = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+    potential = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+    set_hamiltonian(hamiltonian);
+
+#ifdef HAVE_MPI
+    int count = inner_end_y - inner_start_y;  // The number of rows in the halo submatrix
+    int block_length = halo_x;  // The number of columns in the halo submatrix
+    int stride = tile_width;  // The combined width of the matrix with the halo
+    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
+    MPI_Type_commit (&verticalBorder);
+
+    count = halo_y; // The vertical halo in rows
+    block_length = tile_width;  // The number of columns of the matrix
+    stride = tile_width;  // The combined width of the matrix with the halo
+    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
+    MPI_Type_commit (&horizontalBorder);
+#endif
+}
+
+CPUChebyshev::~CPUChebyshev() {
+    for (int i = 0; i < 3; i++) {
+        free_tracked(work_real[i]);
+        free_tracked(work_imag[i]);
+    }
+    free_tracked(sum_real);
+    free_tracked(sum_imag);
+    free_tracked(potential);
+#ifdef HAVE_MPI
+    MPI_Type_free(&verticalBorder);
+    MPI_Type_free(&horizontalBorder);
+#endif
+}
+
+void CPUChebyshev::set_hamiltonian(Hamiltonian *_hamiltonian) {
+    hamiltonian = _hamiltonian;
+    if (hamiltonian->coupling_a != 0. || hamiltonian->LeeHuangYang_coupling_a != 0.) {
+        my_abort("The chebyshev kernel only supports linear problems");
+    }
+    mass = hamiltonian->mass;
+    kin_x = 1. / (2. * mass * delta_x * delta_x);
+    kin_y = tile_height > 1 ? 1. / (2. * mass * delta_y * delta_y) : 0.;
+    for (size_t y = 0; y < tile_height; y++) {
+        for (size_t x = 0; x < tile_width; x++) {
+            potential[y * tile_width + x] = hamiltonian->potential->get_value(x, y);
+        }
+    }
+    set_expansion();
+}
+
+void CPUChebyshev::set_expansion() {
+    double min_potential = DBL_MAX, max_potential = -DBL_MAX;
+    for (int y = inner_start_y - start_y; y < inner_end_y - start_y; y++) {
+        for (int x = inner_start_x - start_x; x < inner_end_x - start_x; x++) {
+            min_potential = min(min_potential, potential[y * tile_width + x]);
+            max_potential = max(max_potential, potential[y * tile_width + x]);
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &min_potential, 1, MPI_DOUBLE, MPI_MIN, cartcomm);
+    MPI_Allreduce(MPI_IN_PLACE, &max_potential, 1, MPI_DOUBLE, MPI_MAX, cartcomm);
+#endif
+    // The kinetic term of the fourth-order stencil lies in [0, 16/3 (kin_x + kin_y)]
+    double min_energy = min_potential;
+    double max_energy = max_potential + 16. / 3. * (kin_x + kin_y);
+    shift = 0.5 * (max_energy + min_energy);
+    scale = 0.5 * (max_energy - min_energy) * 1.01;
+    double z = scale * delta_t;
+    vector<double> bessel;
+    bessel_sequence(z, imag_time, int(z + 10. * cbrt(z)) + 30, bessel);
+    int n_terms = bessel.size();
+    while (n_terms > 1 && abs(bessel[n_terms - 1]) < 1.e-15) {
+        n_terms--;
+    }
+    // exp(-i z x) = J_0(z) + 2 sum (-i)^k J_k(z) T_k(x); exp(-z x) = I_0(z) + 2 sum (-1)^k I_k(z) T_k(x)
+    complex<double> phase = imag_time ? 1. : exp(complex<double>(0., -shift * delta_t));
+    complex<double> power = 1.;
+    coefficients.resize(n_terms);
+    for (int k = 0; k < n_terms; k++) {
+        coefficients[k] = (k == 0 ? 1. : 2.) * bessel[k] * power * phase;
+        power *= imag_time ? complex<double>(-1., 0.) : complex<double>(0., -1.);
+    }
+}
+
+void CPUChebyshev::run_kernel_on_halo() {}
+
+void CPUChebyshev::run_kernel() {
+    size_t x_start = inner_start_x - start_x, x_end = inner_end_x - start_x;
+    size_t y_start = inner_start_y - start_y, y_end = inner_end_y - start_y;
+    // The recurrence T_k+1 = 2 x T_k - T_k-1 starts from the wave function, which is only overwritten at the end
+    const double *previous_real = p_real, *previous_imag = p_imag;
+    double *current_real = work_real[0], *current_imag = work_imag[0];
+    exchange_halos(p_real, p_imag);
+    chebyshev_apply_hamiltonian(tile_width, tile_height, x_start, x_end, y_start, y_end, kin_x, kin_y, shift, scale, 1., potential,
+                                p_real, NULL, current_real);
+    chebyshev_apply_hamiltonian(tile_width, tile_height, x_start, x_end, y_start, y_end, kin_x, kin_y, shift, scale, 1., potential,
+                                p_imag, NULL, current_imag);
+    int n_terms = coefficients.size();
+    for (int k = 0; k < n_terms; k++) {
+        if (k >= 2) {
+            double *next_real = work_real[k % 3], *next_imag = work_imag[k % 3];
+            exchange_halos(current_real, current_imag);
+            chebyshev_apply_hamiltonian(tile_width, tile_height, x_start, x_end, y_start, y_end, kin_x, kin_y, shift, scale, 2., potential,
+                                        current_real, previous_real, next_real);
+            chebyshev_apply_hamiltonian(tile_width, tile_height, x_start, x_end, y_start, y_end, kin_x, kin_y, shift, scale, 2., potential,
+                                        current_imag, previous_imag, next_imag);
+            previous_real = current_real;
+            previous_imag = current_imag;
+            current_real = next_real;
+            current_imag = next_imag;
+        }
+        const double *term_real = k == 0 ? p_real : current_real;
+        const double *term_imag = k == 0 ? p_imag : current_imag;
+        double c_real = real(coefficients[k]), c_imag = imag(coefficients[k]);
+#ifndef HAVE_MPI
+        #pragma omp parallel for
+#endif
+        for (int y = y_start; y < int(y_end); y++) {
+            for (size_t x = x_start; x < x_end; x++) {
+                size_t idx = y * tile_width + x;
+                double sum_r = k == 0 ? 0. : sum_real[idx];
+                double sum_i = k == 0 ? 0. : sum_imag[idx];
+                sum_real[idx] = sum_r + c_real * term_real[idx] - c_imag * term_imag[idx];
+                sum_imag[idx] = sum_i + c_real * term_imag[idx] + c_imag * term_real[idx];
+            }
+        }
+    }
+    for (size_t y = y_start; y < y_end; y++) {
+        memcpy(&p_real[y * tile_width + x_start], &sum_real[y * tile_width + x_start], (x_end - x_start) * sizeof(double));
+        memcpy(&p_imag[y * tile_width + x_start], &sum_imag[y * tile_width + x_start], (x_end - x_start) * sizeof(double));
+    }
+    exchange_halos(p_real, p_imag);
+}
+
+void CPUChebyshev::wait_for_completion() {
+    if (imag_time && norm != 0) {
+        //normalization
+        double _norm = sqrt(calculate_squared_norm(true) / norm);
+        for (size_t i = 0; i < tile_height * tile_width; i++) {
+            p_real[i] /= _norm;
+            p_imag[i] /= _norm;
+        }
+    }
+}
+
+void CPUChebyshev::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *, double *) const {
+    if (dest_real == p_real && dest_imag == p_imag && x == 0 && y == 0) {
+        return;
+    }
+    memcpy2D(dest_real, dest_stride * sizeof(double), &p_real[y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+    memcpy2D(dest_imag, dest_stride * sizeof(double), &p_imag[y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+}
+
+double CPUChebyshev::calculate_squared_norm(bool global) const {
+    TRACE_SCOPE("squared_norm");
+    double norm2 = 0.;
+#ifndef HAVE_MPI
+    #pragma omp parallel for reduction(+:norm2)
+#endif
+    for (int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
+        for (int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
+            norm2 += p_real[j + i * tile_width] * p_real[j + i * tile_width] + p_imag[j + i * tile_width] * p_imag[j + i * tile_width];
+        }
+    }
+#ifdef HAVE_MPI
+    if (global) {
+        MPI_Allreduce(MPI_IN_PLACE, &norm2, 1, MPI_DOUBLE, MPI_SUM, cartcomm);
+    }
+#endif
+    return norm2 * delta_x * delta_y;
+}
+
+void CPUChebyshev::update_potential(double *, double *, int) {
+    set_hamiltonian(hamiltonian);
+}
+
+bool CPUChebyshev::update_coefficients(Hamiltonian *_hamiltonian, double _delta_t) {
+    delta_t = _delta_t;
+    set_hamiltonian(_hamiltonian);
+    return true;
+}
+
+bool CPUChebyshev::update_parameters(const KernelConfig &config) {
+    if (config.two_components || config.n_states != 1 || config.states[0]->p_real != p_real || config.states[0]->p_imag != p_imag) {
+        return false;
+    }
+    imag_time = config.imag_time;
+    norm = config.norm[0];
+    return update_coefficients(config.hamiltonian, config.delta_t);
+}
+
+void CPUChebyshev::exchange_halos(double *real, double *imag) {
+    double *parts[2] = {real, imag};
+    for (int i = 0; i < 2; i++) {
+#ifdef HAVE_MPI
+        // Halo exchange: LEFT/RIGHT, then UP/DOWN on full rows, as in the CPU kernel
+        int row = (inner_start_y - start_y) * tile_width;
+        MPI_Sendrecv(parts[i] + row + inner_end_x - halo_x - start_x, 1, verticalBorder, neighbors[RIGHT], 1,
+                     parts[i] + row, 1, verticalBorder, neighbors[LEFT], 1, cartcomm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(parts[i] + row + halo_x, 1, verticalBorder, neighbors[LEFT], 2,
+                     parts[i] + row + inner_end_x - start_x, 1, verticalBorder, neighbors[RIGHT], 2, cartcomm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(parts[i] + (inner_end_y - halo_y - start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 3,
+                     parts[i], 1, horizontalBorder, neighbors[UP], 3, cartcomm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(parts[i] + halo_y * tile_width, 1, horizontalBorder, neighbors[UP], 4,
+                     parts[i] + (inner_end_y - start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 4, cartcomm, MPI_STATUS_IGNORE);
+#else
+        if (periods[1] != 0) {
+            int offset = (inner_start_y - start_y) * tile_width;
+            memcpy2D(&parts[i][offset], tile_width * sizeof(double), &parts[i][offset + tile_width - 2 * halo_x], tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+            memcpy2D(&parts[i][offset + tile_width - halo_x], tile_width * sizeof(double), &parts[i][offset + halo_x], tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+        }
+        if (periods[0] != 0) {
+            int offset = (inner_end_y - start_y) * tile_width;
+            memcpy2D(&parts[i][0], tile_width * sizeof(double), &parts[i][offset - halo_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(&parts[i][offset], tile_width * sizeof(double), &parts[i][halo_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        }
+#endif
+    }
+}
+
+ITrotterKernel *create_chebyshev_kernel(const KernelConfig &config) {
+    return new CPUChebyshev(config.grid, config.states[0], config.hamiltonian, config.delta_t, config.norm[0], config.imag_time);
+}
@@ -1,7 +1,8 @@
 #include <complex>
+#include "kernel.h"
 
 //real radial kinetic term
-void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
+CPU_KERNEL_CLONES void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
                                  double offset_x, double _kin_radial,
                                  double * p_real, double * p_imag) {
 
@@ -41,7 +42,7 @@ void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t widt
 }
 
 //imaginary radial kinetic term
-void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height,
+CPU_KERNEL_CLONES void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height,
         double offset_x, double _kin_radial,
         double * p_real, double * p_imag) {
 
@@ -19,20 +19,124 @@
 #include "kernel.h"
 #include <iostream>
 
+/**
+ * Global coordinate of a dot, folded into the period of a periodic axis (into [0, 4) on a closed axis, where
+ * only its remainder modulo 4 matters and the mirror halo of a parity has negative coordinates).
+ */
+static size_t nnn_coordinate(int g, size_t period) {
+    int fold = period != 0 ? int(period) : 4;
+    return size_t((g % fold + fold) % fold);
+}
+
+/**
+ * Number of the first dots of a block, of global coordinate g along a closed axis, in the mirror halo of a parity.
+ */
+static size_t mirror_dots(int g, size_t period, size_t dots) {
+    return period == 0 && g < 0 ? std::min(size_t(-g), dots) : 0;
+}
+
+/**
+ * Sweep of the nearest neighbour pairs along y (vertical) or x: the pairs follow the checkerboard of the global coordinates,
+ * which the kernels of whole rows reproduce from the parity of the block unless a periodic axis has odd length and a seam.
+ */
+static void nn_sweep_columns(bool imag_time, size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y,
+                              size_t stride, size_t width, size_t height, double a, double b, double *real, double *imag) {
+    if (period_x % 2 != 0 || period_y % 2 != 0) {
+        if (imag_time) {
+            block_kernel_vertical_seam_imaginary(sweep, global_x, global_y, period_x, period_y, stride, width, height, a, b, real, imag);
+        }
+        else {
+            block_kernel_vertical_seam(sweep, global_x, global_y, period_x, period_y, stride, width, height, a, b, real, imag);
+        }
+        return;
+    }
+    size_t start_offset = (sweep + global_x + global_y) % 2;
+    if (imag_time) {
+        block_kernel_vertical_imaginary(start_offset, stride, width, height, a, b, real, imag);
+    }
+    else {
+        block_kernel_vertical(start_offset, stride, width, height, a, b, real, imag);
+    }
+}
+
+static void nn_sweep_rows(bool imag_time, size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y,
+                                size_t stride, size_t width, size_t height, double a, double b, double *real, double *imag) {
+    if (period_x % 2 != 0 || period_y % 2 != 0) {
+        if (imag_time) {
+            block_kernel_horizontal_seam_imaginary(sweep, global_x, global_y, period_x, period_y, stride, width, height, a, b, real, imag);
+        }
+        else {
+            block_kernel_horizontal_seam(sweep, global_x, global_y, period_x, period_y, stride, width, height, a, b, real, imag);
+        }
+        return;
+    }
+    size_t start_offset = (sweep + global_x + global_y) % 2;
+    if (imag_time) {
+        block_kernel_horizontal_imaginary(start_offset, stride, width, height, a, b, real, imag);
+    }
+    else {
+        block_kernel_horizontal(start_offset, stride, width, height, a, b, real, imag);
+    }
+}
+
+/**
+ * The same sweeps from the global coordinates of the first dot of a block, unfolded. The vertical pairs of the columns in the
+ * mirror halo of a parity along x, and the horizontal pairs of the rows in the one along y, take the checkerboard of their
+ * images across the symmetry plane: the image of every pair is then in the same sweep, the pair straddling the plane being
+ * its own image, and the evolution of the half lattice is the one of the full lattice.
+ */
+static void nn_sweep_vertical(bool imag_time, size_t sweep, int global_x, int global_y, size_t period_x, size_t period_y,
+                              size_t stride, size_t width, size_t height, double a, double b, double *real, double *imag) {
+    size_t mirror = mirror_dots(global_x, period_x, width);
+    if (mirror > 0) {
+        nn_sweep_columns(imag_time, sweep, nnn_coordinate(global_x + 1, period_x), nnn_coordinate(global_y, period_y), period_x, period_y,
+                         stride, mirror, height, a, b, real, imag);
+    }
+    if (mirror < width) {
+        nn_sweep_columns(imag_time, sweep, nnn_coordinate(global_x + int(mirror), period_x), nnn_coordinate(global_y, period_y), period_x, period_y,
+                         stride, width - mirror, height, a, b, real + mirror, imag + mirror);
+    }
+}
+
+static void nn_sweep_horizontal(bool imag_time, size_t sweep, int global_x, int global_y, size_t period_x, size_t period_y,
+                                size_t stride, size_t width, size_t height, double a, double b, double *real, double *imag) {
+    size_t mirror = mirror_dots(global_y, period_y, height);
+    if (mirror > 0) {
+        nn_sweep_rows(imag_time, sweep, nnn_coordinate(global_x, period_x), nnn_coordinate(global_y + 1, period_y), period_x, period_y,
+                      stride, width, mirror, a, b, real, imag);
+    }
+    if (mirror < height) {
+        nn_sweep_rows(imag_time, sweep, nnn_coordinate(global_x, period_x), nnn_coordinate(global_y + int(mirror), period_y), period_x, period_y,
+                      stride, width, height - mirror, a, b, real + mirror * stride, imag + mirror * stride);
+    }
+}
+
 void full_step(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-               double offset_x, double offset_y, double alpha_x, double alpha_y,
-               double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
+               double offset_x, double offset_y, double alpha_x, double alpha_y, int global_x, int global_y, size_t period_x, size_t period_y,
+               double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
                size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
                const double *pb_real, const double *pb_imag, double * real, double * imag,
                string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
+    // The checkerboard of the nearest neighbour pairs follows the parity of the global coordinates, and
+    // the pairs across the seam of a periodic axis of odd length take a third sweep
+    size_t nn_sweeps = (period_x % 2 != 0 || period_y % 2 != 0) ? 3 : 2;
+    for (size_t sweep = 0; sweep < nn_sweeps; ++sweep) {
+        if (height > 1 ) {
+            nn_sweep_vertical  (false, sweep, global_x, global_y, period_x, period_y, stride, width, height, aV, bV, real, imag);
+        }
+        nn_sweep_horizontal(false, sweep, global_x, global_y, period_x, period_y, stride, width, height, aH, bH, real, imag);
     }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
+    // Next-nearest neighbour pairs of the kinetic operator of order 4, swept by global coordinate so that
+    // the blocks, the tiles and the seams of the periodic axes pair the same dots
+    size_t nnn_sweeps = (period_x % 4 != 0 || period_y % 4 != 0) ? 3 : 2;
+    if (dH != 0.) {
+        for (size_t sweep = 0; sweep < nnn_sweeps; ++sweep) {
+            if (height > 1 ) {
+                block_kernel_vertical_nnn  (sweep, nnn_coordinate(global_y, period_y), period_y, stride, width, height, cV, dV, real, imag);
+            }
+            block_kernel_horizontal_nnn(sweep, nnn_coordinate(global_x, period_x), period_x, stride, width, height, cH, dH, real, imag);
+        }
     }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
     if (coordinate_system == "cylindrical") {
         block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
         block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
@@ -45,30 +149,48 @@ void full_step(bool two_wavefunctions, size_t stride, size_t width, size_t heigh
         block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
         block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
     }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
+    if (dH != 0.) {
+        for (size_t sweep = nnn_sweeps; sweep-- > 0; ) {
+            block_kernel_horizontal_nnn(sweep, nnn_coordinate(global_x, period_x), period_x, stride, width, height, cH, dH, real, imag);
+            if (height > 1 ) {
+                block_kernel_vertical_nnn  (sweep, nnn_coordinate(global_y, period_y), period_y, stride, width, height, cV, dV, real, imag);
+            }
+        }
     }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
+    for (size_t sweep = nn_sweeps; sweep-- > 0; ) {
+        nn_sweep_horizontal(false, sweep, global_x, global_y, period_x, period_y, stride, width, height, aH, bH, real, imag);
+        if (height > 1 ) {
+            nn_sweep_vertical  (false, sweep, global_x, global_y, period_x, period_y, stride, width, height, aV, bV, real, imag);
+        }
     }
 }
 
 void full_step_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-                         double offset_x, double offset_y, double alpha_x, double alpha_y,
-                         double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
+                         double offset_x, double offset_y, double alpha_x, double alpha_y, int global_x, int global_y, size_t period_x, size_t period_y,
+                         double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
                          size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
                          const double *pb_real, const double *pb_imag, double * real, double * imag,
                          string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
+    // The checkerboard of the nearest neighbour pairs follows the parity of the global coordinates, and
+    // the pairs across the seam of a periodic axis of odd length take a third sweep
+    size_t nn_sweeps = (period_x % 2 != 0 || period_y % 2 != 0) ? 3 : 2;
+    for (size_t sweep = 0; sweep < nn_sweeps; ++sweep) {
+        if (height > 1 ) {
+            nn_sweep_vertical  (true, sweep, global_x, global_y, period_x, period_y, stride, width, height, aV, bV, real, imag);
+        }
+        nn_sweep_horizontal(true, sweep, global_x, global_y, period_x, period_y, stride, width, height, aH, bH, real, imag);
     }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
+    // Next-nearest neighbour pairs of the kinetic operator of order 4, swept by global coordinate so that
+    // the blocks, the tiles and the seams of the periodic axes pair the same dots
+    size_t nnn_sweeps = (period_x % 4 != 0 || period_y % 4 != 0) ? 3 : 2;
+    if (dH != 0.) {
+        for (size_t sweep = 0; sweep < nnn_sweeps; ++sweep) {
+            if (height > 1 ) {
+                block_kernel_vertical_nnn_imaginary  (sweep, nnn_coordinate(global_y, period_y), period_y, stride, width, height, cV, dV, real, imag);
+            }
+            block_kernel_horizontal_nnn_imaginary(sweep, nnn_coordinate(global_x, period_x), period_x, stride, width, height, cH, dH, real, imag);
+        }
     }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
     if (coordinate_system == "cylindrical") {
         block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
         block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
@@ -81,18 +203,24 @@ void full_step_imaginary(bool two_wavefunctions, size_t stride, size_t width, si
         block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
         block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
     }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
+    if (dH != 0.) {
+        for (size_t sweep = nnn_sweeps; sweep-- > 0; ) {
+            block_kernel_horizontal_nnn_imaginary(sweep, nnn_coordinate(global_x, period_x), period_x, stride, width, height, cH, dH, real, imag);
+            if (height > 1 ) {
+                block_kernel_vertical_nnn_imaginary  (sweep, nnn_coordinate(global_y, period_y), period_y, stride, width, height, cV, dV, real, imag);
+            }
+        }
     }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
+    for (size_t sweep = nn_sweeps; sweep-- > 0; ) {
+        nn_sweep_horizontal(true, sweep, global_x, global_y, period_x, period_y, stride, width, height, aH, bH, real, imag);
+        if (height > 1 ) {
+            nn_sweep_vertical  (true, sweep, global_x, global_y, period_x, period_y, stride, width, height, aV, bV, real, imag);
+        }
     }
 }
 
-void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                   double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag,
+void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, int global_x, int global_y, size_t period_x, size_t period_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
+                   double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag,
                    const double * p_real, const double * p_imag, const double * pb_real, const double * pb_imag,
                    double * next_real, double * next_imag, double * block_real, double * block_imag, bool imag_time, string coordinate_system) {
 
@@ -100,10 +228,10 @@ void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_t
     memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
     memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
     if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+        full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, global_x, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                             &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
     else
-        full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+        full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, global_x, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                   &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
     memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
     memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
@@ -113,20 +241,21 @@ void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_t
     memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
     memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
     if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+        full_step_imaginary(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, global_x + block_start, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                             &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
     else
-        full_step(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+        full_step(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, global_x + block_start, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                   &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
     memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
     memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
 }
 
-void process_band(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                  double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag, const double * p_real, const double * p_imag,
+void process_band(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, int global_x, int global_y, size_t period_x, size_t period_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
+                  double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag, const double * p_real, const double * p_imag,
                   const double * pb_real, const double * pb_imag, double * next_real, double * next_imag, int inner, int sides, bool imag_time, string coordinate_system) {
-    double *block_real = new double[block_height * block_width];
-    double *block_imag = new double[block_height * block_width];
+    TRACE_SCOPE("process_band");
+    double *block_real = allocate_tracked(block_height * block_width, MEMORY_TEMPORARY);
+    double *block_imag = allocate_tracked(block_height * block_width, MEMORY_TEMPORARY);
 
     if (tile_width <= block_width) {
         if (sides) {
@@ -134,10 +263,10 @@ void process_band(bool two_wavefunctions, double offset_tile_x, double offset_ti
             memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
             memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
             if(imag_time)
-                full_step_imaginary(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+                full_step_imaginary(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, global_x, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                                     &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
             else
-                full_step(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+                full_step(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, global_x, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                           &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
             memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
             memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
@@ -145,17 +274,17 @@ void process_band(bool two_wavefunctions, double offset_tile_x, double offset_ti
     }
     else {
         if (sides) {
-            process_sides(two_wavefunctions, offset_tile_x, offset_tile_y, alpha_x, alpha_y, tile_width, block_width, halo_x, read_y, read_height, write_offset, write_height, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, external_pot_real, external_pot_imag, p_real, p_imag, pb_real, pb_imag, next_real, next_imag, block_real, block_imag, imag_time, coordinate_system);
+            process_sides(two_wavefunctions, offset_tile_x, offset_tile_y, global_x, global_y, period_x, period_y, alpha_x, alpha_y, tile_width, block_width, halo_x, read_y, read_height, write_offset, write_height, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, external_pot_real, external_pot_imag, p_real, p_imag, pb_real, pb_imag, next_real, next_imag, block_real, block_imag, imag_time, coordinate_system);
         }
         if (inner) {
             for (size_t block_start = block_width - 2 * halo_x; block_start < tile_width - block_width; block_start += block_width - 2 * halo_x) {
                 memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
                 memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
                 if(imag_time)
-                    full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+                    full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, global_x + block_start, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                                         &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
                 else
-                    full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
+                    full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, global_x + block_start, global_y + read_y, period_x, period_y, aH, bH, aV, bV, cH, dH, cV, dV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
                               &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
                 memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
                 memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
@@ -164,8 +293,8 @@ void process_band(bool two_wavefunctions, double offset_tile_x, double offset_ti
     }
 
 
-    delete[] block_real;
-    delete[] block_imag;
+    free_tracked(block_real);
+    free_tracked(block_imag);
 }
 
 // Class methods
@@ -179,11 +308,10 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
+    kinetic_order = grid->kinetic_order;
     periods = grid->periods;
-    rot_coord_x = hamiltonian->rot_coord_x;
-    rot_coord_y = hamiltonian->rot_coord_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y);
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x);
+    period_x = periods[1] != 0 ? grid->global_no_halo_dim_x : 0;
+    period_y = periods[0] != 0 ? grid->global_no_halo_dim_y : 0;
     coupling_const = new double [3];
     LeeHuangYang_coupling = new double [2];
     norm = new double [1];
@@ -191,33 +319,19 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     bH = new double [1];
     aV = new double [1];
     bV = new double [1];
+    cH = new double [1];
+    dH = new double [1];
+    cV = new double [1];
+    dV = new double [1];
     kin_radial = new double [1];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    coupling_const[0] = hamiltonian->coupling_a * delta_t;
-    coupling_const[1] = 0.;
-    coupling_const[2] = 0.;
-    LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    LeeHuangYang_coupling[1] = 0;
+    two_wavefunctions = false;
+    coordinate_system = grid->coordinate_system;
+    parity_x = grid->parity_x;
+    parity_y = grid->parity_y;
+    symmetry_factor = grid->symmetry_factor();
+    set_coefficients(hamiltonian, delta_t);
     norm[0] = _norm;
     tot_norm = norm[0];
-    coordinate_system = grid->coordinate_system;
     angular_momentum[0] = state->angular_momentum;
 #ifdef HAVE_MPI
     cartcomm = grid->cartcomm;
@@ -241,17 +355,22 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
 
+    n_states = 1;
+    multiple_states = false;
+    orthogonalization_period = 1;
+    step_count = 0;
+    p_real = new double* [2][2];
+    p_imag = new double* [2][2];
     p_real[0][0] = state->p_real;
     p_imag[0][0] = state->p_imag;
-    p_real[0][1] = new double[tile_width * tile_height];
-    p_imag[0][1] = new double[tile_width * tile_height];
+    p_real[0][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+    p_imag[0][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
     p_real[1][0] = NULL;
     p_imag[1][0] = NULL;
     p_real[1][1] = NULL;
     p_imag[1][1] = NULL;
     external_pot_real[0] = _external_pot_real;
     external_pot_imag[0] = _external_pot_imag;
-    two_wavefunctions = false;
 
 #ifdef HAVE_MPI
     // Halo exchange uses wave pattern to communicate
@@ -268,7 +387,12 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     stride = tile_width;  // The combined width of the matrix with the halo
     MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
     MPI_Type_commit (&horizontalBorder);
+    req = new MPI_Request[8];
+    statuses = new MPI_Status[8];
+    float_halos = false;
+    halo_resync_period = 1;
 #endif
+    fill_state_mirror_halos();
 }
 
 CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
@@ -282,58 +406,31 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y),
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x),
-    rot_coord_x = hamiltonian->rot_coord_x;
-    rot_coord_y = hamiltonian->rot_coord_y;
+    kinetic_order = grid->kinetic_order;
     aH = new double [2];
     bH = new double [2];
     aV = new double [2];
     bV = new double [2];
+    cH = new double [2];
+    dH = new double [2];
+    cV = new double [2];
+    dV = new double [2];
     kin_radial = new double [2];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
+    coupling_const = new double[5];
+    LeeHuangYang_coupling = new double [2];
+    two_wavefunctions = true;
+    coordinate_system = grid->coordinate_system;
+    parity_x = grid->parity_x;
+    parity_y = grid->parity_y;
+    symmetry_factor = grid->symmetry_factor();
+    set_coefficients(hamiltonian, delta_t);
     norm = new double [2];
     norm[0] = _norm[0];
     norm[1] = _norm[1];
     tot_norm = norm[0] + norm[1];
-    coupling_const = new double[5];
-    coupling_const[0] = delta_t * hamiltonian->coupling_a;
-    coupling_const[1] = delta_t * hamiltonian->coupling_b;
-    coupling_const[2] = delta_t * hamiltonian->coupling_ab;
-    coupling_const[3] = 0.5 * hamiltonian->omega_r;
-    coupling_const[4] = 0.5 * hamiltonian->omega_i;
-    LeeHuangYang_coupling = new double [2];
-    // LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    // LeeHuangYang_coupling[1] = hamiltonian->LeeHuangYang_coupling_b  * delta_t;
     periods = grid->periods;
-    coordinate_system = grid->coordinate_system;
+    period_x = periods[1] != 0 ? grid->global_no_halo_dim_x : 0;
+    period_y = periods[0] != 0 ? grid->global_no_halo_dim_y : 0;
     angular_momentum[0] = state1->angular_momentum;
     angular_momentum[1] = state2->angular_momentum;
 #ifdef HAVE_MPI
@@ -358,20 +455,25 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     inner_end_y = grid->inner_end_y;
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
+    n_states = 2;
+    multiple_states = false;
+    orthogonalization_period = 1;
+    step_count = 0;
+    p_real = new double* [2][2];
+    p_imag = new double* [2][2];
     p_real[0][0] = state1->p_real;
     p_imag[0][0] = state1->p_imag;
     p_real[1][0] = state2->p_real;
     p_imag[1][0] = state2->p_imag;
 
     for(int i = 0; i < 2; i++) {
-        p_real[i][1] = new double[tile_width * tile_height];
-        p_imag[i][1] = new double[tile_width * tile_height];
+        p_real[i][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+        p_imag[i][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
         memcpy2D(p_real[i][1], tile_width * sizeof(double), p_real[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
         memcpy2D(p_imag[i][1], tile_width * sizeof(double), p_imag[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
         external_pot_real[i] = _external_pot_real[i];
         external_pot_imag[i] = _external_pot_imag[i];
     }
-    two_wavefunctions = true;
 
 #ifdef HAVE_MPI
     // Halo exchange uses wave pattern to communicate
@@ -388,7 +490,65 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     stride = tile_width;    // The combined width of the matrix with the halo
     MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
     MPI_Type_commit (&horizontalBorder);
+    req = new MPI_Request[8];
+    statuses = new MPI_Status[8];
+    float_halos = false;
+    halo_resync_period = 1;
 #endif
+    fill_state_mirror_halos();
+}
+
+CPUBlock::CPUBlock(Lattice *grid, State **states, int _n_states, Hamiltonian *hamiltonian,
+                   double *_external_pot_real, double *_external_pot_imag,
+                   double delta_t, double *_norm, bool _imag_time,
+                   int _orthogonalization_period):
+    CPUBlock(grid, states[0], hamiltonian, _external_pot_real, _external_pot_imag, delta_t, _norm[0], _imag_time) {
+    n_states = _n_states;
+    multiple_states = true;
+    orthogonalization_period = _orthogonalization_period;
+    // Widen the buffers and the norms allocated for the first state to all the states
+    double *(*first_real)[2] = p_real;
+    double *(*first_imag)[2] = p_imag;
+    int rows = n_states > 2 ? n_states : 2;
+    p_real = new double* [rows][2];
+    p_imag = new double* [rows][2];
+    p_real[1][0] = p_real[1][1] = NULL;
+    p_imag[1][0] = p_imag[1][1] = NULL;
+    p_real[0][0] = first_real[0][0];
+    p_imag[0][0] = first_imag[0][0];
+    p_real[0][1] = first_real[0][1];
+    p_imag[0][1] = first_imag[0][1];
+    delete [] first_real;
+    delete [] first_imag;
+    delete [] norm;
+    norm = new double [n_states];
+    tot_norm = 0;
+    for (int i = 0; i < n_states; i++) {
+        if (i > 0) {
+            p_real[i][0] = states[i]->p_real;
+            p_imag[i][0] = states[i]->p_imag;
+            p_real[i][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+            p_imag[i][1] = allocate_tracked(tile_width * tile_height, MEMORY_KERNEL);
+        }
+        norm[i] = _norm[i];
+        tot_norm += norm[i];
+    }
+#ifdef HAVE_MPI
+    delete [] req;
+    delete [] statuses;
+    req = new MPI_Request[8 * n_states];
+    statuses = new MPI_Status[8 * n_states];
+    float_halos = false;
+    halo_resync_period = 1;
+#endif
+    fill_state_mirror_halos();
+}
+
+void CPUBlock::fill_state_mirror_halos() {
+    for (int i = 0; i < n_states; i++) {
+        fill_mirror_halos(p_real[i][sense], p_imag[i][sense], tile_width, tile_height, halo_x, halo_y,
+                          start_x < 0 ? parity_x : 0, start_y < 0 ? parity_y : 0);
+    }
 }
 
 void CPUBlock::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
@@ -396,35 +556,207 @@ void CPUBlock::update_potential(double *_external_pot_real, double *_external_po
     external_pot_imag[which] = _external_pot_imag;
 }
 
+void CPUBlock::set_coefficients(Hamiltonian *hamiltonian, double delta_t) {
+    rot_coord_x = hamiltonian->rot_coord_x;
+    rot_coord_y = hamiltonian->rot_coord_y;
+    alpha_x = hamiltonian->angular_velocity * delta_t * delta_x / (2 * delta_y);
+    alpha_y = hamiltonian->angular_velocity * delta_t * delta_y / (2 * delta_x);
+    double mass[2] = {hamiltonian->mass, 0.};
+    if (two_wavefunctions) {
+        mass[1] = static_cast<Hamiltonian2Component*>(hamiltonian)->mass_b;
+    }
+    // The stencil of order 4 weights the nearest neighbours by 4/3 and the next-nearest ones by -1/12
+    double nearest = kinetic_order == 4 ? 4. / 3. : 1.;
+    double next_nearest = kinetic_order == 4 ? -1. / 12. : 0.;
+    for (int i = 0; i < (two_wavefunctions ? 2 : 1); i++) {
+        double angle_x = delta_t / (4. * mass[i] * delta_x * delta_x);
+        double angle_y = delta_t / (4. * mass[i] * delta_y * delta_y);
+        if (imag_time) {
+            aH[i] = cosh(nearest * angle_x);
+            bH[i] = sinh(nearest * angle_x);
+            aV[i] = cosh(nearest * angle_y);
+            bV[i] = sinh(nearest * angle_y);
+            cH[i] = cosh(next_nearest * angle_x);
+            dH[i] = sinh(next_nearest * angle_x);
+            cV[i] = cosh(next_nearest * angle_y);
+            dV[i] = sinh(next_nearest * angle_y);
+        }
+        else {
+            aH[i] = cos(nearest * angle_x);
+            bH[i] = sin(nearest * angle_x);
+            aV[i] = cos(nearest * angle_y);
+            bV[i] = sin(nearest * angle_y);
+            cH[i] = cos(next_nearest * angle_x);
+            dH[i] = sin(next_nearest * angle_x);
+            cV[i] = cos(next_nearest * angle_y);
+            dV[i] = sin(next_nearest * angle_y);
+        }
+        if (coordinate_system == "cylindrical") {
+            kin_radial[i] = delta_t / (8. * mass[i] * delta_x * delta_x);
+        }
+    }
+    if (two_wavefunctions) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component*>(hamiltonian);
+        coupling_const[0] = delta_t * hamiltonian2->coupling_a;
+        coupling_const[1] = delta_t * hamiltonian2->coupling_b;
+        coupling_const[2] = delta_t * hamiltonian2->coupling_ab;
+        coupling_const[3] = 0.5 * hamiltonian2->omega_r;
+        coupling_const[4] = 0.5 * hamiltonian2->omega_i;
+        // LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
+        // LeeHuangYang_coupling[1] = hamiltonian->LeeHuangYang_coupling_b  * delta_t;
+    }
+    else {
+        coupling_const[0] = hamiltonian->coupling_a * delta_t;
+        coupling_const[1] = 0.;
+        coupling_const[2] = 0.;
+        LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
+        LeeHuangYang_coupling[1] = 0;
+    }
+}
+
+bool CPUBlock::update_coefficients(Hamiltonian *hamiltonian, double delta_t) {
+    set_coefficients(hamiltonian, delta_t);
+    return true;
+}
+
+bool CPUBlock::update_parameters(const KernelConfig &config) {
+    // The buffers and the MPI datatypes only depend on the geometry, which must be unchanged
+    if (config.two_components != two_wavefunctions || config.n_states != n_states ||
+            config.states[0]->p_real != p_real[0][0] || config.states[0]->p_imag != p_imag[0][0] ||
+            config.grid->halo_x != (int)halo_x || config.grid->halo_y != (int)halo_y) {
+        return false;
+    }
+    imag_time = config.imag_time;
+    set_coefficients(config.hamiltonian, config.delta_t);
+    tot_norm = 0;
+    for (int i = 0; i < n_states; i++) {
+        norm[i] = config.norm[i];
+        tot_norm += norm[i];
+    }
+    for (int i = 0; i < (two_wavefunctions ? 2 : 1); i++) {
+        external_pot_real[i] = config.external_pot_real[i];
+        external_pot_imag[i] = config.external_pot_imag[i];
+    }
+    orthogonalization_period = config.orthogonalization_period;
+    set_halo_precision(config.halo_precision, config.halo_resync_period);
+    // Resume from the buffers of the states, which hold the last evolved wave functions
+    // and any change made to the states between two evolutions
+    sense = 0;
+    state_index = 0;
+    return true;
+}
+
+ITrotterKernel *create_cpu_kernel(const KernelConfig &config) {
+    CPUBlock *kernel;
+    if (config.two_components) {
+        kernel = new CPUBlock(config.grid, config.states[0], config.states[1], static_cast<Hamiltonian2Component*>(config.hamiltonian),
+                              config.external_pot_real, config.external_pot_imag, config.delta_t, config.norm, config.imag_time);
+    }
+    else if (config.n_states > 1) {
+        kernel = new CPUBlock(config.grid, config.states, config.n_states, config.hamiltonian, config.external_pot_real[0], config.external_pot_imag[0],
+                              config.delta_t, config.norm, config.imag_time, config.orthogonalization_period);
+    }
+    else {
+        kernel = new CPUBlock(config.grid, config.states[0], config.hamiltonian, config.external_pot_real[0], config.external_pot_imag[0],
+                              config.delta_t, config.norm[0], config.imag_time);
+    }
+    kernel->set_halo_precision(config.halo_precision, config.halo_resync_period);
+    return kernel;
+}
+
+void CPUBlock::set_halo_precision(string precision, int resync_period) {
+#ifdef HAVE_MPI
+    float_halos = precision == "float";
+    halo_resync_period = resync_period;
+    // Every wave function starts again with an exchange in double precision
+    halo_exchanges.assign(n_states > 2 ? n_states : 2, 0);
+    if (float_halos && halo_reference.empty()) {
+        size_t strips = 8 * (size_t(inner_end_y - inner_start_y) * halo_x + halo_y * tile_width);
+        halo_reference.resize(halo_exchanges.size() * strips);
+        halo_message.resize(halo_exchanges.size() * strips);
+        track_memory(halo_reference.size() * (sizeof(double) + sizeof(float)), MEMORY_KERNEL);
+    }
+#endif
+}
+
 CPUBlock::~CPUBlock() {
-    delete [] p_real[0][1];
-    delete [] p_imag[0][1];
-    delete [] p_real[1][1];
-    delete [] p_imag[1][1];
+    for (int i = 0; i < (n_states > 2 ? n_states : 2); i++) {
+        free_tracked(p_real[i][1]);
+        free_tracked(p_imag[i][1]);
+    }
+    delete [] p_real;
+    delete [] p_imag;
+#ifdef HAVE_MPI
+    delete [] req;
+    delete [] statuses;
+    track_memory(-long(halo_reference.size() * (sizeof(double) + sizeof(float))), MEMORY_KERNEL);
+#endif
     delete [] aH;
     delete [] bH;
     delete [] aV;
     delete [] bV;
+    delete [] cH;
+    delete [] dH;
+    delete [] cV;
+    delete [] dV;
+    delete [] kin_radial;
     delete [] norm;
     delete [] coupling_const;
     delete [] LeeHuangYang_coupling;
 }
 
-void CPUBlock::run_kernel() {
-    // Inner part
-    int inner = 1, sides = 0;
-    if (halo_y == 0) {
+void CPUBlock::process_band_states(size_t read_y, size_t read_height, size_t write_offset, size_t write_height, int inner, int sides) {
+    // Several states share the Hamiltonian: they are evolved one after the other on the same band
+    int first = multiple_states ? 0 : state_index;
+    int last = multiple_states ? n_states : state_index + 1;
+    int component = multiple_states ? 0 : state_index;
+    size_t band_offset = read_y * tile_width, band_count = read_height * tile_width;
+    if (inner) {
+        // Out of core, the next band of the thread is read while this one is evolved (no-ops for buffers in RAM)
+        size_t next = (read_y + block_height - 2 * halo_y) * tile_width;
+        if (next < tile_width * tile_height) {
+            size_t count = min(band_count, tile_width * tile_height - next);
+            for (int i = first; i < last; i++) {
+                prefetch_tracked(p_real[i][sense], next, count);
+                prefetch_tracked(p_imag[i][sense], next, count);
+            }
+            prefetch_tracked(external_pot_real[component], next, count);
+            prefetch_tracked(external_pot_imag[component], next, count);
+        }
+    }
+    for (int i = first; i < last; i++) {
+        int other = two_wavefunctions ? 1 - i : i;
         process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
+                     start_x, start_y, period_x, period_y,
                      alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, halo_y, block_height - 2 * halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
+                     halo_x, read_y, read_height, write_offset, write_height,
+                     aH[component], bH[component], aV[component], bV[component], cH[component], dH[component], cV[component], dV[component], kin_radial[component],
+                     coupling_const[component], coupling_const[2], LeeHuangYang_coupling[component],
+                     external_pot_real[component], external_pot_imag[component],
+                     p_real[i][sense], p_imag[i][sense],
+                     p_real[other][sense], p_imag[other][sense],
+                     p_real[i][1 - sense], p_imag[i][1 - sense],
                      inner, sides, imag_time, coordinate_system);
+    }
+    if (inner) {
+        // The rows below the overlap with the next band are done with: let them go back to the scratch files
+        size_t done = read_height > 2 * halo_y ? (read_height - 2 * halo_y) * tile_width : 0;
+        for (int i = first; i < last; i++) {
+            release_tracked(p_real[i][1 - sense], (read_y + write_offset) * tile_width, write_height * tile_width);
+            release_tracked(p_imag[i][1 - sense], (read_y + write_offset) * tile_width, write_height * tile_width);
+            release_tracked(p_real[i][sense], band_offset, done);
+            release_tracked(p_imag[i][sense], band_offset, done);
+        }
+        release_tracked(external_pot_real[component], band_offset, done);
+        release_tracked(external_pot_imag[component], band_offset, done);
+    }
+}
 
+void CPUBlock::run_kernel() {
+    // Inner part
+    int inner = 1, sides = 0;
+    if (halo_y == 0) {
+        process_band_states(0, block_height, halo_y, block_height - 2 * halo_y, inner, sides);
     }
     else {
 #ifndef HAVE_MPI
@@ -437,17 +769,7 @@ void CPUBlock::run_kernel() {
             for (int block_start = block_height - 2 * halo_y;
             block_start < int(tile_height - block_height);
             block_start += block_height - 2 * halo_y) {
-
-                process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                alpha_x, alpha_y, tile_width, block_width, block_height,
-                halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                external_pot_real[state_index], external_pot_imag[state_index],
-                p_real[state_index][sense], p_imag[state_index][sense],
-                p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                inner, sides, imag_time, coordinate_system);
+                process_band_states(block_start, block_height, halo_y, block_height - 2 * halo_y, inner, sides);
             }
         }
     }
@@ -460,16 +782,7 @@ void CPUBlock::run_kernel_on_halo() {
         // One full band
         inner = 1;
         sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, tile_height, 0, tile_height,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+        process_band_states(0, tile_height, 0, tile_height, inner, sides);
     }
     else {
 
@@ -480,50 +793,24 @@ void CPUBlock::run_kernel_on_halo() {
         #pragma omp parallel for
 #endif
         for (int block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {
-            process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                         alpha_x, alpha_y, tile_width, block_width, block_height,
-                         halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                         aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                         coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                         external_pot_real[state_index], external_pot_imag[state_index],
-                         p_real[state_index][sense], p_imag[state_index][sense],
-                         p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                         p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                         inner, sides, imag_time, coordinate_system);
+            process_band_states(block_start, block_height, halo_y, block_height - 2 * halo_y, inner, sides);
         }
         size_t block_start;
         for (block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {}
         // First band
         inner = 1;
         sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, 0, block_height - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+        process_band_states(0, block_height, 0, block_height - halo_y, inner, sides);
 
         // Last band
         inner = 1;
         sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, block_start, tile_height - block_start, halo_y, tile_height - block_start - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+        process_band_states(block_start, tile_height - block_start, halo_y, tile_height - block_start - halo_y, inner, sides);
     }
 }
 
 double CPUBlock::calculate_squared_norm(bool global) const {
+    TRACE_SCOPE("squared_norm");
     double norm2 = 0.;
 #ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:norm2)
@@ -538,17 +825,27 @@ double CPUBlock::calculate_squared_norm(bool global) const {
         int nProcs = 1;
         MPI_Comm_size(cartcomm, &nProcs);
         double *sums = new double[nProcs];
+        double start = trace_time();
         MPI_Allgather(&norm2, 1, MPI_DOUBLE, sums, 1, MPI_DOUBLE, cartcomm);
+        comm_stats.collective_seconds += trace_time() - start;
+        comm_stats.collective_calls++;
         norm2 = 0.;
         for(int i = 0; i < nProcs; i++)
             norm2 += sums[i];
         delete [] sums;
     }
 #endif
-    return norm2 * delta_x * delta_y;
+    return norm2 * delta_x * delta_y * symmetry_factor;
 }
 
 void CPUBlock::wait_for_completion() {
+    if (multiple_states) {
+        if (imag_time) {
+            orthonormalize_states(step_count % orthogonalization_period == 0);
+        }
+        step_count++;
+        return;
+    }
     if (imag_time && norm[state_index] != 0) {
         //normalization
         double tot_norm = calculate_squared_norm(true);
@@ -578,6 +875,111 @@ void CPUBlock::get_sample(size_t dest_stride, size_t x, size_t y, size_t width,
     }
 }
 
+void CPUBlock::get_state_sample(int index, size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag) const {
+    memcpy2D(dest_real, dest_stride * sizeof(double), &(p_real[index][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+    memcpy2D(dest_imag, dest_stride * sizeof(double), &(p_imag[index][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+}
+
+void CPUBlock::orthonormalize_states(bool orthogonalize) {
+    TRACE_SCOPE("orthonormalization");
+    int n = n_states;
+    int ini_y = inner_start_y - start_y, end_y_inner = inner_end_y - start_y;
+    int ini_x = inner_start_x - start_x, end_x_inner = inner_end_x - start_x;
+    // Upper triangle of the overlap matrix <psi_a|psi_b> (real and imaginary parts), or its diagonal only
+    double *overlap = new double[2 * n * n];
+    for (int i = 0; i < 2 * n * n; i++) {
+        overlap[i] = 0.;
+    }
+#ifndef HAVE_MPI
+    #pragma omp parallel for reduction(+:overlap[:2 * n * n])
+#endif
+    for (int i = ini_y; i < end_y_inner; i++) {
+        for (int a = 0; a < n; a++) {
+            const double *a_real = &p_real[a][sense][i * tile_width];
+            const double *a_imag = &p_imag[a][sense][i * tile_width];
+            for (int b = a; b < (orthogonalize ? n : a + 1); b++) {
+                const double *b_real = &p_real[b][sense][i * tile_width];
+                const double *b_imag = &p_imag[b][sense][i * tile_width];
+                double sum_real = 0., sum_imag = 0.;
+                for (int j = ini_x; j < end_x_inner; j++) {
+                    sum_real += a_real[j] * b_real[j] + a_imag[j] * b_imag[j];
+                    sum_imag += a_real[j] * b_imag[j] - a_imag[j] * b_real[j];
+                }
+                overlap[2 * (a * n + b)] += sum_real;
+                overlap[2 * (a * n + b) + 1] += sum_imag;
+            }
+        }
+    }
+#ifdef HAVE_MPI
+    // A single reduction gathers the whole overlap matrix
+    double start = trace_time();
+    MPI_Allreduce(MPI_IN_PLACE, overlap, 2 * n * n, MPI_DOUBLE, MPI_SUM, cartcomm);
+    comm_stats.collective_seconds += trace_time() - start;
+    comm_stats.collective_calls++;
+#endif
+    // The states are multiplied by the upper triangular matrix M = R^-1, where the overlap matrix is S = R^H R
+    // (Cholesky decomposition): each new state only mixes the states preceding it, as in Gram-Schmidt,
+    // so that the first state relaxes to the ground state and the following ones to the excited states.
+    complex<double> *R = new complex<double>[n * n];
+    complex<double> *M = new complex<double>[n * n];
+    for (int i = 0; i < n * n; i++) {
+        R[i] = M[i] = 0.;
+    }
+    for (int a = 0; a < n; a++) {
+        for (int b = a; b < (orthogonalize ? n : a + 1); b++) {
+            double area = delta_x * delta_y * symmetry_factor;
+            complex<double> s_ab(overlap[2 * (a * n + b)] * area, overlap[2 * (a * n + b) + 1] * area);
+            for (int k = 0; k < a; k++) {
+                s_ab -= conj(R[k * n + a]) * R[k * n + b];
+            }
+            if (b == a) {
+                if (real(s_ab) <= 0.) {
+                    my_abort("The states are linearly dependent and cannot be orthonormalized");
+                }
+                R[a * n + a] = sqrt(real(s_ab));
+            }
+            else {
+                R[a * n + b] = s_ab / R[a * n + a];
+            }
+        }
+    }
+    for (int b = 0; b < n; b++) {
+        M[b * n + b] = 1. / R[b * n + b];
+        for (int a = b - 1; a >= 0; a--) {
+            complex<double> sum = 0.;
+            for (int k = a + 1; k <= b; k++) {
+                sum += R[a * n + k] * M[k * n + b];
+            }
+            M[a * n + b] = -sum / R[a * n + a];
+        }
+        // Restore the squared norm of the state
+        for (int a = 0; a <= b; a++) {
+            M[a * n + b] *= sqrt(norm[b]);
+        }
+    }
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < int(tile_height); i++) {
+        // The states are updated from the last one, which is the only one needing all the others unchanged
+        for (int b = n - 1; b >= 0; b--) {
+            double *b_real = &p_real[b][sense][i * tile_width];
+            double *b_imag = &p_imag[b][sense][i * tile_width];
+            for (size_t j = 0; j < tile_width; j++) {
+                complex<double> value = complex<double>(b_real[j], b_imag[j]) * M[b * n + b];
+                for (int a = 0; a < b && orthogonalize; a++) {
+                    value += complex<double>(p_real[a][sense][i * tile_width + j], p_imag[a][sense][i * tile_width + j]) * M[a * n + b];
+                }
+                b_real[j] = real(value);
+                b_imag[j] = imag(value);
+            }
+        }
+    }
+    delete [] overlap;
+    delete [] R;
+    delete [] M;
+}
+
 void CPUBlock::rabi_coupling(double var, double delta_t) {
     double norm_omega = sqrt(coupling_const[3] * coupling_const[3] + coupling_const[4] * coupling_const[4]);
     double cc, cs_r, cs_i;
@@ -632,9 +1034,11 @@ void CPUBlock::normalization() {
             }
         }
 #ifdef HAVE_MPI
-
+        double start = trace_time();
         MPI_Allgather(&sum_a, 1, MPI_DOUBLE, sums_a, 1, MPI_DOUBLE, cartcomm);
         MPI_Allgather(&sum_b, 1, MPI_DOUBLE, sums_b, 1, MPI_DOUBLE, cartcomm);
+        comm_stats.collective_seconds += trace_time() - start;
+        comm_stats.collective_calls += 2;
 #else
         sums_a[0] = sum_a;
         sums_b[0] = sum_b;
@@ -644,7 +1048,7 @@ void CPUBlock::normalization() {
             tot_sum_a += sums_a[i];
             tot_sum_b += sums_b[i];
         }
-        double _norm = sqrt((tot_sum_a + tot_sum_b) * delta_x * delta_y / tot_norm);
+        double _norm = sqrt((tot_sum_a + tot_sum_b) * delta_x * delta_y * symmetry_factor / tot_norm);
 
         for(size_t i = 0; i < tile_height; i++) {
             for(size_t j = 0; j < tile_width; j++) {
@@ -684,64 +1088,239 @@ void CPUBlock::cpy_first_positive_to_first_negative() {
                     p_imag[1][sense][peer] = sign * p_imag[1][sense][idx];
                 }
             }
+            // The states evolved together share the angular momentum of the first one
+            for (int i = 1; multiple_states && i < n_states; i++) {
+                for (int j = start_y, idx = 1, peer = 0; j < end_y; j += 1, idx += stride, peer += stride) {
+                    p_real[i][sense][peer] = sign * p_real[i][sense][idx];
+                    p_imag[i][sense][peer] = sign * p_imag[i][sense][idx];
+                }
+            }
         }
     }
 }
 
 void CPUBlock::start_halo_exchange() {
-    // Halo exchange: LEFT/RIGHT
+    int first = multiple_states ? 0 : state_index;
+    int last = multiple_states ? n_states : state_index + 1;
+    for (int i = first; i < last; i++) {
+        // Halo exchange: LEFT/RIGHT
 #ifdef HAVE_MPI
-    int offset = (inner_start_y - start_y) * tile_width;
-    MPI_Irecv(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 1, cartcomm, req);
-    MPI_Irecv(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 2, cartcomm, req + 1);
-    offset = (inner_start_y - start_y) * tile_width + inner_end_x - start_x;
-    MPI_Irecv(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 3, cartcomm, req + 2);
-    MPI_Irecv(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 4, cartcomm, req + 3);
-
-    offset = (inner_start_y - start_y) * tile_width + inner_end_x - halo_x - start_x;
-    MPI_Isend(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 1, cartcomm, req + 4);
-    MPI_Isend(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 2, cartcomm, req + 5);
-    offset = (inner_start_y - start_y) * tile_width + halo_x;
-    MPI_Isend(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 3, cartcomm, req + 6);
-    MPI_Isend(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 4, cartcomm, req + 7);
+        MPI_Request *state_req = req + 8 * (i - first);
+        int tag = 4 * (i - first);
+        if (float_halo_step(i)) {
+            int neighbor[2] = {LEFT, RIGHT};
+            size_t recv_offset[2] = {(inner_start_y - start_y) * tile_width, (inner_start_y - start_y) * tile_width + inner_end_x - start_x};
+            size_t send_offset[2] = {(inner_start_y - start_y) * tile_width + halo_x, (inner_start_y - start_y) * tile_width + inner_end_x - halo_x - start_x};
+            post_float_halos(i, 0, p_real[i][1 - sense], p_imag[i][1 - sense], neighbor, recv_offset, send_offset,
+                             halo_x, inner_end_y - inner_start_y, state_req, tag);
+            count_halo_messages(LEFT, RIGHT, 2, double(inner_end_y - inner_start_y) * halo_x * sizeof(float));
+        }
+        else {
+            int offset = (inner_start_y - start_y) * tile_width;
+            MPI_Irecv(p_real[i][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], tag + 1, cartcomm, state_req);
+            MPI_Irecv(p_imag[i][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], tag + 2, cartcomm, state_req + 1);
+            offset = (inner_start_y - start_y) * tile_width + inner_end_x - start_x;
+            MPI_Irecv(p_real[i][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], tag + 3, cartcomm, state_req + 2);
+            MPI_Irecv(p_imag[i][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], tag + 4, cartcomm, state_req + 3);
+
+            offset = (inner_start_y - start_y) * tile_width + inner_end_x - halo_x - start_x;
+            MPI_Isend(p_real[i][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], tag + 1, cartcomm, state_req + 4);
+            MPI_Isend(p_imag[i][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], tag + 2, cartcomm, state_req + 5);
+            offset = (inner_start_y - start_y) * tile_width + halo_x;
+            MPI_Isend(p_real[i][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], tag + 3, cartcomm, state_req + 6);
+            MPI_Isend(p_imag[i][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], tag + 4, cartcomm, state_req + 7);
+            count_halo_messages(LEFT, RIGHT, 2, double(inner_end_y - inner_start_y) * halo_x * sizeof(double));
+        }
 #else
-    if(periods[1] != 0) {
-        int offset = (inner_start_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_real[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-    }
+        if(periods[1] != 0) {
+            int offset = (inner_start_y - start_y) * tile_width;
+            memcpy2D(&(p_real[i][1 - sense][offset]), tile_width * sizeof(double), &(p_real[i][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+            memcpy2D(&(p_imag[i][1 - sense][offset]), tile_width * sizeof(double), &(p_imag[i][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+            memcpy2D(&(p_real[i][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_real[i][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+            memcpy2D(&(p_imag[i][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_imag[i][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+        }
 #endif
+        // The halo at a symmetry plane mirrors the tile
+        if (parity_x != 0 && start_x < 0) {
+            fill_mirror_halos(p_real[i][1 - sense], p_imag[i][1 - sense], tile_width, tile_height, halo_x, halo_y, parity_x, 0);
+        }
+    }
 }
 
+#ifdef HAVE_MPI
+void CPUBlock::count_halo_messages(int first_neighbor, int second_neighbor, int messages, double bytes) {
+    int directions[2] = {first_neighbor, second_neighbor};
+    for (int k = 0; k < 2; k++) {
+        if (neighbors[directions[k]] != MPI_PROC_NULL) {
+            comm_stats.messages_sent[directions[k]] += messages;
+            comm_stats.messages_received[directions[k]] += messages;
+            comm_stats.bytes_sent[directions[k]] += messages * bytes;
+            comm_stats.bytes_received[directions[k]] += messages * bytes;
+        }
+    }
+}
+#endif
+
 void CPUBlock::finish_halo_exchange() {
+    int first = multiple_states ? 0 : state_index;
+    int last = multiple_states ? n_states : state_index + 1;
+#ifdef HAVE_MPI
+    {
+        TRACE_SCOPE("mpi_waitall");
+        double start = trace_time();
+        MPI_Waitall(8 * (last - first), req, statuses);
+        comm_stats.wait_seconds[0] += trace_time() - start;
+        comm_stats.wait_calls[0]++;
+    }
+    if (float_halos) {
+        int neighbor[2] = {LEFT, RIGHT};
+        for (int i = first; i < last; i++) {
+            size_t recv_offset[2] = {(inner_start_y - start_y) * tile_width, (inner_start_y - start_y) * tile_width + inner_end_x - start_x};
+            size_t send_offset[2] = {(inner_start_y - start_y) * tile_width + halo_x, (inner_start_y - start_y) * tile_width + inner_end_x - halo_x - start_x};
+            settle_halos(i, 0, p_real[i][sense], p_imag[i][sense], neighbor, recv_offset, send_offset, halo_x, inner_end_y - inner_start_y);
+        }
+    }
+#endif
+    for (int i = first; i < last; i++) {
 #ifdef HAVE_MPI
-    MPI_Waitall(8, req, statuses);
-
-    // Halo exchange: UP/DOWN
-    int offset = 0;
-    MPI_Irecv(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 1, cartcomm, req);
-    MPI_Irecv(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 2, cartcomm, req + 1);
-    offset = (inner_end_y - start_y) * tile_width;
-    MPI_Irecv(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 3, cartcomm, req + 2);
-    MPI_Irecv(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 4, cartcomm, req + 3);
-
-    offset = (inner_end_y - halo_y - start_y) * tile_width;
-    MPI_Isend(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 1, cartcomm, req + 4);
-    MPI_Isend(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 2, cartcomm, req + 5);
-    offset = halo_y * tile_width;
-    MPI_Isend(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 3, cartcomm, req + 6);
-    MPI_Isend(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 4, cartcomm, req + 7);
-
-    MPI_Waitall(8, req, statuses);
+        // Halo exchange: UP/DOWN
+        MPI_Request *state_req = req + 8 * (i - first);
+        int tag = 4 * (i - first);
+        if (float_halo_step(i)) {
+            int neighbor[2] = {UP, DOWN};
+            size_t recv_offset[2] = {0, (inner_end_y - start_y) * tile_width};
+            size_t send_offset[2] = {halo_y * tile_width, (inner_end_y - halo_y - start_y) * tile_width};
+            post_float_halos(i, 1, p_real[i][sense], p_imag[i][sense], neighbor, recv_offset, send_offset,
+                             tile_width, halo_y, state_req, tag);
+            count_halo_messages(UP, DOWN, 2, double(halo_y) * tile_width * sizeof(float));
+        }
+        else {
+            int offset = 0;
+            MPI_Irecv(p_real[i][sense] + offset, 1, horizontalBorder, neighbors[UP], tag + 1, cartcomm, state_req);
+            MPI_Irecv(p_imag[i][sense] + offset, 1, horizontalBorder, neighbors[UP], tag + 2, cartcomm, state_req + 1);
+            offset = (inner_end_y - start_y) * tile_width;
+            MPI_Irecv(p_real[i][sense] + offset, 1, horizontalBorder, neighbors[DOWN], tag + 3, cartcomm, state_req + 2);
+            MPI_Irecv(p_imag[i][sense] + offset, 1, horizontalBorder, neighbors[DOWN], tag + 4, cartcomm, state_req + 3);
+
+            offset = (inner_end_y - halo_y - start_y) * tile_width;
+            MPI_Isend(p_real[i][sense] + offset, 1, horizontalBorder, neighbors[DOWN], tag + 1, cartcomm, state_req + 4);
+            MPI_Isend(p_imag[i][sense] + offset, 1, horizontalBorder, neighbors[DOWN], tag + 2, cartcomm, state_req + 5);
+            offset = halo_y * tile_width;
+            MPI_Isend(p_real[i][sense] + offset, 1, horizontalBorder, neighbors[UP], tag + 3, cartcomm, state_req + 6);
+            MPI_Isend(p_imag[i][sense] + offset, 1, horizontalBorder, neighbors[UP], tag + 4, cartcomm, state_req + 7);
+            count_halo_messages(UP, DOWN, 2, double(halo_y) * tile_width * sizeof(double));
+        }
 #else
-    if(periods[0] != 0) {
-        int offset = (inner_end_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][sense][0]), tile_width * sizeof(double), &(p_real[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][0]), tile_width * sizeof(double), &(p_imag[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_real[state_index][sense][offset]), tile_width * sizeof(double), &(p_real[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        if(periods[0] != 0) {
+            int offset = (inner_end_y - start_y) * tile_width;
+            memcpy2D(&(p_real[i][sense][0]), tile_width * sizeof(double), &(p_real[i][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(&(p_imag[i][sense][0]), tile_width * sizeof(double), &(p_imag[i][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(&(p_real[i][sense][offset]), tile_width * sizeof(double), &(p_real[i][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(&(p_imag[i][sense][offset]), tile_width * sizeof(double), &(p_imag[i][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        }
+#endif
+        if (parity_y != 0 && start_y < 0) {
+            fill_mirror_halos(p_real[i][sense], p_imag[i][sense], tile_width, tile_height, halo_x, halo_y, 0, parity_y);
+        }
+    }
+#ifdef HAVE_MPI
+    {
+        TRACE_SCOPE("mpi_waitall");
+        double start = trace_time();
+        MPI_Waitall(8 * (last - first), req, statuses);
+        comm_stats.wait_seconds[1] += trace_time() - start;
+        comm_stats.wait_calls[1]++;
+    }
+    if (float_halos) {
+        int neighbor[2] = {UP, DOWN};
+        size_t recv_offset[2] = {0, (inner_end_y - start_y) * tile_width};
+        size_t send_offset[2] = {halo_y * tile_width, (inner_end_y - halo_y - start_y) * tile_width};
+        for (int i = first; i < last; i++) {
+            settle_halos(i, 1, p_real[i][sense], p_imag[i][sense], neighbor, recv_offset, send_offset, tile_width, halo_y);
+            halo_exchanges[i]++;
+        }
     }
 #endif
 }
+
+#ifdef HAVE_MPI
+bool CPUBlock::float_halo_step(int i) const {
+    return float_halos && halo_exchanges[i] % halo_resync_period != 0;
+}
+
+/**
+ * Change of a strip of the tile since the previous message, rounded to float; the reference follows the values the
+ * receiver reconstructs, so that the rounding errors do not add up from one message to the next.
+ */
+static void encode_strip(const double *tile, size_t stride, size_t width, size_t height, double *reference, float *message) {
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            size_t k = y * width + x;
+            message[k] = float(tile[y * stride + x] - reference[k]);
+            reference[k] += message[k];
+        }
+    }
+}
+
+static void decode_strip(double *tile, size_t stride, size_t width, size_t height, double *reference, const float *message) {
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            size_t k = y * width + x;
+            reference[k] += message[k];
+            tile[y * stride + x] = reference[k];
+        }
+    }
+}
+
+void CPUBlock::post_float_halos(int i, int direction, double *real, double *imag, const int neighbor[2], const size_t recv_offset[2],
+                                const size_t send_offset[2], size_t width, size_t height, MPI_Request *state_req, int tag) {
+    // Eight strips per direction, in the order of the requests: received from the two neighbours, then sent to them
+    size_t strip = width * height;
+    size_t section = halo_reference.size() / halo_exchanges.size();
+    size_t first_strip = i * section + (direction == 0 ? 0 : 8 * size_t(inner_end_y - inner_start_y) * halo_x);
+    double *reference = halo_reference.data() + first_strip;
+    float *message = halo_message.data() + first_strip;
+    double *parts[2] = {real, imag};
+    for (int k = 0; k < 2; k++) {
+        for (int part = 0; part < 2; part++) {
+            MPI_Irecv(message + (2 * k + part) * strip, strip, MPI_FLOAT, neighbors[neighbor[k]], tag + 2 * k + part + 1, cartcomm, state_req + 2 * k + part);
+        }
+    }
+    for (int k = 0; k < 2; k++) {
+        // What is sent to the second neighbour arrives from the first one on the other side
+        int to = neighbor[1 - k];
+        for (int part = 0; part < 2; part++) {
+            size_t index = (4 + 2 * k + part) * strip;
+            if (neighbors[to] != MPI_PROC_NULL) {
+                encode_strip(parts[part] + send_offset[1 - k], tile_width, width, height, reference + index, message + index);
+            }
+            MPI_Isend(message + index, strip, MPI_FLOAT, neighbors[to], tag + 2 * k + part + 1, cartcomm, state_req + 4 + 2 * k + part);
+        }
+    }
+}
+
+void CPUBlock::settle_halos(int i, int direction, double *real, double *imag, const int neighbor[2], const size_t recv_offset[2],
+                            const size_t send_offset[2], size_t width, size_t height) {
+    size_t strip = width * height;
+    size_t section = halo_reference.size() / halo_exchanges.size();
+    size_t first_strip = i * section + (direction == 0 ? 0 : 8 * size_t(inner_end_y - inner_start_y) * halo_x);
+    double *reference = halo_reference.data() + first_strip;
+    float *message = halo_message.data() + first_strip;
+    double *parts[2] = {real, imag};
+    bool lossy = float_halo_step(i);
+    for (int k = 0; k < 2; k++) {
+        for (int part = 0; part < 2; part++) {
+            size_t index = (2 * k + part) * strip;
+            if (lossy && neighbors[neighbor[k]] != MPI_PROC_NULL) {
+                decode_strip(parts[part] + recv_offset[k], tile_width, width, height, reference + index, message + index);
+            }
+            else if (!lossy) {
+                // Both sides now hold the strips in double precision: the next float messages are relative to them
+                memcpy2D(reference + index, width * sizeof(double), parts[part] + recv_offset[k], tile_width * sizeof(double), width * sizeof(double), height);
+                memcpy2D(reference + (4 + 2 * k + part) * strip, width * sizeof(double), parts[part] + send_offset[1 - k], tile_width * sizeof(double),
+                         width * sizeof(double), height);
+            }
+        }
+    }
+}
+#endif
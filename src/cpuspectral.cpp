@@ -0,0 +1,636 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#include "kernel.h"
+#include <algorithm>
+#include <cstring>
+
+// Above this prime factor, the transform is computed as a convolution of power-of-two length (Bluestein's algorithm)
+#define MAX_DIRECT_FACTOR 16
+
+FFTPlan::FFTPlan(int _n): n(_n), max_factor(1), convolution_length(0) {
+    if (n < 1) {
+        my_abort("The length of a Fourier transform must be positive");
+    }
+    int rest = n;
+    while (rest % 4 == 0) {
+        factors.push_back(4);
+        rest /= 4;
+    }
+    for (int p = 2; p * p <= rest; p++) {
+        while (rest % p == 0) {
+            factors.push_back(p);
+            rest /= p;
+        }
+    }
+    if (rest > 1) {
+        factors.push_back(rest);
+    }
+    for (size_t i = 0; i < factors.size(); i++) {
+        max_factor = max(max_factor, factors[i]);
+    }
+    if (max_factor > MAX_DIRECT_FACTOR) {
+        // X_k = c_k sum_j (x_j c_j) conj(c_k-j), with the chirp c_j = exp(-i pi j^2 / n)
+        convolution_length = 1;
+        while (convolution_length < 2 * n - 1) {
+            convolution_length *= 2;
+        }
+        convolution.push_back(FFTPlan(convolution_length));
+        chirp.resize(n);
+        for (int j = 0; j < n; j++) {
+            // j^2 mod 2n keeps the argument small
+            double angle = -M_PI * double((long(j) * j) % (2L * n)) / n;
+            chirp[j] = complex<double>(cos(angle), sin(angle));
+        }
+        chirp_spectrum.assign(convolution_length, 0.);
+        chirp_spectrum[0] = conj(chirp[0]);
+        for (int j = 1; j < n; j++) {
+            chirp_spectrum[j] = chirp_spectrum[convolution_length - j] = conj(chirp[j]);
+        }
+        vector<complex<double> > work(convolution[0].work_size());
+        convolution[0].transform(&chirp_spectrum[0], &work[0], false);
+        for (int j = 0; j < convolution_length; j++) {
+            chirp_spectrum[j] /= double(convolution_length);
+        }
+        return;
+    }
+    twiddles[0].resize(n);
+    twiddles[1].resize(n);
+    for (int k = 0; k < n; k++) {
+        double angle = -2. * M_PI * k / n;
+        twiddles[0][k] = complex<double>(cos(angle), sin(angle));
+        twiddles[1][k] = conj(twiddles[0][k]);
+    }
+}
+
+int FFTPlan::work_size() const {
+    if (convolution_length > 0) {
+        return convolution_length + convolution[0].work_size();
+    }
+    return n + max_factor;
+}
+
+void FFTPlan::transform(complex<double> *data, complex<double> *work, bool inverse) const {
+    if (n == 1) {
+        return;
+    }
+    if (convolution_length > 0) {
+        // The inverse transform is the conjugate of the direct transform of the conjugate
+        for (int j = 0; j < n; j++) {
+            work[j] = (inverse ? conj(data[j]) : data[j]) * chirp[j];
+        }
+        for (int j = n; j < convolution_length; j++) {
+            work[j] = 0.;
+        }
+        convolution[0].transform(work, work + convolution_length, false);
+        for (int j = 0; j < convolution_length; j++) {
+            work[j] *= chirp_spectrum[j];
+        }
+        convolution[0].transform(work, work + convolution_length, true);
+        for (int k = 0; k < n; k++) {
+            data[k] = inverse ? conj(work[k] * chirp[k]) : work[k] * chirp[k];
+        }
+        return;
+    }
+    memcpy(work, data, n * sizeof(complex<double>));
+    recursive_transform(work, data, work + n, &twiddles[inverse ? 1 : 0][0], n, 1, 0);
+}
+
+void FFTPlan::recursive_transform(const complex<double> *in, complex<double> *out, complex<double> *scratch,
+                                  const complex<double> *roots, int length, int stride, int factor) const {
+    if (length == 1) {
+        out[0] = in[0];
+        return;
+    }
+    // Decimation in time: the p interleaved subsequences are transformed to consecutive blocks of out
+    int p = factors[factor];
+    int m = length / p;
+    for (int q = 0; q < p; q++) {
+        if (m == 1) {
+            out[q] = in[q * stride];
+        }
+        else {
+            recursive_transform(in + q * stride, out + q * m, scratch, roots, m, stride * p, factor + 1);
+        }
+    }
+    int twiddle_step = n / length;
+    if (p == 2) {
+        for (int k = 0; k < m; k++) {
+            complex<double> t = out[k + m] * roots[k * twiddle_step];
+            out[k + m] = out[k] - t;
+            out[k] += t;
+        }
+    }
+    else if (p == 4) {
+        // roots[n / 4] is -i for the direct transform and i for the inverse one
+        complex<double> quarter = roots[n / 4];
+        for (int k = 0; k < m; k++) {
+            complex<double> a0 = out[k];
+            complex<double> a1 = out[k + m] * roots[k * twiddle_step];
+            complex<double> a2 = out[k + 2 * m] * roots[2 * k * twiddle_step];
+            complex<double> a3 = out[k + 3 * m] * roots[3 * k * twiddle_step];
+            complex<double> t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3, t3 = (a1 - a3) * quarter;
+            out[k] = t0 + t2;
+            out[k + m] = t1 + t3;
+            out[k + 2 * m] = t0 - t2;
+            out[k + 3 * m] = t1 - t3;
+        }
+    }
+    else {
+        int root_step = n / p;
+        for (int k = 0; k < m; k++) {
+            for (int q = 0; q < p; q++) {
+                scratch[q] = out[q * m + k] * roots[q * k * twiddle_step];
+            }
+            for (int s = 0; s < p; s++) {
+                complex<double> sum = scratch[0];
+                for (int q = 1, index = s; q < p; q++, index = (index + s) % p) {
+                    sum += scratch[q] * roots[index * root_step];
+                }
+                out[k + s * m] = sum;
+            }
+        }
+    }
+}
+
+CPUSpectral::CPUSpectral(Lattice *grid, State **states, int _n_components, Hamiltonian *hamiltonian,
+                         double **_external_pot_real, double **_external_pot_imag,
+                         double delta_t, double *_norm, bool _imag_time):
+    n_components(_n_components),
+    imag_time(_imag_time),
+    state_index(0) {
+    if (grid->coordinate_system != "cartesian" || grid->periods[1] == 0 ||
+            (grid->global_no_halo_dim_y > 1 && grid->periods[0] == 0)) {
+        my_abort("The spectral kernel requires a cartesian lattice with periodic boundary conditions along every axis");
+    }
+    delta_x = grid->delta_x;
+    delta_y = grid->delta_y;
+    halo_x = grid->halo_x;
+    halo_y = grid->halo_y;
+    periods = grid->periods;
+    start_x = grid->start_x;
+    start_y = grid->start_y;
+    inner_start_x = grid->inner_start_x;
+    inner_end_x = grid->inner_end_x;
+    inner_start_y = grid->inner_start_y;
+    inner_end_y = grid->inner_end_y;
+    tile_width = grid->end_x - grid->start_x;
+    tile_height = grid->end_y - grid->start_y;
+    inner_width = inner_end_x - inner_start_x;
+    inner_height = inner_end_y - inner_start_y;
+    tot_norm = 0.;
+    for (int i = 0; i < n_components; i++) {
+        p_real[i] = states[i]->p_real;
+        p_imag[i] = states[i]->p_imag;
+        external_pot_real[i] = _external_pot_real[i];
+        external_pot_imag[i] = _external_pot_imag[i];
+        norm[i] = _norm[i];
+        tot_norm += norm[i];
+    }
+    plans[0] = FFTPlan(grid->global_no_halo_dim_x);
+    plans[1] = FFTPlan(grid->global_no_halo_dim_y);
+    spectrum.resize(inner_width * inner_height);
+    tracked_bytes = 0;
+    set_coefficients(hamiltonian, delta_t);
+
+#ifdef HAVE_MPI
+    cartcomm = grid->cartcomm;
+    // The x axis of one-dimensional lattices is split along the first dimension of the topology
+    int x_dim = halo_y == 0 ? 0 : 1;
+    MPI_Cart_shift(cartcomm, 1 - x_dim, 1, &neighbors[UP], &neighbors[DOWN]);
+    MPI_Cart_shift(cartcomm, x_dim, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+    for (int axis = 0; axis < 2; axis++) {
+        int cart_dim = axis == 0 ? x_dim : 1 - x_dim;
+        axis_procs[axis] = grid->mpi_dims[cart_dim];
+        axis_comm[axis] = MPI_COMM_NULL;
+        if (axis_procs[axis] > 1) {
+            int remain[2] = {cart_dim == 0, cart_dim == 1};
+            MPI_Cart_sub(cartcomm, remain, &axis_comm[axis]);
+        }
+    }
+
+    int count = inner_end_y - inner_start_y;  // The number of rows in the halo submatrix
+    int block_length = halo_x;  // The number of columns in the halo submatrix
+    int stride = tile_width;  // The combined width of the matrix with the halo
+    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
+    MPI_Type_commit (&verticalBorder);
+
+    count = halo_y; // The vertical halo in rows
+    block_length = tile_width;  // The number of columns of the matrix
+    stride = tile_width;  // The combined width of the matrix with the halo
+    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
+    MPI_Type_commit (&horizontalBorder);
+#endif
+}
+
+CPUSpectral::~CPUSpectral() {
+    track_memory(-tracked_bytes, MEMORY_KERNEL);
+#ifdef HAVE_MPI
+    for (int axis = 0; axis < 2; axis++) {
+        if (axis_comm[axis] != MPI_COMM_NULL) {
+            MPI_Comm_free(&axis_comm[axis]);
+        }
+    }
+    MPI_Type_free(&verticalBorder);
+    MPI_Type_free(&horizontalBorder);
+#endif
+}
+
+void CPUSpectral::set_coefficients(Hamiltonian *hamiltonian, double delta_t) {
+    double mass[2] = {hamiltonian->mass, 0.};
+    if (n_components == 2) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component*>(hamiltonian);
+        mass[1] = hamiltonian2->mass_b;
+        coupling_const[0] = delta_t * hamiltonian2->coupling_a;
+        coupling_const[1] = delta_t * hamiltonian2->coupling_b;
+        coupling_const[2] = delta_t * hamiltonian2->coupling_ab;
+        coupling_const[3] = 0.5 * hamiltonian2->omega_r;
+        coupling_const[4] = 0.5 * hamiltonian2->omega_i;
+        LeeHuangYang_coupling = 0.;
+    }
+    else {
+        coupling_const[0] = hamiltonian->coupling_a * delta_t;
+        coupling_const[1] = 0.;
+        coupling_const[2] = 0.;
+        coupling_const[3] = 0.;
+        coupling_const[4] = 0.;
+        LeeHuangYang_coupling = hamiltonian->LeeHuangYang_coupling_a * delta_t;
+    }
+    int dim_x = plans[0].size(), dim_y = plans[1].size();
+    // The inverse transform is not normalized: 1 / (dim_x dim_y) is folded in the kinetic operator
+    double scale = 1. / (double(dim_x) * double(dim_y));
+    for (int i = 0; i < n_components; i++) {
+        kinetic[i].resize(inner_width * inner_height);
+        for (size_t y = 0; y < inner_height; y++) {
+            int global_y = inner_start_y + y;
+            double k_y = 2. * M_PI / (dim_y * delta_y) * (global_y <= dim_y / 2 ? global_y : global_y - dim_y);
+            for (size_t x = 0; x < inner_width; x++) {
+                int global_x = inner_start_x + x;
+                double k_x = 2. * M_PI / (dim_x * delta_x) * (global_x <= dim_x / 2 ? global_x : global_x - dim_x);
+                double energy = (k_x * k_x + k_y * k_y) / (2. * mass[i]);
+                if (imag_time) {
+                    kinetic[i][y * inner_width + x] = scale * exp(-0.5 * delta_t * energy);
+                }
+                else {
+                    kinetic[i][y * inner_width + x] = polar(scale, -0.5 * delta_t * energy);
+                }
+            }
+        }
+    }
+    track_buffers();
+}
+
+void CPUSpectral::track_buffers() {
+    size_t capacity = spectrum.capacity() + kinetic[0].capacity() + kinetic[1].capacity();
+#ifdef HAVE_MPI
+    capacity += send_buffer.capacity() + recv_buffer.capacity() + line_buffer.capacity();
+#endif
+    long bytes = capacity * sizeof(complex<double>);
+    track_memory(bytes - tracked_bytes, MEMORY_KERNEL);
+    tracked_bytes = bytes;
+}
+
+void CPUSpectral::transform_axis(int axis, bool inverse) {
+    const FFTPlan &plan = plans[axis];
+    int global_length = plan.size();
+    int length = axis == 0 ? inner_width : inner_height;
+    int n_lines = axis == 0 ? inner_height : inner_width;
+    size_t point_stride = axis == 0 ? 1 : inner_width;
+    size_t line_stride = axis == 0 ? inner_width : 1;
+    complex<double> *data = &spectrum[0];
+#ifdef HAVE_MPI
+    if (axis_procs[axis] > 1) {
+        // Each process receives complete lines for its share of the local lines, as in a slab transpose,
+        // transforms them and sends them back, so that the spectrum keeps the layout of the tile
+        int procs = axis_procs[axis], rank;
+        MPI_Comm_rank(axis_comm[axis], &rank);
+        int lines_per_proc = (n_lines + procs - 1) / procs;
+        int block = (global_length + procs - 1) / procs;  // Length of the tiles along the axis, as in calculate_borders
+        int first_line = min(rank * lines_per_proc, n_lines);
+        int own_lines = min(first_line + lines_per_proc, n_lines) - first_line;
+        vector<int> send_counts(procs), send_displs(procs), recv_counts(procs), recv_displs(procs);
+        int send_total = 0, recv_total = 0;
+        for (int q = 0; q < procs; q++) {
+            int q_first = min(q * lines_per_proc, n_lines);
+            int q_lines = min(q_first + lines_per_proc, n_lines) - q_first;
+            int q_start = min(q * block, global_length);
+            int q_length = min(q_start + block, global_length) - q_start;
+            send_counts[q] = 2 * q_lines * length;
+            recv_counts[q] = 2 * own_lines * q_length;
+            send_displs[q] = send_total;
+            recv_displs[q] = recv_total;
+            send_total += send_counts[q];
+            recv_total += recv_counts[q];
+        }
+        send_buffer.resize(max(send_total / 2, 1));
+        recv_buffer.resize(max(recv_total / 2, 1));
+        line_buffer.resize(max(own_lines * global_length, 1));
+        track_buffers();
+        size_t pos = 0;
+        for (int l = 0; l < n_lines; l++) {
+            for (int i = 0; i < length; i++) {
+                send_buffer[pos++] = data[l * line_stride + i * point_stride];
+            }
+        }
+        {
+            TRACE_SCOPE("mpi_alltoallv");
+            MPI_Alltoallv(reinterpret_cast<double *>(&send_buffer[0]), &send_counts[0], &send_displs[0], MPI_DOUBLE,
+                          reinterpret_cast<double *>(&recv_buffer[0]), &recv_counts[0], &recv_displs[0], MPI_DOUBLE, axis_comm[axis]);
+        }
+        pos = 0;
+        for (int q = 0; q < procs; q++) {
+            int q_start = min(q * block, global_length);
+            int q_end = min(q_start + block, global_length);
+            for (int l = 0; l < own_lines; l++) {
+                for (int i = q_start; i < q_end; i++) {
+                    line_buffer[l * global_length + i] = recv_buffer[pos++];
+                }
+            }
+        }
+        vector<complex<double> > work(plan.work_size());
+        for (int l = 0; l < own_lines; l++) {
+            plan.transform(&line_buffer[l * global_length], &work[0], inverse);
+        }
+        pos = 0;
+        for (int q = 0; q < procs; q++) {
+            int q_start = min(q * block, global_length);
+            int q_end = min(q_start + block, global_length);
+            for (int l = 0; l < own_lines; l++) {
+                for (int i = q_start; i < q_end; i++) {
+                    recv_buffer[pos++] = line_buffer[l * global_length + i];
+                }
+            }
+        }
+        {
+            TRACE_SCOPE("mpi_alltoallv");
+            MPI_Alltoallv(reinterpret_cast<double *>(&recv_buffer[0]), &recv_counts[0], &recv_displs[0], MPI_DOUBLE,
+                          reinterpret_cast<double *>(&send_buffer[0]), &send_counts[0], &send_displs[0], MPI_DOUBLE, axis_comm[axis]);
+        }
+        pos = 0;
+        for (int l = 0; l < n_lines; l++) {
+            for (int i = 0; i < length; i++) {
+                data[l * line_stride + i * point_stride] = send_buffer[pos++];
+            }
+        }
+        return;
+    }
+#endif
+#ifndef HAVE_MPI
+    #pragma omp parallel default(shared)
+#endif
+    {
+        vector<complex<double> > line(global_length), work(plan.work_size());
+#ifndef HAVE_MPI
+        #pragma omp for
+#endif
+        for (int l = 0; l < n_lines; l++) {
+            for (int i = 0; i < length; i++) {
+                line[i] = data[l * line_stride + i * point_stride];
+            }
+            plan.transform(&line[0], &work[0], inverse);
+            for (int i = 0; i < length; i++) {
+                data[l * line_stride + i * point_stride] = line[i];
+            }
+        }
+    }
+}
+
+void CPUSpectral::kinetic_step(int component) {
+    double *real = p_real[component], *imag = p_imag[component];
+    size_t offset = (inner_start_y - start_y) * tile_width + inner_start_x - start_x;
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < int(inner_height); y++) {
+        for (size_t x = 0; x < inner_width; x++) {
+            spectrum[y * inner_width + x] = complex<double>(real[offset + y * tile_width + x], imag[offset + y * tile_width + x]);
+        }
+    }
+    transform_axis(0, false);
+    if (plans[1].size() > 1) {
+        transform_axis(1, false);
+    }
+    const complex<double> *operator_values = &kinetic[component][0];
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < int(inner_width * inner_height); i++) {
+        spectrum[i] *= operator_values[i];
+    }
+    if (plans[1].size() > 1) {
+        transform_axis(1, true);
+    }
+    transform_axis(0, true);
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < int(inner_height); y++) {
+        for (size_t x = 0; x < inner_width; x++) {
+            real[offset + y * tile_width + x] = spectrum[y * inner_width + x].real();
+            imag[offset + y * tile_width + x] = spectrum[y * inner_width + x].imag();
+        }
+    }
+}
+
+void CPUSpectral::run_kernel_on_halo() {}
+
+void CPUSpectral::run_kernel() {
+    int component = state_index;
+    int other = n_components == 2 ? 1 - component : component;
+    size_t offset = (inner_start_y - start_y) * tile_width + inner_start_x - start_x;
+    kinetic_step(component);
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < int(inner_height); y++) {
+        size_t row = offset + y * tile_width;
+        if (imag_time) {
+            block_kernel_potential_imaginary(n_components == 2, tile_width, inner_width, 1, coupling_const[component], coupling_const[2], LeeHuangYang_coupling, tile_width,
+                                             &external_pot_real[component][row], &external_pot_imag[component][row], &p_real[other][row], &p_imag[other][row],
+                                             &p_real[component][row], &p_imag[component][row]);
+        }
+        else {
+            block_kernel_potential(n_components == 2, tile_width, inner_width, 1, coupling_const[component], coupling_const[2], LeeHuangYang_coupling, tile_width,
+                                   &external_pot_real[component][row], &external_pot_imag[component][row], &p_real[other][row], &p_imag[other][row],
+                                   &p_real[component][row], &p_imag[component][row]);
+        }
+    }
+    kinetic_step(component);
+    exchange_halos(p_real[component], p_imag[component]);
+}
+
+void CPUSpectral::wait_for_completion() {
+    if (imag_time && norm[state_index] != 0) {
+        //normalization
+        double _norm = sqrt(calculate_squared_norm(true) / norm[state_index]);
+        for (size_t i = 0; i < tile_height * tile_width; i++) {
+            p_real[state_index][i] /= _norm;
+            p_imag[state_index][i] /= _norm;
+        }
+    }
+    if (n_components == 2) {
+        state_index = 1 - state_index;
+    }
+}
+
+void CPUSpectral::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *dest_real2, double * dest_imag2) const {
+    double *dest[2][2] = {{dest_real, dest_imag}, {dest_real2, dest_imag2}};
+    for (int i = 0; i < n_components; i++) {
+        if (dest[i][0] == 0 || (dest[i][0] == p_real[i] && dest[i][1] == p_imag[i] && x == 0 && y == 0)) {
+            continue;
+        }
+        memcpy2D(dest[i][0], dest_stride * sizeof(double), &p_real[i][y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+        memcpy2D(dest[i][1], dest_stride * sizeof(double), &p_imag[i][y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+    }
+}
+
+double CPUSpectral::calculate_squared_norm(bool global) const {
+    TRACE_SCOPE("squared_norm");
+    double norm2 = 0.;
+    const double *real = p_real[state_index], *imag = p_imag[state_index];
+#ifndef HAVE_MPI
+    #pragma omp parallel for reduction(+:norm2)
+#endif
+    for (int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
+        for (int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
+            norm2 += real[j + i * tile_width] * real[j + i * tile_width] + imag[j + i * tile_width] * imag[j + i * tile_width];
+        }
+    }
+#ifdef HAVE_MPI
+    if (global) {
+        MPI_Allreduce(MPI_IN_PLACE, &norm2, 1, MPI_DOUBLE, MPI_SUM, cartcomm);
+    }
+#endif
+    return norm2 * delta_x * delta_y;
+}
+
+void CPUSpectral::rabi_coupling(double var, double delta_t) {
+    if (n_components != 2) {
+        return;
+    }
+    double norm_omega = sqrt(coupling_const[3] * coupling_const[3] + coupling_const[4] * coupling_const[4]);
+    double cc, cs_r = 0., cs_i = 0.;
+    if (imag_time) {
+        cc = cosh(- delta_t * var * norm_omega);
+        if (norm_omega != 0) {
+            cs_r = coupling_const[3] / norm_omega * sinh(- delta_t * var * norm_omega);
+            cs_i = coupling_const[4] / norm_omega * sinh(- delta_t * var * norm_omega);
+        }
+        rabi_coupling_imaginary(tile_width, tile_width, tile_height, cc, cs_r, cs_i, p_real[0], p_imag[0], p_real[1], p_imag[1]);
+    }
+    else {
+        cc = cos(- delta_t * var * norm_omega);
+        if (norm_omega != 0) {
+            cs_r = coupling_const[3] / norm_omega * sin(- delta_t * var * norm_omega);
+            cs_i = coupling_const[4] / norm_omega * sin(- delta_t * var * norm_omega);
+        }
+        rabi_coupling_real(tile_width, tile_width, tile_height, cc, cs_r, cs_i, p_real[0], p_imag[0], p_real[1], p_imag[1]);
+    }
+}
+
+void CPUSpectral::normalization() {
+    if (n_components != 2 || !imag_time || (coupling_const[3] == 0 && coupling_const[4] == 0)) {
+        return;
+    }
+    // The Rabi coupling transfers population between the components: only the total norm is preserved
+    double sums[2] = {0., 0.};
+    for (int k = 0; k < 2; k++) {
+        for (int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
+            for (int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
+                sums[k] += p_real[k][j + i * tile_width] * p_real[k][j + i * tile_width] + p_imag[k][j + i * tile_width] * p_imag[k][j + i * tile_width];
+            }
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, cartcomm);
+#endif
+    double _norm = sqrt((sums[0] + sums[1]) * delta_x * delta_y / tot_norm);
+    for (int k = 0; k < 2; k++) {
+        for (size_t i = 0; i < tile_height * tile_width; i++) {
+            p_real[k][i] /= _norm;
+            p_imag[k][i] /= _norm;
+        }
+        norm[k] = sums[k] / (sums[0] + sums[1]) * tot_norm;
+    }
+}
+
+void CPUSpectral::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
+    external_pot_real[which] = _external_pot_real;
+    external_pot_imag[which] = _external_pot_imag;
+}
+
+bool CPUSpectral::update_coefficients(Hamiltonian *hamiltonian, double delta_t) {
+    set_coefficients(hamiltonian, delta_t);
+    return true;
+}
+
+bool CPUSpectral::update_parameters(const KernelConfig &config) {
+    if (config.two_components != (n_components == 2) || config.n_states != n_components) {
+        return false;
+    }
+    for (int i = 0; i < n_components; i++) {
+        if (config.states[i]->p_real != p_real[i] || config.states[i]->p_imag != p_imag[i]) {
+            return false;
+        }
+    }
+    imag_time = config.imag_time;
+    tot_norm = 0.;
+    for (int i = 0; i < n_components; i++) {
+        external_pot_real[i] = config.external_pot_real[i];
+        external_pot_imag[i] = config.external_pot_imag[i];
+        norm[i] = config.norm[i];
+        tot_norm += norm[i];
+    }
+    set_coefficients(config.hamiltonian, config.delta_t);
+    state_index = 0;
+    return true;
+}
+
+void CPUSpectral::exchange_halos(double *real, double *imag) {
+    double *parts[2] = {real, imag};
+    for (int i = 0; i < 2; i++) {
+#ifdef HAVE_MPI
+        // Halo exchange: LEFT/RIGHT, then UP/DOWN on full rows, as in the CPU kernel
+        int row = (inner_start_y - start_y) * tile_width;
+        MPI_Sendrecv(parts[i] + row + inner_end_x - halo_x - start_x, 1, verticalBorder, neighbors[RIGHT], 1,
+                     parts[i] + row, 1, verticalBorder, neighbors[LEFT], 1, cartcomm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(parts[i] + row + halo_x, 1, verticalBorder, neighbors[LEFT], 2,
+                     parts[i] + row + inner_end_x - start_x, 1, verticalBorder, neighbors[RIGHT], 2, cartcomm, MPI_STATUS_IGNORE);
+        if (periods[0] != 0) {
+            MPI_Sendrecv(parts[i] + (inner_end_y - halo_y - start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 3,
+                         parts[i], 1, horizontalBorder, neighbors[UP], 3, cartcomm, MPI_STATUS_IGNORE);
+            MPI_Sendrecv(parts[i] + halo_y * tile_width, 1, horizontalBorder, neighbors[UP], 4,
+                         parts[i] + (inner_end_y - start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 4, cartcomm, MPI_STATUS_IGNORE);
+        }
+#else
+        int offset = (inner_start_y - start_y) * tile_width;
+        memcpy2D(&parts[i][offset], tile_width * sizeof(double), &parts[i][offset + tile_width - 2 * halo_x], tile_width * sizeof(double), halo_x * sizeof(double), inner_height);
+        memcpy2D(&parts[i][offset + tile_width - halo_x], tile_width * sizeof(double), &parts[i][offset + halo_x], tile_width * sizeof(double), halo_x * sizeof(double), inner_height);
+        if (periods[0] != 0) {
+            offset = (inner_end_y - start_y) * tile_width;
+            memcpy2D(&parts[i][0], tile_width * sizeof(double), &parts[i][offset - halo_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(&parts[i][offset], tile_width * sizeof(double), &parts[i][halo_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        }
+#endif
+    }
+}
+
+ITrotterKernel *create_spectral_kernel(const KernelConfig &config) {
+    return new CPUSpectral(config.grid, config.states, config.two_components ? 2 : 1, config.hamiltonian,
+                           config.external_pot_real, config.external_pot_imag, config.delta_t, config.norm, config.imag_time);
+}
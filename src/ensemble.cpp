@@ -0,0 +1,515 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "trottersuzuki.h"
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <map>
+
+/*
+ * The interleaved layout stores the lattice point (x, y) of the l-th system of a chunk at
+ * (y * width + x) * ENSEMBLE_LANES + l. The pair updates are the same as in cpucartesian.cpp,
+ * applied to ENSEMBLE_LANES systems at once with per-system coefficients.
+ */
+
+static inline void ensemble_pair(const double *a, const double *b, double *r, double *i, double *r_peer, double *i_peer) {
+    #pragma omp simd
+    for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+        double tmp_real = r[l];
+        double tmp_imag = i[l];
+        r[l] = a[l] * tmp_real - b[l] * i_peer[l];
+        i[l] = a[l] * tmp_imag + b[l] * r_peer[l];
+        r_peer[l] = a[l] * r_peer[l] - b[l] * tmp_imag;
+        i_peer[l] = a[l] * i_peer[l] + b[l] * tmp_real;
+    }
+}
+
+static inline void ensemble_pair_imaginary(const double *a, const double *b, double *r, double *i, double *r_peer, double *i_peer) {
+    #pragma omp simd
+    for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+        double tmp_real = r[l];
+        double tmp_imag = i[l];
+        r[l] = a[l] * tmp_real + b[l] * r_peer[l];
+        i[l] = a[l] * tmp_imag + b[l] * i_peer[l];
+        r_peer[l] = a[l] * r_peer[l] + b[l] * tmp_real;
+        i_peer[l] = a[l] * i_peer[l] + b[l] * tmp_imag;
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_vertical(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag) {
+    size_t rows = periodic ? height : height - 1;
+    for (size_t y = 0; y < rows; ++y) {
+        size_t y_peer = (y + 1) % height;
+        for (size_t x = (start_offset + y) % 2; x < width; x += 2) {
+            size_t idx = (y * width + x) * ENSEMBLE_LANES;
+            size_t peer = (y_peer * width + x) * ENSEMBLE_LANES;
+            ensemble_pair(a, b, &p_real[idx], &p_imag[idx], &p_real[peer], &p_imag[peer]);
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_vertical_imaginary(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag) {
+    size_t rows = periodic ? height : height - 1;
+    for (size_t y = 0; y < rows; ++y) {
+        size_t y_peer = (y + 1) % height;
+        for (size_t x = (start_offset + y) % 2; x < width; x += 2) {
+            size_t idx = (y * width + x) * ENSEMBLE_LANES;
+            size_t peer = (y_peer * width + x) * ENSEMBLE_LANES;
+            ensemble_pair_imaginary(a, b, &p_real[idx], &p_imag[idx], &p_real[peer], &p_imag[peer]);
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_horizontal(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag) {
+    size_t columns = periodic ? width : width - 1;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = (start_offset + y) % 2; x < columns; x += 2) {
+            size_t idx = (y * width + x) * ENSEMBLE_LANES;
+            size_t peer = (y * width + (x + 1) % width) * ENSEMBLE_LANES;
+            ensemble_pair(a, b, &p_real[idx], &p_imag[idx], &p_real[peer], &p_imag[peer]);
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_horizontal_imaginary(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag) {
+    size_t columns = periodic ? width : width - 1;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = (start_offset + y) % 2; x < columns; x += 2) {
+            size_t idx = (y * width + x) * ENSEMBLE_LANES;
+            size_t peer = (y * width + (x + 1) % width) * ENSEMBLE_LANES;
+            ensemble_pair_imaginary(a, b, &p_real[idx], &p_imag[idx], &p_real[peer], &p_imag[peer]);
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_potential(size_t size, const double *coupling_a, const double *coupling_aa, const double *external_pot_real, const double *external_pot_imag, double * p_real, double * p_imag) {
+    double phase[ENSEMBLE_LANES], c_cos[ENSEMBLE_LANES], c_sin[ENSEMBLE_LANES];
+    for (size_t idx = 0; idx < size * ENSEMBLE_LANES; idx += ENSEMBLE_LANES) {
+        const double *pot_real = &external_pot_real[idx];
+        const double *pot_imag = &external_pot_imag[idx];
+        double *real = &p_real[idx];
+        double *imag = &p_imag[idx];
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            double norm_2 = real[l] * real[l] + imag[l] * imag[l];
+            double norm_3 = norm_2 * sqrt(norm_2);
+            phase[l] = coupling_a[l] * norm_2 + coupling_aa[l] * norm_3;
+        }
+        // Separate loops keep cos and sin vectorized instead of being fused into scalar sincos calls
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            c_cos[l] = cos(phase[l]);
+        }
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            c_sin[l] = sin(phase[l]);
+        }
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            double tmp_real = pot_real[l] * real[l] - pot_imag[l] * imag[l];
+            double tmp_imag = pot_real[l] * imag[l] + pot_imag[l] * real[l];
+            real[l] = c_cos[l] * tmp_real + c_sin[l] * tmp_imag;
+            imag[l] = c_cos[l] * tmp_imag - c_sin[l] * tmp_real;
+        }
+    }
+}
+
+CPU_KERNEL_CLONES void ensemble_kernel_potential_imaginary(size_t size, const double *coupling_a, const double *coupling_aa, const double *external_pot_real, const double *external_pot_imag, double * p_real, double * p_imag) {
+    for (size_t idx = 0; idx < size * ENSEMBLE_LANES; idx += ENSEMBLE_LANES) {
+        const double *pot_real = &external_pot_real[idx];
+        double *real = &p_real[idx];
+        double *imag = &p_imag[idx];
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            double norm_2 = real[l] * real[l] + imag[l] * imag[l];
+            double norm_3 = norm_2 * sqrt(norm_2);
+            double tmp = exp(-1. * (coupling_a[l] * norm_2 + coupling_aa[l] * norm_3));
+            real[l] = tmp * pot_real[l] * real[l];
+            imag[l] = tmp * pot_real[l] * imag[l];
+        }
+    }
+}
+
+static void ensemble_full_step(bool imag_time, size_t width, size_t height, bool periodic_x, bool periodic_y,
+                               const double *aH, const double *bH, const double *aV, const double *bV,
+                               const double *coupling_a, const double *coupling_aa,
+                               const double *external_pot_real, const double *external_pot_imag,
+                               double * real, double * imag) {
+    void (*vertical)(size_t, size_t, size_t, bool, const double *, const double *, double *, double *) =
+        imag_time ? ensemble_kernel_vertical_imaginary : ensemble_kernel_vertical;
+    void (*horizontal)(size_t, size_t, size_t, bool, const double *, const double *, double *, double *) =
+        imag_time ? ensemble_kernel_horizontal_imaginary : ensemble_kernel_horizontal;
+    if (height > 1) {
+        vertical(0u, width, height, periodic_y, aV, bV, real, imag);
+    }
+    horizontal(0u, width, height, periodic_x, aH, bH, real, imag);
+    if (height > 1) {
+        vertical(1u, width, height, periodic_y, aV, bV, real, imag);
+    }
+    horizontal(1u, width, height, periodic_x, aH, bH, real, imag);
+    if (imag_time) {
+        ensemble_kernel_potential_imaginary(width * height, coupling_a, coupling_aa, external_pot_real, external_pot_imag, real, imag);
+    }
+    else {
+        ensemble_kernel_potential(width * height, coupling_a, coupling_aa, external_pot_real, external_pot_imag, real, imag);
+    }
+    horizontal(1u, width, height, periodic_x, aH, bH, real, imag);
+    if (height > 1) {
+        vertical(1u, width, height, periodic_y, aV, bV, real, imag);
+    }
+    horizontal(0u, width, height, periodic_x, aH, bH, real, imag);
+    if (height > 1) {
+        vertical(0u, width, height, periodic_y, aV, bV, real, imag);
+    }
+}
+
+EnsembleSolver::EnsembleSolver(Lattice *_grid, int _n_systems, State **_states, Hamiltonian **_hamiltonians,
+                               double _delta_t):
+    grid(_grid), n_systems(_n_systems), states(_states), hamiltonians(_hamiltonians), delta_t(_delta_t) {
+    if (n_systems < 1) {
+        my_abort("The ensemble must contain at least one system");
+    }
+    if (grid->mpi_procs > 1) {
+        my_abort("The ensemble solver runs on a single process");
+    }
+    if (grid->coordinate_system != "cartesian") {
+        my_abort("The ensemble solver only supports Cartesian coordinates");
+    }
+    if (grid->kinetic_order != 2) {
+        my_abort("The ensemble solver only supports the kinetic operator of order 2");
+    }
+    if (grid->parity_x != 0 || grid->parity_y != 0) {
+        my_abort("The ensemble solver does not support lattices with a parity");
+    }
+    width = grid->global_no_halo_dim_x;
+    height = grid->global_no_halo_dim_y;
+    if ((grid->periods[1] && width % 2 != 0) || (grid->periods[0] && height > 1 && height % 2 != 0)) {
+        my_abort("The ensemble solver needs an even number of points along periodic axes");
+    }
+    for (int s = 0; s < n_systems; ++s) {
+        if (states[s]->grid != grid) {
+            my_abort("All the states of the ensemble must be defined on the same lattice");
+        }
+        if (hamiltonians[s]->angular_velocity != 0.) {
+            my_abort("The ensemble solver does not work with nonzero angular velocity");
+        }
+    }
+    n_chunks = (n_systems + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES;
+    chunk_size = width * height * ENSEMBLE_LANES;
+    p_real = allocate_tracked(n_chunks * chunk_size, MEMORY_KERNEL);
+    p_imag = allocate_tracked(n_chunks * chunk_size, MEMORY_KERNEL);
+    external_pot_real = allocate_tracked(n_chunks * chunk_size, MEMORY_EXP_POTENTIAL);
+    external_pot_imag = allocate_tracked(n_chunks * chunk_size, MEMORY_EXP_POTENTIAL);
+    fill(p_real, p_real + n_chunks * chunk_size, 0.);
+    fill(p_imag, p_imag + n_chunks * chunk_size, 0.);
+    fill(external_pot_imag, external_pot_imag + n_chunks * chunk_size, 0.);
+    for (size_t i = 0; i < n_chunks * chunk_size; ++i) {
+        external_pot_real[i] = 1.;
+    }
+    aH = new double[n_chunks * ENSEMBLE_LANES];
+    bH = new double[n_chunks * ENSEMBLE_LANES]();
+    aV = new double[n_chunks * ENSEMBLE_LANES];
+    bV = new double[n_chunks * ENSEMBLE_LANES]();
+    for (int s = 0; s < n_chunks * ENSEMBLE_LANES; ++s) {
+        aH[s] = 1.;
+        aV[s] = 1.;
+    }
+    coupling_const = new double[n_chunks * ENSEMBLE_LANES]();
+    LeeHuangYang_coupling = new double[n_chunks * ENSEMBLE_LANES]();
+    norm2 = new double[n_chunks * ENSEMBLE_LANES]();
+    squared_norm = new double[n_systems];
+    total_energy = new double[n_systems];
+    kinetic_energy = new double[n_systems];
+    potential_energy = new double[n_systems];
+    intra_species_energy = new double[n_systems];
+    LeeHuangYang_energy = new double[n_systems];
+    imag_time = false;
+    current_evolution_time = 0;
+    kernel_ready = false;
+    has_parameters_changed = false;
+    energy_expected_values_updated = false;
+}
+
+EnsembleSolver::~EnsembleSolver() {
+    free_tracked(p_real);
+    free_tracked(p_imag);
+    free_tracked(external_pot_real);
+    free_tracked(external_pot_imag);
+    delete [] aH;
+    delete [] bH;
+    delete [] aV;
+    delete [] bV;
+    delete [] coupling_const;
+    delete [] LeeHuangYang_coupling;
+    delete [] norm2;
+    delete [] squared_norm;
+    delete [] total_energy;
+    delete [] kinetic_energy;
+    delete [] potential_energy;
+    delete [] intra_species_energy;
+    delete [] LeeHuangYang_energy;
+}
+
+void EnsembleSolver::pack_states() {
+    int offset_x = grid->inner_start_x - grid->start_x;
+    int offset_y = grid->inner_start_y - grid->start_y;
+    #pragma omp parallel for
+    for (int s = 0; s < n_systems; ++s) {
+        double *real = &p_real[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        double *imag = &p_imag[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                size_t tile_idx = (y + offset_y) * grid->dim_x + x + offset_x;
+                real[(y * width + x) * ENSEMBLE_LANES] = states[s]->p_real[tile_idx];
+                imag[(y * width + x) * ENSEMBLE_LANES] = states[s]->p_imag[tile_idx];
+            }
+        }
+    }
+}
+
+void EnsembleSolver::copy_to_states() {
+    int offset_x = grid->inner_start_x - grid->start_x;
+    int offset_y = grid->inner_start_y - grid->start_y;
+    #pragma omp parallel for
+    for (int s = 0; s < n_systems; ++s) {
+        const double *real = &p_real[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        const double *imag = &p_imag[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        for (int y_tile = 0; y_tile < grid->dim_y; ++y_tile) {
+            // The halos of periodic lattices are filled with the points of the opposite side
+            size_t y = (y_tile - offset_y + height) % height;
+            for (int x_tile = 0; x_tile < grid->dim_x; ++x_tile) {
+                size_t x = (x_tile - offset_x + width) % width;
+                states[s]->p_real[y_tile * grid->dim_x + x_tile] = real[(y * width + x) * ENSEMBLE_LANES];
+                states[s]->p_imag[y_tile * grid->dim_x + x_tile] = imag[(y * width + x) * ENSEMBLE_LANES];
+            }
+        }
+        states[s]->expected_values_updated = false;
+    }
+}
+
+void EnsembleSolver::initialize_exp_potential(int system) {
+    int offset_x = grid->inner_start_x - grid->start_x;
+    int offset_y = grid->inner_start_y - grid->start_y;
+    double *pot_real = &external_pot_real[(system / ENSEMBLE_LANES) * chunk_size + system % ENSEMBLE_LANES];
+    double *pot_imag = &external_pot_imag[(system / ENSEMBLE_LANES) * chunk_size + system % ENSEMBLE_LANES];
+    complex<double> tmp;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            double ptmp = hamiltonians[system]->potential->get_value(x + offset_x, y + offset_y);
+            if (imag_time) {
+                tmp = exp(complex<double> (-delta_t * ptmp, 0.));
+            }
+            else {
+                tmp = exp(complex<double> (-delta_t * hamiltonians[system]->get_absorbing_potential(x + offset_x, y + offset_y), -delta_t * ptmp));
+            }
+            pot_real[(y * width + x) * ENSEMBLE_LANES] = real(tmp);
+            pot_imag[(y * width + x) * ENSEMBLE_LANES] = imag(tmp);
+        }
+    }
+}
+
+void EnsembleSolver::init_kernel() {
+    #pragma omp parallel for
+    for (int s = 0; s < n_systems; ++s) {
+        double mass = hamiltonians[s]->mass;
+        if (imag_time) {
+            aH[s] = cosh(delta_t / (4. * mass * grid->delta_x * grid->delta_x));
+            bH[s] = sinh(delta_t / (4. * mass * grid->delta_x * grid->delta_x));
+            aV[s] = cosh(delta_t / (4. * mass * grid->delta_y * grid->delta_y));
+            bV[s] = sinh(delta_t / (4. * mass * grid->delta_y * grid->delta_y));
+            norm2[s] = states[s]->get_squared_norm();
+        }
+        else {
+            aH[s] = cos(delta_t / (4. * mass * grid->delta_x * grid->delta_x));
+            bH[s] = sin(delta_t / (4. * mass * grid->delta_x * grid->delta_x));
+            aV[s] = cos(delta_t / (4. * mass * grid->delta_y * grid->delta_y));
+            bV[s] = sin(delta_t / (4. * mass * grid->delta_y * grid->delta_y));
+        }
+        coupling_const[s] = hamiltonians[s]->coupling_a * delta_t;
+        LeeHuangYang_coupling[s] = hamiltonians[s]->LeeHuangYang_coupling_a * delta_t;
+        initialize_exp_potential(s);
+    }
+    kernel_ready = true;
+}
+
+void EnsembleSolver::normalization(int chunk) {
+    double sum[ENSEMBLE_LANES] = {0.};
+    const double *real = &p_real[chunk * chunk_size];
+    const double *imag = &p_imag[chunk * chunk_size];
+    for (size_t idx = 0; idx < chunk_size; idx += ENSEMBLE_LANES) {
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            sum[l] += real[idx + l] * real[idx + l] + imag[idx + l] * imag[idx + l];
+        }
+    }
+    double factor[ENSEMBLE_LANES];
+    for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+        double target = norm2[chunk * ENSEMBLE_LANES + l];
+        factor[l] = (target != 0 && sum[l] != 0) ? sqrt(target / (sum[l] * grid->delta_x * grid->delta_y)) : 1.;
+    }
+    for (size_t idx = 0; idx < chunk_size; idx += ENSEMBLE_LANES) {
+        #pragma omp simd
+        for (int l = 0; l < ENSEMBLE_LANES; ++l) {
+            p_real[chunk * chunk_size + idx + l] *= factor[l];
+            p_imag[chunk * chunk_size + idx + l] *= factor[l];
+        }
+    }
+}
+
+void EnsembleSolver::evolve(int iterations, bool _imag_time) {
+    // The State objects may have been written since the last evolution, and packing them costs less than a step
+    pack_states();
+    if (_imag_time != imag_time || !kernel_ready || has_parameters_changed) {
+        imag_time = _imag_time;
+        init_kernel();
+        has_parameters_changed = false;
+    }
+    bool periodic_x = grid->periods[1];
+    bool periodic_y = grid->periods[0];
+    for (int i = 0; i < iterations; ++i) {
+        if (i > 0) {
+            // Systems may share a potential, which reports its update only once
+            map<Potential*, bool> updated;
+            for (int s = 0; s < n_systems; ++s) {
+                Potential *potential = hamiltonians[s]->potential;
+                if (updated.find(potential) == updated.end()) {
+                    updated[potential] = potential->update(current_evolution_time);
+                }
+                if (updated[potential]) {
+                    initialize_exp_potential(s);
+                }
+            }
+        }
+        #pragma omp parallel for schedule(static)
+        for (int c = 0; c < n_chunks; ++c) {
+            size_t lanes = c * ENSEMBLE_LANES;
+            ensemble_full_step(imag_time, width, height, periodic_x, periodic_y,
+                               &aH[lanes], &bH[lanes], &aV[lanes], &bV[lanes],
+                               &coupling_const[lanes], &LeeHuangYang_coupling[lanes],
+                               &external_pot_real[c * chunk_size], &external_pot_imag[c * chunk_size],
+                               &p_real[c * chunk_size], &p_imag[c * chunk_size]);
+            if (imag_time) {
+                normalization(c);
+            }
+        }
+        current_evolution_time += delta_t;
+    }
+    copy_to_states();
+    energy_expected_values_updated = false;
+}
+
+void EnsembleSolver::update_parameters() {
+    has_parameters_changed = true;
+    energy_expected_values_updated = false;
+}
+
+void EnsembleSolver::calculate_energy_expected_values(void) {
+    pack_states();
+    int offset_x = grid->inner_start_x - grid->start_x;
+    int offset_y = grid->inner_start_y - grid->start_y;
+    bool periodic_x = grid->periods[1];
+    bool periodic_y = grid->periods[0];
+    const double const_1 = -1. / 12., const_2 = 4. / 3., const_3 = -2.5;
+
+    #pragma omp parallel for
+    for (int s = 0; s < n_systems; ++s) {
+        const double *ens_real = &p_real[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        const double *ens_imag = &p_imag[(s / ENSEMBLE_LANES) * chunk_size + s % ENSEMBLE_LANES];
+        Potential *potential = hamiltonians[s]->potential;
+        double cost_E = -1. / (2. * hamiltonians[s]->mass);
+        double coupling = hamiltonians[s]->coupling_a;
+        double LeeHuangYang_coupling_a = hamiltonians[s]->LeeHuangYang_coupling_a;
+        double sum_norm2 = 0, sum_norm2_kin = 0, sum_kinetic = 0, sum_potential = 0, sum_intra = 0, sum_LeeHuangYang = 0;
+
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                complex<double> psi_center(ens_real[(y * width + x) * ENSEMBLE_LANES], ens_imag[(y * width + x) * ENSEMBLE_LANES]);
+                double density = real(conj(psi_center) * psi_center);
+                sum_norm2 += density;
+                sum_potential += density * potential->get_value(x + offset_x, y + offset_y);
+                sum_intra += density * density * 0.5 * coupling;
+                sum_LeeHuangYang += pow(density, 2.5) * 0.4 * LeeHuangYang_coupling_a;
+
+                // Closed boundaries leave out the two outermost points, as the Solver does
+                if ((height > 1 && !periodic_y && (y < 2 || y >= height - 2)) ||
+                        (!periodic_x && (x < 2 || x >= width - 2))) {
+                    continue;
+                }
+                complex<double> psi[5];
+                for (int k = -2; k <= 2; ++k) {
+                    size_t xk = (x + k + width) % width;
+                    psi[k + 2] = complex<double> (ens_real[(y * width + xk) * ENSEMBLE_LANES], ens_imag[(y * width + xk) * ENSEMBLE_LANES]);
+                }
+                sum_norm2_kin += density;
+                sum_kinetic += real(cost_E * conj(psi_center) *
+                                    (const_1 * psi[4] + const_2 * psi[3] + const_2 * psi[1] + const_1 * psi[0] + const_3 * psi_center) / (grid->delta_x * grid->delta_x));
+                if (height > 1) {
+                    for (int k = -2; k <= 2; ++k) {
+                        size_t yk = (y + k + height) % height;
+                        psi[k + 2] = complex<double> (ens_real[(yk * width + x) * ENSEMBLE_LANES], ens_imag[(yk * width + x) * ENSEMBLE_LANES]);
+                    }
+                    sum_kinetic += real(cost_E * conj(psi_center) *
+                                        (const_1 * psi[4] + const_2 * psi[3] + const_2 * psi[1] + const_1 * psi[0] + const_3 * psi_center) / (grid->delta_y * grid->delta_y));
+                }
+            }
+        }
+        kinetic_energy[s] = sum_kinetic / sum_norm2_kin;
+        potential_energy[s] = sum_potential / sum_norm2;
+        intra_species_energy[s] = sum_intra / sum_norm2;
+        LeeHuangYang_energy[s] = sum_LeeHuangYang / sum_norm2;
+        total_energy[s] = kinetic_energy[s] + potential_energy[s] + intra_species_energy[s] + LeeHuangYang_energy[s];
+        squared_norm[s] = sum_norm2 * grid->delta_x * grid->delta_y;
+    }
+    energy_expected_values_updated = true;
+}
+
+const double *EnsembleSolver::get_squared_norm(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return squared_norm;
+}
+
+const double *EnsembleSolver::get_total_energy(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return total_energy;
+}
+
+const double *EnsembleSolver::get_kinetic_energy(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return kinetic_energy;
+}
+
+const double *EnsembleSolver::get_potential_energy(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return potential_energy;
+}
+
+const double *EnsembleSolver::get_intra_species_energy(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return intra_species_energy;
+}
+
+const double *EnsembleSolver::get_LeeHuangYang_energy(void) {
+    if (!energy_expected_values_updated)
+        calculate_energy_expected_values();
+    return LeeHuangYang_energy;
+}
@@ -387,6 +387,26 @@ void CC2Kernel::update_potential(double *_external_pot_real, double *_external_p
 }
 
 
+ITrotterKernel *create_gpu_kernel(const KernelConfig &config) {
+    if (config.two_components) {
+        return new CC2Kernel(config.grid, config.states[0], config.states[1], static_cast<Hamiltonian2Component*>(config.hamiltonian),
+                             config.external_pot_real, config.external_pot_imag, config.delta_t, config.norm, config.imag_time);
+    }
+    else {
+        return new CC2Kernel(config.grid, config.states[0], config.hamiltonian, config.external_pot_real[0], config.external_pot_imag[0],
+                             config.delta_t, config.norm[0], config.imag_time);
+    }
+}
+
+bool gpu_kernel_available(void) {
+    int devCount = 0;
+    if (cudaGetDeviceCount(&devCount) != cudaSuccess) {
+        cudaGetLastError();
+        return false;
+    }
+    return devCount > 0;
+}
+
 CC2Kernel::~CC2Kernel() {
     CUDA_SAFE_CALL(cudaFreeHost(left_real_receive));
     CUDA_SAFE_CALL(cudaFreeHost(left_real_send));
@@ -19,6 +19,8 @@
 #ifndef __KERNEL_H
 #define __KERNEL_H
 #include <string>
+#include <vector>
+#include <map>
 #include "trottersuzuki.h"
 #ifdef _OPENMP
 #include <omp.h>
@@ -37,12 +39,32 @@
 #define BLOCK_WIDTH_CACHE 128u
 #define BLOCK_HEIGHT_CACHE 128u
 
+/** Marks the definition of a CPU kernel function: it is compiled for several instruction
+ *  sets (AVX-512, AVX2 and the SSE2 baseline) and the variant matching the processor is
+ *  selected through cpuid when the library is loaded. Builds configured with --enable-native
+ *  are tuned for the build host instead. The attribute must not appear on the declarations,
+ *  otherwise every caller emits its own dispatcher.
+ */
+#if defined(HAVE_TARGET_CLONES) && !defined(__CUDACC__)
+#define CPU_KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CPU_KERNEL_CLONES
+#endif
+
 /** Functions defining Euclidean geometry
  */
 void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_vertical_nnn(size_t sweep, size_t global_y, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_vertical_nnn_imaginary(size_t sweep, size_t global_y, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_nnn(size_t sweep, size_t global_x, size_t period_x, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_nnn_imaginary(size_t sweep, size_t global_x, size_t period_x, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_vertical_seam(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_vertical_seam_imaginary(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_seam(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_seam_imaginary(size_t sweep, size_t global_x, size_t global_y, size_t period_x, size_t period_y, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
 void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
 void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
@@ -51,6 +73,38 @@ void block_kernel_rotation(size_t stride, size_t width, size_t height, int offse
 void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag);
 void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
 void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
+
+/** Functions evolving a block, and a band of blocks, of the CPU kernel
+ */
+void full_step(bool two_wavefunctions, size_t stride, size_t width, size_t height,
+               double offset_x, double offset_y, double alpha_x, double alpha_y, int global_x, int global_y, size_t period_x, size_t period_y,
+               double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
+               size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
+               const double *pb_real, const double *pb_imag, double * real, double * imag,
+               string coordinate_system);
+void full_step_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height,
+                         double offset_x, double offset_y, double alpha_x, double alpha_y, int global_x, int global_y, size_t period_x, size_t period_y,
+                         double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
+                         size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
+                         const double *pb_real, const double *pb_imag, double * real, double * imag,
+                         string coordinate_system);
+void process_band(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, int global_x, int global_y, size_t period_x, size_t period_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
+                  double aH, double bH, double aV, double bV, double cH, double dH, double cV, double dV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag, const double * p_real, const double * p_imag,
+                  const double * pb_real, const double * pb_imag, double * next_real, double * next_imag, int inner, int sides, bool imag_time, string coordinate_system);
+
+/** Number of systems evolved together by the ensemble kernels: a lattice point of a chunk of
+ *  the ensemble stores ENSEMBLE_LANES consecutive values, one for each system.
+ */
+#define ENSEMBLE_LANES 8
+
+/** Functions defining Euclidean geometry on interleaved ensembles
+ */
+void ensemble_kernel_vertical(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag);
+void ensemble_kernel_vertical_imaginary(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag);
+void ensemble_kernel_horizontal(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag);
+void ensemble_kernel_horizontal_imaginary(size_t start_offset, size_t width, size_t height, bool periodic, const double *a, const double *b, double * p_real, double * p_imag);
+void ensemble_kernel_potential(size_t size, const double *coupling_a, const double *coupling_aa, const double *external_pot_real, const double *external_pot_imag, double * p_real, double * p_imag);
+void ensemble_kernel_potential_imaginary(size_t size, const double *coupling_a, const double *coupling_aa, const double *external_pot_real, const double *external_pot_imag, double * p_real, double * p_imag);
 /**
  * \brief This class defines the CPU kernel.
  *
@@ -75,15 +129,24 @@ public:
              double **_external_pot_real, double **_external_pot_imag,
              double delta_t, double *_norm, bool _imag_time);    ///< Instantiate the kernel for two wave functions state evolution.
 
+    CPUBlock(Lattice *grid, State **states, int n_states, Hamiltonian *hamiltonian,
+             double *_external_pot_real, double *_external_pot_imag,
+             double delta_t, double *_norm, bool _imag_time,
+             int orthogonalization_period = 1);    ///< Instantiate the kernel for the evolution of several independent states of the same Hamiltonian, kept orthonormal in imaginary time.
+
     ~CPUBlock();
     void run_kernel_on_halo();          ///< Evolve blocks of wave function at the edge of the tile. This comprises the halos.
     void run_kernel();              ///< Evolve the remaining blocks in the inner part of the tile.
     void wait_for_completion();         ///< Synchronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution in the case of single wave-function evolution.
     void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function from the two buffers pointed by p_real and p_imag, without halos, to dest_real and dest_imag.
+    void get_state_sample(int index, size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag) const; ///< Copy the wave function of the index-th state to dest_real and dest_imag.
     void normalization();    ///< Normalize the state when performing an imaginary time evolution (only two wave-function evolution).
     void rabi_coupling(double var, double delta_t);    ///< Evolution corresponding to the Rabi coupling term of the Hamiltonian (only two wave-function evolution).
     double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
     void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential).
+    bool update_parameters(const KernelConfig &config);    ///< Recompute the coefficients of the evolution in place, keeping the buffers and the MPI datatypes.
+    bool update_coefficients(Hamiltonian *hamiltonian, double delta_t);    ///< Recompute the coefficients of the evolution operators between two time steps.
+    void set_halo_precision(string precision, int resync_period);    ///< Send the halos as floats (precision float) between exchanges in double precision every resync_period steps, or always in double precision.
     void cpy_first_positive_to_first_negative();    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
     bool runs_in_place() const {
         return false;
@@ -95,18 +158,38 @@ public:
 
     void start_halo_exchange();         ///< Start vertical halos exchange.
     void finish_halo_exchange();        ///< Start horizontal halos exchange.
+    CommStats get_comm_stats() const {
+        return comm_stats;
+    }
+    void reset_comm_stats() {
+        comm_stats = CommStats();
+    }
 
 
 
 private:
-    double *p_real[2][2];       ///< Array of two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step.
-    double *p_imag[2][2];       ///< Array of two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step.
+    void process_band_states(size_t read_y, size_t read_height, size_t write_offset, size_t write_height, int inner, int sides);    ///< Evolve a band of the tile for the wave functions being evolved (all of them when evolving several states).
+    void set_coefficients(Hamiltonian *hamiltonian, double delta_t);    ///< Compute the coefficients of the evolution operators from the Hamiltonian, the time step and the time direction.
+    void orthonormalize_states(bool orthogonalize);    ///< Restore the squared norms of the states and, if requested, orthogonalize them in Gram-Schmidt order.
+    void fill_state_mirror_halos();    ///< Fill the mirror halos of the wave functions at the symmetry planes of the lattice.
+
+    double *(*p_real)[2];       ///< For each wave function, two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step.
+    double *(*p_imag)[2];       ///< For each wave function, two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step.
+    int n_states;    ///< Number of wave functions stored by the kernel.
+    bool multiple_states;    ///< Whether the kernel evolves several independent states of the same Hamiltonian.
+    int orthogonalization_period;    ///< Number of imaginary time steps between two orthogonalizations of the states.
+    int step_count;    ///< Number of time steps performed by the kernel.
     double *external_pot_real[2];   ///< Points to the matrix representation (real entries) of the operator given by the exponential of external potential.
     double *external_pot_imag[2];   ///< Points to the matrix representation (immaginary entries) of the operator given by the exponential of external potential.
     double *aH;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *bH;            ///< Off diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *aV;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *bV;            ///< Off diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
+    double *cH;            ///< Diagonal value of the exponential of the next-nearest neighbour kinetic operator along the x axis (order 4).
+    double *dH;            ///< Off diagonal value of the exponential of the next-nearest neighbour kinetic operator along the x axis (zero at order 2).
+    double *cV;            ///< Diagonal value of the exponential of the next-nearest neighbour kinetic operator along the y axis (order 4).
+    double *dV;            ///< Off diagonal value of the exponential of the next-nearest neighbour kinetic operator along the y axis (zero at order 2).
+    int kinetic_order;    ///< Order of the spatial accuracy of the kinetic operator (2 or 4).
     double *kin_radial;   ///< Kinetic costant for the radial coordinate.
     double delta_x;         ///< Physical length between two neighbour along x axis dots of the lattice.
     double delta_y;         ///< Physical length between two neighbour along y axis dots of the lattice.
@@ -139,17 +222,354 @@ private:
     int inner_end_x;        ///< X axis coordinate of the last dot of the processed tile, which is not in the halo.
     int inner_end_y;        ///< Y axis coordinate of the last dot of the processed tile, which is not in the halo.
     int *periods;         ///< Two dimensional array which takes entries 0 or 1. 1: periodic boundary condition along the corresponding axis; 0: closed boundary condition along the corresponding axis.
+    size_t period_x;    ///< Number of dots of the x axis when it is periodic, 0 when it is closed.
+    size_t period_y;    ///< Number of dots of the y axis when it is periodic, 0 when it is closed.
     string coordinate_system;  ///< Type of the coordinate system used.
+    int parity_x;    ///< Parity of the wave function along the x axis (1 even, -1 odd, 0 no symmetry).
+    int parity_y;    ///< Parity of the wave function along the y axis (1 even, -1 odd, 0 no symmetry).
+    int symmetry_factor;    ///< Ratio between the full lattice and the one evolved, which the norms are multiplied by.
+    mutable CommStats comm_stats;    ///< Halo messages, waits and collectives of the kernel; the norms are computed by const methods.
 #ifdef HAVE_MPI
     MPI_Comm cartcomm;        ///< Ensemble of processes communicating the halos and evolving the tiles.
     int neighbors[4];       ///< Array that stores the processes' rank neighbour of the current process.
-    MPI_Request req[8];       ///< Variable to manage MPI communication.
-    MPI_Status statuses[8];     ///< Variable to manage MPI communication.
+    MPI_Request *req;       ///< Variable to manage MPI communication (eight requests per exchanged wave function).
+    MPI_Status *statuses;     ///< Variable to manage MPI communication.
     MPI_Datatype horizontalBorder;  ///< Datatype for the horizontal halos.
     MPI_Datatype verticalBorder;  ///< Datatype for the vertical halos.
+    bool float_halos;    ///< Whether the halos travel as floats between the exchanges in double precision.
+    int halo_resync_period;    ///< Steps between two exchanges of the halos in double precision.
+    vector<int> halo_exchanges;    ///< Halo exchanges of each wave function since the halo precision was set.
+    vector<double> halo_reference;    ///< Halo strips of each wave function as last exchanged: the ones received and the copies the neighbours hold of the ones sent.
+    vector<float> halo_message;    ///< Float messages of the halo strips, laid out as halo_reference.
+    void count_halo_messages(int first_neighbor, int second_neighbor, int messages, double bytes);    ///< Count the halo messages exchanged with two opposite neighbours, each of the given size.
+    bool float_halo_step(int i) const;    ///< Whether the halos of the i-th wave function travel as floats in this step.
+    void post_float_halos(int i, int direction, double *real, double *imag, const int neighbor[2], const size_t recv_offset[2],
+                          const size_t send_offset[2], size_t width, size_t height, MPI_Request *state_req, int tag);    ///< Post the messages of the halos of a direction (0 vertical, 1 horizontal) as floats.
+    void settle_halos(int i, int direction, double *real, double *imag, const int neighbor[2], const size_t recv_offset[2],
+                      const size_t send_offset[2], size_t width, size_t height);    ///< Complete the exchange of the halos of a direction once the messages arrived: decode the floats, or record the strips exchanged in double precision.
+#endif
+};
+
+/** Apply the finite-difference Hamiltonian of the energy routines, shifted and scaled to the spectral interval [-1, 1],
+ *  to the real or the imaginary part of a wave function: out = factor * (H - shift) / scale * in - sub (sub may be NULL).
+ *  The Hamiltonian is real, so that the two parts are independent. The stencil is the fourth-order one; points outside the tile are zero.
+ */
+void chebyshev_apply_hamiltonian(size_t tile_width, size_t tile_height, size_t x_start, size_t x_end, size_t y_start, size_t y_end,
+                                 double kin_x, double kin_y, double shift, double scale, double factor, const double *potential,
+                                 const double *in, const double *sub, double *out);
+
+/**
+ * \brief This class defines the Chebyshev propagator kernel.
+ *
+ * This kernel expands the evolution operator of a linear single-component system in Chebyshev polynomials of the
+ * finite-difference Hamiltonian used by the energy routines, instead of splitting it with the Trotter-Suzuki formula.
+ * Each step is exact up to the truncation of the expansion, so the time step is only limited by the cost of the
+ * expansion, whose length grows with the spectral range of the Hamiltonian times the time step.
+ * Time-dependent potentials are sampled once per step.
+ */
+class CPUChebyshev: public ITrotterKernel {
+public:
+    CPUChebyshev(Lattice *grid, State *state, Hamiltonian *hamiltonian,
+                 double delta_t, double _norm, bool _imag_time);    ///< Instantiate the kernel for single wave functions state evolution.
+    ~CPUChebyshev();
+    void run_kernel_on_halo();    ///< Empty function: the whole step is performed by run_kernel.
+    void run_kernel();    ///< Perform a time step by the Chebyshev expansion of the evolution operator.
+    void wait_for_completion();    ///< Perform normalization for imaginary time evolution.
+    void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function to dest_real and dest_imag.
+    void normalization() {};    ///< Empty function (only two wave-function evolution).
+    void rabi_coupling(double, double) {};    ///< Empty function (only two wave-function evolution).
+    double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Sample again the potential of the Hamiltonian.
+    bool update_coefficients(Hamiltonian *hamiltonian, double delta_t);    ///< Recompute the expansion for the new Hamiltonian parameters.
+    bool update_parameters(const KernelConfig &config);    ///< Recompute the expansion for the new parameters, time step and time direction.
+    void cpy_first_positive_to_first_negative() {};    ///< Empty function (only cylindrical coordinates).
+    bool runs_in_place() const {
+        return true;
+    }
+    /// Get kernel name.
+    string get_name() const {
+        return "Chebyshev";
+    }
+
+    void start_halo_exchange() {};    ///< Empty function: the halos are exchanged before every application of the Hamiltonian.
+    void finish_halo_exchange() {};    ///< Empty function: the halos are exchanged before every application of the Hamiltonian.
+
+private:
+    void set_hamiltonian(Hamiltonian *hamiltonian);    ///< Read mass and potential of the Hamiltonian.
+    void set_expansion();    ///< Compute the spectral bounds and the coefficients of the expansion.
+    void exchange_halos(double *real, double *imag);    ///< Update the halos of a wave function.
+
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system.
+    double *p_real;    ///< Real part of the wave function (the buffer of the state).
+    double *p_imag;    ///< Imaginary part of the wave function (the buffer of the state).
+    double *work_real[3];    ///< Real part of the last three vectors of the Chebyshev recurrence.
+    double *work_imag[3];    ///< Imaginary part of the last three vectors of the Chebyshev recurrence.
+    double *sum_real;    ///< Real part of the sum of the expansion.
+    double *sum_imag;    ///< Imaginary part of the sum of the expansion.
+    double *potential;    ///< External potential on the tile.
+    vector<complex<double> > coefficients;    ///< Coefficients of the Chebyshev polynomials, global phase included.
+    double delta_t;    ///< A single evolution iteration, evolves the state for this time.
+    double mass;    ///< Mass of the particle.
+    double kin_x;    ///< Kinetic coefficient 1/(2 m delta_x^2).
+    double kin_y;    ///< Kinetic coefficient 1/(2 m delta_y^2), zero on one-dimensional lattices.
+    double shift;    ///< Center of the spectral interval of the Hamiltonian.
+    double scale;    ///< Half width of the spectral interval of the Hamiltonian.
+    double delta_x;    ///< Physical length between two neighbour along x axis dots of the lattice.
+    double delta_y;    ///< Physical length between two neighbour along y axis dots of the lattice.
+    double norm;    ///< Squared norm of the wave function.
+    bool imag_time;    ///< True: imaginary time evolution; False: real time evolution.
+    size_t halo_x;    ///< Thickness of the vertical halos (number of lattice's dots).
+    size_t halo_y;    ///< Thickness of the horizontal halos (number of lattice's dots).
+    size_t tile_width;    ///< Width of the tile (number of lattice's dots).
+    size_t tile_height;    ///< Height of the tile (number of lattice's dots).
+    int start_x;    ///< X axis coordinate of the first dot of the processed tile.
+    int start_y;    ///< Y axis coordinate of the first dot of the processed tile.
+    int inner_start_x;    ///< X axis coordinate of the first dot of the processed tile, which is not in the halo.
+    int inner_start_y;    ///< Y axis coordinate of the first dot of the processed tile, which is not in the halo.
+    int inner_end_x;    ///< X axis coordinate of the last dot of the processed tile, which is not in the halo.
+    int inner_end_y;    ///< Y axis coordinate of the last dot of the processed tile, which is not in the halo.
+    int *periods;    ///< Two dimensional array which takes entries 0 or 1. 1: periodic boundary condition along the corresponding axis; 0: closed boundary condition along the corresponding axis.
+#ifdef HAVE_MPI
+    MPI_Comm cartcomm;    ///< Ensemble of processes communicating the halos and evolving the tiles.
+    int neighbors[4];    ///< Array that stores the processes' rank neighbour of the current process.
+    MPI_Datatype horizontalBorder;    ///< Datatype for the horizontal halos.
+    MPI_Datatype verticalBorder;    ///< Datatype for the vertical halos.
+#endif
+};
+
+/**
+ * \brief One-dimensional complex discrete Fourier transform of a given length.
+ *
+ * Mixed-radix Cooley-Tukey transform with dedicated butterflies for radix 2 and 4. Lengths with a prime factor
+ * larger than 16 are transformed as a convolution of power-of-two length (Bluestein's algorithm), so that every length is O(n log n).
+ * The plan is read-only after construction and can be shared by several threads.
+ */
+class FFTPlan {
+public:
+    FFTPlan(int n = 1);    ///< Prepare the factors and the twiddle factors of the transform of length n.
+    void transform(complex<double> *data, complex<double> *work, bool inverse) const;    ///< Transform data in place, without normalization; work holds work_size() values.
+    int work_size() const;    ///< Get the number of values of the work buffer of transform.
+    /// Get the length of the transform.
+    int size() const {
+        return n;
+    }
+
+private:
+    void recursive_transform(const complex<double> *in, complex<double> *out, complex<double> *scratch, const complex<double> *roots,
+                             int length, int stride, int factor) const;    ///< Transform the length values of in, taken every stride, to out.
+
+    int n;    ///< Length of the transform.
+    int max_factor;    ///< Largest prime factor of the length.
+    vector<int> factors;    ///< Radices of the Cooley-Tukey steps.
+    vector<complex<double> > twiddles[2];    ///< Roots of unity exp(-2 pi i k / n) and their conjugates, for the direct and the inverse transforms.
+    int convolution_length;    ///< Length of the convolution of Bluestein's algorithm (zero if it is not used).
+    vector<FFTPlan> convolution;    ///< Transform of the convolution of Bluestein's algorithm.
+    vector<complex<double> > chirp;    ///< Chirp exp(-i pi j^2 / n) of Bluestein's algorithm.
+    vector<complex<double> > chirp_spectrum;    ///< Normalized transform of the conjugate chirp, extended periodically.
+};
+
+/**
+ * \brief This class defines the split-step Fourier kernel.
+ *
+ * This kernel evolves single or two wave functions on lattices periodic along every axis, applying the kinetic
+ * operator exactly in momentum space: each step is a half kinetic step, the potential, nonlinear and inter-species
+ * step of the CPU kernel, and a second half kinetic step. The Rabi coupling and the normalizations are those of the CPU kernel.
+ * The Fourier transforms are computed along one axis at a time; under MPI, the lines along an axis are redistributed
+ * among the processes sharing the same tiles along the other axis, so that each process transforms complete lines.
+ */
+class CPUSpectral: public ITrotterKernel {
+public:
+    CPUSpectral(Lattice *grid, State **states, int n_components, Hamiltonian *hamiltonian,
+                double **_external_pot_real, double **_external_pot_imag,
+                double delta_t, double *_norm, bool _imag_time);    ///< Instantiate the kernel for single or two wave functions state evolution.
+    ~CPUSpectral();
+    void run_kernel_on_halo();    ///< Empty function: the whole step is performed by run_kernel.
+    void run_kernel();    ///< Evolve the current wave function for a time step.
+    void wait_for_completion();    ///< Normalize in imaginary time and switch to the other wave function.
+    void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave functions to dest_real, dest_imag, dest_real2 and dest_imag2.
+    void normalization();    ///< Normalization of the two components wave function.
+    void rabi_coupling(double var, double delta_t);    ///< Evolution of the Rabi coupling.
+    double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the current wave function.
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update the evolution operator of the external potential of a component.
+    bool update_coefficients(Hamiltonian *hamiltonian, double delta_t);    ///< Recompute the kinetic operators and the coupling constants.
+    bool update_parameters(const KernelConfig &config);    ///< Recompute the operators for the new parameters, time step and time direction.
+    void cpy_first_positive_to_first_negative() {};    ///< Empty function (only cylindrical coordinates).
+    bool runs_in_place() const {
+        return true;
+    }
+    /// Get kernel name.
+    string get_name() const {
+        return "Spectral";
+    }
+
+    void start_halo_exchange() {};    ///< Empty function: the halos are exchanged at the end of every step.
+    void finish_halo_exchange() {};    ///< Empty function: the halos are exchanged at the end of every step.
+
+private:
+    void set_coefficients(Hamiltonian *hamiltonian, double delta_t);    ///< Compute the kinetic operators in momentum space and the coupling constants.
+    void kinetic_step(int component);    ///< Apply half the kinetic evolution operator to a wave function.
+    void transform_axis(int axis, bool inverse);    ///< Fourier transform the spectrum along the x (0) or y (1) axis.
+    void exchange_halos(double *real, double *imag);    ///< Update the halos of a wave function.
+    void track_buffers();    ///< Account the change of the capacity of the buffers in the memory of the kernel.
+
+    int n_components;    ///< Number of wave functions (one or two).
+    double *p_real[2];    ///< Real part of the wave functions (the buffers of the states).
+    double *p_imag[2];    ///< Imaginary part of the wave functions (the buffers of the states).
+    double *external_pot_real[2];    ///< Real part of the evolution operators of the external potentials.
+    double *external_pot_imag[2];    ///< Imaginary part of the evolution operators of the external potentials.
+    vector<complex<double> > kinetic[2];    ///< Half-step kinetic evolution operators on the local momenta, normalization of the transforms included.
+    vector<complex<double> > spectrum;    ///< Wave function being transformed, on the inner part of the tile.
+    long tracked_bytes;    ///< Capacity of the buffers accounted in the memory of the kernel.
+    FFTPlan plans[2];    ///< Transforms along the x and y axes.
+    double coupling_const[5];    ///< Intra-species couplings (times delta_t), inter-species coupling (times delta_t), and the halved Rabi frequencies.
+    double LeeHuangYang_coupling;    ///< Lee-Huang-Yang coupling (times delta_t) of a single wave function.
+    double norm[2];    ///< Squared norms of the wave functions.
+    double tot_norm;    ///< Squared norm of the whole system.
+    bool imag_time;    ///< True: imaginary time evolution; False: real time evolution.
+    int state_index;    ///< Wave function evolved by the next run_kernel.
+    double delta_x;    ///< Physical length between two neighbour along x axis dots of the lattice.
+    double delta_y;    ///< Physical length between two neighbour along y axis dots of the lattice.
+    size_t halo_x;    ///< Thickness of the vertical halos (number of lattice's dots).
+    size_t halo_y;    ///< Thickness of the horizontal halos (number of lattice's dots).
+    size_t tile_width;    ///< Width of the tile (number of lattice's dots).
+    size_t tile_height;    ///< Height of the tile (number of lattice's dots).
+    size_t inner_width;    ///< Width of the inner part of the tile (number of lattice's dots).
+    size_t inner_height;    ///< Height of the inner part of the tile (number of lattice's dots).
+    int start_x;    ///< X axis coordinate of the first dot of the processed tile.
+    int start_y;    ///< Y axis coordinate of the first dot of the processed tile.
+    int inner_start_x;    ///< X axis coordinate of the first dot of the processed tile, which is not in the halo.
+    int inner_start_y;    ///< Y axis coordinate of the first dot of the processed tile, which is not in the halo.
+    int inner_end_x;    ///< X axis coordinate of the last dot of the processed tile, which is not in the halo.
+    int inner_end_y;    ///< Y axis coordinate of the last dot of the processed tile, which is not in the halo.
+    int *periods;    ///< Two dimensional array which takes entries 0 or 1. 1: periodic boundary condition along the corresponding axis; 0: closed boundary condition along the corresponding axis.
+#ifdef HAVE_MPI
+    MPI_Comm cartcomm;    ///< Ensemble of processes communicating the halos and evolving the tiles.
+    MPI_Comm axis_comm[2];    ///< Processes sharing the lines along the x and y axes (MPI_COMM_NULL if the axis is not split).
+    int axis_procs[2];    ///< Number of processes sharing the lines along the x and y axes.
+    vector<complex<double> > send_buffer;    ///< Values sent by the redistribution of the lines.
+    vector<complex<double> > recv_buffer;    ///< Values received by the redistribution of the lines.
+    vector<complex<double> > line_buffer;    ///< Complete lines owned by the process during a distributed transform.
+    int neighbors[4];    ///< Array that stores the processes' rank neighbour of the current process.
+    MPI_Datatype horizontalBorder;    ///< Datatype for the horizontal halos.
+    MPI_Datatype verticalBorder;    ///< Datatype for the vertical halos.
 #endif
 };
 
+/**
+ * \brief Features of the simulated system that a kernel may or may not support.
+ *
+ * The same structure describes what a kernel supports and what a system requires.
+ */
+struct KernelCapabilities {
+    bool rotation;    ///< Rotating frame of reference (nonzero angular velocity).
+    bool cylindrical;    ///< Cylindrical coordinate system.
+    bool two_components;    ///< Two-component systems.
+    bool imaginary_time;    ///< Imaginary time evolution.
+    bool multiple_states;    ///< Several states of a single-component system evolved together.
+    bool high_order_kinetic;    ///< Kinetic operator of spatial order 4 (Lattice::kinetic_order).
+    bool absorbing_layer;    ///< Complex absorbing potential along the edges (Hamiltonian::set_absorbing_layer), through the exponential of the potential.
+    bool mirror_symmetry;    ///< Lattices reduced by a parity along an axis (Lattice::parity_x, Lattice::parity_y).
+    bool reduced_precision_halos;    ///< Halo messages in single precision (Solver::set_halo_precision).
+    KernelCapabilities(bool _rotation = false, bool _cylindrical = false, bool _two_components = false,
+                       bool _imaginary_time = false, bool _multiple_states = false, bool _high_order_kinetic = false,
+                       bool _absorbing_layer = false, bool _mirror_symmetry = false, bool _reduced_precision_halos = false);
+    string missing(const KernelCapabilities &required) const;    ///< Name of the first required feature that is not supported; empty if all of them are.
+};
+
+/**
+ * \brief Arguments shared by the kernel factories.
+ */
+struct KernelConfig {
+    Lattice *grid;    ///< Lattice object.
+    State **states;    ///< States to evolve: the two components, or the states evolved together.
+    int n_states;    ///< Number of states.
+    bool two_components;    ///< Whether states holds the two components of a single system.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system.
+    double **external_pot_real;    ///< Real part of the evolution operators regarding the external potentials (one per component).
+    double **external_pot_imag;    ///< Imaginary part of the evolution operators regarding the external potentials (one per component).
+    double delta_t;    ///< A single evolution iteration, evolves the state for this time.
+    double *norm;    ///< Squared norms to preserve in imaginary time (one per state).
+    bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
+    int orthogonalization_period;    ///< Imaginary time iterations between two orthogonalizations of the states evolved together.
+    string halo_precision;    ///< Wire format of the halo messages: double or float.
+    int halo_resync_period;    ///< Steps between two exchanges of the halos in double precision when they travel as floats.
+};
+
+typedef ITrotterKernel *(*KernelFactory)(const KernelConfig &config);    ///< Build a kernel.
+typedef bool (*KernelProbe)(void);    ///< Whether a kernel can run on this machine.
+
+/**
+ * \brief Registry of the kernels available to the Solver.
+ *
+ * Kernels register by name with a capability descriptor and a priority; the built-in cpu and gpu kernels are registered on first use.
+ * The kernel type "auto" selects the available kernel with the highest priority that supports the system.
+ */
+class KernelRegistry {
+public:
+    static void register_kernel(string name, KernelFactory factory, KernelCapabilities capabilities,
+                                int priority, KernelProbe probe = NULL);    ///< Register a kernel, replacing any kernel with the same name.
+    static bool is_registered(string name);    ///< Whether a kernel with this name is registered.
+    static bool is_available(string name);    ///< Whether the kernel is registered and can run on this machine.
+    static KernelCapabilities get_capabilities(string name);    ///< Get the capabilities of a registered kernel.
+    static vector<string> get_names(void);    ///< Get the names of the registered kernels, by decreasing priority.
+    static string select(const KernelCapabilities &required);    ///< Name of the available kernel with the highest priority supporting the required features; empty if there is none.
+    static ITrotterKernel *create(string name, const KernelConfig &config);    ///< Build a registered kernel.
+};
+
+string get_cpu_isa(void);    ///< Instruction set of the CPU kernel variant selected for this processor (avx512f, avx2, sse2 or generic).
+
+ITrotterKernel *create_cpu_kernel(const KernelConfig &config);    ///< Factory of the CPU kernel.
+ITrotterKernel *create_chebyshev_kernel(const KernelConfig &config);    ///< Factory of the Chebyshev propagator kernel.
+ITrotterKernel *create_spectral_kernel(const KernelConfig &config);    ///< Factory of the split-step Fourier kernel.
+#ifdef CUDA
+ITrotterKernel *create_gpu_kernel(const KernelConfig &config);    ///< Factory of the GPU kernel.
+bool gpu_kernel_available(void);    ///< Whether a CUDA device is visible.
+#endif
+
+/** Events read by the hardware performance counters.
+ */
+enum CounterEvent {
+    COUNTER_CYCLES,    ///< CPU cycles.
+    COUNTER_INSTRUCTIONS,    ///< Instructions retired.
+    COUNTER_LLC_MISSES,    ///< Last level cache misses.
+    COUNTER_FP_OPS,    ///< Double precision floating point operations, summed over one event per vector width.
+    COUNTER_MAX_EVENTS = COUNTER_FP_OPS + 4    ///< Maximum number of events opened per thread.
+};
+
+/**
+ * \brief Hardware performance counters of the threads running the CPU kernels.
+ *
+ * The counters are opened through perf_event_open for each thread of the OpenMP pool (the calling thread under MPI),
+ * and count in user space only while started. An event that cannot be opened by every thread, because the host, the
+ * kernel or its perf_event_paranoid setting does not provide it, reads as negative; without Linux no event is available.
+ */
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+    bool is_available() const;    ///< Whether any event is available.
+    bool has_event(CounterEvent event) const;    ///< Whether the event is available.
+    void start();    ///< Start counting.
+    void stop();    ///< Stop counting, accumulating the counts and the time since start.
+    void reset();    ///< Clear the counts and the time.
+    double read_event(CounterEvent event) const;    ///< Count of an event, summed over the threads; negative if the event is not available.
+    double get_seconds() const;    ///< Time spent counting.
+    KernelCounters get_summary(double points) const;    ///< Derived metrics and roofline of the counts, for the given number of lattice point updates.
+
+private:
+    PerfCounters(const PerfCounters &);
+    PerfCounters &operator=(const PerfCounters &);
+
+    int n_threads;    ///< Number of threads followed.
+    int n_events;    ///< Number of events opened per thread.
+    vector<int> fds;    ///< File descriptors of the events, n_events per thread; negative if the event could not be opened.
+    double fp_weights[COUNTER_MAX_EVENTS - COUNTER_FP_OPS];    ///< Floating point operations of each floating point event.
+    double seconds;    ///< Time spent counting.
+    double start_time;    ///< Time of the last start.
+};
+
+void measure_roofline(double *peak_gflop_per_s, double *peak_gb_per_s);    ///< Peak floating point throughput (multiply-add loop) and memory bandwidth (triad loop) of the host with the threads of the CPU kernels; measured at the first call.
+
 #ifdef CUDA
 
 //#define DISABLE_FMA
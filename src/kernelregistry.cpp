@@ -0,0 +1,171 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "trottersuzuki.h"
+#include "common.h"
+#include "kernel.h"
+#include <algorithm>
+
+/*
+ * Built-in kernels. The priority ranks the kernels for kernel_type "auto": the GPU kernel is
+ * preferred whenever a device is visible and the system does not need features it lacks.
+ * The Chebyshev and spectral kernels are only used on request, since they require a linear problem
+ * and a lattice periodic along every axis, respectively.
+ */
+
+struct KernelEntry {
+    KernelFactory factory;
+    KernelCapabilities capabilities;
+    int priority;
+    KernelProbe probe;
+};
+
+static map<string, KernelEntry> builtin_kernels() {
+    map<string, KernelEntry> table;
+    KernelEntry cpu = {create_cpu_kernel, KernelCapabilities(true, true, true, true, true, true, true, true, true), 10, NULL};
+    table["cpu"] = cpu;
+    KernelEntry chebyshev = {create_chebyshev_kernel, KernelCapabilities(false, false, false, true, false), 5, NULL};
+    table["chebyshev"] = chebyshev;
+    // The spectral kernel applies the exact kinetic operator, which is at least as accurate as the stencil of order 4
+    KernelEntry spectral = {create_spectral_kernel, KernelCapabilities(false, false, true, true, false, true, true), 4, NULL};
+    table["spectral"] = spectral;
+#ifdef CUDA
+    KernelEntry gpu = {create_gpu_kernel, KernelCapabilities(false, false, true, true, false, false, true), 20, gpu_kernel_available};
+    table["gpu"] = gpu;
+#endif
+    return table;
+}
+
+static map<string, KernelEntry> &kernel_table() {
+    static map<string, KernelEntry> table = builtin_kernels();
+    return table;
+}
+
+static bool higher_priority(const pair<int, string> &a, const pair<int, string> &b) {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+KernelCapabilities::KernelCapabilities(bool _rotation, bool _cylindrical, bool _two_components,
+                                       bool _imaginary_time, bool _multiple_states, bool _high_order_kinetic, bool _absorbing_layer,
+                                       bool _mirror_symmetry, bool _reduced_precision_halos):
+    rotation(_rotation), cylindrical(_cylindrical), two_components(_two_components),
+    imaginary_time(_imaginary_time), multiple_states(_multiple_states), high_order_kinetic(_high_order_kinetic),
+    absorbing_layer(_absorbing_layer), mirror_symmetry(_mirror_symmetry), reduced_precision_halos(_reduced_precision_halos) {}
+
+string KernelCapabilities::missing(const KernelCapabilities &required) const {
+    if (required.rotation && !rotation)
+        return "nonzero angular velocity";
+    if (required.cylindrical && !cylindrical)
+        return "cylindrical coordinates";
+    if (required.two_components && !two_components)
+        return "two-component systems";
+    if (required.imaginary_time && !imaginary_time)
+        return "imaginary time evolution";
+    if (required.multiple_states && !multiple_states)
+        return "several states evolved together";
+    if (required.high_order_kinetic && !high_order_kinetic)
+        return "kinetic operator of order 4";
+    if (required.absorbing_layer && !absorbing_layer)
+        return "absorbing layers";
+    if (required.mirror_symmetry && !mirror_symmetry)
+        return "mirror symmetric lattices";
+    if (required.reduced_precision_halos && !reduced_precision_halos)
+        return "reduced-precision halo messages";
+    return "";
+}
+
+void KernelRegistry::register_kernel(string name, KernelFactory factory, KernelCapabilities capabilities,
+                                     int priority, KernelProbe probe) {
+    if (name == "auto") {
+        my_abort("The kernel name auto is reserved");
+    }
+    if (factory == NULL) {
+        my_abort("A kernel needs a factory");
+    }
+    KernelEntry entry = {factory, capabilities, priority, probe};
+    kernel_table()[name] = entry;
+}
+
+bool KernelRegistry::is_registered(string name) {
+    return kernel_table().count(name) > 0;
+}
+
+bool KernelRegistry::is_available(string name) {
+    map<string, KernelEntry>::const_iterator it = kernel_table().find(name);
+    if (it == kernel_table().end()) {
+        return false;
+    }
+    return it->second.probe == NULL || it->second.probe();
+}
+
+KernelCapabilities KernelRegistry::get_capabilities(string name) {
+    map<string, KernelEntry>::const_iterator it = kernel_table().find(name);
+    if (it == kernel_table().end()) {
+        my_abort("Unknown kernel");
+    }
+    return it->second.capabilities;
+}
+
+vector<string> KernelRegistry::get_names(void) {
+    vector<pair<int, string> > ranked;
+    for (map<string, KernelEntry>::const_iterator it = kernel_table().begin(); it != kernel_table().end(); ++it) {
+        ranked.push_back(make_pair(it->second.priority, it->first));
+    }
+    sort(ranked.begin(), ranked.end(), higher_priority);
+    vector<string> names;
+    for (size_t i = 0; i < ranked.size(); i++) {
+        names.push_back(ranked[i].second);
+    }
+    return names;
+}
+
+string KernelRegistry::select(const KernelCapabilities &required) {
+    vector<string> names = get_names();
+    for (size_t i = 0; i < names.size(); i++) {
+        if (kernel_table()[names[i]].capabilities.missing(required).empty() && is_available(names[i])) {
+            return names[i];
+        }
+    }
+    return "";
+}
+
+ITrotterKernel *KernelRegistry::create(string name, const KernelConfig &config) {
+    map<string, KernelEntry>::const_iterator it = kernel_table().find(name);
+    if (it == kernel_table().end()) {
+        my_abort("Unknown kernel");
+    }
+    return it->second.factory(config);
+}
+
+string get_cpu_isa(void) {
+#if defined(HAVE_TARGET_CLONES) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512f";
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+    return "sse2";
+#elif defined(__AVX512F__)
+    return "avx512f";
+#elif defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "generic";
+#endif
+}
@@ -0,0 +1,247 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const char *memory_category_names[MEMORY_CATEGORIES] = {"states", "kernel", "exp_potential", "potential", "temporary"};
+
+static volatile long memory_current[MEMORY_CATEGORIES + 1];    ///< Bytes allocated now per category; the last entry is the total.
+static volatile long memory_peak[MEMORY_CATEGORIES + 1];    ///< Largest bytes allocated at the same time per category; the last entry is the total.
+static volatile long memory_mapped[MEMORY_CATEGORIES + 1];    ///< Bytes allocated now in scratch files per category; the last entry is the total.
+
+static string scratch_directory;    ///< Directory of the scratch files of the out-of-core mode; empty when it is disabled.
+static size_t scratch_min_bytes;    ///< Smallest buffer mapped from a scratch file.
+
+/**
+ * \brief Prefix of a tracked buffer.
+ *
+ * Its size is a multiple of 16 bytes, so that the buffer keeps the alignment of new.
+ */
+struct TrackedHeader {
+    size_t count;    ///< Number of doubles of the buffer.
+    size_t category;    ///< Category the buffer is accounted in.
+    size_t mapped_bytes;    ///< Length of the mapping of the buffer, header included; zero if it was allocated with new.
+    size_t padding;    ///< Keeps the size a multiple of 16 bytes.
+};
+
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * \brief Mapped buffers, looked up by the paging hints so that they ignore the buffers in RAM.
+ *
+ * The list is short (a few buffers per solver) and only changes on allocation, so a spin lock is enough.
+ */
+static vector<pair<const char *, const char *> > mapped_regions;
+static volatile int mapped_regions_lock = 0;
+
+static void lock_mapped_regions(void) {
+    while (!__sync_bool_compare_and_swap(&mapped_regions_lock, 0, 1)) {}
+}
+
+static void unlock_mapped_regions(void) {
+    __sync_lock_release(&mapped_regions_lock);
+}
+
+static bool is_mapped(const double *buffer) {
+    const char *address = reinterpret_cast<const char *>(buffer);
+    bool found = false;
+    lock_mapped_regions();
+    for (size_t i = 0; i < mapped_regions.size() && !found; i++) {
+        found = address >= mapped_regions[i].first && address < mapped_regions[i].second;
+    }
+    unlock_mapped_regions();
+    return found;
+}
+
+/**
+ * Map bytes from a new scratch file, which is unlinked at once so that it disappears with the mapping.
+ */
+static char *map_scratch_file(size_t bytes) {
+    string file_name = scratch_directory + "/trottersuzuki-XXXXXX";
+    vector<char> name(file_name.begin(), file_name.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        my_abort("Cannot create a scratch file in " + scratch_directory);
+    }
+    unlink(&name[0]);
+    if (posix_fallocate(fd, 0, bytes) != 0) {
+        close(fd);
+        my_abort("Not enough space for the scratch files in " + scratch_directory);
+    }
+    void *block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) {
+        my_abort("Cannot map a scratch file of " + scratch_directory);
+    }
+    return static_cast<char *>(block);
+}
+
+/**
+ * Pages of the mapped buffer covering count doubles from offset; false if the buffer is not mapped.
+ */
+static bool mapped_pages(const double *buffer, size_t offset, size_t count, char **start, size_t *length) {
+    if (count == 0 || !is_mapped(buffer)) {
+        return false;
+    }
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = reinterpret_cast<size_t>(buffer + offset) / page * page;
+    size_t end = reinterpret_cast<size_t>(buffer + offset + count);
+    *start = reinterpret_cast<char *>(begin);
+    *length = end - begin;
+    return true;
+}
+#endif
+
+void set_out_of_core(string directory, size_t min_bytes) {
+#ifdef HAVE_SYS_MMAN_H
+    scratch_directory = directory;
+    scratch_min_bytes = min_bytes;
+#else
+    if (directory != "") {
+        my_abort("The out-of-core mode needs memory-mapped files, which are not available on this platform");
+    }
+#endif
+}
+
+void prefetch_tracked(const double *buffer, size_t offset, size_t count) {
+#ifdef HAVE_SYS_MMAN_H
+    char *start;
+    size_t length;
+    if (mapped_pages(buffer, offset, count, &start, &length)) {
+        madvise(start, length, MADV_WILLNEED);
+    }
+#endif
+}
+
+void release_tracked(const double *buffer, size_t offset, size_t count) {
+#ifdef HAVE_SYS_MMAN_H
+    char *start;
+    size_t length;
+    if (mapped_pages(buffer, offset, count, &start, &length)) {
+        // The dirty pages stay in the page cache, which writes them back to the file when it needs room
+        msync(start, length, MS_ASYNC);
+        madvise(start, length, MADV_DONTNEED);
+    }
+#endif
+}
+
+static void raise_peak(int index, long current) {
+    long peak = memory_peak[index];
+    while (current > peak && !__sync_bool_compare_and_swap(&memory_peak[index], peak, current)) {
+        peak = memory_peak[index];
+    }
+}
+
+void track_memory(long bytes, MemoryCategory category) {
+    long current = __sync_add_and_fetch(&memory_current[category], bytes);
+    long total = __sync_add_and_fetch(&memory_current[MEMORY_CATEGORIES], bytes);
+    if (bytes > 0) {
+        raise_peak(category, current);
+        raise_peak(MEMORY_CATEGORIES, total);
+    }
+}
+
+double *allocate_tracked(size_t count, MemoryCategory category) {
+    size_t bytes = sizeof(TrackedHeader) + count * sizeof(double);
+    char *block = NULL;
+    size_t mapped_bytes = 0;
+#ifdef HAVE_SYS_MMAN_H
+    // The temporaries are short-lived and touched as a whole: only the large buffers go out of core
+    if (scratch_directory != "" && category != MEMORY_TEMPORARY && count * sizeof(double) >= scratch_min_bytes) {
+        block = map_scratch_file(bytes);
+        mapped_bytes = bytes;
+        lock_mapped_regions();
+        mapped_regions.push_back(make_pair(const_cast<const char *>(block), const_cast<const char *>(block + bytes)));
+        unlock_mapped_regions();
+        __sync_add_and_fetch(&memory_mapped[category], long(count * sizeof(double)));
+        __sync_add_and_fetch(&memory_mapped[MEMORY_CATEGORIES], long(count * sizeof(double)));
+    }
+#endif
+    if (block == NULL) {
+        block = new char[bytes];
+    }
+    TrackedHeader *header = reinterpret_cast<TrackedHeader *>(block);
+    header->count = count;
+    header->category = category;
+    header->mapped_bytes = mapped_bytes;
+    track_memory(count * sizeof(double), category);
+    return reinterpret_cast<double *>(block + sizeof(TrackedHeader));
+}
+
+void free_tracked(double *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    char *block = reinterpret_cast<char *>(buffer) - sizeof(TrackedHeader);
+    TrackedHeader *header = reinterpret_cast<TrackedHeader *>(block);
+    track_memory(-long(header->count * sizeof(double)), MemoryCategory(header->category));
+#ifdef HAVE_SYS_MMAN_H
+    if (header->mapped_bytes != 0) {
+        __sync_sub_and_fetch(&memory_mapped[header->category], long(header->count * sizeof(double)));
+        __sync_sub_and_fetch(&memory_mapped[MEMORY_CATEGORIES], long(header->count * sizeof(double)));
+        lock_mapped_regions();
+        for (size_t i = 0; i < mapped_regions.size(); i++) {
+            if (mapped_regions[i].first == block) {
+                mapped_regions.erase(mapped_regions.begin() + i);
+                break;
+            }
+        }
+        unlock_mapped_regions();
+        munmap(block, header->mapped_bytes);
+        return;
+    }
+#endif
+    delete [] block;
+}
+
+vector<MemoryUsage> get_tracked_memory(void) {
+    vector<MemoryUsage> usage(MEMORY_CATEGORIES + 1);
+    for (int i = 0; i <= MEMORY_CATEGORIES; i++) {
+        usage[i].category = i < MEMORY_CATEGORIES ? memory_category_names[i] : "total";
+        usage[i].current_bytes = memory_current[i];
+        usage[i].peak_bytes = memory_peak[i];
+        usage[i].mapped_bytes = memory_mapped[i];
+    }
+    return usage;
+}
+
+void reset_tracked_peaks(void) {
+    for (int i = 0; i <= MEMORY_CATEGORIES; i++) {
+        memory_peak[i] = memory_current[i];
+    }
+}
+
+vector<MemoryUsage> make_memory_usage(const double *bytes) {
+    vector<MemoryUsage> usage(MEMORY_CATEGORIES + 1);
+    double total = 0.;
+    for (int i = 0; i < MEMORY_CATEGORIES; i++) {
+        usage[i].category = memory_category_names[i];
+        usage[i].current_bytes = usage[i].peak_bytes = bytes[i];
+        usage[i].mapped_bytes = 0.;
+        total += bytes[i];
+    }
+    usage[MEMORY_CATEGORIES].category = "total";
+    usage[MEMORY_CATEGORIES].current_bytes = usage[MEMORY_CATEGORIES].peak_bytes = total;
+    usage[MEMORY_CATEGORIES].mapped_bytes = 0.;
+    return usage;
+}
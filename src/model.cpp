@@ -16,7 +16,9 @@
  *
  */
 #include <fstream>
+#include <algorithm>
 #include <iostream>
+#include <cstring>
 #include "trottersuzuki.h"
 #include "common.h"
 #include <math.h>
@@ -29,18 +31,65 @@ double const_potential(double x, double y) {
     return 0.;
 }
 
-Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system) {
+static void check_kinetic_order(int kinetic_order, string coordinate_system) {
+    if (kinetic_order != 2 && kinetic_order != 4) {
+        my_abort("The order of the kinetic operator must be 2 or 4");
+    }
+    if (kinetic_order == 4 && coordinate_system != "cartesian") {
+        my_abort("The kinetic operator of order 4 is only available in cartesian coordinates");
+    }
+}
+
+/**
+ * An axis with a parity is closed and cartesian, and its points split evenly between the two sides of the symmetry plane.
+ */
+static void check_parity(int parity, int dim, bool periodic, string coordinate_system) {
+    if (parity != 0 && parity != 1 && parity != -1) {
+        my_abort("The parity must be 1 (even), -1 (odd) or 0 (no symmetry)");
+    }
+    if (parity != 0 && (periodic || coordinate_system != "cartesian")) {
+        my_abort("Only closed cartesian axes can have a parity");
+    }
+    if (parity != 0 && dim % 2 != 0) {
+        my_abort("An axis with a parity needs an even number of points");
+    }
+}
+
+/**
+ * Along an axis with a parity, the tile at the symmetry plane gets a halo as if the axis were periodic, which
+ * holds the mirror images of its first points.
+ */
+static void add_mirror_halo(int parity, int halo, int mpi_coord, int *start, int *global_dim) {
+    if (parity != 0) {
+        *global_dim += halo;
+        if (mpi_coord == 0) {
+            *start -= halo;
+        }
+    }
+}
+
+Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system, int _kinetic_order, int _parity_x) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
     }
+    check_kinetic_order(_kinetic_order, _coordinate_system);
+    check_parity(_parity_x, dim, periodic_x_axis, _coordinate_system);
     if (_coordinate_system == "cylindrical" &&
             periodic_x_axis == true) {
         my_abort("You cannot choose periodic boundary on the radial axis.");
     }
     coordinate_system = _coordinate_system;
+    kinetic_order = _kinetic_order;
+    parity_x = _parity_x;
+    parity_y = 0;
+    if (parity_x != 0) {
+        dim /= 2;
+        length /= 2.;
+    }
     length_x = length;
     length_y = 0;
+    origin_x = origin_y = 0.;
     if (_coordinate_system == "cylindrical") {
         dim += 1;
         delta_x = length_x / (double(dim) - 0.5);
@@ -65,7 +114,7 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     mpi_dims[0] = mpi_dims[1] = 1;
     mpi_coords[0] = mpi_coords[1] = 0;
 #endif
-    halo_x = 4;
+    halo_x = lattice_halo(0., kinetic_order);
     halo_y = 0;
     global_dim_x = dim + periods[1] * 2 * halo_x;
     global_dim_y = 1;
@@ -78,6 +127,7 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     if (coordinate_system == "cylindrical" && mpi_coords[1] == 0) {
         inner_start_x += 1;
     }
+    add_mirror_halo(parity_x, halo_x, mpi_coords[0], &start_x, &global_dim_x);
     dim_x = end_x - start_x;
     start_y = 0;
     end_y = 1;
@@ -86,33 +136,81 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     dim_y = 1;
 }
 
+void Lattice::extend(int points_x, int points_y) {
+    if ((points_x > 0 && periods[1] != 0) || (points_y > 0 && periods[0] != 0)) {
+        my_abort("Periodic axes cannot be extended");
+    }
+    if ((points_x > 0 && parity_x != 0) || (points_y > 0 && parity_y != 0)) {
+        my_abort("Axes with a parity cannot be extended");
+    }
+    // The processes keep their place in the topology, and split the longer axes again
+    if (points_x > 0) {
+        global_no_halo_dim_x += 2 * points_x;
+        global_dim_x += 2 * points_x;
+        length_x += 2 * points_x * delta_x;
+        calculate_borders(mpi_coords[1], mpi_dims[1], &start_x, &end_x,
+                          &inner_start_x, &inner_end_x,
+                          global_no_halo_dim_x, halo_x, periods[1]);
+        dim_x = end_x - start_x;
+    }
+    if (points_y > 0) {
+        global_no_halo_dim_y += 2 * points_y;
+        global_dim_y += 2 * points_y;
+        length_y += 2 * points_y * delta_y;
+        calculate_borders(mpi_coords[0], mpi_dims[0], &start_y, &end_y,
+                          &inner_start_y, &inner_end_y,
+                          global_no_halo_dim_y, halo_y, periods[0]);
+        dim_y = end_y - start_y;
+    }
+}
+
 Lattice2D::Lattice2D(int dim, double _length,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system, int kinetic_order,
+                     int parity_x, int parity_y) {
     init(dim, _length, dim, _length, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, kinetic_order, parity_x, parity_y);
 }
 
 Lattice2D::Lattice2D(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system, int kinetic_order,
+                     int parity_x, int parity_y) {
     init(_dim_x, _length_x, _dim_y, _length_y, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, kinetic_order, parity_x, parity_y);
 }
 
 void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string _coordinate_system) {
+                     double angular_velocity, string _coordinate_system, int _kinetic_order,
+                     int _parity_x, int _parity_y) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
     }
+    check_kinetic_order(_kinetic_order, _coordinate_system);
     if (_coordinate_system == "cylindrical" &&
             periodic_x_axis == true) {
         my_abort("You cannot choose periodic boundary on the radial axis.");
     }
+    check_parity(_parity_x, _dim_x, periodic_x_axis, _coordinate_system);
+    check_parity(_parity_y, _dim_y, periodic_y_axis, _coordinate_system);
+    if ((_parity_x != 0 || _parity_y != 0) && angular_velocity != 0.) {
+        my_abort("The rotation of the frame of reference breaks the reflection symmetries");
+    }
+    parity_x = _parity_x;
+    parity_y = _parity_y;
+    if (parity_x != 0) {
+        _dim_x /= 2;
+        _length_x /= 2.;
+    }
+    if (parity_y != 0) {
+        _dim_y /= 2;
+        _length_y /= 2.;
+    }
     length_x = _length_x;
     length_y = _length_y;
+    origin_x = origin_y = 0.;
     if (_coordinate_system == "cylindrical") {
         _dim_x += 1;
         delta_x = length_x / (double(_dim_x) - 0.5);
@@ -122,6 +220,7 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     }
     delta_y = length_y / double(_dim_y);
     coordinate_system = _coordinate_system;
+    kinetic_order = _kinetic_order;
     periods[0] = (int) periodic_y_axis;
     periods[1] = (int) periodic_x_axis;
     mpi_dims[0] = mpi_dims[1] = 0;
@@ -137,8 +236,8 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     mpi_dims[0] = mpi_dims[1] = 1;
     mpi_coords[0] = mpi_coords[1] = 0;
 #endif
-    halo_x = (angular_velocity == 0. ? 4 : 8);
-    halo_y = (angular_velocity == 0. ? 4 : 8);
+    halo_x = lattice_halo(angular_velocity, kinetic_order);
+    halo_y = lattice_halo(angular_velocity, kinetic_order);
     global_dim_x = _dim_x + periods[1] * 2 * halo_x;
     global_dim_y = _dim_y + periods[0] * 2 * halo_y;
     global_no_halo_dim_x = _dim_x;
@@ -153,15 +252,30 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     calculate_borders(mpi_coords[0], mpi_dims[0], &start_y, &end_y,
                       &inner_start_y, &inner_end_y,
                       _dim_y, halo_y, periods[0]);
+    add_mirror_halo(parity_x, halo_x, mpi_coords[1], &start_x, &global_dim_x);
+    add_mirror_halo(parity_y, halo_y, mpi_coords[0], &start_y, &global_dim_y);
     dim_x = end_x - start_x;
     dim_y = end_y - start_y;
 }
 
+int Lattice::symmetry_factor() const {
+    return (parity_x != 0 ? 2 : 1) * (parity_y != 0 ? 2 : 1);
+}
+
+void Lattice::get_snapshot_dims(int *width, int *height) const {
+    *width = inner_end_x - inner_start_x;
+    *height = inner_end_y - inner_start_y;
+    if (mpi_procs == 1) {
+        *width *= parity_x != 0 ? 2 : 1;
+        *height *= parity_y != 0 ? 2 : 1;
+    }
+}
+
 State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_imag): grid(_grid), angular_momentum(_angular_momentum) {
     expected_values_updated = false;
     if (_p_real == 0) {
         self_init = true;
-        p_real = new double[grid->dim_x * grid->dim_y];
+        p_real = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
         for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
             p_real[i] = 0;
         }
@@ -171,7 +285,7 @@ State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_
         p_real = _p_real;
     }
     if (_p_imag == 0) {
-        p_imag = new double[grid->dim_x * grid->dim_y];
+        p_imag = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
         for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
             p_imag[i] = 0;
         }
@@ -182,12 +296,12 @@ State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_
 }
 
 State::State(const State &obj): grid(obj.grid), angular_momentum(obj.angular_momentum),
-    expected_values_updated(obj.expected_values_updated), self_init(obj.self_init),
+    expected_values_updated(obj.expected_values_updated), self_init(true),
     mean_X(obj.mean_X), mean_XX(obj.mean_XX), mean_Y(obj.mean_Y), mean_YY(obj.mean_YY),
     mean_Px(obj.mean_Px), mean_PxPx(obj.mean_PxPx), mean_Py(obj.mean_Py), mean_PyPy(obj.mean_PyPy),
     norm2(obj.norm2) {
-    p_real = new double[grid->dim_x * grid->dim_y];
-    p_imag = new double[grid->dim_x * grid->dim_y];
+    p_real = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
+    p_imag = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
     for (int y = 0; y < grid->dim_y; y++) {
         for (int x = 0; x < grid->dim_x; x++) {
             p_real[y * grid->dim_x + x] = obj.p_real[y * grid->dim_x + x];
@@ -196,10 +310,99 @@ State::State(const State &obj): grid(obj.grid), angular_momentum(obj.angular_mom
     }
 }
 
+/**
+ * Copy the inner points of the tiles of a wave function over the lattice grid to the matrices of the whole lattice,
+ * on every process.
+ */
+static void gather_lattice(const Lattice &grid, const double *p_real, const double *p_imag,
+                           double *lattice_real, double *lattice_imag) {
+    int width = grid.global_no_halo_dim_x;
+    int bounds[4] = {grid.inner_start_x, grid.inner_start_y, grid.inner_end_x - grid.inner_start_x, grid.inner_end_y - grid.inner_start_y};
+#ifdef HAVE_MPI
+    if (grid.mpi_procs > 1) {
+        size_t tile_points = size_t(bounds[2]) * bounds[3];
+        double *tile = allocate_tracked(2 * tile_points, MEMORY_TEMPORARY);
+        for (int y = 0; y < bounds[3]; y++) {
+            for (int x = 0; x < bounds[2]; x++) {
+                int idx = (y + grid.inner_start_y - grid.start_y) * grid.dim_x + x + grid.inner_start_x - grid.start_x;
+                tile[y * bounds[2] + x] = p_real[idx];
+                tile[tile_points + y * bounds[2] + x] = p_imag[idx];
+            }
+        }
+        vector<int> all_bounds(4 * grid.mpi_procs), counts(grid.mpi_procs), displs(grid.mpi_procs);
+        MPI_Allgather(bounds, 4, MPI_INT, &all_bounds[0], 4, MPI_INT, grid.cartcomm);
+        for (int rank = 0, offset = 0; rank < grid.mpi_procs; rank++) {
+            counts[rank] = 2 * all_bounds[4 * rank + 2] * all_bounds[4 * rank + 3];
+            displs[rank] = offset;
+            offset += counts[rank];
+        }
+        double *tiles = allocate_tracked(2 * size_t(width) * grid.global_no_halo_dim_y, MEMORY_TEMPORARY);
+        MPI_Allgatherv(tile, 2 * tile_points, MPI_DOUBLE, tiles, &counts[0], &displs[0], MPI_DOUBLE, grid.cartcomm);
+        for (int rank = 0; rank < grid.mpi_procs; rank++) {
+            const int *b = &all_bounds[4 * rank];
+            const double *source = tiles + displs[rank];
+            for (int y = 0; y < b[3]; y++) {
+                for (int x = 0; x < b[2]; x++) {
+                    lattice_real[(b[1] + y) * width + b[0] + x] = source[y * b[2] + x];
+                    lattice_imag[(b[1] + y) * width + b[0] + x] = source[counts[rank] / 2 + y * b[2] + x];
+                }
+            }
+        }
+        free_tracked(tiles);
+        free_tracked(tile);
+        return;
+    }
+#endif
+    for (int y = 0; y < bounds[3]; y++) {
+        for (int x = 0; x < bounds[2]; x++) {
+            int idx = (y + grid.inner_start_y - grid.start_y) * grid.dim_x + x + grid.inner_start_x - grid.start_x;
+            lattice_real[(bounds[1] + y) * width + bounds[0] + x] = p_real[idx];
+            lattice_imag[(bounds[1] + y) * width + bounds[0] + x] = p_imag[idx];
+        }
+    }
+}
+
+/**
+ * Coordinate on the lattice of a point of the tile, folded into the lattice along a periodic axis.
+ */
+static int lattice_coordinate(int coordinate, int length, int periodic) {
+    return periodic != 0 ? (coordinate % length + length) % length : coordinate;
+}
+
+void State::remap(const Lattice &old_grid, int offset_x, int offset_y) {
+    bool resized = old_grid.dim_x != grid->dim_x || old_grid.dim_y != grid->dim_y;
+    if (resized && !self_init) {
+        my_abort("The state cannot follow the lattice: its matrices are owned by the caller");
+    }
+    int old_width = old_grid.global_no_halo_dim_x, old_height = old_grid.global_no_halo_dim_y;
+    double *lattice_real = allocate_tracked(size_t(old_width) * old_height, MEMORY_TEMPORARY);
+    double *lattice_imag = allocate_tracked(size_t(old_width) * old_height, MEMORY_TEMPORARY);
+    gather_lattice(old_grid, p_real, p_imag, lattice_real, lattice_imag);
+    if (resized) {
+        free_tracked(p_real);
+        free_tracked(p_imag);
+        p_real = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
+        p_imag = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_STATES);
+    }
+    // Every point of the tile, halos included, takes its value on the previous lattice
+    for (int y = 0; y < grid->dim_y; y++) {
+        for (int x = 0; x < grid->dim_x; x++) {
+            int old_x = lattice_coordinate(grid->start_x + x, grid->global_no_halo_dim_x, grid->periods[1]) - offset_x;
+            int old_y = lattice_coordinate(grid->start_y + y, grid->global_no_halo_dim_y, grid->periods[0]) - offset_y;
+            bool inside = old_x >= 0 && old_x < old_width && old_y >= 0 && old_y < old_height;
+            p_real[y * grid->dim_x + x] = inside ? lattice_real[old_y * old_width + old_x] : 0.;
+            p_imag[y * grid->dim_x + x] = inside ? lattice_imag[old_y * old_width + old_x] : 0.;
+        }
+    }
+    free_tracked(lattice_real);
+    free_tracked(lattice_imag);
+    expected_values_updated = false;
+}
+
 State::~State() {
     if (self_init) {
-        delete [] p_real;
-        delete [] p_imag;
+        free_tracked(p_real);
+        free_tracked(p_imag);
     }
 }
 
@@ -252,13 +455,25 @@ void State::init_state(complex<double> (*ini_state)(double x, double y)) {
 }
 
 void State::loadtxt(char *file_name) {
+    TRACE_SCOPE("read_file");
     ifstream input(file_name);
     int in_width = grid->global_no_halo_dim_x;
     int in_height = grid->global_no_halo_dim_y;
+    // Files written on a single process hold the lattice unfolded along the axes with a parity:
+    // the mirrored first half is skipped
+    int skip_x = 0, skip_y = 0;
+    if (grid->mpi_procs == 1) {
+        skip_x = grid->parity_x != 0 ? in_width : 0;
+        skip_y = grid->parity_y != 0 ? in_height : 0;
+    }
     complex<double> tmp;
-    for(int i = 0; i < in_height; i++) {
-        for(int j = 0; j < in_width; j++) {
+    for(int row = 0; row < skip_y + in_height; row++) {
+        for(int col = 0; col < skip_x + in_width; col++) {
             input >> tmp;
+            int i = row - skip_y, j = col - skip_x;
+            if (i < 0 || j < 0) {
+                continue;
+            }
 
             if((i - grid->start_y) >= 0 && (i - grid->start_y) < grid->dim_y && (j - grid->start_x) >= 0 && (j - grid->start_x) < grid->dim_x) {
                 p_real[(i - grid->start_y) * grid->dim_x + j - grid->start_x] = real(tmp);
@@ -319,21 +534,23 @@ void State::loadtxt(char *file_name) {
         }
     }
     input.close();
+    fill_mirror_halos(grid, p_real, p_imag);
 }
 
 double *State::get_particle_density(double *_density) {
     double *density;
-    int local_no_halo_dim_x = grid->inner_end_x - grid->inner_start_x;
-    int local_no_halo_dim_y = grid->inner_end_y - grid->inner_start_y;
+    int width, height, sign;
+    grid->get_snapshot_dims(&width, &height);
     if (_density == 0) {
-        density = new double[local_no_halo_dim_x * local_no_halo_dim_y];
+        density = new double[width * height];
     }
     else {
         density = _density;
     }
-    for(int id_j = 0, j = grid->inner_start_y - grid->start_y; j < grid->inner_end_y - grid->start_y; ++id_j, ++j) {
-        for(int id_i = 0, i = grid->inner_start_x - grid->start_x; i < grid->inner_end_x - grid->start_x; ++id_i, ++i) {
-            density[id_j * local_no_halo_dim_x + id_i] = (p_real[j * grid->dim_x + i] * p_real[j * grid->dim_x + i] + p_imag[j * grid->dim_x + i] * p_imag[j * grid->dim_x + i]);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int index = map_snapshot_to_tile(grid, x, y, &sign);
+            density[y * width + x] = p_real[index] * p_real[index] + p_imag[index] * p_imag[index];
         }
     }
     return density;
@@ -343,30 +560,32 @@ void State::write_particle_density(string fileprefix) {
     double *density = get_particle_density();
     stringstream filename;
     filename << fileprefix << "-density";
-    int local_no_halo_dim_x = grid->inner_end_x - grid->inner_start_x;
-    int local_no_halo_dim_y = grid->inner_end_y - grid->inner_start_y;
-    print_matrix(filename.str(), density, local_no_halo_dim_x, local_no_halo_dim_x, local_no_halo_dim_y);
+    int width, height;
+    grid->get_snapshot_dims(&width, &height);
+    print_matrix(filename.str(), density, width, width, height);
     delete [] density;
 }
 
 double *State::get_phase(double *_phase) {
     double *phase;
-    int local_no_halo_dim_x = grid->inner_end_x - grid->inner_start_x;
-    int local_no_halo_dim_y = grid->inner_end_y - grid->inner_start_y;
+    int width, height, sign;
+    grid->get_snapshot_dims(&width, &height);
     if (_phase == 0) {
-        phase = new double[local_no_halo_dim_x * local_no_halo_dim_y];
+        phase = new double[width * height];
     }
     else {
         phase = _phase;
     }
     double norm;
-    for(int id_j = 0, j = grid->inner_start_y - grid->start_y; j < grid->inner_end_y - grid->start_y; ++id_j, ++j) {
-        for(int id_i = 0, i = grid->inner_start_x - grid->start_x; i < grid->inner_end_x - grid->start_x; ++id_i, ++i) {
-            norm = sqrt(p_real[j * grid->dim_x + i] * p_real[j * grid->dim_x + i] + p_imag[j * grid->dim_x + i] * p_imag[j * grid->dim_x + i]);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int index = map_snapshot_to_tile(grid, x, y, &sign);
+            double real = sign * p_real[index], imag = sign * p_imag[index];
+            norm = sqrt(real * real + imag * imag);
             if(norm == 0)
-                phase[id_j * local_no_halo_dim_x + id_i] = 0;
+                phase[y * width + x] = 0;
             else
-                phase[id_j * local_no_halo_dim_x + id_i] = acos(p_real[j * grid->dim_x + i] / norm) * ((p_imag[j * grid->dim_x + i] >= 0) - (p_imag[j * grid->dim_x + i] < 0));
+                phase[y * width + x] = acos(real / norm) * ((imag >= 0) - (imag < 0));
         }
     }
     return phase;
@@ -376,13 +595,14 @@ void State::write_phase(string fileprefix) {
     double *phase = get_phase();
     stringstream filename;
     filename << fileprefix << "-phase";
-    int local_no_halo_dim_x = grid->inner_end_x - grid->inner_start_x;
-    int local_no_halo_dim_y = grid->inner_end_y - grid->inner_start_y;
-    print_matrix(filename.str(), phase, local_no_halo_dim_x, local_no_halo_dim_x, local_no_halo_dim_y);
+    int width, height;
+    grid->get_snapshot_dims(&width, &height);
+    print_matrix(filename.str(), phase, width, width, height);
     delete [] phase;
 }
 
 void State::calculate_expected_values(void) {
+    TRACE_SCOPE("state_expected_values");
     int ini_halo_x = grid->inner_start_x - grid->start_x;
     int ini_halo_y = grid->inner_start_y - grid->start_y;
     int end_halo_x = grid->end_x - grid->inner_end_x;
@@ -465,16 +685,16 @@ void State::calculate_expected_values(void) {
     mean_angular_momentum = sum_angular_momentum;
 
 #ifdef HAVE_MPI
-    double *norm2_mpi = new double[grid->mpi_procs];
-    double *mean_X_mpi = new double[grid->mpi_procs];
-    double *mean_Y_mpi = new double[grid->mpi_procs];
-    double *mean_XX_mpi = new double[grid->mpi_procs];
-    double *mean_YY_mpi = new double[grid->mpi_procs];
-    double *mean_Px_mpi = new double[grid->mpi_procs];
-    double *mean_Py_mpi = new double[grid->mpi_procs];
-    double *mean_PxPx_mpi = new double[grid->mpi_procs];
-    double *mean_PyPy_mpi = new double[grid->mpi_procs];
-    double *mean_angular_momentum_mpi = new double[grid->mpi_procs];
+    double *norm2_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_X_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_Y_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_XX_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_YY_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_Px_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_Py_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_PxPx_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_PyPy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *mean_angular_momentum_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
 
     MPI_Allgather(&norm2, 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
     MPI_Allgather(&mean_X, 1, MPI_DOUBLE, mean_X_mpi, 1, MPI_DOUBLE, grid->cartcomm);
@@ -510,16 +730,16 @@ void State::calculate_expected_values(void) {
         mean_PyPy += mean_PyPy_mpi[i];
         mean_angular_momentum += mean_angular_momentum_mpi[i];
     }
-    delete [] norm2_mpi;
-    delete [] mean_X_mpi;
-    delete [] mean_Y_mpi;
-    delete [] mean_XX_mpi;
-    delete [] mean_YY_mpi;
-    delete [] mean_Px_mpi;
-    delete [] mean_Py_mpi;
-    delete [] mean_PxPx_mpi;
-    delete [] mean_PyPy_mpi;
-    delete [] mean_angular_momentum_mpi;
+    free_tracked(norm2_mpi);
+    free_tracked(mean_X_mpi);
+    free_tracked(mean_Y_mpi);
+    free_tracked(mean_XX_mpi);
+    free_tracked(mean_YY_mpi);
+    free_tracked(mean_Px_mpi);
+    free_tracked(mean_Py_mpi);
+    free_tracked(mean_PxPx_mpi);
+    free_tracked(mean_PyPy_mpi);
+    free_tracked(mean_angular_momentum_mpi);
 #endif
     mean_X = mean_X / norm2;
     mean_Y = mean_Y / norm2;
@@ -530,8 +750,20 @@ void State::calculate_expected_values(void) {
     mean_PxPx = mean_PxPx / norm2;
     mean_PyPy = mean_PyPy / norm2;
     mean_angular_momentum = mean_angular_momentum / norm2;
+    // The moments odd along an axis with a parity vanish on the full lattice
+    if (grid->parity_x != 0) {
+        mean_X = 0.;
+        mean_Px = 0.;
+    }
+    if (grid->parity_y != 0) {
+        mean_Y = 0.;
+        mean_Py = 0.;
+    }
+    if (grid->parity_x != 0 || grid->parity_y != 0) {
+        mean_angular_momentum = 0.;
+    }
 
-    norm2 *= grid->delta_x * grid->delta_y;
+    norm2 *= grid->delta_x * grid->delta_y * grid->symmetry_factor();
     expected_values_updated = true;
 }
 
@@ -634,6 +866,7 @@ double State::get_squared_norm(void) {
 }
 
 void State::write_to_file(string filename) {
+    TRACE_SCOPE("write_file");
     stamp(grid, this, filename);
 }
 
@@ -666,8 +899,8 @@ ExponentialState::ExponentialState(Lattice2D *_grid, int _n_x, int _n_y, double
 }
 
 complex<double> ExponentialState::exp_state(double x, double y) {
-    double L_x = grid->global_no_halo_dim_x * grid->delta_x;
-    double L_y = grid->global_no_halo_dim_y * grid->delta_y;
+    double L_x = grid->global_no_halo_dim_x * grid->delta_x * (grid->parity_x != 0 ? 2 : 1);
+    double L_y = grid->global_no_halo_dim_y * grid->delta_y * (grid->parity_y != 0 ? 2 : 1);
     return sqrt(norm / (L_x * L_y)) * exp(complex<double>(0., phase)) * exp(complex<double>(0., 2 * M_PI * double(n_x) / L_x * x + 2 * M_PI * double(n_y) / L_y * y));
 }
 
@@ -742,8 +975,8 @@ SinusoidState::SinusoidState(Lattice2D *_grid, int _n_x, int _n_y, double _norm,
 }
 
 complex<double> SinusoidState::sinusoid_state(double x, double y) {
-    double L_x = grid->global_no_halo_dim_x * grid->delta_x;
-    double L_y = grid->global_no_halo_dim_y * grid->delta_y;
+    double L_x = grid->global_no_halo_dim_x * grid->delta_x * (grid->parity_x != 0 ? 2 : 1);
+    double L_y = grid->global_no_halo_dim_y * grid->delta_y * (grid->parity_y != 0 ? 2 : 1);
     return sqrt(norm / (L_x * L_y)) * 2.* exp(complex<double>(0., phase)) * complex<double> (sin(2 * M_PI * double(n_x) / L_x * x) * sin(2 * M_PI * double(n_y) / L_y * y), 0.0);
 }
 
@@ -824,7 +1057,8 @@ complex<double> BesselState::bessel_state2D(double x, double y) {
 }
 
 Potential::Potential(Lattice *_grid, char *filename): grid(_grid) {
-    matrix = new double[grid->dim_y * grid->dim_x];
+    TRACE_SCOPE("read_file");
+    matrix = allocate_tracked(grid->dim_y * grid->dim_x, MEMORY_POTENTIAL);
     self_init = true;
     is_static = true;
     ifstream input(filename);
@@ -841,12 +1075,12 @@ Potential::Potential(Lattice *_grid, char *filename): grid(_grid) {
 Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid) {
     if (_external_pot == 0) {
         self_init = true;
-        matrix = new double[grid->dim_x * grid->dim_y];
+        matrix = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_POTENTIAL);
     }
     else {
+        self_init = false;
         matrix = _external_pot;
     }
-    self_init = false;
     is_static = true;
     updated_potential_matrix = false;
     evolving_potential = NULL;
@@ -882,12 +1116,19 @@ double Potential::get_value(int x, int y) {
     else {
         double x_r = 0, y_r = 0;
         map_lattice_to_coordinate_space(grid, x, y, &x_r, &y_r);
-        if (is_static) {
-            return static_potential(x_r, y_r);
-        }
-        else {
-            return evolving_potential(x_r, y_r, current_evolution_time);
-        }
+        return get_value_at(x_r, y_r);
+    }
+}
+
+double Potential::get_value_at(double x, double y) {
+    if (matrix != NULL) {
+        my_abort("A potential defined by a matrix is only known on the points of its lattice");
+    }
+    if (is_static) {
+        return static_potential(x, y);
+    }
+    else {
+        return evolving_potential(x, y, current_evolution_time);
     }
 }
 
@@ -903,7 +1144,7 @@ bool Potential::update(double t) {
 
 Potential::~Potential() {
     if (self_init) {
-        delete [] matrix;
+        free_tracked(matrix);
     }
 }
 
@@ -920,30 +1161,89 @@ HarmonicPotential::HarmonicPotential(Lattice2D *_grid, double _omegax, double _o
 double HarmonicPotential::get_value(int x, int y) {
     double x_r = 0, y_r = 0;
     map_lattice_to_coordinate_space(grid, x, y, &x_r, &y_r);
-    x_r -= mean_x;
-    y_r -= mean_y;
-    return 0.5 * mass * (omegax * omegax * x_r * x_r + omegay * omegay * y_r * y_r);
+    return get_value_at(x_r, y_r);
+}
+
+double HarmonicPotential::get_value_at(double x, double y) {
+    x -= mean_x;
+    y -= mean_y;
+    return 0.5 * mass * (omegax * omegax * x * x + omegay * omegay * y * y);
 }
 
 HarmonicPotential::~HarmonicPotential() {
 }
 
+ParameterSchedule::ParameterSchedule(double *_parameter, double (*_schedule_function)(double t)):
+    parameter(_parameter), schedule_function(_schedule_function) {
+}
+
+ParameterSchedule::ParameterSchedule(double *_parameter, const double *_times, const double *_values, int n_points):
+    parameter(_parameter), schedule_function(NULL), times(_times, _times + n_points), values(_values, _values + n_points) {
+    if (n_points < 1) {
+        my_abort("The schedule needs at least one point");
+    }
+    for (int i = 1; i < n_points; i++) {
+        if (times[i] <= times[i - 1]) {
+            my_abort("The times of the schedule must be increasing");
+        }
+    }
+}
+
+double ParameterSchedule::get_value(double t) const {
+    if (schedule_function != NULL) {
+        return schedule_function(t);
+    }
+    if (t <= times.front()) {
+        return values.front();
+    }
+    if (t >= times.back()) {
+        return values.back();
+    }
+    size_t i = upper_bound(times.begin(), times.end(), t) - times.begin();
+    double weight = (t - times[i - 1]) / (times[i] - times[i - 1]);
+    return values[i - 1] + weight * (values[i] - values[i - 1]);
+}
+
+bool ParameterSchedule::update(double t) {
+    double value = get_value(t);
+    if (value == *parameter) {
+        return false;
+    }
+    *parameter = value;
+    return true;
+}
+
+/**
+ * Prepare the lattice for a rotating frame of reference: on a single process the halos are widened for the rotation
+ * terms. Return why the lattice cannot rotate, or an empty string.
+ */
+static string prepare_rotation(Lattice *grid) {
+    if (grid->periods[0] != 0 || grid->periods[1] != 0) {
+        return "Boundary conditions must be closed for rotating frame of reference";
+    }
+    int halo = lattice_halo(1., grid->kinetic_order);
+    if (grid->mpi_procs == 1) {
+        grid->halo_x = halo;
+        grid->halo_y = halo;
+    }
+    if (grid->mpi_procs > 1 && (grid->halo_x < halo || grid->halo_y < halo)) {
+        stringstream message;
+        message << "Halos must be of " << halo << " points width";
+        return message.str();
+    }
+    return "";
+}
+
 Hamiltonian::Hamiltonian(Lattice *_grid, Potential *_potential,
                          double _mass, double _coupling_a, double _LeeHuangYang_coupling_a,
                          double _angular_velocity,
                          double _rot_coord_x, double _rot_coord_y): mass(_mass),
-    coupling_a(_coupling_a), LeeHuangYang_coupling_a(_LeeHuangYang_coupling_a), angular_velocity(_angular_velocity), grid(_grid) {
+    coupling_a(_coupling_a), LeeHuangYang_coupling_a(_LeeHuangYang_coupling_a), angular_velocity(_angular_velocity),
+    absorbing_width(0.), absorbing_strength(0.), absorbing_power(2), grid(_grid) {
     if (angular_velocity != 0.) {
-        if (grid->periods[0] != 0 || grid->periods[1] != 0) {
-            cout << "Boundary conditions must be closed for rotating frame of reference\n";
-            return;
-        }
-        if (grid->mpi_procs == 1) {
-            grid->halo_x = 8;
-            grid->halo_y = 8;
-        }
-        if (grid->mpi_procs > 1 && (grid->halo_x == 4 || grid->halo_y == 4)) {
-            cout << "Halos must be of 8 points width\n";
+        string error = prepare_rotation(grid);
+        if (!error.empty()) {
+            cout << error << "\n";
             return;
         }
     }
@@ -970,12 +1270,132 @@ double Hamiltonian::azimuthal_potential(double x, int angular_momentum) {
     return (angular_momentum * angular_momentum) / (2. * mass * x_r * x_r);
 }
 
+void Hamiltonian::set_absorbing_layer(double width, double strength, int power) {
+    if (width < 0. || strength < 0.) {
+        my_abort("The width and the strength of the absorbing layer cannot be negative");
+    }
+    if (power < 1) {
+        my_abort("The power of the absorbing potential must be at least 1");
+    }
+    absorbing_width = width;
+    absorbing_strength = strength;
+    absorbing_power = power;
+}
+
+bool Hamiltonian::has_absorbing_layer(void) {
+    return absorbing_width > 0. && absorbing_strength > 0.;
+}
+
+/**
+ * Absorbing potential at the given distance from an edge of the lattice.
+ */
+static double absorbing_profile(double distance, double width, double strength, int power) {
+    if (distance >= width) {
+        return 0.;
+    }
+    return strength * pow((width - distance) / width, power);
+}
+
+double Hamiltonian::get_absorbing_potential(int x, int y) {
+    if (!has_absorbing_layer()) {
+        return 0.;
+    }
+    double x_r = 0, y_r = 0;
+    map_lattice_to_coordinate_space(grid, x, y, &x_r, &y_r);
+    double value = 0.;
+    // The radial coordinate only has an outer edge
+    if (grid->coordinate_system == "cylindrical") {
+        value += absorbing_profile(grid->length_x - x_r, absorbing_width, absorbing_strength, absorbing_power);
+    }
+    else {
+        // The lattice of an axis with a parity only covers half of the system
+        double half_length_x = grid->parity_x != 0 ? grid->length_x : 0.5 * grid->length_x;
+        value += absorbing_profile(half_length_x - fabs(x_r - grid->origin_x), absorbing_width, absorbing_strength, absorbing_power);
+    }
+    if (grid->global_no_halo_dim_y > 1) {
+        double half_length_y = grid->parity_y != 0 ? grid->length_y : 0.5 * grid->length_y;
+        value += absorbing_profile(half_length_y - fabs(y_r - grid->origin_y), absorbing_width, absorbing_strength, absorbing_power);
+    }
+    return value;
+}
+
 Hamiltonian::~Hamiltonian() {
     if (self_init) {
         delete potential;
     }
 }
 
+double *Hamiltonian::get_parameter(string parameter) {
+    if (parameter == "mass") {
+        return &mass;
+    }
+    if (parameter == "coupling_a") {
+        return &coupling_a;
+    }
+    if (parameter == "angular_velocity") {
+        return &angular_velocity;
+    }
+    return NULL;
+}
+
+void Hamiltonian::set_schedule(string parameter, double (*schedule_function)(double t)) {
+    double *target = get_parameter(parameter);
+    if (target == NULL) {
+        my_abort("The parameter " + parameter + " cannot be scheduled");
+    }
+    check_schedule(parameter);
+    remove_schedule(parameter);
+    schedules.push_back(ParameterSchedule(target, schedule_function));
+}
+
+void Hamiltonian::set_schedule(string parameter, const double *times, const double *values, int n_points) {
+    double *target = get_parameter(parameter);
+    if (target == NULL) {
+        my_abort("The parameter " + parameter + " cannot be scheduled");
+    }
+    check_schedule(parameter);
+    remove_schedule(parameter);
+    schedules.push_back(ParameterSchedule(target, times, values, n_points));
+}
+
+void Hamiltonian::check_schedule(string parameter) {
+    // A scheduled angular velocity rotates the frame of reference as the constructor would
+    if (parameter == "angular_velocity") {
+        string error = prepare_rotation(grid);
+        if (!error.empty()) {
+            my_abort(error);
+        }
+    }
+}
+
+void Hamiltonian::remove_schedule(string parameter) {
+    double *target = get_parameter(parameter);
+    for (size_t i = 0; i < schedules.size(); i++) {
+        if (schedules[i].parameter == target) {
+            schedules.erase(schedules.begin() + i);
+            return;
+        }
+    }
+}
+
+bool Hamiltonian::has_schedule(string parameter) {
+    double *target = get_parameter(parameter);
+    for (size_t i = 0; i < schedules.size(); i++) {
+        if (schedules[i].parameter == target) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Hamiltonian::update(double t) {
+    bool changed = false;
+    for (size_t i = 0; i < schedules.size(); i++) {
+        changed = schedules[i].update(t) || changed;
+    }
+    return changed;
+}
+
 Hamiltonian2Component::Hamiltonian2Component(Lattice *_grid,
         Potential *_potential,
         Potential *_potential_b,
@@ -1005,3 +1425,22 @@ double Hamiltonian2Component::azimuthal_potential_b(double x, int angular_moment
 Hamiltonian2Component::~Hamiltonian2Component() {
 
 }
+
+double *Hamiltonian2Component::get_parameter(string parameter) {
+    if (parameter == "mass_b") {
+        return &mass_b;
+    }
+    if (parameter == "coupling_b") {
+        return &coupling_b;
+    }
+    if (parameter == "coupling_ab") {
+        return &coupling_ab;
+    }
+    if (parameter == "omega_r") {
+        return &omega_r;
+    }
+    if (parameter == "omega_i") {
+        return &omega_i;
+    }
+    return Hamiltonian::get_parameter(parameter);
+}
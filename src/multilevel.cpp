@@ -0,0 +1,264 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <math.h>
+#include <algorithm>
+#include "trottersuzuki.h"
+#include "common.h"
+
+/**
+ * Index in the tile [start, end) of the point of the lattice of n points with the given global index,
+ * looking for its periodic images on periodic axes and its mirror image on axes with a parity; -1 if the
+ * tile does not hold it.
+ */
+static int tile_index(int global, int n, int start, int end, bool periodic, bool mirrored = false) {
+    if (mirrored && global < 0 && global < start) {
+        global = -1 - global;
+    }
+    if (global >= start && global < end) {
+        return global - start;
+    }
+    if (periodic) {
+        for (int image = global - n; image <= global + n; image += n) {
+            if (image >= start && image < end) {
+                return image - start;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Average of the fine matrix over the factor x factor fine points covering each point of the coarse tile.
+ * The points of the coarse tile whose fine points are not all in the fine tile are set to zero; the return
+ * value tells whether there were any.
+ */
+static bool restrict_matrix(const double *fine_matrix, Lattice *fine, double *coarse_matrix, Lattice *coarse, int factor) {
+    bool complete = true;
+    for (int y = 0; y < coarse->dim_y; y++) {
+        for (int x = 0; x < coarse->dim_x; x++) {
+            double sum = 0.;
+            bool available = true;
+            for (int dy = 0; dy < factor && available; dy++) {
+                int fy = tile_index(factor * (y + coarse->start_y) + dy, fine->global_no_halo_dim_y, fine->start_y, fine->end_y, fine->periods[0] != 0, fine->parity_y != 0);
+                for (int dx = 0; dx < factor && available; dx++) {
+                    int fx = tile_index(factor * (x + coarse->start_x) + dx, fine->global_no_halo_dim_x, fine->start_x, fine->end_x, fine->periods[1] != 0, fine->parity_x != 0);
+                    available = fx >= 0 && fy >= 0;
+                    if (available) {
+                        sum += fine_matrix[fy * fine->dim_x + fx];
+                    }
+                }
+            }
+            coarse_matrix[y * coarse->dim_x + x] = available ? sum / (factor * factor) : 0.;
+            complete = complete && available;
+        }
+    }
+    return complete;
+}
+
+/**
+ * Tile index of a point of the coarse lattice needed to interpolate the fine tile; -1 beyond a closed edge,
+ * where the wave function vanishes.
+ */
+static int coarse_tile_index(int global, int n, int start, int end, bool periodic) {
+    int index = tile_index(global, n, start, end, periodic);
+    if (index < 0 && (periodic || (global >= 0 && global < n))) {
+        my_abort("The coarse tiles do not cover the fine tiles: the dimensions of the lattice must be divisible by the process grid at every level");
+    }
+    return index;
+}
+
+/**
+ * Weights of the cubic Lagrange interpolation at t in [0, 1) between the points -1, 0, 1 and 2.
+ */
+static void cubic_weights(double t, double *weights) {
+    weights[0] = -t * (t - 1.) * (t - 2.) / 6.;
+    weights[1] = (t + 1.) * (t - 1.) * (t - 2.) / 2.;
+    weights[2] = -(t + 1.) * t * (t - 2.) / 2.;
+    weights[3] = (t + 1.) * t * (t - 1.) / 6.;
+}
+
+/**
+ * Cubic interpolation of the coarse state on the points of the fine lattice, of twice its resolution.
+ */
+static void prolong_state(State *coarse_state, Lattice *coarse, State *fine_state, Lattice *fine) {
+    for (int y = 0; y < fine->dim_y; y++) {
+        // Fine point 2i + d lies at i - 1/4 + d/2 in the coarse point spacing
+        double v = 0.5 * (y + fine->start_y) - 0.25;
+        int j0 = int(floor(v));
+        double wy[4];
+        cubic_weights(v - j0, wy);
+        int cy[4];
+        for (int l = 0; l < 4; l++) {
+            cy[l] = coarse_tile_index(j0 + l - 1, coarse->global_no_halo_dim_y, coarse->start_y, coarse->end_y, coarse->periods[0] != 0);
+        }
+        for (int x = 0; x < fine->dim_x; x++) {
+            double u = 0.5 * (x + fine->start_x) - 0.25;
+            int i0 = int(floor(u));
+            double wx[4];
+            cubic_weights(u - i0, wx);
+            double real = 0., imag = 0.;
+            for (int k = 0; k < 4; k++) {
+                int cx = coarse_tile_index(i0 + k - 1, coarse->global_no_halo_dim_x, coarse->start_x, coarse->end_x, coarse->periods[1] != 0);
+                for (int l = 0; l < 4; l++) {
+                    if (cx >= 0 && cy[l] >= 0) {
+                        real += wx[k] * wy[l] * coarse_state->p_real[cy[l] * coarse->dim_x + cx];
+                        imag += wx[k] * wy[l] * coarse_state->p_imag[cy[l] * coarse->dim_x + cx];
+                    }
+                }
+            }
+            fine_state->p_real[y * fine->dim_x + x] = real;
+            fine_state->p_imag[y * fine->dim_x + x] = imag;
+        }
+    }
+    fine_state->expected_values_updated = false;
+}
+
+/**
+ * Potential of the fine lattice on the points of the coarse lattice, stored as a matrix.
+ */
+static Potential *coarsen_potential(Potential *potential, Lattice *fine, Lattice *coarse, int factor) {
+    Potential *coarse_potential = new Potential(coarse);
+    if (potential->matrix == NULL) {
+        // Potentials defined by a function are evaluated on the coarse points; the potential may be shared with
+        // solvers running in other threads, so its lattice is left untouched
+        for (int y = 0; y < coarse->dim_y; y++) {
+            for (int x = 0; x < coarse->dim_x; x++) {
+                double x_r = 0, y_r = 0;
+                map_lattice_to_coordinate_space(coarse, x, y, &x_r, &y_r);
+                coarse_potential->matrix[y * coarse->dim_x + x] = potential->get_value_at(x_r, y_r);
+            }
+        }
+    }
+    else if (!restrict_matrix(potential->matrix, fine, coarse_potential->matrix, coarse, factor)) {
+        my_abort("The multilevel solver needs a potential defined by a function when the lattice is split over several processes");
+    }
+    return coarse_potential;
+}
+
+static void scale_state(State *state, double target_norm2) {
+    double norm2 = state->get_squared_norm();
+    if (norm2 <= 0.) {
+        return;
+    }
+    double scale = sqrt(target_norm2 / norm2);
+    for (int i = 0; i < state->grid->dim_x * state->grid->dim_y; i++) {
+        state->p_real[i] *= scale;
+        state->p_imag[i] *= scale;
+    }
+    state->expected_values_updated = false;
+}
+
+vector<int> multilevel_ground_state(Lattice2D *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
+                                    int levels, double tolerance, int check_period, int max_iterations, string kernel_type) {
+    if (levels < 1 || check_period < 1 || max_iterations < 1) {
+        my_abort("The levels, the check period and the maximum of iterations of the multilevel solver must be positive");
+    }
+    if (grid->coordinate_system != "cartesian") {
+        my_abort("The multilevel solver is only available in cartesian coordinates");
+    }
+    if (dynamic_cast<Hamiltonian2Component *>(hamiltonian) != NULL) {
+        my_abort("The multilevel solver only supports single-component systems");
+    }
+    int coarsest = 1 << (levels - 1);
+    if (grid->global_no_halo_dim_x % coarsest != 0 || grid->global_no_halo_dim_y % coarsest != 0) {
+        my_abort("The dimensions of the lattice must be divisible by 2 to the power of the levels minus one");
+    }
+    double target_norm2 = state->get_squared_norm();
+    // Physical coordinates of the center of rotation, which the Hamiltonian stores in lattice points
+    double rot_x = (hamiltonian->rot_coord_x - (grid->global_dim_x - grid->periods[1] * 2 * grid->halo_x) * 0.5) * grid->delta_x;
+    double rot_y = (hamiltonian->rot_coord_y - (grid->global_dim_y - grid->periods[0] * 2 * grid->halo_y) * 0.5) * grid->delta_y;
+
+    vector<int> iterations;
+    Lattice2D *previous_grid = NULL;
+    State *previous_state = NULL;
+    State *previous_guess = NULL;
+    Potential *previous_potential = NULL;
+    Hamiltonian *previous_hamiltonian = NULL;
+    for (int level = 0; level < levels; level++) {
+        int factor = 1 << (levels - 1 - level);
+        Lattice2D *level_grid = grid;
+        State *level_state = state;
+        Potential *level_potential = NULL;
+        Hamiltonian *level_hamiltonian = hamiltonian;
+        if (factor > 1) {
+            // The lattice constructor halves the axes with a parity again
+            int unfold_x = grid->parity_x != 0 ? 2 : 1, unfold_y = grid->parity_y != 0 ? 2 : 1;
+            level_grid = new Lattice2D(unfold_x * grid->global_no_halo_dim_x / factor, unfold_x * grid->length_x,
+                                       unfold_y * grid->global_no_halo_dim_y / factor, unfold_y * grid->length_y,
+                                       grid->periods[1] != 0, grid->periods[0] != 0, hamiltonian->angular_velocity, "cartesian", grid->kinetic_order,
+                                       grid->parity_x, grid->parity_y);
+            level_potential = coarsen_potential(hamiltonian->potential, grid, level_grid, factor);
+            level_hamiltonian = new Hamiltonian(level_grid, level_potential, hamiltonian->mass, hamiltonian->coupling_a,
+                                                hamiltonian->LeeHuangYang_coupling_a, hamiltonian->angular_velocity, rot_x, rot_y);
+            level_state = new State(level_grid, state->angular_momentum);
+        }
+        if (level == 0) {
+            if (factor > 1) {
+                restrict_matrix(state->p_real, grid, level_state->p_real, level_grid, factor);
+                restrict_matrix(state->p_imag, grid, level_state->p_imag, level_grid, factor);
+                // The mirror images are restricted without the sign of odd parities
+                fill_mirror_halos(level_grid, level_state->p_real, level_state->p_imag);
+                level_state->expected_values_updated = false;
+            }
+        }
+        else {
+            prolong_state(previous_state, previous_grid, level_state, level_grid);
+            if (previous_guess != NULL) {
+                // The error of a level is proportional to the square of its lattice spacing: extrapolate it away
+                // from the two previous levels, the coarsest being represented by the initial guess of the previous one
+                State guess(level_grid);
+                prolong_state(previous_guess, previous_grid, &guess, level_grid);
+                for (int i = 0; i < level_grid->dim_x * level_grid->dim_y; i++) {
+                    level_state->p_real[i] = 1.25 * level_state->p_real[i] - 0.25 * guess.p_real[i];
+                    level_state->p_imag[i] = 1.25 * level_state->p_imag[i] - 0.25 * guess.p_imag[i];
+                }
+            }
+            delete previous_guess;
+            previous_guess = NULL;
+            delete previous_hamiltonian;
+            delete previous_potential;
+            delete previous_state;
+            delete previous_grid;
+        }
+        scale_state(level_state, target_norm2);
+        if (level > 0 && level < levels - 1) {
+            previous_guess = new State(*level_state);
+        }
+
+        // The time step follows the square of the lattice spacing, as the error of the kinetic splitting
+        Solver solver(level_grid, level_state, level_hamiltonian, delta_t * factor * factor, kernel_type);
+        double energy = 0.;
+        int done = 0;
+        while (done < max_iterations) {
+            int chunk = min(check_period, max_iterations - done);
+            solver.evolve(chunk, true);
+            done += chunk;
+            double previous_energy = energy;
+            energy = solver.get_total_energy();
+            if (done > chunk && fabs(energy - previous_energy) <= tolerance * fabs(energy)) {
+                break;
+            }
+        }
+        iterations.push_back(done);
+        previous_grid = level_grid;
+        previous_state = level_state;
+        previous_potential = level_potential;
+        previous_hamiltonian = level_hamiltonian;
+    }
+    return iterations;
+}
@@ -0,0 +1,337 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstring>
+#include <fstream>
+#include <sys/time.h>
+#include "common.h"
+#include "kernel.h"
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/** Size of a cache line: every last level cache miss is counted as a line read from memory.
+ */
+#define CACHE_LINE_BYTES 64.
+
+/** Elements of each array of the bandwidth measurement, large enough to exceed the last level cache.
+ */
+#define ROOFLINE_ARRAY_SIZE (1 << 23)
+
+/** Independent accumulators of the floating point measurement, enough to hide the latency of the
+ *  vector units.
+ */
+#define ROOFLINE_LANES 64
+
+/** Result of the floating point measurement, kept so that the loop is not optimized away.
+ */
+static volatile double roofline_sink;
+
+static double wall_time(void) {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+/**
+ * Events counting the double precision floating point operations, with the operations done by each
+ * event, as raw event codes of the host vendor (FP_ARITH_INST_RETIRED on Intel, RETIRED_SSE_AVX_FLOPS
+ * on AMD Zen). Other vendors have no floating point counter.
+ */
+static int fp_events(unsigned long long *configs, double *weights) {
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+    while (getline(cpuinfo, line)) {
+        if (line.compare(0, 9, "vendor_id") != 0) {
+            continue;
+        }
+        if (line.find("GenuineIntel") != string::npos) {
+            const unsigned long long umasks[4] = {0x01, 0x04, 0x10, 0x40};
+            const double lanes[4] = {1., 2., 4., 8.};
+            for (int i = 0; i < 4; i++) {
+                configs[i] = 0xc7 | (umasks[i] << 8);
+                weights[i] = lanes[i];
+            }
+            return 4;
+        }
+        if (line.find("AuthenticAMD") != string::npos) {
+            configs[0] = 0x03 | (0xffULL << 8);
+            weights[0] = 1.;
+            return 1;
+        }
+        break;
+    }
+    return 0;
+}
+
+static int open_counter(unsigned int type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Counters of the calling thread, on any CPU
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+PerfCounters::PerfCounters(): n_threads(1), n_events(0) {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    unsigned int types[COUNTER_MAX_EVENTS];
+    unsigned long long configs[COUNTER_MAX_EVENTS];
+    types[0] = PERF_TYPE_HARDWARE;
+    configs[0] = PERF_COUNT_HW_CPU_CYCLES;
+    types[1] = PERF_TYPE_HARDWARE;
+    configs[1] = PERF_COUNT_HW_INSTRUCTIONS;
+    types[2] = PERF_TYPE_HARDWARE;
+    configs[2] = PERF_COUNT_HW_CACHE_MISSES;
+    n_events = 3 + fp_events(configs + 3, fp_weights);
+    for (int i = 3; i < n_events; i++) {
+        types[i] = PERF_TYPE_RAW;
+    }
+#if defined(_OPENMP) && !defined(HAVE_MPI)
+    n_threads = omp_get_max_threads();
+#endif
+    fds.assign(n_threads * n_events, -1);
+    // A counter follows a single thread: every thread of the pool opens its own
+#ifndef HAVE_MPI
+    #pragma omp parallel num_threads(n_threads)
+#endif
+    {
+        int thread = 0;
+#if defined(_OPENMP) && !defined(HAVE_MPI)
+        thread = omp_get_thread_num();
+#endif
+        for (int i = 0; i < n_events; i++) {
+            fds[thread * n_events + i] = open_counter(types[i], configs[i]);
+        }
+    }
+#endif
+    reset();
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::has_event(CounterEvent event) const {
+    int first = event, last = event + 1;
+    if (event == COUNTER_FP_OPS) {
+        last = n_events;
+    }
+    if (first >= n_events || last <= first) {
+        return false;
+    }
+    // The event is available if every thread could open it
+    for (int thread = 0; thread < n_threads; thread++) {
+        for (int i = first; i < last; i++) {
+            if (fds[thread * n_events + i] < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool PerfCounters::is_available() const {
+    return has_event(COUNTER_CYCLES) || has_event(COUNTER_INSTRUCTIONS) || has_event(COUNTER_LLC_MISSES) || has_event(COUNTER_FP_OPS);
+}
+
+void PerfCounters::start() {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    start_time = wall_time();
+}
+
+void PerfCounters::stop() {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+    seconds += wall_time() - start_time;
+}
+
+void PerfCounters::reset() {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        }
+    }
+#endif
+    seconds = 0.;
+}
+
+double PerfCounters::read_event(CounterEvent event) const {
+    if (!has_event(event)) {
+        return -1.;
+    }
+    double total = 0.;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    int first = event, last = event == COUNTER_FP_OPS ? n_events : event + 1;
+    for (int thread = 0; thread < n_threads; thread++) {
+        for (int i = first; i < last; i++) {
+            // Value, time enabled and time running: events multiplexed on fewer hardware
+            // counters are scaled to the whole time enabled
+            unsigned long long values[3];
+            if (read(fds[thread * n_events + i], values, sizeof(values)) != sizeof(values)) {
+                return -1.;
+            }
+            double count = values[2] > 0 ? double(values[0]) * values[1] / values[2] : 0.;
+            total += i >= COUNTER_FP_OPS ? count * fp_weights[i - COUNTER_FP_OPS] : count;
+        }
+    }
+#endif
+    return total;
+}
+
+double PerfCounters::get_seconds() const {
+    return seconds;
+}
+
+KernelCounters PerfCounters::get_summary(double points) const {
+    KernelCounters summary;
+    summary.seconds = seconds;
+    summary.points = points;
+    summary.cycles = read_event(COUNTER_CYCLES);
+    summary.instructions = read_event(COUNTER_INSTRUCTIONS);
+    summary.llc_misses = read_event(COUNTER_LLC_MISSES);
+    summary.fp_ops = read_event(COUNTER_FP_OPS);
+    summary.ipc = summary.cycles > 0. && summary.instructions >= 0. ? summary.instructions / summary.cycles : -1.;
+    double bytes = summary.llc_misses >= 0. ? CACHE_LINE_BYTES * summary.llc_misses : -1.;
+    summary.bytes_per_point = bytes >= 0. && points > 0. ? bytes / points : -1.;
+    summary.flops_per_point = summary.fp_ops >= 0. && points > 0. ? summary.fp_ops / points : -1.;
+    summary.arithmetic_intensity = summary.fp_ops >= 0. && bytes > 0. ? summary.fp_ops / bytes : -1.;
+    summary.gflop_per_s = summary.fp_ops >= 0. && seconds > 0. ? 1.e-9 * summary.fp_ops / seconds : -1.;
+    summary.gb_per_s = bytes >= 0. && seconds > 0. ? 1.e-9 * bytes / seconds : -1.;
+    measure_roofline(&summary.peak_gflop_per_s, &summary.peak_gb_per_s);
+    summary.bound = "unknown";
+    if (summary.fp_ops >= 0. && bytes >= 0.) {
+        // Ridge point of the roofline: below it the bandwidth limits the throughput
+        double ridge = summary.peak_gflop_per_s / summary.peak_gb_per_s;
+        summary.bound = bytes > 0. && summary.arithmetic_intensity < ridge ? "memory" : "compute";
+    }
+    return summary;
+}
+
+double CPU_KERNEL_CLONES roofline_flops(long iterations) {
+    double acc[ROOFLINE_LANES];
+    for (int j = 0; j < ROOFLINE_LANES; j++) {
+        acc[j] = 1. + 1.e-3 * j;
+    }
+    for (long i = 0; i < iterations; i++) {
+        for (int j = 0; j < ROOFLINE_LANES; j++) {
+            acc[j] = acc[j] * 0.999999 + 1.e-6;
+        }
+    }
+    double sum = 0.;
+    for (int j = 0; j < ROOFLINE_LANES; j++) {
+        sum += acc[j];
+    }
+    return sum;
+}
+
+void CPU_KERNEL_CLONES roofline_triad(size_t size, double scale, const double *a, const double *b, double *c) {
+    for (size_t i = 0; i < size; i++) {
+        c[i] = a[i] + scale * b[i];
+    }
+}
+
+void measure_roofline(double *peak_gflop_per_s, double *peak_gb_per_s) {
+    static double gflop_per_s = -1., gb_per_s = -1.;
+    if (gflop_per_s < 0.) {
+        int threads = 1;
+#if defined(_OPENMP) && !defined(HAVE_MPI)
+        threads = omp_get_max_threads();
+#endif
+        const long iterations = 1 << 20;
+        double start = wall_time();
+#ifndef HAVE_MPI
+        #pragma omp parallel num_threads(threads)
+#endif
+        {
+            roofline_sink = roofline_flops(iterations);
+        }
+        // One multiplication and one addition per lane and iteration
+        gflop_per_s = 2.e-9 * ROOFLINE_LANES * iterations * threads / (wall_time() - start);
+
+        size_t size = ROOFLINE_ARRAY_SIZE;
+        double *a = new double[size];
+        double *b = new double[size];
+        double *c = new double[size];
+        size_t chunk = (size + threads - 1) / threads;
+        double best = -1.;
+        // The first run touches the pages, each thread those it streams
+        for (int repeat = 0; repeat < 6; repeat++) {
+            start = wall_time();
+#ifndef HAVE_MPI
+            #pragma omp parallel num_threads(threads)
+#endif
+            {
+                size_t first = 0;
+#if defined(_OPENMP) && !defined(HAVE_MPI)
+                first = min(size, chunk * omp_get_thread_num());
+#endif
+                size_t count = min(size - first, chunk);
+                if (repeat == 0) {
+                    for (size_t i = first; i < first + count; i++) {
+                        a[i] = 1.;
+                        b[i] = 2.;
+                    }
+                }
+                roofline_triad(count, 3., a + first, b + first, c + first);
+            }
+            double elapsed = wall_time() - start;
+            if (repeat > 0 && (best < 0. || elapsed < best)) {
+                best = elapsed;
+            }
+        }
+        // Two arrays read, one written
+        gb_per_s = 3.e-9 * sizeof(double) * size / best;
+        delete [] a;
+        delete [] b;
+        delete [] c;
+    }
+    *peak_gflop_per_s = gflop_per_s;
+    *peak_gb_per_s = gb_per_s;
+}
@@ -19,7 +19,57 @@
 #include "common.h"
 #include "kernel.h"
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <cstring>
+#include <algorithm>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const char *phase_names[SOLVER_PHASES] = {"setup", "parameters", "kernel_on_halo", "start_halo_exchange", "kernel",
+                                                 "finish_halo_exchange", "wait_for_completion", "rabi_coupling", "normalization", "get_sample"
+                                                };
+
+static double wall_time(void) {
+#ifdef HAVE_MPI
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+/**
+ * \brief Scoped OpenMP thread budget.
+ *
+ * The number of threads is a per-thread setting in OpenMP, so solvers driven
+ * by different host threads can run with independent budgets.
+ */
+class ThreadBudget {
+public:
+    ThreadBudget(int num_threads): previous(0) {
+#ifdef _OPENMP
+        if (num_threads > 0) {
+            previous = omp_get_max_threads();
+            omp_set_num_threads(num_threads);
+        }
+#endif
+    }
+    ~ThreadBudget() {
+#ifdef _OPENMP
+        if (previous > 0) {
+            omp_set_num_threads(previous);
+        }
+#endif
+    }
+private:
+    int previous;    ///< Thread count to restore, 0 if untouched.
+};
 
 Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
                double _delta_t, string _kernel_type):
@@ -27,17 +77,29 @@ Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
     kernel_type(_kernel_type) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
-    external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
+    external_pot_real[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_imag[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
     external_pot_real[1] = NULL;
     external_pot_imag[1] = NULL;
     is_python = false;
+    num_threads = 0;
     state_b = NULL;
     kernel = NULL;
     current_evolution_time = 0;
     single_component = true;
+    states = NULL;
+    n_states = 1;
+    states_norm2 = NULL;
+    orthogonalization_period = 1;
+    halo_precision = "double";
+    halo_resync_period = 16;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    counters = NULL;
+    counted_points = 0.;
+    reference_norm2 = -1.;
+    domain_mode = "fixed";
+    reset_timings();
 }
 
 Solver::Solver(Lattice *_grid, State *state1, State *state2,
@@ -47,28 +109,81 @@ Solver::Solver(Lattice *_grid, State *state1, State *state2,
     kernel_type(_kernel_type) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
-    external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_real[1] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[1] = new double[grid->dim_x * grid->dim_y];
+    external_pot_real[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_imag[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_real[1] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_imag[1] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
     is_python = false;
+    num_threads = 0;
     kernel = NULL;
     current_evolution_time = 0;
     single_component = false;
+    states = NULL;
+    n_states = 2;
+    states_norm2 = NULL;
+    orthogonalization_period = 1;
+    halo_precision = "double";
+    halo_resync_period = 16;
+    energy_expected_values_updated = false;
+    has_parameters_changed = false;
+    counters = NULL;
+    counted_points = 0.;
+    reference_norm2 = -1.;
+    domain_mode = "fixed";
+    reset_timings();
+}
+
+Solver::Solver(Lattice *_grid, State **_states, int _n_states, Hamiltonian *_hamiltonian,
+               double _delta_t, string _kernel_type):
+    grid(_grid), state(_states[0]), hamiltonian(_hamiltonian), delta_t(_delta_t),
+    kernel_type(_kernel_type) {
+    if (_n_states < 1) {
+        my_abort("At least one state is required");
+    }
+    external_pot_real = new double* [2];
+    external_pot_imag = new double* [2];
+    external_pot_real[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_imag[0] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+    external_pot_real[1] = NULL;
+    external_pot_imag[1] = NULL;
+    n_states = _n_states;
+    states = new State* [n_states];
+    states_norm2 = new double[n_states];
+    for (int i = 0; i < n_states; i++) {
+        states[i] = _states[i];
+        states_norm2[i] = 0;
+    }
+    is_python = false;
+    num_threads = 0;
+    state_b = NULL;
+    kernel = NULL;
+    current_evolution_time = 0;
+    single_component = true;
+    orthogonalization_period = 1;
+    halo_precision = "double";
+    halo_resync_period = 16;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    counters = NULL;
+    counted_points = 0.;
+    reference_norm2 = -1.;
+    domain_mode = "fixed";
+    reset_timings();
 }
 
 Solver::~Solver() {
-    delete [] external_pot_real[0];
-    delete [] external_pot_imag[0];
-    delete [] external_pot_real[1];
-    delete [] external_pot_imag[1];
+    free_tracked(external_pot_real[0]);
+    free_tracked(external_pot_imag[0]);
+    free_tracked(external_pot_real[1]);
+    free_tracked(external_pot_imag[1]);
     delete [] external_pot_real;
     delete [] external_pot_imag;
+    delete [] states;
+    delete [] states_norm2;
     if (kernel != NULL) {
         delete kernel;
     }
+    delete counters;
 }
 
 void Solver::initialize_exp_potential(double delta_t, int which) {
@@ -99,7 +214,7 @@ void Solver::initialize_exp_potential(double delta_t, int which) {
                     tmp = exp(complex<double> (-delta_t * ptmp, 0.));
                 }
                 else {
-                    tmp = exp(complex<double> (0., -delta_t * ptmp));
+                    tmp = exp(complex<double> (-delta_t * hamiltonian->get_absorbing_potential(x, y), -delta_t * ptmp));
                 }
                 external_pot_real[which][y * grid->dim_x + x] = real(tmp);
                 external_pot_imag[which][y * grid->dim_x + x] = imag(tmp);
@@ -115,44 +230,134 @@ void Solver::set_exp_potential(double *real, int real_length, double *imag,
     memcpy(external_pot_imag[which], imag, sizeof(double)*imag_length);
 }
 
-void Solver::init_kernel() {
-    if (kernel != NULL) {
-        delete kernel;
+double *Solver::get_exp_potential_real(int which) {
+    return external_pot_real[which];
+}
+
+double *Solver::get_exp_potential_imag(int which) {
+    return external_pot_imag[which];
+}
+
+void Solver::use_external_exp_potential(bool external) {
+    is_python = external;
+}
+
+void Solver::apply_absorbing_layer(int which) {
+    if (!hamiltonian->has_absorbing_layer()) {
+        return;
     }
-    if (kernel_type == "cpu") {
-        if (single_component) {
-            kernel = new CPUBlock(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
-        }
-        else {
-            kernel = new CPUBlock(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time);
+#ifndef HAVE_MPI
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < grid->dim_y; ++y) {
+        for (int x = 0; x < grid->dim_x; ++x) {
+            double absorbing = hamiltonian->get_absorbing_potential(x, y);
+            if (absorbing > 0.) {
+                double decay = exp(-delta_t * absorbing);
+                external_pot_real[which][y * grid->dim_x + x] *= decay;
+                external_pot_imag[which][y * grid->dim_x + x] *= decay;
+            }
         }
     }
-    else if (kernel_type == "gpu") {
-#ifdef CUDA
-        if (hamiltonian->angular_velocity != 0) {
-            my_abort("The GPU kernel does not work with nonzero angular velocity.");
+}
+
+double Solver::get_states_squared_norm(void) {
+    if (states != NULL) {
+        double norm = 0.;
+        for (int k = 0; k < n_states; k++) {
+            norm += states[k]->get_squared_norm();
         }
-        if (single_component) {
-            kernel = new CC2Kernel(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
+        return norm;
+    }
+    return state->get_squared_norm() + (single_component ? 0. : state_b->get_squared_norm());
+}
+
+double Solver::get_absorbed_norm(void) {
+    if (reference_norm2 < 0.) {
+        return 0.;
+    }
+    return reference_norm2 - get_states_squared_norm();
+}
+
+void Solver::init_kernel() {
+    KernelCapabilities required(hamiltonian->angular_velocity != 0 || hamiltonian->has_schedule("angular_velocity"), grid->coordinate_system == "cylindrical",
+                                !single_component, imag_time, states != NULL && n_states > 1, grid->kinetic_order == 4,
+                                !imag_time && hamiltonian->has_absorbing_layer(), grid->parity_x != 0 || grid->parity_y != 0,
+                                halo_precision != "double");
+    string name = kernel_type;
+    if (kernel_type == "auto") {
+        name = KernelRegistry::select(required);
+        if (name.empty()) {
+            my_abort("No available kernel supports the system");
         }
-        else {
-            kernel = new CC2Kernel(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time);
+    }
+    else if (!KernelRegistry::is_registered(kernel_type)) {
+        if (kernel_type == "gpu") {
+            my_abort("Compiled without CUDA");
         }
-#else
-        my_abort("Compiled without CUDA");
-#endif
+        my_abort("Unknown kernel");
     }
     else {
-        my_abort("Unknown kernel");
+        string missing = KernelRegistry::get_capabilities(kernel_type).missing(required);
+        if (!missing.empty()) {
+            my_abort("The " + kernel_type + " kernel does not support " + missing + ".");
+        }
+    }
+    State *components[2] = {state, state_b};
+    KernelConfig config;
+    config.grid = grid;
+    config.states = states != NULL ? states : components;
+    config.n_states = n_states;
+    config.two_components = !single_component;
+    config.hamiltonian = hamiltonian;
+    config.external_pot_real = external_pot_real;
+    config.external_pot_imag = external_pot_imag;
+    config.delta_t = delta_t;
+    config.norm = states != NULL ? states_norm2 : norm2;
+    config.imag_time = imag_time;
+    config.orthogonalization_period = orthogonalization_period;
+    config.halo_precision = halo_precision;
+    config.halo_resync_period = halo_resync_period;
+    // The lattice and the states never change: the kernel in use only needs its coefficients updated
+    if (kernel != NULL && name == kernel_name && kernel->update_parameters(config)) {
+        return;
     }
+    if (kernel != NULL) {
+        comm_stats.add(kernel->get_comm_stats());
+        delete kernel;
+        kernel = NULL;
+    }
+    kernel = KernelRegistry::create(name, config);
+    kernel_name = name;
 }
 
 void Solver::evolve(int iterations, bool _imag_time) {
+    // The adaptive domain is checked between chunks of iterations
+    if (domain_mode != "fixed" && iterations > domain_check_period) {
+        for (int done = 0; done < iterations; done += domain_check_period) {
+            evolve(min(domain_check_period, iterations - done), _imag_time);
+        }
+        return;
+    }
+    ThreadBudget budget(num_threads);
+    double lap = wall_time();
+    if (hamiltonian->update(current_evolution_time)) {
+        has_parameters_changed = true;
+    }
+    // The kernel is also restarted when the domain adapts, which keeps the reference
+    if (!_imag_time && ((kernel == NULL && reference_norm2 < 0.) || imag_time)) {
+        reference_norm2 = get_states_squared_norm();
+    }
     if (_imag_time != imag_time || kernel == NULL || has_parameters_changed) {
         imag_time = _imag_time;
         if (imag_time) {
             initialize_exp_potential(delta_t, 0);
             norm2[0] = state->get_squared_norm();
+            if (states != NULL) {
+                for (int k = 0; k < n_states; k++) {
+                    states_norm2[k] = states[k]->get_squared_norm();
+                }
+            }
             if (!single_component) {
                 initialize_exp_potential(delta_t, 1);
                 norm2[1] = state_b->get_squared_norm();
@@ -168,12 +373,14 @@ void Solver::evolve(int iterations, bool _imag_time) {
         }
         init_kernel();
         has_parameters_changed = false;
+        lap = end_phase(PHASE_SETUP, lap);
     }
     // Main loop
     double var = 0.5;
     if ((!is_python && !single_component) ||
             (is_python && current_evolution_time == 0 && !single_component)) {
         kernel->rabi_coupling(var, delta_t);
+        lap = end_phase(PHASE_RABI_COUPLING, lap);
     }
     var = 1.;
     bool soft_update = false;
@@ -184,11 +391,18 @@ void Solver::evolve(int iterations, bool _imag_time) {
 
     // Main loop
     for (int i = 0; i < iterations; ++i) {
+        lap = wall_time();
+        bool updated = false;
+        if (i > 0 && hamiltonian->update(current_evolution_time)) {
+            update_scheduled_parameters();
+            updated = true;
+        }
         if (i > 0 && hamiltonian->potential->update(current_evolution_time)) {
             if (!is_python) {
                 initialize_exp_potential(delta_t, 0);
             }
             kernel->update_potential(external_pot_real[0], external_pot_imag[0], 0);
+            updated = true;
         }
         if (!single_component && i > 0) {
             if (static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->update(current_evolution_time)) {
@@ -196,52 +410,114 @@ void Solver::evolve(int iterations, bool _imag_time) {
                     initialize_exp_potential(delta_t, 1);
                 }
                 kernel->update_potential(external_pot_real[1], external_pot_imag[1], 1);
+                updated = true;
             }
         }
-        //first wave function
-        kernel->run_kernel_on_halo();
-        if (i != iterations - 1) {
-            kernel->start_halo_exchange();
-        }
-        kernel->run_kernel();
-        if (i != iterations - 1) {
-            kernel->finish_halo_exchange();
+        if (updated) {
+            lap = end_phase(PHASE_PARAMETERS, lap);
         }
-        kernel->wait_for_completion();
-        if (!single_component) {
-            //second wave function
+        for (int component = 0; component < (single_component ? 1 : 2); component++) {
+            if (counters != NULL) {
+                counters->start();
+            }
             kernel->run_kernel_on_halo();
+            lap = end_phase(PHASE_KERNEL_ON_HALO, lap);
             if (i != iterations - 1) {
                 kernel->start_halo_exchange();
+                lap = end_phase(PHASE_START_HALO_EXCHANGE, lap);
             }
             kernel->run_kernel();
+            if (counters != NULL) {
+                counters->stop();
+                counted_points += double(grid->inner_end_x - grid->inner_start_x) * (grid->inner_end_y - grid->inner_start_y) * (states != NULL ? n_states : 1);
+            }
+            lap = end_phase(PHASE_KERNEL, lap);
             if (i != iterations - 1) {
                 kernel->finish_halo_exchange();
+                lap = end_phase(PHASE_FINISH_HALO_EXCHANGE, lap);
             }
             kernel->wait_for_completion();
+            lap = end_phase(PHASE_WAIT_FOR_COMPLETION, lap);
+        }
+        if (!single_component) {
             if (i == iterations - 1) {
                 var = 0.5;
             }
             kernel->rabi_coupling(var, delta_t);
+            lap = end_phase(PHASE_RABI_COUPLING, lap);
             kernel->normalization();
+            lap = end_phase(PHASE_NORMALIZATION, lap);
         }
         kernel->cpy_first_positive_to_first_negative(); //only for cylindrical coordinates
         current_evolution_time += delta_t;
     }
+    // The observables see the parameters at the end of the evolution; the kernel follows at the next one
+    if (hamiltonian->update(current_evolution_time)) {
+        has_parameters_changed = true;
+    }
     if (!soft_update) {
-        if (single_component) {
-            kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag);
-        }
-        else {
-            kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag, state_b->p_real, state_b->p_imag);
-            state_b->expected_values_updated = false;
-        }
+        lap = wall_time();
+        copy_states_from_kernel();
+        end_phase(PHASE_GET_SAMPLE, lap);
     }
     state->expected_values_updated = false;
     energy_expected_values_updated = false;
+    if (!soft_update && domain_mode != "fixed") {
+        lap = wall_time();
+        adapt_domain();
+        end_phase(PHASE_SETUP, lap);
+    }
+}
+
+double Solver::end_phase(SolverPhase phase, double start) {
+    double now = wall_time();
+    TRACE_EVENT(phase_names[phase], start, now);
+    phase_seconds[phase] += now - start;
+    phase_calls[phase]++;
+    return now;
+}
+
+void Solver::copy_states_from_kernel() {
+    // The halos are not exchanged after the last iteration: the mirror halos are refreshed here
+    if (states != NULL) {
+        for (int k = 0; k < n_states; k++) {
+            kernel->get_state_sample(k, grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, states[k]->p_real, states[k]->p_imag);
+            fill_mirror_halos(grid, states[k]->p_real, states[k]->p_imag);
+            states[k]->expected_values_updated = false;
+        }
+    }
+    else if (single_component) {
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag);
+        fill_mirror_halos(grid, state->p_real, state->p_imag);
+    }
+    else {
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag, state_b->p_real, state_b->p_imag);
+        fill_mirror_halos(grid, state->p_real, state->p_imag);
+        fill_mirror_halos(grid, state_b->p_real, state_b->p_imag);
+        state_b->expected_values_updated = false;
+    }
+}
+
+void Solver::update_scheduled_parameters() {
+    // The azimuthal potential depends on the mass
+    if (grid->coordinate_system == "cylindrical" && !is_python) {
+        initialize_exp_potential(delta_t, 0);
+        kernel->update_potential(external_pot_real[0], external_pot_imag[0], 0);
+        if (!single_component) {
+            initialize_exp_potential(delta_t, 1);
+            kernel->update_potential(external_pot_real[1], external_pot_imag[1], 1);
+        }
+    }
+    if (!kernel->update_coefficients(hamiltonian, delta_t)) {
+        // The kernel restarts from the states
+        copy_states_from_kernel();
+        init_kernel();
+    }
 }
 
 void Solver::calculate_energy_expected_values(void) {
+    TRACE_SCOPE("energy_expected_values");
+    ThreadBudget budget(num_threads);
 
     double delta_x = grid->delta_x;
     double delta_y = grid->delta_y;
@@ -419,7 +695,7 @@ void Solver::calculate_energy_expected_values(void) {
         }
     }
 
-    double *norm2_kin = new double[2];
+    double *norm2_kin = allocate_tracked(2, MEMORY_TEMPORARY);
     norm2_kin[0] = sum_norm2_kin0;
     norm2[0] = sum_norm2_0;
     kinetic_energy[0] = sum_kinetic_energy_0;
@@ -440,14 +716,15 @@ void Solver::calculate_energy_expected_values(void) {
     }
 
 #ifdef HAVE_MPI
-    double *norm2_kin_mpi = new double[grid->mpi_procs];
-    double *norm2_mpi = new double[grid->mpi_procs];
-    double *kinetic_energy_mpi = new double[grid->mpi_procs];
-    double *potential_energy_mpi = new double[grid->mpi_procs];
-    double *rotational_energy_mpi = new double[grid->mpi_procs];
-    double *intra_species_energy_mpi = new double[grid->mpi_procs];
-    double *LeeHuangYang_energy_mpi = new double[grid->mpi_procs];
+    double *norm2_kin_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *norm2_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *kinetic_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *potential_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *rotational_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *intra_species_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+    double *LeeHuangYang_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
 
+    double start = wall_time();
     MPI_Allgather(&norm2_kin[0], 1, MPI_DOUBLE, norm2_kin_mpi, 1, MPI_DOUBLE, grid->cartcomm);
     MPI_Allgather(&norm2[0], 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
     MPI_Allgather(&kinetic_energy[0], 1, MPI_DOUBLE, kinetic_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
@@ -455,6 +732,8 @@ void Solver::calculate_energy_expected_values(void) {
     MPI_Allgather(&rotational_energy[0], 1, MPI_DOUBLE, rotational_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
     MPI_Allgather(&intra_species_energy[0], 1, MPI_DOUBLE, intra_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
     MPI_Allgather(&LeeHuangYang_energy, 1, MPI_DOUBLE, LeeHuangYang_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
+    comm_stats.collective_seconds += wall_time() - start;
+    comm_stats.collective_calls += 7;
 
     norm2_kin[0] = 0;
     norm2[0] = 0;
@@ -473,24 +752,25 @@ void Solver::calculate_energy_expected_values(void) {
         intra_species_energy[0] += intra_species_energy_mpi[i];
         LeeHuangYang_energy += LeeHuangYang_energy_mpi[i];
     }
-    delete [] norm2_kin_mpi;
-    delete [] norm2_mpi;
-    delete [] kinetic_energy_mpi;
-    delete [] potential_energy_mpi;
-    delete [] rotational_energy_mpi;
-    delete [] intra_species_energy_mpi;
-    delete [] LeeHuangYang_energy_mpi;
+    free_tracked(norm2_kin_mpi);
+    free_tracked(norm2_mpi);
+    free_tracked(kinetic_energy_mpi);
+    free_tracked(potential_energy_mpi);
+    free_tracked(rotational_energy_mpi);
+    free_tracked(intra_species_energy_mpi);
+    free_tracked(LeeHuangYang_energy_mpi);
 
     if (!single_component) {
-    double *norm2_kin_mpi = new double[grid->mpi_procs];
-        double *norm2_mpi = new double[grid->mpi_procs];
-        double *kinetic_energy_mpi = new double[grid->mpi_procs];
-        double *potential_energy_mpi = new double[grid->mpi_procs];
-        double *rotational_energy_mpi = new double[grid->mpi_procs];
-        double *intra_species_energy_mpi = new double[grid->mpi_procs];
-        double *inter_species_energy_mpi = new double[grid->mpi_procs];
-        double *rabi_energy_mpi = new double[grid->mpi_procs];
+    double *norm2_kin_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *norm2_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *kinetic_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *potential_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *rotational_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *intra_species_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *inter_species_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
+        double *rabi_energy_mpi = allocate_tracked(grid->mpi_procs, MEMORY_TEMPORARY);
 
+        start = wall_time();
         MPI_Allgather(&norm2_kin[1], 1, MPI_DOUBLE, norm2_kin_mpi, 1, MPI_DOUBLE, grid->cartcomm);
         MPI_Allgather(&norm2[1], 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
         MPI_Allgather(&kinetic_energy[1], 1, MPI_DOUBLE, kinetic_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
@@ -499,6 +779,8 @@ void Solver::calculate_energy_expected_values(void) {
         MPI_Allgather(&intra_species_energy[1], 1, MPI_DOUBLE, intra_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
         MPI_Allgather(&inter_species_energy, 1, MPI_DOUBLE, inter_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
         MPI_Allgather(&rabi_energy, 1, MPI_DOUBLE, rabi_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
+        comm_stats.collective_seconds += wall_time() - start;
+        comm_stats.collective_calls += 8;
 
         norm2_kin[1] = 0;
         norm2[1] = 0;
@@ -519,14 +801,14 @@ void Solver::calculate_energy_expected_values(void) {
             inter_species_energy += inter_species_energy_mpi[i];
             rabi_energy += rabi_energy_mpi[i];
         }
-        delete [] norm2_kin_mpi;
-        delete [] norm2_mpi;
-        delete [] kinetic_energy_mpi;
-        delete [] potential_energy_mpi;
-        delete [] rotational_energy_mpi;
-        delete [] intra_species_energy_mpi;
-        delete [] inter_species_energy_mpi;
-        delete [] rabi_energy_mpi;
+        free_tracked(norm2_kin_mpi);
+        free_tracked(norm2_mpi);
+        free_tracked(kinetic_energy_mpi);
+        free_tracked(potential_energy_mpi);
+        free_tracked(rotational_energy_mpi);
+        free_tracked(intra_species_energy_mpi);
+        free_tracked(inter_species_energy_mpi);
+        free_tracked(rabi_energy_mpi);
     }
 #endif
     kinetic_energy[0] = kinetic_energy[0] / norm2_kin[0];
@@ -546,8 +828,9 @@ void Solver::calculate_energy_expected_values(void) {
         rotational_energy[1] = rotational_energy[1] / norm2_kin[1];
         potential_energy[1] = potential_energy[1] / norm2[1];
         intra_species_energy[1] = intra_species_energy[1] / norm2[1];
-        inter_species_energy = inter_species_energy / (norm2[0] * norm2[1]);
-        rabi_energy = rabi_energy / (norm2[0] * norm2[1]);
+        // The sums run over the lattice reduced by the parities, which holds 1 / symmetry_factor of each norm
+        inter_species_energy = inter_species_energy / (norm2[0] * norm2[1] * grid->symmetry_factor());
+        rabi_energy = rabi_energy / (norm2[0] * norm2[1] * grid->symmetry_factor());
 
         total_energy = kinetic_energy[0] + potential_energy[0] + intra_species_energy[0] + rotational_energy[0] +
                        kinetic_energy[1] + potential_energy[1] + intra_species_energy[1] + rotational_energy[1] +
@@ -556,11 +839,11 @@ void Solver::calculate_energy_expected_values(void) {
         tot_potential_energy = potential_energy[0] + potential_energy[1];
         tot_rotational_energy = rotational_energy[0] + rotational_energy[1];
         tot_intra_species_energy = intra_species_energy[0] + intra_species_energy[1];
-        norm2[1] *= delta_y * grid->length_x / (grid->global_no_halo_dim_x - (grid->coordinate_system == "cylindrical" ? 1 : 0));
+        norm2[1] *= delta_y * grid->length_x / (grid->global_no_halo_dim_x - (grid->coordinate_system == "cylindrical" ? 1 : 0)) * grid->symmetry_factor();
     }
-    norm2[0] *= delta_y * grid->length_x / (grid->global_no_halo_dim_x - (grid->coordinate_system == "cylindrical" ? 1 : 0));
+    norm2[0] *= delta_y * grid->length_x / (grid->global_no_halo_dim_x - (grid->coordinate_system == "cylindrical" ? 1 : 0)) * grid->symmetry_factor();
     energy_expected_values_updated = true;
-    delete [] norm2_kin;
+    free_tracked(norm2_kin);
 }
 
 double Solver::get_total_energy(void) {
@@ -704,3 +987,417 @@ double Solver::get_rabi_energy(void) {
 void Solver::update_parameters() {
     has_parameters_changed = true;
 }
+
+void Solver::set_adaptive_domain(string mode, int edge_points, double edge_fraction, int growth_points, int check_period) {
+    if (mode != "fixed" && mode != "window" && mode != "grow") {
+        my_abort("The adaptive domain mode must be fixed, window or grow");
+    }
+    if (edge_points < 1 || growth_points < 1 || check_period < 1 || edge_fraction <= 0.) {
+        my_abort("The edge points, the growth points, the check period and the edge fraction of the adaptive domain must be positive");
+    }
+    if (mode != "fixed") {
+        if (grid->coordinate_system != "cartesian") {
+            my_abort("The adaptive domain is only available in cartesian coordinates");
+        }
+        if (grid->periods[0] != 0 && grid->periods[1] != 0) {
+            my_abort("The adaptive domain needs a closed axis");
+        }
+        if (grid->parity_x != 0 || grid->parity_y != 0) {
+            my_abort("The adaptive domain is not available on lattices with a parity");
+        }
+        if (is_python || hamiltonian->potential->matrix != NULL ||
+                (!single_component && static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->matrix != NULL)) {
+            my_abort("The adaptive domain needs potentials defined by a function");
+        }
+    }
+    domain_mode = mode;
+    domain_edge_points = edge_points;
+    domain_edge_fraction = edge_fraction;
+    domain_growth_points = growth_points;
+    domain_check_period = check_period;
+}
+
+/**
+ * Add the density of a state over the inner region of the tile to the sums: the total, the bands along the
+ * low and high x edges of the lattice, the bands along its low and high y edges, and the first moments in
+ * points of the lattice along x and y.
+ */
+static void accumulate_edge_density(const State *state, const Lattice *grid, int edge_points, double *sums) {
+    int width = grid->global_no_halo_dim_x;
+    int height = grid->global_no_halo_dim_y;
+    for (int y = grid->inner_start_y; y < grid->inner_end_y; y++) {
+        for (int x = grid->inner_start_x; x < grid->inner_end_x; x++) {
+            int idx = (y - grid->start_y) * grid->dim_x + x - grid->start_x;
+            double density = state->p_real[idx] * state->p_real[idx] + state->p_imag[idx] * state->p_imag[idx];
+            sums[0] += density;
+            sums[1] += x < edge_points ? density : 0.;
+            sums[2] += x >= width - edge_points ? density : 0.;
+            sums[3] += y < edge_points ? density : 0.;
+            sums[4] += y >= height - edge_points ? density : 0.;
+            sums[5] += x * density;
+            sums[6] += y * density;
+        }
+    }
+}
+
+void Solver::adapt_domain(void) {
+    double sums[7] = {0., 0., 0., 0., 0., 0., 0.};
+    if (states != NULL) {
+        for (int k = 0; k < n_states; k++) {
+            accumulate_edge_density(states[k], grid, domain_edge_points, sums);
+        }
+    }
+    else {
+        accumulate_edge_density(state, grid, domain_edge_points, sums);
+        if (!single_component) {
+            accumulate_edge_density(state_b, grid, domain_edge_points, sums);
+        }
+    }
+#ifdef HAVE_MPI
+    // Every process takes the same decision
+    MPI_Allreduce(MPI_IN_PLACE, sums, 7, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+#endif
+    if (sums[0] <= 0.) {
+        return;
+    }
+    double threshold = domain_edge_fraction * sums[0];
+    bool edge_x = grid->periods[1] == 0 && (sums[1] > threshold || sums[2] > threshold);
+    bool edge_y = grid->periods[0] == 0 && grid->global_no_halo_dim_y > 1 && (sums[3] > threshold || sums[4] > threshold);
+    if (!edge_x && !edge_y) {
+        return;
+    }
+    Lattice old_grid = *grid;
+    if (domain_mode == "window") {
+        // Translate the lattice so that the center of the density falls on its center
+        int width = grid->global_no_halo_dim_x;
+        int height = grid->global_no_halo_dim_y;
+        int shift_x = edge_x ? int(floor(sums[5] / sums[0] - 0.5 * (width - 1) + 0.5)) : 0;
+        int shift_y = edge_y ? int(floor(sums[6] / sums[0] - 0.5 * (height - 1) + 0.5)) : 0;
+        if (shift_x == 0 && shift_y == 0) {
+            return;
+        }
+        grid->origin_x += shift_x * grid->delta_x;
+        grid->origin_y += shift_y * grid->delta_y;
+        hamiltonian->rot_coord_x -= shift_x;
+        hamiltonian->rot_coord_y -= shift_y;
+        rebuild_domain(old_grid, -shift_x, -shift_y);
+    }
+    else {
+        int growth_x = edge_x ? domain_growth_points : 0;
+        int growth_y = edge_y ? domain_growth_points : 0;
+        grid->extend(growth_x, growth_y);
+        hamiltonian->rot_coord_x += growth_x;
+        hamiltonian->rot_coord_y += growth_y;
+        rebuild_domain(old_grid, growth_x, growth_y);
+    }
+}
+
+void Solver::rebuild_domain(const Lattice &old_grid, int offset_x, int offset_y) {
+    if (states != NULL) {
+        for (int k = 0; k < n_states; k++) {
+            states[k]->remap(old_grid, offset_x, offset_y);
+        }
+    }
+    else {
+        state->remap(old_grid, offset_x, offset_y);
+        if (!single_component) {
+            state_b->remap(old_grid, offset_x, offset_y);
+        }
+    }
+    if (old_grid.dim_x != grid->dim_x || old_grid.dim_y != grid->dim_y) {
+        for (int which = 0; which < 2; which++) {
+            if (external_pot_real[which] != NULL) {
+                free_tracked(external_pot_real[which]);
+                free_tracked(external_pot_imag[which]);
+                external_pot_real[which] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+                external_pot_imag[which] = allocate_tracked(grid->dim_x * grid->dim_y, MEMORY_EXP_POTENTIAL);
+            }
+        }
+    }
+    // The next evolution evaluates the potentials on the new domain and starts a new kernel
+    if (kernel != NULL) {
+        comm_stats.add(kernel->get_comm_stats());
+        delete kernel;
+        kernel = NULL;
+    }
+    energy_expected_values_updated = false;
+}
+
+void Solver::set_num_threads(int _num_threads) {
+    if (_num_threads < 0) {
+        my_abort("The number of threads must be non-negative");
+    }
+    num_threads = _num_threads;
+}
+
+int Solver::get_num_threads(void) {
+    return num_threads;
+}
+
+vector<PhaseTiming> Solver::get_timings(void) {
+    double min_seconds[SOLVER_PHASES], max_seconds[SOLVER_PHASES], sum_seconds[SOLVER_PHASES];
+    int nprocs = 1;
+#ifdef HAVE_MPI
+    MPI_Comm_size(grid->cartcomm, &nprocs);
+    MPI_Allreduce(phase_seconds, min_seconds, SOLVER_PHASES, MPI_DOUBLE, MPI_MIN, grid->cartcomm);
+    MPI_Allreduce(phase_seconds, max_seconds, SOLVER_PHASES, MPI_DOUBLE, MPI_MAX, grid->cartcomm);
+    MPI_Allreduce(phase_seconds, sum_seconds, SOLVER_PHASES, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+#else
+    for (int phase = 0; phase < SOLVER_PHASES; phase++) {
+        min_seconds[phase] = max_seconds[phase] = sum_seconds[phase] = phase_seconds[phase];
+    }
+#endif
+    vector<PhaseTiming> timings(SOLVER_PHASES);
+    for (int phase = 0; phase < SOLVER_PHASES; phase++) {
+        timings[phase].phase = phase_names[phase];
+        timings[phase].calls = phase_calls[phase];
+        timings[phase].seconds = phase_seconds[phase];
+        timings[phase].min_seconds = min_seconds[phase];
+        timings[phase].max_seconds = max_seconds[phase];
+        timings[phase].avg_seconds = sum_seconds[phase] / nprocs;
+    }
+    return timings;
+}
+
+void Solver::enable_counters(bool enable) {
+    delete counters;
+    counters = NULL;
+    counted_points = 0.;
+    if (enable) {
+        // Follow the threads the kernels run on
+        ThreadBudget budget(num_threads);
+        counters = new PerfCounters();
+    }
+}
+
+KernelCounters Solver::get_counters(void) {
+    if (counters == NULL) {
+        my_abort("The hardware counters are not enabled");
+    }
+    ThreadBudget budget(num_threads);
+    return counters->get_summary(counted_points);
+}
+
+CommStats::CommStats() {
+    for (int i = 0; i < 4; i++) {
+        bytes_sent[i] = bytes_received[i] = 0.;
+        messages_sent[i] = messages_received[i] = 0;
+    }
+    wait_seconds[0] = wait_seconds[1] = 0.;
+    wait_calls[0] = wait_calls[1] = 0;
+    collective_seconds = 0.;
+    collective_calls = 0;
+}
+
+void CommStats::add(const CommStats &other) {
+    for (int i = 0; i < 4; i++) {
+        bytes_sent[i] += other.bytes_sent[i];
+        bytes_received[i] += other.bytes_received[i];
+        messages_sent[i] += other.messages_sent[i];
+        messages_received[i] += other.messages_received[i];
+    }
+    for (int i = 0; i < 2; i++) {
+        wait_seconds[i] += other.wait_seconds[i];
+        wait_calls[i] += other.wait_calls[i];
+    }
+    collective_seconds += other.collective_seconds;
+    collective_calls += other.collective_calls;
+}
+
+CommStats Solver::get_comm_stats(void) {
+    CommStats stats = comm_stats;
+    if (kernel != NULL) {
+        stats.add(kernel->get_comm_stats());
+    }
+    return stats;
+}
+
+void Solver::reset_comm_stats(void) {
+    comm_stats = CommStats();
+    if (kernel != NULL) {
+        kernel->reset_comm_stats();
+    }
+}
+
+/**
+ * Append to the report a table of one value per process, laid out over the process grid, with a shade growing with the value.
+ */
+static void format_heat_map(stringstream &report, const char *title, const vector<double> &values, const vector<int> &coords, const int *dims) {
+    static const char shades[] = " .:-=+*#%@";
+    int nprocs = values.size();
+    double max_value = 0., sum = 0.;
+    vector<double> cells(dims[0] * dims[1], 0.);
+    for (int i = 0; i < nprocs; i++) {
+        max_value = values[i] > max_value ? values[i] : max_value;
+        sum += values[i];
+        cells[coords[2 * i] * dims[1] + coords[2 * i + 1]] = values[i];
+    }
+    report << title << "\n      ";
+    for (int column = 0; column < dims[1]; column++) {
+        report << setw(12) << column;
+    }
+    report << "\n";
+    for (int row = 0; row < dims[0]; row++) {
+        report << setw(6) << row;
+        for (int column = 0; column < dims[1]; column++) {
+            double value = cells[row * dims[1] + column];
+            int shade = max_value > 0. ? int((sizeof(shades) - 2) * value / max_value + 0.5) : 0;
+            report << setw(10) << value << " " << shades[shade];
+        }
+        report << "\n";
+    }
+    report << "      max / average: " << (sum > 0. ? max_value * nprocs / sum : 1.) << "\n\n";
+}
+
+string Solver::get_comm_report(void) {
+    CommStats stats = get_comm_stats();
+    double volume = 0.;
+    for (int i = 0; i < 4; i++) {
+        volume += stats.bytes_sent[i] + stats.bytes_received[i];
+    }
+    // Coordinates in the process grid, halo volume in MB, halo wait and collectives in ms
+    double local[5] = {double(grid->mpi_coords[0]), double(grid->mpi_coords[1]), volume / 1.e6,
+                       1.e3 * (stats.wait_seconds[0] + stats.wait_seconds[1]), 1.e3 * stats.collective_seconds
+                      };
+    int rank = 0, nprocs = 1;
+    int dims[2] = {1, 1};
+#ifdef HAVE_MPI
+    MPI_Comm_rank(grid->cartcomm, &rank);
+    MPI_Comm_size(grid->cartcomm, &nprocs);
+    dims[0] = grid->mpi_dims[0];
+    dims[1] = grid->mpi_dims[1];
+    vector<double> all(5 * nprocs);
+    MPI_Gather(local, 5, MPI_DOUBLE, &all[0], 5, MPI_DOUBLE, 0, grid->cartcomm);
+#else
+    vector<double> all(local, local + 5);
+#endif
+    if (rank != 0) {
+        return "";
+    }
+    vector<int> coords(2 * nprocs);
+    vector<double> volumes(nprocs), waits(nprocs), collectives(nprocs);
+    for (int i = 0; i < nprocs; i++) {
+        coords[2 * i] = int(all[5 * i]);
+        coords[2 * i + 1] = int(all[5 * i + 1]);
+        volumes[i] = all[5 * i + 2];
+        waits[i] = all[5 * i + 3];
+        collectives[i] = all[5 * i + 4];
+    }
+    stringstream report;
+    report << fixed << setprecision(3);
+    report << "Communication of " << nprocs << " processes over the " << dims[0] << " x " << dims[1] << " process grid\n\n";
+    format_heat_map(report, "Halo volume sent and received (MB)", volumes, coords, dims);
+    format_heat_map(report, "Wait for the halos (ms)", waits, coords, dims);
+    format_heat_map(report, "Collectives of the norms and observables (ms)", collectives, coords, dims);
+    return report.str();
+}
+
+vector<MemoryUsage> Solver::get_memory_usage(void) {
+    return get_tracked_memory();
+}
+
+void Solver::reset_memory_peaks(void) {
+    reset_tracked_peaks();
+}
+
+vector<MemoryUsage> Solver::predict_memory(int dim_x, int dim_y, int n_components, string kernel_type, int n_procs, bool rotating,
+                                           int kinetic_order) {
+    if (dim_x < 1 || dim_y < 1 || n_components < 1 || n_procs < 1) {
+        my_abort("The lattice, the number of components and the number of processes must be positive");
+    }
+    if (kinetic_order != 2 && kinetic_order != 4) {
+        my_abort("The order of the kinetic operator must be 2 or 4");
+    }
+    // Split of the processes of MPI_Dims_create: the y axis gets the larger factor
+    int procs_x = 1;
+    for (int d = 1; d * d <= n_procs; d++) {
+        if (n_procs % d == 0) {
+            procs_x = d;
+        }
+    }
+    int procs_y = n_procs / procs_x;
+    int halo = lattice_halo(rotating ? 1. : 0., kinetic_order);
+    double inner_width = ceil(double(dim_x) / procs_x);
+    double inner_height = ceil(double(dim_y) / procs_y);
+    double tile = (inner_width + 2 * halo) * (inner_height + 2 * halo);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    double bytes[MEMORY_CATEGORIES];
+    bytes[MEMORY_STATES] = n_components * 2 * tile * sizeof(double);
+    bytes[MEMORY_EXP_POTENTIAL] = (n_components == 2 ? 2 : 1) * 2 * tile * sizeof(double);
+    bytes[MEMORY_POTENTIAL] = 0.;
+    bytes[MEMORY_TEMPORARY] = 0.;
+    if (kernel_type == "cpu") {
+        // Second buffer of each wave function, and a cached block per thread
+        bytes[MEMORY_KERNEL] = n_components * 2 * tile * sizeof(double);
+        bytes[MEMORY_TEMPORARY] = 2. * BLOCK_HEIGHT_CACHE * BLOCK_WIDTH_CACHE * sizeof(double) * threads;
+    }
+    else if (kernel_type == "chebyshev") {
+        // Three terms of the recurrence, the sum and the potential
+        bytes[MEMORY_KERNEL] = 9 * tile * sizeof(double);
+    }
+    else if (kernel_type == "spectral") {
+        // Spectrum and kinetic operators, and the buffers of the distributed transforms
+        double inner = inner_width * inner_height * sizeof(complex<double>);
+        bytes[MEMORY_KERNEL] = (1 + n_components) * inner + (n_procs > 1 ? 3 * inner : 0.);
+    }
+    else {
+        my_abort("The memory can only be predicted for the cpu, chebyshev and spectral kernels");
+    }
+    return make_memory_usage(bytes);
+}
+
+void Solver::reset_timings(void) {
+    for (int phase = 0; phase < SOLVER_PHASES; phase++) {
+        phase_seconds[phase] = 0.;
+        phase_calls[phase] = 0;
+    }
+}
+
+double Solver::get_state_energy(int index) {
+    if (states == NULL) {
+        if (index != 0) {
+            my_abort("The solver evolves a single state");
+        }
+        return get_total_energy();
+    }
+    if (index < 0 || index >= n_states) {
+        my_abort("State index out of range");
+    }
+    if (index == 0) {
+        return get_total_energy();
+    }
+    State *first_state = state;
+    state = states[index];
+    calculate_energy_expected_values();
+    double energy = total_energy;
+    state = first_state;
+    energy_expected_values_updated = false;
+    return energy;
+}
+
+string Solver::get_kernel_name(void) {
+    return kernel_name;
+}
+
+void Solver::set_orthogonalization_period(int period) {
+    if (period < 1) {
+        my_abort("The orthogonalization period must be positive");
+    }
+    orthogonalization_period = period;
+    has_parameters_changed = true;
+}
+
+void Solver::set_halo_precision(string precision, int resync_period) {
+    if (precision != "double" && precision != "float") {
+        my_abort("The halo precision must be double or float");
+    }
+    if (resync_period < 1) {
+        my_abort("The resynchronization period of the halos must be positive");
+    }
+    halo_precision = precision;
+    halo_resync_period = resync_period;
+    has_parameters_changed = true;
+}
@@ -0,0 +1,218 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <fstream>
+#include <sstream>
+#include <sys/time.h>
+#include "common.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+double trace_time(void) {
+#ifdef HAVE_MPI
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.e-6 * now.tv_usec;
+#endif
+}
+
+#ifdef ENABLE_TRACING
+
+/** Maximum number of threads recording events.
+ */
+#define MAX_TRACE_THREADS 1024
+
+/**
+ * \brief Event of the timeline: a named span of time.
+ */
+struct TraceEvent {
+    const char *name;    ///< Name of the span; a string literal.
+    double start;    ///< Beginning of the span.
+    double duration;    ///< Length of the span.
+};
+
+/**
+ * \brief Ring buffer of the events of a thread.
+ *
+ * Only the owning thread writes into the buffer, so that recording takes no lock; when the
+ * buffer is full, the oldest events are overwritten.
+ */
+struct TraceBuffer {
+    TraceEvent *events;    ///< Ring of capacity events.
+    size_t capacity;    ///< Number of events kept.
+    size_t count;    ///< Number of events recorded; the next one is written at count % capacity.
+    int openmp_thread;    ///< OpenMP thread number of the owner when it recorded its first event.
+    int generation;    ///< Trace the buffer belongs to.
+};
+
+static TraceBuffer *trace_buffers[MAX_TRACE_THREADS];
+static volatile int trace_threads = 0;    ///< Number of registered buffers.
+static volatile int trace_generation = 0;    ///< Incremented by start_trace, so that the threads register new buffers.
+volatile bool tracing = false;
+static size_t trace_capacity = 0;
+static double trace_origin = 0.;
+static __thread TraceBuffer *thread_buffer = NULL;
+
+/**
+ * Buffer of the calling thread in the current trace, registered at the first event.
+ */
+static TraceBuffer *get_thread_buffer(void) {
+    if (thread_buffer != NULL && thread_buffer->generation == trace_generation) {
+        return thread_buffer;
+    }
+    int index = __sync_fetch_and_add(&trace_threads, 1);
+    if (index >= MAX_TRACE_THREADS) {
+        thread_buffer = NULL;
+        return NULL;
+    }
+    TraceBuffer *buffer = new TraceBuffer;
+    buffer->events = new TraceEvent[trace_capacity];
+    buffer->capacity = trace_capacity;
+    buffer->count = 0;
+    buffer->openmp_thread = 0;
+#ifdef _OPENMP
+    buffer->openmp_thread = omp_get_thread_num();
+#endif
+    buffer->generation = trace_generation;
+    trace_buffers[index] = buffer;
+    thread_buffer = buffer;
+    return buffer;
+}
+
+void trace_event(const char *name, double start, double end) {
+    if (!tracing) {
+        return;
+    }
+    TraceBuffer *buffer = get_thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    TraceEvent &event = buffer->events[buffer->count % buffer->capacity];
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    buffer->count++;
+}
+
+static void free_trace_buffers(void) {
+    int n_buffers = trace_threads < MAX_TRACE_THREADS ? trace_threads : MAX_TRACE_THREADS;
+    for (int i = 0; i < n_buffers; i++) {
+        delete [] trace_buffers[i]->events;
+        delete trace_buffers[i];
+    }
+    trace_threads = 0;
+}
+
+void start_trace(size_t events_per_thread) {
+    if (events_per_thread == 0) {
+        my_abort("The trace needs room for at least one event per thread");
+    }
+    tracing = false;
+    free_trace_buffers();
+    trace_capacity = events_per_thread;
+    trace_generation++;
+#ifdef HAVE_MPI
+    // The processes share the origin of the timeline up to the skew of the barrier
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    trace_origin = trace_time();
+    tracing = true;
+}
+
+void stop_trace(void) {
+    tracing = false;
+}
+
+/**
+ * Events of this process as Chrome trace JSON objects, each followed by a comma.
+ */
+static string format_trace_events(int rank) {
+    stringstream events;
+    events.precision(15);
+    events << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << rank << ", \"args\": {\"name\": \"rank " << rank << "\"}},\n";
+    int n_buffers = trace_threads < MAX_TRACE_THREADS ? trace_threads : MAX_TRACE_THREADS;
+    for (int i = 0; i < n_buffers; i++) {
+        const TraceBuffer *buffer = trace_buffers[i];
+        events << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << rank << ", \"tid\": " << i
+               << ", \"args\": {\"name\": \"thread " << i << " (OpenMP " << buffer->openmp_thread << ")\"}},\n";
+        size_t first = buffer->count > buffer->capacity ? buffer->count - buffer->capacity : 0;
+        for (size_t k = first; k < buffer->count; k++) {
+            const TraceEvent &event = buffer->events[k % buffer->capacity];
+            // Complete events, in microseconds
+            events << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << rank << ", \"tid\": " << i
+                   << ", \"ts\": " << 1.e6 * (event.start - trace_origin) << ", \"dur\": " << 1.e6 * event.duration << "},\n";
+        }
+    }
+    return events.str();
+}
+
+void write_trace(string file_name) {
+    bool was_tracing = tracing;
+    tracing = false;
+    int rank = 0;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+    string events = format_trace_events(rank);
+#ifdef HAVE_MPI
+    int nprocs;
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    // The events of every process are gathered on the first one
+    int length = events.size();
+    vector<int> lengths(nprocs), displs(nprocs, 0);
+    MPI_Gather(&length, 1, MPI_INT, &lengths[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int total = 0;
+    for (int i = 0; i < nprocs; i++) {
+        displs[i] = total;
+        total += lengths[i];
+    }
+    vector<char> all_events(rank == 0 ? total + 1 : 1);
+    MPI_Gatherv(const_cast<char *>(events.data()), length, MPI_CHAR, &all_events[0], &lengths[0], &displs[0], MPI_CHAR, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        events.assign(all_events.begin(), all_events.begin() + total);
+    }
+#endif
+    if (rank == 0) {
+        ofstream out(file_name.c_str(), ios::out | ios::trunc);
+        if (!out) {
+            my_abort("Cannot write the trace to " + file_name);
+        }
+        // Drop the comma after the last event
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" << events.substr(0, events.size() - 2) << "\n]}\n";
+    }
+    tracing = was_tracing;
+}
+
+#else
+
+void start_trace(size_t events_per_thread) {
+    my_abort("Tracing is not available: configure with --enable-tracing");
+}
+
+void stop_trace(void) {
+}
+
+void write_trace(string file_name) {
+    my_abort("Tracing is not available: configure with --enable-tracing");
+}
+
+#endif
@@ -19,6 +19,7 @@
 #define __TROTTERSUZUKI_H
 
 #include <string>
+#include <vector>
 #define _USE_MATH_DEFINES
 #include <cfloat>
 #include <complex>
@@ -42,6 +43,7 @@ public:
     int global_dim_x, global_dim_y;    ///< Linear dimension of the lattice, comprising the eventual surrounding halo, along x and y axes.
     int periods[2];    ///< Whether the grid is periodic in any of the directions.
     string coordinate_system;	///< Type of the coordinate system used.
+    int kinetic_order;    ///< Order of the spatial accuracy of the kinetic evolution operator (2 or 4).
 
     // Computational topology
     int halo_x, halo_y;    ///< Halo length along the x and y halos.
@@ -50,9 +52,19 @@ public:
     int inner_start_x, inner_start_y;    ///< Spatial coordinates (not physical) of the first element of the tile, excluding the eventual surrounding halo.
     int inner_end_x, inner_end_y;    ///< Spatial coordinates (not physical) of the last element of the tile, excluding the eventual surrounding halo.
     int mpi_coords[2], mpi_dims[2];    ///< Coordinate of the process in the MPI topology and structure of the MPI topology.
+    double origin_x, origin_y;    ///< Physical coordinates of the center of the lattice, moved along with the wave function by the adaptive domain of Solver.
+    int parity_x, parity_y;    ///< Parity of the wave functions under the reflection x -> -x (y -> -y): 1 even, -1 odd, 0 no symmetry. With a parity, the lattice only covers x > 0 (y > 0).
 #ifdef HAVE_MPI
     MPI_Comm cartcomm;    ///< MPI communitaros chart.
 #endif
+
+    void extend(int points_x, int points_y);    ///< Add points on both sides of the closed x and y axes of the lattice, keeping its center and spacing, and split them again over the processes.
+    int symmetry_factor() const;    ///< Number of images of the lattice covering the full domain: 2 for each axis with a parity.
+    /**
+        Dimensions of the snapshots of the tile (density, phase and files of the State): its inner points, unfolded over the full domain
+        along the axes with a parity when the lattice is on a single process.
+     */
+    void get_snapshot_dims(int *width, int *height) const;
 };
 
 /**
@@ -70,8 +82,10 @@ public:
         @param [in] length            Physical length of the lattice.
         @param [in] periodic_x_axis   Boundary condition along the x axis (false=closed, true=periodic).
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] kinetic_order     Order of the spatial accuracy of the kinetic operator: 2 (nearest neighbours) or 4 (next-nearest neighbours, wider halos).
+        @param [in] parity_x          Parity of the wave functions under x -> -x (1 even, -1 odd): only the half x > 0 of the closed axis is evolved.
      */
-    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian", int kinetic_order = 2, int parity_x = 0);
 };
 
 /**
@@ -79,6 +93,8 @@ public:
  *
  * As to single-process execution, the lattice is a single tile which can be surrounded by a halo, in the case of periodic boundary conditions.
  * As to multi-process execution, the lattice is divided in smaller lattices, dubbed tiles, one for each process. Each of the tiles is surrounded by a halo.
+ * Along an axis with a parity, the lattice only covers the positive half of the domain: the halo at the symmetry plane mirrors the first points,
+ * with the sign of the parity, and the observables and snapshots account for the other half.
  */
 class Lattice2D: public Lattice {
 public:
@@ -91,10 +107,14 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] kinetic_order     Order of the spatial accuracy of the kinetic operator: 2 (nearest neighbours) or 4 (next-nearest neighbours, wider halos).
+        @param [in] parity_x          Parity of the wave functions under x -> -x (1 even, -1 odd): only the half x > 0 of the closed axis is evolved.
+        @param [in] parity_y          Parity of the wave functions under y -> -y (1 even, -1 odd): only the half y > 0 of the closed axis is evolved.
      */
     Lattice2D(int dim, double length,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int kinetic_order = 2,
+              int parity_x = 0, int parity_y = 0);
     /**
         Lattice constructor.
 
@@ -106,14 +126,19 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] kinetic_order     Order of the spatial accuracy of the kinetic operator: 2 (nearest neighbours) or 4 (next-nearest neighbours, wider halos).
+        @param [in] parity_x          Parity of the wave functions under x -> -x (1 even, -1 odd): only the half x > 0 of the closed axis is evolved.
+        @param [in] parity_y          Parity of the wave functions under y -> -y (1 even, -1 odd): only the half y > 0 of the closed axis is evolved.
      */
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int kinetic_order = 2,
+              int parity_x = 0, int parity_y = 0);
 private:
     void init(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int kinetic_order = 2,
+              int parity_x = 0, int parity_y = 0);
 };
 
 /**
@@ -141,6 +166,15 @@ public:
     void init_state(complex<double> (*ini_state)(double x) /** Pointer to a wave function */); ///< Write the wave function from a C++ function to p_real and p_imag matrices in 1D.
     void init_state(complex<double> (*ini_state)(double x, double y) /** Pointer to a wave function */);    ///< Write the wave function from a C++ function to p_real and p_imag matrices in 2D.
     void loadtxt(char *file_name);    ///< Load the wave function from a file to p_real and p_imag matrices.
+    /**
+        Move the wave function onto the lattice after its domain moved or grew.
+
+        The point (x, y) of the previous lattice old_grid goes to the point (x + offset_x, y + offset_y) of the current one;
+        the points left uncovered are set to zero and those falling outside are dropped. Under MPI the tiles of the previous
+        lattice are gathered on every process, which then takes its tile of the current one: all the processes must call it.
+        The matrices are reallocated if the tile changed size, which requires them to be owned by the state.
+     */
+    void remap(const Lattice &old_grid, int offset_x, int offset_y);
 
     void imprint(complex<double> (*function)(double x) /** Pointer to a function */);    ///< Multiply the wave function of the state by the function provided in 1D.
     void imprint(complex<double> (*function)(double x, double y) /** Pointer to a function */);    ///< Multiply the wave function of the state by the function provided in 2D.
@@ -380,6 +414,7 @@ public:
     virtual ~Potential();
     virtual double get_value(int x); ///< Get the value at the coordinate x in a 1D model.
     virtual double get_value(int x, int y);    ///< Get the value at the coordinate (x,y) in a 2D model.
+    virtual double get_value_at(double x, double y);    ///< Get the value at the point (x,y) of the coordinate space, for a potential defined by a function.
     bool update(double t);    ///< Update the potential matrix at time t.
     bool updated_potential_matrix;
 protected:
@@ -410,6 +445,7 @@ public:
     HarmonicPotential(Lattice2D *grid, double omegax, double omegay, double mass = 1., double mean_x = 0., double mean_y = 0.);
     ~HarmonicPotential();
     double get_value(int x, int y);    ///< Return the value of the external potential at coordinate (x,y)
+    double get_value_at(double x, double y);    ///< Return the value of the external potential at the point (x,y) of the coordinate space.
 
 private:
     double omegax, omegay;    ///< Frequencies along x and y axis.
@@ -417,6 +453,38 @@ private:
     double mean_x, mean_y;    ///< Minimum of the potential along x and y axis.
 };
 
+/**
+ * \brief This class defines the value of a Hamiltonian parameter as a function of time.
+ *
+ * The value is given either by a function of time or by a piecewise-linear table, constant before the first and after the last point.
+ */
+class ParameterSchedule {
+public:
+    /**
+    	Construct the schedule from a function.
+
+    	@param [in] parameter              Pointer to the scheduled parameter.
+    	@param [in] schedule_function      Value of the parameter at time t.
+     */
+    ParameterSchedule(double *parameter, double (*schedule_function)(double t));
+    /**
+    	Construct the schedule from a piecewise-linear table.
+
+    	@param [in] parameter      Pointer to the scheduled parameter.
+    	@param [in] times          Times of the points of the table, in increasing order.
+    	@param [in] values         Values of the parameter at the points of the table.
+    	@param [in] n_points       Number of points of the table.
+     */
+    ParameterSchedule(double *parameter, const double *times, const double *values, int n_points);
+    double get_value(double t) const;    ///< Get the value of the parameter at time t.
+    bool update(double t);    ///< Set the parameter to its value at time t; return whether it changed.
+    double *parameter;    ///< Pointer to the scheduled parameter.
+private:
+    double (*schedule_function)(double t);    ///< Function of the schedule.
+    vector<double> times;    ///< Times of the points of the table.
+    vector<double> values;    ///< Values of the parameter at the points of the table.
+};
+
 /**
  * \brief This class defines the Hamiltonian of a single component system.
  */
@@ -429,6 +497,9 @@ public:
     double angular_velocity;    ///< The frame of reference rotates with this angular velocity.
     double rot_coord_x;    ///< X coordinate of the center of rotation.
     double rot_coord_y;    ///< Y coordinate of the center of rotation.
+    double absorbing_width;    ///< Width of the absorbing layer along the edges of the lattice (0: no layer).
+    double absorbing_strength;    ///< Height of the complex absorbing potential at the edges of the lattice.
+    int absorbing_power;    ///< The absorbing potential grows as this power of the depth into the layer.
     double azimuthal_potential(double x, int angular_momentum);
 
     /**
@@ -446,11 +517,48 @@ public:
     Hamiltonian(Lattice *grid, Potential *potential = 0, double mass = 1., double coupling_a = 0., double LeeHuangYang_coupling_a = 0.,
                 double angular_velocity = 0.,
                 double rot_coord_x = 0, double rot_coord_y = 0);
-    ~Hamiltonian();
+    virtual ~Hamiltonian();
+    /**
+    	Make a parameter follow a function of time during the evolution.
+    	A scheduled angular_velocity needs closed boundaries and the halos of a rotating frame, as a nonzero one in the constructor; under MPI the lattice must be built with a nonzero angular velocity.
+
+    	@param [in] parameter           Name of the parameter (mass, coupling_a or angular_velocity; also mass_b, coupling_b, coupling_ab, omega_r and omega_i for two-component systems).
+    	@param [in] schedule_function   Value of the parameter at time t.
+     */
+    void set_schedule(string parameter, double (*schedule_function)(double t));
+    /**
+    	Make a parameter follow a piecewise-linear table during the evolution.
+
+    	@param [in] parameter      Name of the parameter.
+    	@param [in] times          Times of the points of the table, in increasing order.
+    	@param [in] values         Values of the parameter at the points of the table.
+    	@param [in] n_points       Number of points of the table.
+     */
+    void set_schedule(string parameter, const double *times, const double *values, int n_points);
+    /**
+    	Absorb the wave function near the edges of the lattice, so that outgoing waves leave the domain instead of being reflected.
+
+    	Real time evolution adds the complex absorbing potential -i W to the external potential, where W rises from 0 to strength
+    	as the power of the depth into a layer of the given width along each edge (along the outer radius only, in cylindrical coordinates).
+    	Imaginary time evolution ignores the layer. Call Solver::update_parameters after changing the layer of a Hamiltonian in use.
+
+    	@param [in] width         Physical width of the layer; 0 removes it.
+    	@param [in] strength      Height of the absorbing potential at the edges.
+    	@param [in] power         Power of the profile of the absorbing potential (2: quadratic).
+     */
+    void set_absorbing_layer(double width, double strength, int power = 2);
+    bool has_absorbing_layer(void);    ///< Whether an absorbing layer is set.
+    double get_absorbing_potential(int x, int y);    ///< Return the height W of the absorbing potential -i W at the coordinate (x,y) of the tile.
+    void remove_schedule(string parameter);    ///< Stop scheduling a parameter, which keeps its last value.
+    bool has_schedule(string parameter);    ///< Whether the parameter follows a schedule.
+    bool update(double t);    ///< Set the scheduled parameters to their values at time t; return whether any of them changed.
 
 protected:
     bool self_init;    ///< Whether the potential is initialized in the Hamiltonian constructor or not.
     Lattice *grid;    ///< Lattice object.
+    vector<ParameterSchedule> schedules;    ///< Schedules of the time-dependent parameters.
+    virtual double *get_parameter(string parameter);    ///< Pointer to the parameter with this name; NULL if it cannot be scheduled.
+    void check_schedule(string parameter);    ///< Check that the lattice supports the parameter changing in time, and prepare its halos.
 };
 
 /**
@@ -494,6 +602,106 @@ public:
                           double rot_coord_x = 0,
                           double rot_coord_y = 0);
     ~Hamiltonian2Component();
+
+protected:
+    double *get_parameter(string parameter);    ///< Pointer to the parameter with this name; NULL if it cannot be scheduled.
+};
+
+struct KernelConfig;
+class PerfCounters;
+
+/**
+ * \brief Phases of the evolution timed by the solver.
+ */
+enum SolverPhase {
+    PHASE_SETUP,    ///< Initialization of the evolution operators and of the kernel.
+    PHASE_PARAMETERS,    ///< Update of the scheduled parameters and of the time-dependent potentials.
+    PHASE_KERNEL_ON_HALO,    ///< Evolution of the borders of the tile (run_kernel_on_halo).
+    PHASE_START_HALO_EXCHANGE,    ///< Start of the exchange of the halos.
+    PHASE_KERNEL,    ///< Evolution of the inner part of the tile (run_kernel).
+    PHASE_FINISH_HALO_EXCHANGE,    ///< Wait for the exchange of the halos.
+    PHASE_WAIT_FOR_COMPLETION,    ///< End of the step, comprising the normalization in imaginary time of single-component systems.
+    PHASE_RABI_COUPLING,    ///< Rabi coupling of two-component systems.
+    PHASE_NORMALIZATION,    ///< Normalization of two-component systems.
+    PHASE_GET_SAMPLE,    ///< Copy of the evolved states from the kernel.
+    SOLVER_PHASES    ///< Number of phases.
+};
+
+/**
+ * \brief Hardware performance counters of the kernel phases of the evolution, with a roofline estimate of the host.
+ *
+ * Quantities that cannot be measured on the host are negative.
+ */
+struct KernelCounters {
+    double seconds;    ///< Time spent in the counted phases.
+    double points;    ///< Lattice point updates in the counted phases.
+    double cycles;    ///< CPU cycles.
+    double instructions;    ///< Instructions retired.
+    double llc_misses;    ///< Last level cache misses.
+    double fp_ops;    ///< Double precision floating point operations.
+    double ipc;    ///< Instructions per cycle.
+    double bytes_per_point;    ///< Memory traffic per point update, counting a cache line per last level cache miss.
+    double flops_per_point;    ///< Floating point operations per point update.
+    double arithmetic_intensity;    ///< Floating point operations per byte of memory traffic.
+    double gflop_per_s;    ///< Achieved floating point throughput.
+    double gb_per_s;    ///< Achieved memory bandwidth.
+    double peak_gflop_per_s;    ///< Peak floating point throughput of the host.
+    double peak_gb_per_s;    ///< Memory bandwidth of the host.
+    string bound;    ///< Roofline limit of the kernel: compute or memory; unknown without the arithmetic intensity.
+};
+
+/**
+ * \brief Time spent in a phase of the evolution, accumulated over the calls to Solver::evolve.
+ */
+struct PhaseTiming {
+    string phase;    ///< Name of the phase.
+    long calls;    ///< Number of times the phase ran on this process.
+    double seconds;    ///< Time spent in the phase by this process.
+    double min_seconds;    ///< Minimum over the processes of the time spent in the phase.
+    double max_seconds;    ///< Maximum over the processes of the time spent in the phase.
+    double avg_seconds;    ///< Average over the processes of the time spent in the phase.
+};
+
+/**
+ * \brief Communication of a process during the evolution.
+ *
+ * The halo messages are counted per neighbour, in the order up, down, left and right of the process grid; the left and right
+ * halos are exchanged first, then the up and down ones, and the waits for each exchange are timed separately.
+ * Messages to the missing neighbours of a closed boundary are not counted.
+ */
+struct CommStats {
+    double bytes_sent[4];    ///< Bytes of halo sent to each neighbour.
+    double bytes_received[4];    ///< Bytes of halo received from each neighbour.
+    long messages_sent[4];    ///< Halo messages sent to each neighbour.
+    long messages_received[4];    ///< Halo messages received from each neighbour.
+    double wait_seconds[2];    ///< Time blocked in MPI_Waitall for the left and right halos, and for the up and down halos.
+    long wait_calls[2];    ///< Number of waits for the left and right halos, and for the up and down halos.
+    double collective_seconds;    ///< Time spent in the collective operations of the norms and of the observables.
+    long collective_calls;    ///< Number of collective operations of the norms and of the observables.
+    CommStats();    ///< Zero communication.
+    void add(const CommStats &other);    ///< Accumulate the communication of another period.
+};
+
+/**
+ * \brief Categories of the memory allocated by the library.
+ */
+enum MemoryCategory {
+    MEMORY_STATES,    ///< Wave functions of the states.
+    MEMORY_KERNEL,    ///< Buffers of the kernels: second buffers of the wave functions, work arrays and spectra.
+    MEMORY_EXP_POTENTIAL,    ///< Exponential of the potential, held by the solvers.
+    MEMORY_POTENTIAL,    ///< Potentials defined by a matrix.
+    MEMORY_TEMPORARY,    ///< Temporaries of the kernels, of the observables and of the energy routines.
+    MEMORY_CATEGORIES    ///< Number of categories.
+};
+
+/**
+ * \brief Memory of a category on this process.
+ */
+struct MemoryUsage {
+    string category;    ///< Name of the category (states, kernel, exp_potential, potential, temporary), or total.
+    double current_bytes;    ///< Bytes allocated now.
+    double peak_bytes;    ///< Largest number of bytes allocated at the same time.
+    double mapped_bytes;    ///< Bytes of current_bytes held in the scratch files of the out-of-core mode (see set_out_of_core).
 };
 
 /**
@@ -506,16 +714,35 @@ public:
     virtual void run_kernel_on_halo() = 0;    ///< Evolve blocks of wave function at the edge of the tile. This comprises the halos.
     virtual void wait_for_completion() = 0;    ///< Sincronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution.
     virtual void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const = 0; ///< Get the evolved wave function.
+    /// Get the evolved wave function of the index-th state; kernels evolving a single state only provide the first one.
+    virtual void get_state_sample(int index, size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag) const {
+        if (index == 0) {
+            get_sample(dest_stride, x, y, width, height, dest_real, dest_imag);
+        }
+    }
     virtual void normalization() = 0;    ///< Normalization of the two components wave function.
     virtual void rabi_coupling(double var, double delta_t) = 0;    ///< Perform the evolution regarding the Rabi coupling.
     virtual double calculate_squared_norm(bool global = true) const = 0;  ///< Calculate the squared norm of the wave function.
     virtual bool runs_in_place() const = 0;
     virtual string get_name() const = 0;				///< Get kernel name.
     virtual void update_potential(double *_external_pot_real, double *_external_pot_imag, int which) = 0;    ///< Update the evolution matrix, regarding the external potential, at time t.
+    /// Update the per-step coefficients from the Hamiltonian parameters in the middle of an evolution; return false if the kernel must be rebuilt instead.
+    virtual bool update_coefficients(Hamiltonian *, double) {
+        return false;
+    }
+    /// Update in place the Hamiltonian parameters, the time step and the time direction of a kernel built on the same geometry; return false if the kernel must be rebuilt instead.
+    virtual bool update_parameters(const KernelConfig &) {
+        return false;
+    }
     virtual void cpy_first_positive_to_first_negative() = 0;    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
 
     virtual void start_halo_exchange() = 0;					///< Exchange halos between processes.
     virtual void finish_halo_exchange() = 0;				///< Exchange halos between processes.
+    /// Get the communication of this process since the construction of the kernel or the last reset; kernels that do not count it report none.
+    virtual CommStats get_comm_stats() const {
+        return CommStats();
+    }
+    virtual void reset_comm_stats() {}    ///< Restart the count of the communication.
 
 };
 
@@ -536,7 +763,7 @@ public:
     	@param [in] state               State of the system.
     	@param [in] hamiltonian         Hamiltonian of the system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use (cpu, gpu, chebyshev for linear problems, spectral for periodic lattices, or auto for the fastest available kernel supporting the system).
      */
     Solver(Lattice *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
            string kernel_type = "cpu");
@@ -548,14 +775,28 @@ public:
     	@param [in] state2              Second component's state of the system.
     	@param [in] hamiltonian         Hamiltonian of the two-component system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use (cpu, gpu, spectral for periodic lattices, or auto for the fastest available kernel supporting the system).
      */
     Solver(Lattice *grid, State *state1, State *state2,
            Hamiltonian2Component *hamiltonian,
            double delta_t, string kernel_type = "cpu");
+    /**
+    	Construct the Solver object for several states of a single-component system.
+
+    	The states are evolved together and, in imaginary time, kept orthonormal by Gram-Schmidt ordering: the first state relaxes to the ground state and the i-th state to the i-th excited state.
+
+    	@param [in] grid                Lattice object.
+    	@param [in] states              Array of n_states states of the system.
+    	@param [in] n_states            Number of states.
+    	@param [in] hamiltonian         Hamiltonian of the system.
+    	@param [in] delta_t             A single evolution iteration, evolves the states for this time.
+    	@param [in] kernel_type         Which kernel to use (cpu or auto).
+     */
+    Solver(Lattice *grid, State **states, int n_states, Hamiltonian *hamiltonian,
+           double delta_t, string kernel_type = "cpu");
     ~Solver();
     void evolve(int iterations, bool imag_time = false);  ///< Evolve the state of the system.
-    void update_parameters();  ///< Notify the solver if any parameter changed in the Hamiltonian.
+    void update_parameters();  ///< Notify the solver if any parameter changed in the Hamiltonian; the kernel is updated in place at the next evolution.
     double get_total_energy(void);    ///< Get the total energy of the system.
     double get_squared_norm(size_t which = 3 /** [in] Which = 1(first component); 2 (second component); 3(total state) */);  ///< Get the squared norm of the state (default: total wave-function).
     double get_kinetic_energy(size_t which = 3 /** [in] Which = 1(first component); 2 (second component); 3(total state) */);  ///< Get the kinetic energy of the system.
@@ -565,8 +806,86 @@ public:
     double get_LeeHuangYang_energy(void);    ///< Get the LeeHuangYang energy (only first component);
     double get_inter_species_energy(void);    ///< Get the inter-particles interaction energy of the system.
     double get_rabi_energy(void);    ///< Get the Rabi energy of the system.
+    double get_absorbed_norm(void);    ///< Get the squared norm removed by the absorbing layer of the Hamiltonian since the last switch to real time evolution.
     void set_exp_potential(double *real, int real_length, double *imag,
                            int imag_length, int which); ///< Set exponential potential directly from Python
+    double *get_exp_potential_real(int which = 0 /** [in] Which = 0 (first component); 1 (second component) */);  ///< Get the buffer storing the real part of the exponential of the potential.
+    double *get_exp_potential_imag(int which = 0 /** [in] Which = 0 (first component); 1 (second component) */);  ///< Get the buffer storing the imaginary part of the exponential of the potential.
+    void use_external_exp_potential(bool external = true);  ///< Whether the exponential of the potential is written by the caller (e.g. through get_exp_potential_real), so that real time evolution does not recompute it from the Hamiltonian.
+    void apply_absorbing_layer(int which = 0 /** [in] Which = 0 (first component); 1 (second component) */);  ///< Multiply the exponential of the potential written by the caller by the decay of the absorbing layer.
+    void set_num_threads(int num_threads /** [in] Number of OpenMP threads; 0 restores the OpenMP default. */);  ///< Limit the number of OpenMP threads used by the solver, so that several solvers can share a node.
+    int get_num_threads(void);    ///< Get the OpenMP thread budget of the solver (0: OpenMP default).
+    double get_state_energy(int index /** [in] Index of the state in the array given to the constructor. */);  ///< Get the total energy of one of the states evolved together.
+    void set_orthogonalization_period(int period /** [in] Number of imaginary time iterations between two orthogonalizations. */);  ///< Orthogonalize the states evolved together every period iterations; the norms are restored at every iteration.
+    /**
+    	Set the wire format of the halos exchanged between the MPI processes at every step; the wave functions stay in double precision.
+
+    	As floats, each message carries the change of the strip since the previous one, so that the rounding error does not
+    	accumulate in the halos; every resync_period steps the strips are exchanged in double precision, which makes the
+    	halos of the two sides identical again. Only the cpu kernel supports float halos.
+
+    	@param [in] precision       double (default) or float.
+    	@param [in] resync_period   Number of steps between two exchanges in double precision.
+     */
+    void set_halo_precision(string precision, int resync_period = 16);
+    string get_kernel_name(void);    ///< Get the name of the kernel in use, which resolves kernel type auto (empty before the first evolution).
+    /**
+    	Get the time spent in each phase of the evolution since the construction of the solver or the last reset_timings.
+
+    	Under MPI, every process of the lattice has to call it, as the summary over the processes is a collective operation.
+     */
+    vector<PhaseTiming> get_timings(void);
+    void reset_timings(void);    ///< Restart the accumulation of the time spent in the phases of the evolution.
+    /**
+    	Count the hardware events of the kernel phases (run_kernel_on_halo to run_kernel) of the following evolutions.
+
+    	The counters are opened through perf_event_open on Linux; the events the host does not provide are reported as negative.
+     */
+    void enable_counters(bool enable = true);
+    KernelCounters get_counters(void);    ///< Get the hardware events of this process counted since enable_counters, with IPC, bytes per point, arithmetic intensity and the roofline estimate of the host.
+    CommStats get_comm_stats(void);    ///< Get the halo messages, the waits and the collectives of this process since the construction of the solver or the last reset_comm_stats.
+    void reset_comm_stats(void);    ///< Restart the count of the communication.
+    /**
+    	Get a summary of the communication volume, of the halo waits and of the collectives of each process, laid out over the process grid.
+
+    	Under MPI, every process of the lattice has to call it; the summary is returned by the first process of the lattice and the others get an empty string.
+     */
+    string get_comm_report(void);
+    vector<MemoryUsage> get_memory_usage(void);    ///< Get the bytes allocated by the library on this process, now and at the peak, per category and in total.
+    void reset_memory_peaks(void);    ///< Restart the peaks of the memory usage from the bytes allocated now.
+    /**
+    	Adapt the lattice to the wave function during the evolution, instead of allocating the final domain from the start.
+
+    	Every check_period iterations, the solver measures the density within edge_points of the closed edges of the lattice.
+    	When it exceeds edge_fraction of the norm, the "window" mode translates the lattice by whole points to recenter
+    	the density (Lattice::origin_x and origin_y follow the translation), and the "grow" mode adds growth_points
+    	on both sides of the axis. The potentials are evaluated again on the new domain; they must be defined by a function.
+    	The adaptive domain works on cartesian lattices, and the states of "grow" must own their matrices, which are reallocated.
+    	Under MPI each adaptation gathers the whole lattice on every process, which then takes its tile of the new domain.
+
+    	@param [in] mode            fixed (the default: never adapt), window or grow.
+    	@param [in] edge_points     Width in points of the band along the edges where the density is measured.
+    	@param [in] edge_fraction   Fraction of the norm in the band that triggers the adaptation.
+    	@param [in] growth_points   Points added on each side of an axis by the grow mode.
+    	@param [in] check_period    Iterations between two measures of the density.
+     */
+    void set_adaptive_domain(string mode, int edge_points = 8, double edge_fraction = 1.e-6, int growth_points = 32, int check_period = 100);
+    /**
+    	Predict the memory used on each process by a solver of the given configuration, per category and in total.
+
+    	The prediction is an upper bound for the largest tile of the lattice, split over n_procs processes as by MPI_Dims_create, with periodic halos.
+    	Potentials defined by a matrix add one tile of doubles per component, which is not counted.
+
+    	@param [in] dim_x               Points of the lattice along the x axis.
+    	@param [in] dim_y               Points of the lattice along the y axis.
+    	@param [in] n_components        Number of wave functions: 1, 2 for a two-component system, or the number of states evolved together.
+    	@param [in] kernel_type         Kernel of the solver (cpu, chebyshev or spectral).
+    	@param [in] n_procs             Number of MPI processes.
+    	@param [in] rotating            Whether the frame of reference rotates, which widens the halos.
+    	@param [in] kinetic_order       Order of the kinetic operator (2 or 4), which widens the halos.
+     */
+    static vector<MemoryUsage> predict_memory(int dim_x, int dim_y, int n_components = 1, string kernel_type = "cpu", int n_procs = 1,
+                                              bool rotating = false, int kinetic_order = 2);
 private:
     bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
     double **external_pot_real;    ///< Real part of the evolution operator regarding the external potential.
@@ -574,10 +893,19 @@ private:
     double delta_t;    ///< A single evolution iteration, evolves the state for this time.
     double norm2[2];    ///< Squared norms of the two wave function.
     bool single_component;    ///< Whether the system is single-component(true) or two-components(false).
-    string kernel_type;    ///< Which kernel are being used (cpu or gpu).
+    State **states;    ///< States evolved together (NULL unless built from an array of states).
+    int n_states;    ///< Number of states evolved together.
+    double *states_norm2;    ///< Squared norms of the states evolved together.
+    int orthogonalization_period;    ///< Imaginary time iterations between two orthogonalizations of the states.
+    string halo_precision;    ///< Wire format of the halo messages: double or float.
+    int halo_resync_period;    ///< Steps between two exchanges of the halos in double precision when they travel as floats.
+    string kernel_type;    ///< Which kernel was requested (cpu, gpu, chebyshev, spectral or auto).
+    string kernel_name;    ///< Which kernel is being used.
     ITrotterKernel * kernel;    ///< Pointer to the kernel object.
     void initialize_exp_potential(double time_single_it, int which);    ///< Initialize the evolution operator regarding the external potential.
     void init_kernel();    ///< Initialize the kernel (cpu or gpu).
+    void update_scheduled_parameters();    ///< Pass the scheduled Hamiltonian parameters to the kernel during the evolution.
+    void copy_states_from_kernel();    ///< Copy the evolved wave functions from the kernel to the states.
     double total_energy;    ///< Total energy of the system.
     double kinetic_energy[2];    ///< Kinetic energy for the single components.
     double tot_kinetic_energy;    ///< Total kinetic energy of the system.
@@ -594,10 +922,139 @@ private:
     bool energy_expected_values_updated;    ///< Whether the expectation values are updated or not.
     void calculate_energy_expected_values(void);    ///< Calculate all the expectation values and the state's norm.
     bool is_python;
+    int num_threads;    ///< OpenMP thread budget of the solver (0: OpenMP default).
+    double phase_seconds[SOLVER_PHASES];    ///< Time spent by this process in each phase of the evolution.
+    long phase_calls[SOLVER_PHASES];    ///< Number of times each phase of the evolution ran on this process.
+    PerfCounters *counters;    ///< Hardware performance counters of the kernel phases (NULL unless enabled).
+    double counted_points;    ///< Lattice point updates of the counted kernel phases.
+    double reference_norm2;    ///< Squared norm of the states when the real time evolution started (negative before).
+    string domain_mode;    ///< Adaptation of the lattice to the wave function: fixed, window or grow.
+    int domain_edge_points;    ///< Width in points of the band along the edges where the density is measured.
+    double domain_edge_fraction;    ///< Fraction of the norm in the band that triggers the adaptation.
+    int domain_growth_points;    ///< Points added on each side of an axis by the grow mode.
+    int domain_check_period;    ///< Iterations between two measures of the density.
+    void adapt_domain(void);    ///< Move or grow the lattice if the density reaches its edges.
+    void rebuild_domain(const Lattice &old_grid, int offset_x, int offset_y);    ///< Move the states from the lattice old_grid to the new domain and restart the kernel.
+    double get_states_squared_norm(void);    ///< Sum of the squared norms of the evolved states.
+    CommStats comm_stats;    ///< Communication of the observables and of the kernels already replaced.
+    double end_phase(SolverPhase phase, double start);    ///< Add the time since start to a phase of the evolution; return the current time.
+};
+
+/**
+ * \brief This class evolves an ensemble of independent single-component systems defined on the same lattice.
+ *
+ * The systems may differ in mass, couplings and external potential. Their wave functions are stored interleaved, with the system index running fastest, in chunks of ENSEMBLE_LANES systems: every pair update of the Trotter-Suzuki decomposition acts on a whole chunk with the same vector instructions, and the threads are spread over the chunks.
+ * The ensemble runs on a single process with Cartesian coordinates and without rotating frame of reference.
+ */
+class EnsembleSolver {
+public:
+    Lattice *grid;    ///< Lattice object shared by all the systems.
+    int n_systems;    ///< Number of systems in the ensemble.
+    State **states;    ///< States of the systems.
+    Hamiltonian **hamiltonians;    ///< Hamiltonians of the systems.
+    double current_evolution_time;    ///< Amount of time evolved since the beginning of the evolution.
+    /**
+    	Construct the EnsembleSolver object.
+
+    	@param [in] grid                Lattice object.
+    	@param [in] n_systems           Number of systems.
+    	@param [in] states              Array of n_systems states.
+    	@param [in] hamiltonians        Array of n_systems single-component Hamiltonians.
+    	@param [in] delta_t             A single evolution iteration, evolves the states for this time.
+     */
+    EnsembleSolver(Lattice *grid, int n_systems, State **states, Hamiltonian **hamiltonians, double delta_t);
+    ~EnsembleSolver();
+    void evolve(int iterations, bool imag_time = false);  ///< Evolve the current wave functions of the State objects of all the systems and copy them back.
+    void update_parameters();  ///< Notify the solver if any parameter changed in the Hamiltonians, or the states were modified outside the solver before reading the energies.
+    const double *get_squared_norm(void);    ///< Get the squared norm of each system (n_systems entries).
+    const double *get_total_energy(void);    ///< Get the total energy of each system (n_systems entries).
+    const double *get_kinetic_energy(void);    ///< Get the kinetic energy of each system (n_systems entries).
+    const double *get_potential_energy(void);    ///< Get the potential energy of each system (n_systems entries).
+    const double *get_intra_species_energy(void);    ///< Get the intra-particles interaction energy of each system (n_systems entries).
+    const double *get_LeeHuangYang_energy(void);    ///< Get the Lee-Huang-Yang energy of each system (n_systems entries).
+private:
+    bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
+    double delta_t;    ///< A single evolution iteration, evolves the states for this time.
+    int n_chunks;    ///< Number of chunks of ENSEMBLE_LANES systems.
+    size_t width, height;    ///< Dimensions of the lattice, excluding the halos.
+    size_t chunk_size;    ///< Number of doubles stored per chunk.
+    double *p_real;    ///< Real part of the interleaved wave functions.
+    double *p_imag;    ///< Imaginary part of the interleaved wave functions.
+    double *external_pot_real;    ///< Real part of the interleaved evolution operator regarding the external potentials.
+    double *external_pot_imag;    ///< Imaginary part of the interleaved evolution operator regarding the external potentials.
+    double *aH, *bH, *aV, *bV;    ///< Per-system coefficients of the exponential of the kinetic operator.
+    double *coupling_const;    ///< Per-system coupling constant of the density self-interacting term.
+    double *LeeHuangYang_coupling;    ///< Per-system coupling constant of the Lee-Huang-Yang term.
+    double *norm2;    ///< Per-system squared norm preserved by imaginary time evolution.
+    bool kernel_ready;    ///< Whether the coefficients match the Hamiltonians and the time direction.
+    bool has_parameters_changed;   ///< Keeps track whether the Hamiltonian parameters were changed.
+    bool energy_expected_values_updated;    ///< Whether the expectation values are updated or not.
+    double *squared_norm;    ///< Squared norms of the systems.
+    double *total_energy;    ///< Total energies of the systems.
+    double *kinetic_energy;    ///< Kinetic energies of the systems.
+    double *potential_energy;    ///< Potential energies of the systems.
+    double *intra_species_energy;    ///< Intra-particles interaction energies of the systems.
+    double *LeeHuangYang_energy;    ///< Lee-Huang-Yang energies of the systems.
+    void pack_states();    ///< Copy the inner region of the State objects into the interleaved buffers.
+    void init_kernel();    ///< Compute the per-system coefficients and evolution operators.
+    void initialize_exp_potential(int system);    ///< Initialize the evolution operator regarding the external potential of a system.
+    void normalization(int chunk);    ///< Restore the squared norm of the systems of a chunk (imaginary time evolution).
+    void copy_to_states();    ///< Unpack the wave functions into the State objects, halos included.
+    void calculate_energy_expected_values(void);    ///< Calculate the energies and the squared norm of each system.
 };
 
+/**
+	Find the ground state of a single-component system by imaginary time evolution on successively finer lattices.
+
+	The state is first relaxed on a lattice coarser than grid by 2 to the power of levels - 1, where the slowly decaying
+	long-wavelength components converge at a fraction of the cost, then interpolated on a lattice twice as fine at each level,
+	down to grid. From the third level on, the discretization error of the coarser levels is extrapolated away from the
+	interpolated states, so that the finest level starts close to its own ground state. Each level evolves until the total energy changes by
+	less than tolerance (relative) over check_period iterations, with a time step scaled as the square of its lattice spacing.
+	The coarse levels evaluate the potentials defined by a function on their own points; potentials defined by a matrix are
+	averaged, which requires a single process. Under MPI the dimensions of the lattice must be divisible by the process grid
+	at every level.
+
+	@param [in] grid             Lattice of the ground state (cartesian).
+	@param [in,out] state        Initial guess, overwritten by the ground state; its squared norm is kept.
+	@param [in] hamiltonian      Hamiltonian of the system.
+	@param [in] delta_t          Time step of the finest level.
+	@param [in] levels           Number of lattices, including grid.
+	@param [in] tolerance        Relative change of the energy below which a level is converged.
+	@param [in] check_period     Iterations between two evaluations of the energy.
+	@param [in] max_iterations   Largest number of iterations of each level.
+	@param [in] kernel_type      Kernel of the solvers of the levels.
+	@return                      Number of iterations run on each level, from the coarsest to grid.
+ */
+vector<int> multilevel_ground_state(Lattice2D *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
+                                    int levels = 3, double tolerance = 1.e-9, int check_period = 100, int max_iterations = 100000,
+                                    string kernel_type = "cpu");
 double const_potential(double x);    ///< Defines the null potential function in 1D.
 double const_potential(double x, double y);    ///< Defines the null potential function in 2D.
 void map_lattice_to_coordinate_space(Lattice *grid, int x_in, double *x_out);  ///< Centers the coordinates in 1D.
 void map_lattice_to_coordinate_space(Lattice *grid, int x_in, int y_in, double *x_out, double *y_out); ///< Centers the coordinates in 2D.
+/**
+	Keep the large buffers of the library in memory-mapped scratch files, for the lattices that do not fit in RAM.
+
+	The wave functions, the second buffers of the kernels and the potentials allocated afterwards are mapped from files
+	created, and unlinked at once, in the scratch directory. The CPU kernel asks the operating system to read ahead the
+	band after the one it evolves and to drop the bands behind it, so that only a few bands per thread stay resident;
+	the page cache writes them back to the files. Buffers allocated before the call stay where they are.
+
+	@param [in] scratch_directory   Directory of the scratch files, on a fast local disk; an empty string disables the mode.
+	@param [in] min_bytes           Smallest buffer mapped from a file; the smaller ones stay in RAM.
+ */
+void set_out_of_core(string scratch_directory, size_t min_bytes = 1 << 20);
+/**
+	Start recording the timeline of the evolution: the kernel phases of the solver, each band of blocks of the CPU kernel,
+	the MPI waits and reductions, and the file input and output, per thread and per process.
+
+	Every thread keeps its events in a ring buffer, so that the most recent ones are kept. Tracing requires the library
+	to be configured with --enable-tracing; otherwise the calls to the tracing functions abort.
+
+	@param [in] events_per_thread   Number of events kept by each thread.
+ */
+void start_trace(size_t events_per_thread = 1 << 16);
+void stop_trace(void);    ///< Stop recording the timeline.
+void write_trace(string file_name /** [in] Name of the file. */);    ///< Write the timeline as Chrome trace JSON, gathering the events of all the processes (a collective operation under MPI).
 #endif // __TROTTERSUZUKI_H
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
 #include "kerneltest.h"
 
 #define DIM 250
@@ -236,6 +239,796 @@ void my_test<F>::imaginary_mixed_BEC_test() {
             " kernel -> PASSED! " << std::endl;
 }
 
+static complex<double> momentum_kick(double x, double y) {
+	return exp(complex<double>(0., 2. * x));
+}
+
+template<class F>
+void my_test<F>::ensemble_test() {
+	const int n_systems = 3;
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
+	for (int k = 0; k < 2; ++k) {
+		bool imag_time = k == 1;
+		State *states[n_systems], *reference[n_systems];
+		Potential *potentials[n_systems];
+		Hamiltonian *hamiltonians[n_systems];
+		for (int i = 0; i < n_systems; ++i) {
+			// Displaced from the centre of the traps, the states move and change shape
+			states[i] = new GaussianState(grid, 1., 1., 2., -1.5);
+			reference[i] = new GaussianState(grid, 1., 1., 2., -1.5);
+			potentials[i] = new HarmonicPotential(grid, 1. + 0.5 * i, 1.);
+			hamiltonians[i] = new Hamiltonian(grid, potentials[i], 1., 5. * i);
+		}
+		EnsembleSolver *ensemble = new EnsembleSolver(grid, n_systems, states, hamiltonians, 1.e-3);
+		ensemble->evolve(50, imag_time);
+		// A state written between two evolutions is evolved from its new wave function
+		for (int i = 0; i < n_systems; ++i) {
+			states[i]->imprint(momentum_kick);
+		}
+		ensemble->evolve(50, imag_time);
+		const double *tot_energy = ensemble->get_total_energy();
+		const double *norm = ensemble->get_squared_norm();
+		for (int i = 0; i < n_systems; ++i) {
+			Solver *solver = new Solver(grid, reference[i], hamiltonians[i], 1.e-3, this->kernel_type);
+			solver->evolve(50, imag_time);
+			reference[i]->imprint(momentum_kick);
+			solver->evolve(50, imag_time);
+			//Check
+			double difference = 0.;
+			for (int j = 0; j < grid->dim_x * grid->dim_y; ++j) {
+				difference = std::max(difference, std::abs(states[i]->p_real[j] - reference[i]->p_real[j]) + std::abs(states[i]->p_imag[j] - reference[i]->p_imag[j]));
+			}
+			CPPUNIT_ASSERT( difference < NORM_TOLERANCE );
+			CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - tot_energy[i]) < TOLERANCE );
+			CPPUNIT_ASSERT( std::abs(solver->get_squared_norm() - norm[i]) < NORM_TOLERANCE );
+			delete solver;
+		}
+		delete ensemble;
+		for (int i = 0; i < n_systems; ++i) {
+			delete hamiltonians[i];
+			delete potentials[i];
+			delete states[i];
+			delete reference[i];
+		}
+	}
+	delete grid;
+	std::cout << "TEST FUNCTION: ensemble_test with " << this->kernel_type <<
+            " kernel -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::excited_states_test() {
+	const int n_states = 3;
+	const double exact_energy[n_states] = {1., 2., 2.};
+	Lattice2D *grid = new Lattice2D(64, 12.);
+	State *states[n_states];
+	states[0] = new GaussianState(grid, 1., 1., 0.3, 0.2);
+	states[1] = new GaussianState(grid, 0.8, 0.8, 0.7, -0.4);
+	states[2] = new GaussianState(grid, 1.2, 1.1, -0.5, 0.6);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, states, n_states, hamiltonian, 1.e-3);
+	solver->evolve(6000, true);
+	//Check
+	for (int i = 0; i < n_states; ++i) {
+		CPPUNIT_ASSERT( std::abs(solver->get_state_energy(i) - exact_energy[i]) < TOLERANCE );
+		CPPUNIT_ASSERT( std::abs(states[i]->get_squared_norm() - 1.) < NORM_TOLERANCE );
+		for (int j = 0; j < i; ++j) {
+			std::complex<double> overlap = 0;
+			for (int k = 0; k < grid->dim_x * grid->dim_y; ++k) {
+				overlap += std::conj(std::complex<double>(states[j]->p_real[k], states[j]->p_imag[k])) *
+				           std::complex<double>(states[i]->p_real[k], states[i]->p_imag[k]);
+			}
+			CPPUNIT_ASSERT( std::abs(overlap) * grid->delta_x * grid->delta_y < NORM_TOLERANCE );
+		}
+	}
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	for (int i = 0; i < n_states; ++i) {
+		delete states[i];
+	}
+	delete grid;
+	std::cout << "TEST FUNCTION: excited_states_test with cpu kernel -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::auto_kernel_test() {
+	double angular_velocity = 0.7;
+	Lattice2D *grid = new Lattice2D(DIM, 20, false, false, angular_velocity);
+	State *state = new GaussianState(grid, 1);
+	State *reference = new GaussianState(grid, 1);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
+	// Only the CPU kernel supports the rotating frame of reference
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-4, "auto");
+	Solver *cpu_solver = new Solver(grid, reference, hamiltonian, 1.e-4, "cpu");
+	solver->evolve(100);
+	cpu_solver->evolve(100);
+	//Check
+	CPPUNIT_ASSERT( solver->get_kernel_name() == "cpu" );
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - cpu_solver->get_total_energy()) < TOLERANCE );
+	delete solver;
+	delete cpu_solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete reference;
+	delete grid;
+	std::cout << "TEST FUNCTION: auto_kernel_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::parameter_update_test() {
+	Lattice2D *grid = new Lattice2D(DIM, 20.);
+	State *state = new GaussianState(grid, 1.);
+	State *reference = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 0.);
+	Hamiltonian *reference_hamiltonian = new Hamiltonian(grid, potential, 1., 0.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	Solver *reference_solver = new Solver(grid, reference, reference_hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(51);
+	reference_solver->evolve(51);
+	// The solver updates its kernel in place, the reference one is built again
+	hamiltonian->coupling_a = reference_hamiltonian->coupling_a = 20.;
+	solver->update_parameters();
+	delete reference_solver;
+	reference_solver = new Solver(grid, reference, reference_hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(51);
+	reference_solver->evolve(51);
+	solver->evolve(20, true);
+	reference_solver->evolve(20, true);
+	solver->evolve(7);
+	reference_solver->evolve(7);
+	//Check
+	double difference = 0.;
+	for (int i = 0; i < grid->dim_x * grid->dim_y; ++i) {
+		difference = std::max(difference, std::abs(state->p_real[i] - reference->p_real[i]) + std::abs(state->p_imag[i] - reference->p_imag[i]));
+	}
+	CPPUNIT_ASSERT( difference < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - reference_solver->get_total_energy()) < TOLERANCE );
+	delete solver;
+	delete reference_solver;
+	delete hamiltonian;
+	delete reference_hamiltonian;
+	delete potential;
+	delete state;
+	delete reference;
+	delete grid;
+	std::cout << "TEST FUNCTION: parameter_update_test with " << this->kernel_type << " kernel -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::parameter_schedule_test() {
+	double delta_t = 1.e-3;
+	double times[2] = {0., 0.1};
+	double values[2] = {0., 50.};
+	Lattice2D *grid = new Lattice2D(DIM, 20.);
+	State *state = new GaussianState(grid, 1.);
+	State *reference = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Hamiltonian *reference_hamiltonian = new Hamiltonian(grid, potential);
+	hamiltonian->set_schedule("coupling_a", times, values, 2);
+	Solver *solver = new Solver(grid, state, hamiltonian, delta_t, this->kernel_type);
+	Solver *reference_solver = new Solver(grid, reference, reference_hamiltonian, delta_t, this->kernel_type);
+	solver->evolve(150);
+	// The same ramp, one step at a time
+	for (int i = 0; i < 150; ++i) {
+		reference_hamiltonian->coupling_a = std::min(500. * i * delta_t, 50.);
+		reference_solver->update_parameters();
+		reference_solver->evolve(1);
+	}
+	//Check
+	double difference = 0.;
+	for (int i = 0; i < grid->dim_x * grid->dim_y; ++i) {
+		difference = std::max(difference, std::abs(state->p_real[i] - reference->p_real[i]) + std::abs(state->p_imag[i] - reference->p_imag[i]));
+	}
+	CPPUNIT_ASSERT( difference < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( hamiltonian->coupling_a == 50. );
+	delete solver;
+	delete reference_solver;
+	delete hamiltonian;
+	delete reference_hamiltonian;
+	delete potential;
+	delete state;
+	delete reference;
+	if (this->kernel_type == "cpu" && grid->mpi_procs == 1) {
+		//Check: a rotation scheduled on a lattice built at rest evolves as on a rotating lattice, whose halos are wider
+		double rotation[2] = {0., 0.7};
+		Lattice2D *grids[2];
+		State *states[2];
+		Potential *potentials[2];
+		Hamiltonian *hamiltonians[2];
+		Solver *solvers[2];
+		for (int k = 0; k < 2; ++k) {
+			grids[k] = new Lattice2D(DIM, 20., false, false, k == 0 ? 0. : 0.7);
+			states[k] = new GaussianState(grids[k], 1., 1., 1., 0.5);
+			potentials[k] = new HarmonicPotential(grids[k], 1., 1.);
+			hamiltonians[k] = new Hamiltonian(grids[k], potentials[k], 1., 100., 0., k == 0 ? 0. : 0.7);
+		}
+		hamiltonians[0]->set_schedule("angular_velocity", times, rotation, 2);
+		for (int k = 0; k < 2; ++k) {
+			solvers[k] = new Solver(grids[k], states[k], hamiltonians[k], delta_t, this->kernel_type);
+		}
+		solvers[0]->evolve(150);
+		for (int i = 0; i < 150; ++i) {
+			hamiltonians[1]->angular_velocity = std::min(7. * i * delta_t, 0.7);
+			solvers[1]->update_parameters();
+			solvers[1]->evolve(1);
+		}
+		difference = 0.;
+		for (int i = 0; i < grids[0]->dim_x * grids[0]->dim_y; ++i) {
+			difference = std::max(difference, std::abs(states[0]->p_real[i] - states[1]->p_real[i]) + std::abs(states[0]->p_imag[i] - states[1]->p_imag[i]));
+		}
+		CPPUNIT_ASSERT( grids[0]->halo_x == grids[1]->halo_x && grids[0]->halo_y == grids[1]->halo_y );
+		CPPUNIT_ASSERT( difference < 1.e-12 );
+		for (int k = 0; k < 2; ++k) {
+			delete solvers[k];
+			delete hamiltonians[k];
+			delete potentials[k];
+			delete states[k];
+			delete grids[k];
+		}
+	}
+	delete grid;
+	std::cout << "TEST FUNCTION: parameter_schedule_test with " << this->kernel_type << " kernel -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::chebyshev_test() {
+	Lattice2D *grid = new Lattice2D(DIM, 20.);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	// Steps far beyond the accuracy of the Trotter-Suzuki decomposition
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-2, "chebyshev");
+	double initial_energy = solver->get_total_energy();
+	solver->evolve(100);
+	//Check
+	CPPUNIT_ASSERT( solver->get_kernel_name() == "chebyshev" );
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - initial_energy) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(solver->get_squared_norm() - 1.) < NORM_TOLERANCE );
+	solver->evolve(200, true);
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - 1.) < TOLERANCE );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	std::cout << "TEST FUNCTION: chebyshev_test -> PASSED! " << std::endl;
+}
+
+template <typename F>
+void my_test<F>::spectral_test() {
+	Lattice2D *grid = new Lattice2D(DIM, 20., true, true);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-2, "spectral");
+	double initial_energy = solver->get_total_energy();
+	solver->evolve(100);
+	//Check
+	CPPUNIT_ASSERT( solver->get_kernel_name() == "spectral" );
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - initial_energy) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(solver->get_squared_norm() - 1.) < NORM_TOLERANCE );
+	solver->evolve(1000, true);
+	CPPUNIT_ASSERT( std::abs(solver->get_total_energy() - 1.) < TOLERANCE );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	std::cout << "TEST FUNCTION: spectral_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::kinetic_order_test() {
+	//Infidelity of the ground state of the harmonic oscillator on a coarse lattice
+	double infidelity[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(16, 12., 16, 12., false, false, 0., "cartesian", 2 + 2 * k);
+		State *state = new GaussianState(grid, 0.8);
+		State *exact = new GaussianState(grid, 1.);
+		Potential *potential = new HarmonicPotential(grid, 1., 1.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+		Solver *solver = new Solver(grid, state, hamiltonian, 2.e-4, "cpu");
+		solver->evolve(20000, true);
+		double overlap = 0., norm2 = 0., exact_norm2 = 0.;
+		for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
+			overlap += state->p_real[i] * exact->p_real[i];
+			norm2 += state->p_real[i] * state->p_real[i] + state->p_imag[i] * state->p_imag[i];
+			exact_norm2 += exact->p_real[i] * exact->p_real[i];
+		}
+		infidelity[k] = 1. - overlap * overlap / (norm2 * exact_norm2);
+		//Check: the stencil of order 4 widens the halos
+		CPPUNIT_ASSERT( grid->halo_x == (k == 0 ? 4 : 12) );
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete exact;
+		delete state;
+		delete grid;
+	}
+	//Check: the wave function error drops from the second to the fourth power of the lattice spacing
+	CPPUNIT_ASSERT( infidelity[1] < 0.1 * infidelity[0] );
+	//Real time evolution of a Gaussian across the seam of a periodic lattice whose side is not a multiple of 4,
+	//of one whose side is odd, and across the blocks of a closed lattice wider than one block
+	for (int k = 0; k < 3; k++) {
+		Lattice2D *grid = k < 2 ? new Lattice2D(250 + k, 20., 250 + k, 20., true, true, 0., "cartesian", 4) :
+		                  new Lattice2D(300, 30., 40, 4., false, false, 0., "cartesian", 4);
+		State *state = k < 2 ? new GaussianState(grid, 0.5, 0.5, 9.5, 9.5) : new GaussianState(grid, 0.5, 0.5, -4.6, 0.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid);
+		Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, "cpu");
+		double norm2 = solver->get_squared_norm();
+		solver->evolve(500);
+		//Check: the sweeps pair the same points in every block and across the seams, so that the evolution is unitary
+		CPPUNIT_ASSERT( fabs(solver->get_squared_norm() - norm2) < 1.e-10 * norm2 );
+		delete solver;
+		delete hamiltonian;
+		delete state;
+		delete grid;
+	}
+	std::cout << "TEST FUNCTION: kinetic_order_test -> PASSED! " << std::endl;
+}
+
+static complex<double> outgoing_packet(double x, double y) {
+	return exp(complex<double>(-0.5 * (x + 5.) * (x + 5.) - 0.5 * y * y, 4. * x));
+}
+
+template <class F>
+void my_test<F>::absorbing_layer_test() {
+	//A wave packet runs into the edge x = 20 of the lattice
+	double norm2[2], absorbed[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(160, 40., 80, 20.);
+		State *state = new State(grid);
+		state->init_state(outgoing_packet);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid);
+		if (k == 1) {
+			hamiltonian->set_absorbing_layer(4., 5.);
+		}
+		Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+		double initial_norm2 = solver->get_squared_norm();
+		solver->evolve(2000);
+		norm2[k] = solver->get_squared_norm() / initial_norm2;
+		absorbed[k] = solver->get_absorbed_norm() / initial_norm2;
+		delete solver;
+		delete hamiltonian;
+		delete state;
+		delete grid;
+	}
+	//Check: the closed edge reflects the packet, the layer absorbs it
+	CPPUNIT_ASSERT( fabs(norm2[0] - 1.) < 1.e-9 && fabs(absorbed[0]) < 1.e-9 );
+	CPPUNIT_ASSERT( norm2[1] < 0.02 );
+	CPPUNIT_ASSERT( fabs(norm2[1] + absorbed[1] - 1.) < 1.e-9 );
+	std::cout << "TEST FUNCTION: absorbing_layer_test -> PASSED! " << std::endl;
+}
+
+static complex<double> drifting_packet(double x, double y) {
+	return exp(complex<double>(-0.125 * (x + 5.) * (x + 5.) - 0.125 * y * y, 4. * x));
+}
+
+static complex<double> spreading_packet(double x, double y) {
+	return exp(complex<double>(-2. * (x * x + y * y), 0.));
+}
+
+template <class F>
+void my_test<F>::adaptive_domain_test() {
+	//The moving window follows a drifting packet that a large lattice holds from the start
+	double norm2[2], mean_x[2], mean_xx[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(k == 0 ? 320 : 128, k == 0 ? 80. : 32., 96, 24.);
+		State *state = new State(grid);
+		state->init_state(drifting_packet);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid);
+		Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+		if (k == 1) {
+			solver->set_adaptive_domain("window", 8, 1.e-8, 32, 50);
+		}
+		solver->evolve(1600);
+		norm2[k] = state->get_squared_norm();
+		mean_x[k] = state->get_mean_x();
+		//Check: the window moved along x only
+		CPPUNIT_ASSERT( k == 0 || (grid->origin_x > 15. && grid->origin_y == 0. && grid->dim_x == 128) );
+		delete solver;
+		delete hamiltonian;
+		delete state;
+		delete grid;
+	}
+	//Check
+	CPPUNIT_ASSERT( fabs(norm2[1] - norm2[0]) < 1.e-5 * norm2[0] );
+	CPPUNIT_ASSERT( fabs(mean_x[1] - mean_x[0]) < 1.e-4 * fabs(mean_x[0]) );
+
+	//The lattice grows with a spreading packet
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(k == 0 ? 128 : 32, k == 0 ? 16. : 4., k == 0 ? 128 : 32, k == 0 ? 16. : 4.);
+		State *state = new State(grid);
+		state->init_state(spreading_packet);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid);
+		Solver *solver = new Solver(grid, state, hamiltonian, 2.e-3, "cpu");
+		if (k == 1) {
+			solver->set_adaptive_domain("grow", 4, 1.e-8, 16, 50);
+		}
+		solver->evolve(500);
+		norm2[k] = state->get_squared_norm();
+		mean_xx[k] = state->get_mean_xx();
+		//Check: the lattice grew with the same spacing
+		CPPUNIT_ASSERT( k == 0 || (grid->dim_x > 32 && fabs(grid->length_x - grid->dim_x * 0.125) < 1.e-12) );
+		delete solver;
+		delete hamiltonian;
+		delete state;
+		delete grid;
+	}
+	//Check
+	CPPUNIT_ASSERT( fabs(norm2[1] - norm2[0]) < 1.e-5 * norm2[0] );
+	CPPUNIT_ASSERT( fabs(mean_xx[1] - mean_xx[0]) < 1.e-4 * mean_xx[0] );
+	std::cout << "TEST FUNCTION: adaptive_domain_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::multilevel_test() {
+	//Ground state of a condensate in a harmonic trap, on the fine lattice alone and through two coarser lattices
+	double energy[2];
+	vector<int> iterations[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(64, 16.);
+		State *state = new GaussianState(grid, 0.3, 0.3, 1., -0.5);
+		Potential *potential = new HarmonicPotential(grid, 1., 1.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 50.);
+		iterations[k] = multilevel_ground_state(grid, state, hamiltonian, 1.e-3, k == 0 ? 1 : 3, 1.e-9, 100);
+		CPPUNIT_ASSERT( potential->grid == grid );
+		Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, "cpu");
+		energy[k] = solver->get_total_energy();
+		CPPUNIT_ASSERT( fabs(solver->get_squared_norm() - 1.) < 1.e-6 );
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete state;
+		delete grid;
+	}
+	//Check: the same ground state with fewer iterations on the fine lattice
+	CPPUNIT_ASSERT( iterations[0].size() == 1 && iterations[1].size() == 3 );
+	CPPUNIT_ASSERT( fabs(energy[1] - energy[0]) < 1.e-7 * energy[0] );
+	CPPUNIT_ASSERT( iterations[1][2] < iterations[0][0] );
+	std::cout << "TEST FUNCTION: multilevel_test -> PASSED! " << std::endl;
+}
+
+static complex<double> odd_packet(double x, double y) {
+	return complex<double>(x, 0.3 * x) * exp(-0.5 * (x * x + y * y));
+}
+
+template <class F>
+void my_test<F>::symmetry_test() {
+	//Ground state of a condensate in a harmonic trap, on the full lattice and on the quarter x > 0, y > 0
+	double energy[2], norm2[2];
+	double *density[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(64, 20., false, false, 0., "cartesian", 2, k, k);
+		State *state = new GaussianState(grid, 0.5);
+		Potential *potential = new HarmonicPotential(grid, 1., 1.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 5.);
+		Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+		solver->evolve(500, true);
+		energy[k] = solver->get_total_energy();
+		norm2[k] = solver->get_squared_norm();
+		int width, height;
+		grid->get_snapshot_dims(&width, &height);
+		CPPUNIT_ASSERT( width == 64 && height == 64 );
+		density[k] = state->get_particle_density();
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete state;
+		delete grid;
+	}
+	//Check: the same ground state, up to the mirror asymmetry of the splitting on the full lattice
+	CPPUNIT_ASSERT( fabs(energy[1] - energy[0]) < 1.e-5 * energy[0] );
+	CPPUNIT_ASSERT( fabs(norm2[1] - norm2[0]) < 1.e-10 );
+	double deviation = 0.;
+	for (int i = 0; i < 64 * 64; i++) {
+		deviation = max(deviation, fabs(density[1][i] - density[0][i]));
+	}
+	CPPUNIT_ASSERT( deviation < 1.e-4 );
+	delete [] density[0];
+	delete [] density[1];
+
+	//Real time evolution of a state odd along x, on the full lattice and on the half x > 0
+	double mean_xx[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(64, 20., false, false, 0., "cartesian", 2, -k, 0);
+		State *state = new State(grid);
+		state->init_state(odd_packet);
+		Potential *potential = new HarmonicPotential(grid, 1., 2.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 2.);
+		Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+		solver->evolve(300, false);
+		energy[k] = solver->get_total_energy();
+		norm2[k] = state->get_squared_norm();
+		mean_xx[k] = state->get_mean_xx();
+		if (k == 1) {
+			CPPUNIT_ASSERT( state->get_mean_x() == 0. );
+		}
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete state;
+		delete grid;
+	}
+	CPPUNIT_ASSERT( fabs(energy[1] - energy[0]) < 1.e-6 * energy[0] );
+	CPPUNIT_ASSERT( fabs(norm2[1] - norm2[0]) < 1.e-6 * norm2[0] );
+	CPPUNIT_ASSERT( fabs(mean_xx[1] - mean_xx[0]) < 1.e-5 * mean_xx[0] );
+
+	//Real time evolution of a state odd along x and even along y, on the full lattice and on the quarter x > 0, y > 0,
+	//for long at a large time step, then at a small one
+	for (int step = 0; step < 2; step++) {
+		double *phase[2];
+		for (int k = 0; k < 2; k++) {
+			Lattice2D *grid = new Lattice2D(64, 20., false, false, 0., "cartesian", 2, -k, k);
+			State *state = new State(grid);
+			state->init_state(odd_packet);
+			Potential *potential = new HarmonicPotential(grid, 1., 2.);
+			Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 2.);
+			Solver *solver = new Solver(grid, state, hamiltonian, step == 0 ? 2.5e-2 : 1.e-3, "cpu");
+			norm2[k] = state->get_squared_norm();
+			solver->evolve(step == 0 ? 1000 : 500, false);
+			//Check: the image of every pair across the symmetry planes is in the same sweep, so that the evolution is unitary
+			CPPUNIT_ASSERT( fabs(state->get_squared_norm() - norm2[k]) < 1.e-10 * norm2[k] );
+			density[k] = state->get_particle_density();
+			phase[k] = state->get_phase();
+			delete solver;
+			delete hamiltonian;
+			delete potential;
+			delete state;
+			delete grid;
+		}
+		//Check: the same wave function point by point, up to the mirror asymmetry of the splitting on the full lattice
+		if (step == 1) {
+			deviation = 0.;
+			for (int i = 0; i < 64 * 64; i++) {
+				deviation = max(deviation, sqrt(fabs(density[0][i] + density[1][i] - 2. * sqrt(density[0][i] * density[1][i]) * cos(phase[0][i] - phase[1][i]))));
+			}
+			CPPUNIT_ASSERT( deviation < 5.e-5 );
+		}
+		for (int k = 0; k < 2; k++) {
+			delete [] density[k];
+			delete [] phase[k];
+		}
+	}
+	std::cout << "TEST FUNCTION: symmetry_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::timings_test() {
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
+	State *state1 = new GaussianState(grid, 1);
+	State *state2 = new State(grid);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian2Component *hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 0., 0., 0., 2.*M_PI/10.);
+	Solver *solver = new Solver(grid, state1, state2, hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(10);
+	vector<PhaseTiming> timings = solver->get_timings();
+	//Check
+	CPPUNIT_ASSERT( timings.size() == SOLVER_PHASES );
+	CPPUNIT_ASSERT( timings[PHASE_SETUP].calls == 1 );
+	CPPUNIT_ASSERT( timings[PHASE_KERNEL].phase == "kernel" && timings[PHASE_KERNEL].calls == 20 );
+	CPPUNIT_ASSERT( timings[PHASE_FINISH_HALO_EXCHANGE].calls == 18 );
+	CPPUNIT_ASSERT( timings[PHASE_RABI_COUPLING].calls == 11 );
+	CPPUNIT_ASSERT( timings[PHASE_GET_SAMPLE].calls == 1 );
+	for (size_t i = 0; i < timings.size(); i++) {
+		CPPUNIT_ASSERT( timings[i].seconds >= 0. );
+		CPPUNIT_ASSERT( timings[i].min_seconds <= timings[i].avg_seconds && timings[i].avg_seconds <= timings[i].max_seconds );
+	}
+	solver->reset_timings();
+	solver->evolve(10);
+	timings = solver->get_timings();
+	CPPUNIT_ASSERT( timings[PHASE_SETUP].calls == 0 && timings[PHASE_SETUP].seconds == 0. );
+	CPPUNIT_ASSERT( timings[PHASE_KERNEL].calls == 20 );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state1;
+	delete state2;
+	delete grid;
+	std::cout << "TEST FUNCTION: timings_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::counters_test() {
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->enable_counters();
+	solver->evolve(10);
+	KernelCounters counters = solver->get_counters();
+	//Check: the events the host does not count are negative, whatever the host
+	double points = double(grid->inner_end_x - grid->inner_start_x) * (grid->inner_end_y - grid->inner_start_y);
+	CPPUNIT_ASSERT( counters.seconds > 0. );
+	CPPUNIT_ASSERT( std::abs(counters.points - 10 * points) < 0.5 );
+	CPPUNIT_ASSERT( counters.ipc < 0. || (counters.cycles > 0. && counters.instructions > 0.) );
+	CPPUNIT_ASSERT( counters.peak_gflop_per_s > 0. && counters.peak_gb_per_s > 0. );
+	CPPUNIT_ASSERT( counters.bound == "compute" || counters.bound == "memory" || counters.bound == "unknown" );
+	solver->enable_counters(false);
+	solver->evolve(10);
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	std::cout << "TEST FUNCTION: counters_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::trace_test() {
+#ifdef ENABLE_TRACING
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	start_trace(1024);
+	solver->evolve(10);
+	stop_trace();
+	write_trace("trace_test.json");
+	std::ifstream in("trace_test.json");
+	std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	//Check: the timeline holds the phases of the evolution as complete events
+	CPPUNIT_ASSERT( trace.find("\"traceEvents\"") != std::string::npos );
+	CPPUNIT_ASSERT( trace.find("\"name\": \"kernel\", \"ph\": \"X\"") != std::string::npos );
+	std::remove("trace_test.json");
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+#endif
+	std::cout << "TEST FUNCTION: trace_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::comm_stats_test() {
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, true, true);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(10, true);
+	CommStats stats = solver->get_comm_stats();
+	std::string report = solver->get_comm_report();
+	//Check: on a periodic lattice every process exchanges the halos with all its neighbours at every step
+	CPPUNIT_ASSERT( stats.wait_calls[0] == stats.wait_calls[1] );
+	CPPUNIT_ASSERT( stats.messages_sent[0] == stats.messages_received[1] );
+	CPPUNIT_ASSERT( grid->mpi_rank != 0 || report.find("process grid") != std::string::npos );
+#ifdef HAVE_MPI
+	CPPUNIT_ASSERT( stats.wait_calls[0] == 10 && stats.collective_calls >= 10 );
+#endif
+	solver->reset_comm_stats();
+	stats = solver->get_comm_stats();
+	CPPUNIT_ASSERT( stats.wait_calls[0] == 0 && stats.collective_calls == 0 );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	std::cout << "TEST FUNCTION: comm_stats_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::halo_precision_test() {
+	if (this->kernel_type != "cpu") {
+		return;
+	}
+	//Evolve the same system with the halos sent in double precision and as floats
+	const char *precision[2] = {"double", "float"};
+	double energy[2], bytes[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(DIM, LENGTH, true, true);
+		State *state = new GaussianState(grid, 1., 1., 2.);
+		Potential *potential = new HarmonicPotential(grid, 1., 1.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+		Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+		solver->set_halo_precision(precision[k], 8);
+		solver->evolve(100, false);
+		energy[k] = solver->get_total_energy();
+		CommStats stats = solver->get_comm_stats();
+		bytes[k] = stats.bytes_sent[0] + stats.bytes_sent[1] + stats.bytes_sent[2] + stats.bytes_sent[3];
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete state;
+		delete grid;
+	}
+	//Check: the same evolution, with about half the bytes on the wire
+	CPPUNIT_ASSERT( fabs(energy[1] - energy[0]) < 1.e-6 * fabs(energy[0]) );
+	CPPUNIT_ASSERT( bytes[1] <= bytes[0] );
+#ifdef HAVE_MPI
+	CPPUNIT_ASSERT( bytes[1] < 0.6 * bytes[0] );
+#endif
+	std::cout << "TEST FUNCTION: halo_precision_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::memory_test() {
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, true, true);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(10, true);
+	vector<MemoryUsage> usage = solver->get_memory_usage();
+	double sum = 0.;
+	for (int i = 0; i < MEMORY_CATEGORIES; i++) {
+		sum += usage[i].current_bytes;
+		CPPUNIT_ASSERT( usage[i].peak_bytes >= usage[i].current_bytes );
+	}
+	//Check: the wave function is accounted, and the total is the sum of the categories
+	CPPUNIT_ASSERT( usage[MEMORY_STATES].current_bytes >= 2. * sizeof(double) * grid->dim_x * grid->dim_y );
+	CPPUNIT_ASSERT( usage[MEMORY_CATEGORIES].current_bytes == sum );
+	CPPUNIT_ASSERT( usage[MEMORY_CATEGORIES].peak_bytes >= sum );
+	if (this->kernel_type != "gpu") {
+		//Check: the prediction accounts the wave function and the kernel of this solver
+		vector<MemoryUsage> predicted = Solver::predict_memory(DIM, DIM, 1, this->kernel_type, grid->mpi_procs);
+		CPPUNIT_ASSERT( usage[MEMORY_KERNEL].current_bytes > 0. );
+		CPPUNIT_ASSERT( predicted[MEMORY_STATES].peak_bytes >= 2. * sizeof(double) * grid->dim_x * grid->dim_y );
+		CPPUNIT_ASSERT( predicted[MEMORY_KERNEL].peak_bytes > 0. );
+		//Check: the wider halos of the kinetic operator of order 4 are accounted
+		Lattice2D *grid_4 = new Lattice2D(DIM, LENGTH, DIM, LENGTH, true, true, 0., "cartesian", 4);
+		predicted = Solver::predict_memory(DIM, DIM, 1, this->kernel_type, grid->mpi_procs, false, 4);
+		CPPUNIT_ASSERT( predicted[MEMORY_STATES].peak_bytes >= 2. * sizeof(double) * grid_4->dim_x * grid_4->dim_y );
+		delete grid_4;
+	}
+	//Check: a new solver on the same state frees the memory of the previous one
+	delete solver;
+	solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->evolve(10, true);
+	vector<MemoryUsage> again = solver->get_memory_usage();
+	CPPUNIT_ASSERT( again[MEMORY_CATEGORIES].current_bytes == usage[MEMORY_CATEGORIES].current_bytes );
+	solver->reset_memory_peaks();
+	again = solver->get_memory_usage();
+	CPPUNIT_ASSERT( again[MEMORY_CATEGORIES].peak_bytes == again[MEMORY_CATEGORIES].current_bytes );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	std::cout << "TEST FUNCTION: memory_test -> PASSED! " << std::endl;
+}
+
+template <class F>
+void my_test<F>::out_of_core_test() {
+	//Evolve the same system with its buffers in RAM and in scratch files
+	double *p_real[2];
+	double mapped[2];
+	for (int k = 0; k < 2; k++) {
+		set_out_of_core(k == 0 ? "" : "/tmp", 0);
+		Lattice2D *grid = new Lattice2D(DIM, LENGTH, false, false);
+		State *state = new GaussianState(grid, 1., 1., 2.);
+		Potential *potential = new HarmonicPotential(grid, 1., 1.);
+		Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+		Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+		solver->evolve(50, false);
+		mapped[k] = solver->get_memory_usage()[MEMORY_CATEGORIES].mapped_bytes;
+		p_real[k] = new double[grid->dim_x * grid->dim_y];
+		std::copy(state->p_real, state->p_real + grid->dim_x * grid->dim_y, p_real[k]);
+		delete solver;
+		delete hamiltonian;
+		delete potential;
+		delete state;
+		delete grid;
+	}
+	set_out_of_core("");
+	//Check: the wave function lived in the scratch files, and evolved in the same way
+	CPPUNIT_ASSERT( mapped[0] == 0. );
+	CPPUNIT_ASSERT( mapped[1] > 0. );
+	CPPUNIT_ASSERT( std::equal(p_real[0], p_real[0] + DIM * DIM, p_real[1]) );
+	delete [] p_real[0];
+	delete [] p_real[1];
+	std::cout << "TEST FUNCTION: out_of_core_test -> PASSED! " << std::endl;
+}
+
 void CpuKernelTest::setUp() {
     this->kernel_type = "cpu";
 }
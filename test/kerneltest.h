@@ -31,6 +31,25 @@ class my_test: public F {
     CPPUNIT_TEST( imaginary_rotating_frame_of_reference_test );
     CPPUNIT_TEST( mixed_BEC_test );
     CPPUNIT_TEST( imaginary_mixed_BEC_test );
+    CPPUNIT_TEST( ensemble_test );
+    CPPUNIT_TEST( excited_states_test );
+    CPPUNIT_TEST( auto_kernel_test );
+    CPPUNIT_TEST( parameter_update_test );
+    CPPUNIT_TEST( parameter_schedule_test );
+    CPPUNIT_TEST( chebyshev_test );
+    CPPUNIT_TEST( spectral_test );
+    CPPUNIT_TEST( kinetic_order_test );
+    CPPUNIT_TEST( absorbing_layer_test );
+    CPPUNIT_TEST( adaptive_domain_test );
+    CPPUNIT_TEST( multilevel_test );
+    CPPUNIT_TEST( symmetry_test );
+    CPPUNIT_TEST( timings_test );
+    CPPUNIT_TEST( counters_test );
+    CPPUNIT_TEST( trace_test );
+    CPPUNIT_TEST( comm_stats_test );
+    CPPUNIT_TEST( halo_precision_test );
+    CPPUNIT_TEST( memory_test );
+    CPPUNIT_TEST( out_of_core_test );
     CPPUNIT_TEST_SUITE_END();
 
     void free_particle_test();
@@ -42,6 +61,25 @@ class my_test: public F {
     void imaginary_rotating_frame_of_reference_test();
     void mixed_BEC_test();
     void imaginary_mixed_BEC_test();
+    void ensemble_test();
+    void excited_states_test();
+    void auto_kernel_test();
+    void parameter_update_test();
+    void parameter_schedule_test();
+    void chebyshev_test();
+    void spectral_test();
+    void kinetic_order_test();
+    void absorbing_layer_test();
+    void adaptive_domain_test();
+    void multilevel_test();
+    void symmetry_test();
+    void timings_test();
+    void counters_test();
+    void trace_test();
+    void comm_stats_test();
+    void halo_precision_test();
+    void memory_test();
+    void out_of_core_test();
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuKernelTest>);